@@ -0,0 +1,568 @@
+/*
+ * Copyright (C) 2017 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * In-memory emulation of the BCM2835 peripherals used by Galdur, selected
+ * with the "mock_hardware" build option. bcm2835.c then maps an anonymous
+ * memory block instead of /dev/mem and routes every register access
+ * through here, so the unmodified library code drives:
+ *  - SPI0 with its FIFOs and the two pipelined MAX1133 ADCs behind it,
+ *    returning values from a programmable sample source,
+ *  - the AUX SPI carrying the commands of the DAC,
+ *  - the GPIO level registers, logging every edge with a timestamp,
+ *  - the system timer, running on CLOCK_MONOTONIC.
+ * All other registers behave like plain memory.
+ *
+ * If the GALDUR_MOCK_GPIO_LOG environment variable names a file, the
+ * GPIO edges are written to it as CSV when the library is closed.
+ */
+
+#include "bcm2835-mock.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "bcm2835.h"
+
+#define MOCK_SPI0_FIFO_SIZE 64
+#define MOCK_GPIO_PINS      54
+#define MOCK_DAC_CHANNELS   4
+
+#define MAX1133_START       0x80
+#define MAX1133_MUX_MASK    0x07
+
+typedef struct {
+    /* SPI0 with the MAX1133 chips */
+    uint8_t rx_fifo[MOCK_SPI0_FIFO_SIZE];
+    guint rx_head;
+    guint rx_len;
+    guint word_pos;             /* byte of the current 16-bit transaction */
+    uint8_t control;            /* control byte of the current transaction */
+    int16_t result;             /* conversion clocked out in the current transaction */
+    gint pending[2];            /* channel each chip converts next, -1 for none */
+    guint64 conversions[16];
+    Bcm2835MockAdcSource adc_source;
+    gpointer adc_source_data;
+
+    /* AUX SPI with the DAC */
+    uint8_t aux_tx[16];
+    guint aux_tx_len;
+    uint16_t dac_values[MOCK_DAC_CHANNELS];
+    guint64 dac_writes;
+
+    /* GPIO */
+    pthread_mutex_t gpio_lock;
+    uint64_t output_latch;
+    uint64_t input_levels;
+    uint64_t levels;
+    GArray *gpio_edges;
+} Bcm2835Mock;
+
+static Bcm2835Mock mock = {
+    .gpio_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+static size_t mock_size = 0;
+
+/**
+ * mock_time_ns:
+ */
+static int64_t
+mock_time_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * mock_default_adc_source:
+ *
+ * An 8 Hz sine wave, shifted in phase from channel to channel.
+ */
+static int16_t
+mock_default_adc_source (guint channel, guint64 index, gpointer user_data)
+{
+    const double t = mock_time_ns () / 1000000000.0;
+
+    return (int16_t) (1000 * sin (2 * M_PI * 8 * t + 0.2 * channel));
+}
+
+/**
+ * mock_reg:
+ *
+ * Returns: The backing memory of the register at @offset from the peripherals base.
+ */
+static inline volatile uint32_t*
+mock_reg (size_t offset)
+{
+    return bcm2835_peripherals + offset / 4;
+}
+
+/**
+ * mock_gpio_is_output:
+ */
+static gboolean
+mock_gpio_is_output (uint8_t pin)
+{
+    const uint32_t fsel = *mock_reg (BCM2835_GPIO_BASE + BCM2835_GPFSEL0 + (pin / 10) * 4);
+
+    return ((fsel >> ((pin % 10) * 3)) & BCM2835_GPIO_FSEL_MASK) == BCM2835_GPIO_FSEL_OUTP;
+}
+
+/**
+ * mock_gpio_update_levels:
+ *
+ * Recompute the pin levels from the output latch and the external inputs,
+ * and log every pin that changed. Called with the GPIO lock held.
+ */
+static void
+mock_gpio_update_levels (void)
+{
+    const int64_t now = mock_time_ns ();
+    uint64_t levels = 0;
+    uint64_t changed;
+    uint8_t pin;
+
+    for (pin = 0; pin < MOCK_GPIO_PINS; pin++) {
+        const uint64_t src = mock_gpio_is_output (pin)? mock.output_latch : mock.input_levels;
+        levels |= src & (1ULL << pin);
+    }
+
+    changed = levels ^ mock.levels;
+    mock.levels = levels;
+    for (pin = 0; changed != 0 && pin < MOCK_GPIO_PINS; pin++) {
+        Bcm2835MockGpioEdge edge;
+
+        if (!(changed & (1ULL << pin)))
+            continue;
+        edge.time_ns = now;
+        edge.pin = pin;
+        edge.level = (levels >> pin) & 1;
+        g_array_append_vals (mock.gpio_edges, &edge, 1);
+    }
+}
+
+/**
+ * mock_spi0_fifo_write:
+ *
+ * Clock a byte out to the selected MAX1133, and queue the byte it
+ * returns. Every 16-bit transaction sends a control byte selecting
+ * the next conversion, and returns the result of the previous one.
+ */
+static void
+mock_spi0_fifo_write (uint32_t value)
+{
+    const guint chip = *mock_reg (BCM2835_SPI0_BASE + BCM2835_SPI0_CS) & BCM2835_SPI0_CS_CS;
+    uint8_t out = 0xff;
+
+    if (mock.rx_len == MOCK_SPI0_FIFO_SIZE)
+        return;
+
+    if (chip < 2) {
+        if (mock.word_pos == 0) {
+            const gint channel = mock.pending[chip];
+
+            mock.control = value & 0xff;
+            mock.result = 0;
+            if (channel >= 0)
+                mock.result = mock.adc_source (channel, mock.conversions[channel]++, mock.adc_source_data);
+        } else if (mock.control & MAX1133_START) {
+            mock.pending[chip] = chip * 8 + (mock.control & MAX1133_MUX_MASK);
+        }
+
+        /* bytes in the order the Galdur ADC code stores them */
+        memcpy (&out, (uint8_t*) &mock.result + mock.word_pos, 1);
+        mock.word_pos ^= 1;
+    }
+
+    mock.rx_fifo[(mock.rx_head + mock.rx_len) % MOCK_SPI0_FIFO_SIZE] = out;
+    mock.rx_len++;
+}
+
+/**
+ * mock_spi0_read:
+ */
+static uint32_t
+mock_spi0_read (size_t offset)
+{
+    uint32_t value;
+
+    if (offset == BCM2835_SPI0_FIFO) {
+        if (mock.rx_len == 0)
+            return 0;
+        value = mock.rx_fifo[mock.rx_head];
+        mock.rx_head = (mock.rx_head + 1) % MOCK_SPI0_FIFO_SIZE;
+        mock.rx_len--;
+        return value;
+    }
+
+    value = *mock_reg (BCM2835_SPI0_BASE + offset);
+    if (offset == BCM2835_SPI0_CS) {
+        /* bytes are clocked through as soon as they are written, so
+         * the transfer is done whenever it is active */
+        if (mock.rx_len < MOCK_SPI0_FIFO_SIZE)
+            value |= BCM2835_SPI0_CS_TXD;
+        else
+            value |= BCM2835_SPI0_CS_RXF | BCM2835_SPI0_CS_RXR;
+        if (mock.rx_len > 0)
+            value |= BCM2835_SPI0_CS_RXD;
+        if (value & BCM2835_SPI0_CS_TA)
+            value |= BCM2835_SPI0_CS_DONE;
+    }
+
+    return value;
+}
+
+/**
+ * mock_spi0_write:
+ */
+static void
+mock_spi0_write (size_t offset, uint32_t value)
+{
+    if (offset == BCM2835_SPI0_FIFO) {
+        mock_spi0_fifo_write (value);
+        return;
+    }
+
+    if (offset == BCM2835_SPI0_CS) {
+        if (value & BCM2835_SPI0_CS_CLEAR_RX) {
+            mock.rx_head = 0;
+            mock.rx_len = 0;
+            mock.word_pos = 0;
+        }
+        value &= ~(BCM2835_SPI0_CS_CLEAR | BCM2835_SPI0_CS_DONE | BCM2835_SPI0_CS_RXD |
+                   BCM2835_SPI0_CS_TXD | BCM2835_SPI0_CS_RXR | BCM2835_SPI0_CS_RXF);
+    }
+
+    *mock_reg (BCM2835_SPI0_BASE + offset) = value;
+}
+
+/**
+ * mock_aux_spi_write:
+ *
+ * Collect the bytes of an AUX SPI transaction, and decode it as a DAC
+ * command once the chip select is released by a write to the IO register.
+ */
+static void
+mock_aux_spi_write (size_t offset, uint32_t value)
+{
+    guint n_bits, i;
+
+    if (offset < BCM2835_AUX_SPI_IO || offset >= BCM2835_AUX_SPI_TXHOLD + 0x10) {
+        *mock_reg (BCM2835_SPI1_BASE + offset) = value;
+        return;
+    }
+
+    /* variable width mode: bit count in the top byte, data MSB first below */
+    n_bits = value >> 24;
+    for (i = 0; i < n_bits / 8 && mock.aux_tx_len < sizeof(mock.aux_tx); i++)
+        mock.aux_tx[mock.aux_tx_len++] = (value >> (16 - 8 * i)) & 0xff;
+
+    if (offset >= BCM2835_AUX_SPI_TXHOLD)
+        return;
+
+    /* control byte with the channel bit, then the value, MSB first */
+    if (mock.aux_tx_len == 3 && (mock.aux_tx[0] & 0xf0) == 0x30 && (mock.aux_tx[0] & 0x0f) != 0) {
+        const guint channel = __builtin_ctz (mock.aux_tx[0] & 0x0f);
+
+        mock.dac_values[channel] = (mock.aux_tx[1] << 8) | mock.aux_tx[2];
+        __atomic_add_fetch (&mock.dac_writes, 1, __ATOMIC_RELAXED);
+    }
+    mock.aux_tx_len = 0;
+}
+
+/**
+ * mock_gpio_write:
+ */
+static void
+mock_gpio_write (size_t offset, uint32_t value)
+{
+    pthread_mutex_lock (&mock.gpio_lock);
+    switch (offset) {
+        case BCM2835_GPSET0:
+        case BCM2835_GPSET0 + 4:
+            mock.output_latch |= (uint64_t) value << (offset == BCM2835_GPSET0? 0 : 32);
+            break;
+        case BCM2835_GPCLR0:
+        case BCM2835_GPCLR0 + 4:
+            mock.output_latch &= ~((uint64_t) value << (offset == BCM2835_GPCLR0? 0 : 32));
+            break;
+        default:
+            *mock_reg (BCM2835_GPIO_BASE + offset) = value;
+            break;
+    }
+
+    /* changing a pin function may change its level as well */
+    mock_gpio_update_levels ();
+    pthread_mutex_unlock (&mock.gpio_lock);
+}
+
+/**
+ * mock_gpio_read:
+ */
+static uint32_t
+mock_gpio_read (size_t offset)
+{
+    uint32_t value;
+
+    if (offset != BCM2835_GPLEV0 && offset != BCM2835_GPLEV1)
+        return *mock_reg (BCM2835_GPIO_BASE + offset);
+
+    pthread_mutex_lock (&mock.gpio_lock);
+    value = mock.levels >> (offset == BCM2835_GPLEV0? 0 : 32);
+    pthread_mutex_unlock (&mock.gpio_lock);
+
+    return value;
+}
+
+/**
+ * mock_in_block:
+ *
+ * Returns: %TRUE if @offset is within the @size bytes of registers at @base,
+ * and sets @reg to the offset of the register in the block.
+ */
+static inline gboolean
+mock_in_block (size_t offset, size_t base, size_t size, size_t *reg)
+{
+    if (offset < base || offset >= base + size)
+        return FALSE;
+    *reg = offset - base;
+    return TRUE;
+}
+
+/**
+ * bcm2835_mock_read:
+ */
+uint32_t
+bcm2835_mock_read (volatile uint32_t *paddr)
+{
+    const size_t offset = (paddr - bcm2835_peripherals) * 4;
+    size_t reg;
+
+    __sync_synchronize ();
+
+    if (mock_in_block (offset, BCM2835_SPI0_BASE, 0x18, &reg))
+        return mock_spi0_read (reg);
+    if (mock_in_block (offset, BCM2835_GPIO_BASE, 0x100, &reg))
+        return mock_gpio_read (reg);
+    if (mock_in_block (offset, BCM2835_SPI1_BASE, 0x40, &reg)) {
+        /* the FIFOs never fill up, and transfers finish instantly */
+        if (reg == BCM2835_AUX_SPI_STAT)
+            return BCM2835_AUX_SPI_STAT_TX_EMPTY | BCM2835_AUX_SPI_STAT_RX_EMPTY;
+        if (reg >= BCM2835_AUX_SPI_IO)
+            return 0;
+    }
+    if (mock_in_block (offset, BCM2835_ST_BASE, 0x1c, &reg)) {
+        const uint64_t usec = mock_time_ns () / 1000;
+
+        if (reg == BCM2835_ST_CLO)
+            return usec & 0xffffffff;
+        if (reg == BCM2835_ST_CHI)
+            return usec >> 32;
+    }
+
+    return *paddr;
+}
+
+/**
+ * bcm2835_mock_write:
+ */
+void
+bcm2835_mock_write (volatile uint32_t *paddr, uint32_t value)
+{
+    const size_t offset = (paddr - bcm2835_peripherals) * 4;
+    size_t reg;
+
+    if (mock_in_block (offset, BCM2835_SPI0_BASE, 0x18, &reg))
+        mock_spi0_write (reg, value);
+    else if (mock_in_block (offset, BCM2835_GPIO_BASE, 0x100, &reg))
+        mock_gpio_write (reg, value);
+    else if (mock_in_block (offset, BCM2835_SPI1_BASE, 0x40, &reg))
+        mock_aux_spi_write (reg, value);
+    else
+        *paddr = value;
+
+    __sync_synchronize ();
+}
+
+/**
+ * bcm2835_mock_map:
+ * @size: Size of the peripherals block
+ *
+ * Allocate zeroed memory standing in for the peripheral registers,
+ * and reset the emulated devices.
+ *
+ * Returns: The memory block, or %MAP_FAILED on error.
+ */
+uint32_t*
+bcm2835_mock_map (size_t size)
+{
+    uint32_t *mem;
+    guint i;
+
+    mem = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        return MAP_FAILED;
+    mock_size = size;
+
+    pthread_mutex_lock (&mock.gpio_lock);
+    mock.rx_head = 0;
+    mock.rx_len = 0;
+    mock.word_pos = 0;
+    mock.pending[0] = mock.pending[1] = -1;
+    for (i = 0; i < G_N_ELEMENTS (mock.conversions); i++)
+        mock.conversions[i] = 0;
+    if (mock.adc_source == NULL)
+        mock.adc_source = mock_default_adc_source;
+
+    mock.aux_tx_len = 0;
+    for (i = 0; i < MOCK_DAC_CHANNELS; i++)
+        mock.dac_values[i] = 0;
+    mock.dac_writes = 0;
+
+    mock.output_latch = 0;
+    mock.levels = mock.input_levels;
+    if (mock.gpio_edges == NULL)
+        mock.gpio_edges = g_array_new (FALSE, FALSE, sizeof(Bcm2835MockGpioEdge));
+    pthread_mutex_unlock (&mock.gpio_lock);
+
+    return mem;
+}
+
+/**
+ * bcm2835_mock_unmap:
+ *
+ * Release the register memory, and save the GPIO edge log if requested.
+ */
+void
+bcm2835_mock_unmap (void)
+{
+    const gchar *log_fname = g_getenv ("GALDUR_MOCK_GPIO_LOG");
+
+    if (log_fname != NULL && mock.gpio_edges != NULL) {
+        FILE *f = fopen (log_fname, "w");
+
+        if (f == NULL) {
+            g_printerr ("Unable to write GPIO log to %s\n", log_fname);
+        } else {
+            guint i;
+
+            pthread_mutex_lock (&mock.gpio_lock);
+            fprintf (f, "time_ns,pin,level\n");
+            for (i = 0; i < mock.gpio_edges->len; i++) {
+                const Bcm2835MockGpioEdge *edge = &((Bcm2835MockGpioEdge*) mock.gpio_edges->data)[i];
+                fprintf (f, "%" G_GINT64_FORMAT ",%u,%u\n", (gint64) edge->time_ns, edge->pin, edge->level);
+            }
+            pthread_mutex_unlock (&mock.gpio_lock);
+            fclose (f);
+        }
+    }
+
+    if (bcm2835_peripherals != MAP_FAILED)
+        munmap (bcm2835_peripherals, mock_size);
+}
+
+/**
+ * bcm2835_mock_set_adc_source:
+ * @source: Function returning the ADC samples, or %NULL for the default 8 Hz sine wave
+ *
+ * Set where the emulated MAX1133 chips get their samples from.
+ * @source is called from the thread reading the ADCs.
+ */
+void
+bcm2835_mock_set_adc_source (Bcm2835MockAdcSource source, gpointer user_data)
+{
+    mock.adc_source = source != NULL? source : mock_default_adc_source;
+    mock.adc_source_data = user_data;
+}
+
+/**
+ * bcm2835_mock_set_gpio_input:
+ *
+ * Drive the external level of @pin, seen while it is configured as input.
+ */
+void
+bcm2835_mock_set_gpio_input (uint8_t pin, uint8_t level)
+{
+    g_return_if_fail (pin < MOCK_GPIO_PINS);
+
+    pthread_mutex_lock (&mock.gpio_lock);
+    if (level)
+        mock.input_levels |= 1ULL << pin;
+    else
+        mock.input_levels &= ~(1ULL << pin);
+    if (mock.gpio_edges != NULL)
+        mock_gpio_update_levels ();
+    pthread_mutex_unlock (&mock.gpio_lock);
+}
+
+/**
+ * bcm2835_mock_steal_gpio_edges:
+ * @n_edges: (out): Number of returned edges
+ *
+ * Take all GPIO edges logged so far, oldest first, and clear the log.
+ *
+ * Returns: The edges, free with g_free()
+ */
+Bcm2835MockGpioEdge*
+bcm2835_mock_steal_gpio_edges (guint *n_edges)
+{
+    Bcm2835MockGpioEdge *edges;
+
+    pthread_mutex_lock (&mock.gpio_lock);
+    if (mock.gpio_edges == NULL) {
+        pthread_mutex_unlock (&mock.gpio_lock);
+        *n_edges = 0;
+        return NULL;
+    }
+    *n_edges = mock.gpio_edges->len;
+    edges = (Bcm2835MockGpioEdge*) g_array_free (mock.gpio_edges, FALSE);
+    mock.gpio_edges = g_array_new (FALSE, FALSE, sizeof(Bcm2835MockGpioEdge));
+    pthread_mutex_unlock (&mock.gpio_lock);
+
+    return edges;
+}
+
+/**
+ * bcm2835_mock_get_dac_value:
+ *
+ * Returns: The value last written to DAC @channel.
+ */
+uint16_t
+bcm2835_mock_get_dac_value (uint8_t channel)
+{
+    g_return_val_if_fail (channel < MOCK_DAC_CHANNELS, 0);
+    return mock.dac_values[channel];
+}
+
+/**
+ * bcm2835_mock_get_dac_write_count:
+ *
+ * Returns: The number of DAC commands received.
+ */
+guint64
+bcm2835_mock_get_dac_write_count (void)
+{
+    return __atomic_load_n (&mock.dac_writes, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2017 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BCM2835_MOCK_H
+#define __BCM2835_MOCK_H
+
+#include <glib.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Bcm2835MockAdcSource:
+ * @channel: Physical ADC channel (0-15), the inputs of the second MAX1133 are 8-15
+ * @index: Number of earlier conversions on @channel
+ * @user_data: Data passed to bcm2835_mock_set_adc_source()
+ *
+ * Returns: The value the emulated MAX1133 converts for @channel.
+ */
+typedef int16_t (*Bcm2835MockAdcSource) (guint channel, guint64 index, gpointer user_data);
+
+/**
+ * Bcm2835MockGpioEdge:
+ *
+ * A level change of a GPIO pin, driven by the program or by
+ * bcm2835_mock_set_gpio_input().
+ */
+typedef struct {
+    int64_t time_ns;    /* CLOCK_MONOTONIC time of the change */
+    uint8_t pin;
+    uint8_t level;
+} Bcm2835MockGpioEdge;
+
+/* used by bcm2835.c instead of mapping /dev/mem */
+uint32_t            *bcm2835_mock_map (size_t size);
+void                bcm2835_mock_unmap (void);
+uint32_t            bcm2835_mock_read (volatile uint32_t *paddr);
+void                bcm2835_mock_write (volatile uint32_t *paddr,
+                                        uint32_t value);
+
+void                bcm2835_mock_set_adc_source (Bcm2835MockAdcSource source,
+                                                 gpointer user_data);
+void                bcm2835_mock_set_gpio_input (uint8_t pin,
+                                                 uint8_t level);
+
+Bcm2835MockGpioEdge *bcm2835_mock_steal_gpio_edges (guint *n_edges);
+uint16_t            bcm2835_mock_get_dac_value (uint8_t channel);
+guint64             bcm2835_mock_get_dac_write_count (void);
+
+#endif /* __BCM2835_MOCK_H */
@@ -26,6 +26,12 @@
 #define BCK2835_LIBRARY_BUILD
 #include "bcm2835.h"
 
+/* Galdur: with MOCK_HARDWARE, the peripherals are emulated in memory */
+#include "config.h"
+#ifdef MOCK_HARDWARE
+#include "bcm2835-mock.h"
+#endif
+
 /* This define enables a little test program (by default a blinking output on pin RPI_GPIO_PIN_11)
 // You can do some safe, non-destructive testing on any platform with:
 // gcc bcm2835.c -D BCM2835_TEST
@@ -203,6 +209,10 @@ unsigned int bcm2835_version(void)
 uint32_t bcm2835_peri_read(volatile uint32_t* paddr)
 {
     uint32_t ret;
+#ifdef MOCK_HARDWARE
+    if (!debug)
+	return bcm2835_mock_read(paddr);
+#endif
     if (debug)
     {
 		printf("bcm2835_peri_read  paddr %p\n", (void *) paddr);
@@ -225,6 +235,10 @@ uint32_t bcm2835_peri_read(volatile uint32_t* paddr)
  */
 uint32_t bcm2835_peri_read_nb(volatile uint32_t* paddr)
 {
+#ifdef MOCK_HARDWARE
+    if (!debug)
+	return bcm2835_mock_read(paddr);
+#endif
     if (debug)
     {
 	printf("bcm2835_peri_read_nb  paddr %p\n", paddr);
@@ -241,6 +255,13 @@ uint32_t bcm2835_peri_read_nb(volatile uint32_t* paddr)
 
 void bcm2835_peri_write(volatile uint32_t* paddr, uint32_t value)
 {
+#ifdef MOCK_HARDWARE
+    if (!debug)
+    {
+	bcm2835_mock_write(paddr, value);
+	return;
+    }
+#endif
     if (debug)
     {
 	printf("bcm2835_peri_write paddr %p, value %08X\n", paddr, value);
@@ -256,6 +277,13 @@ void bcm2835_peri_write(volatile uint32_t* paddr, uint32_t value)
 /* write to peripheral without the write barrier */
 void bcm2835_peri_write_nb(volatile uint32_t* paddr, uint32_t value)
 {
+#ifdef MOCK_HARDWARE
+    if (!debug)
+    {
+	bcm2835_mock_write(paddr, value);
+	return;
+    }
+#endif
     if (debug)
     {
 	printf("bcm2835_peri_write_nb paddr %p, value %08X\n",
@@ -2032,6 +2060,27 @@ int bcm2835_init(void)
 	return 1; /* Success */
     }
 
+#ifdef MOCK_HARDWARE
+    /* Emulate the peripherals in memory instead of mapping /dev/mem */
+    bcm2835_peripherals = bcm2835_mock_map(bcm2835_peripherals_size);
+    if (bcm2835_peripherals == MAP_FAILED)
+        return 0;
+
+    bcm2835_gpio = bcm2835_peripherals + BCM2835_GPIO_BASE/4;
+    bcm2835_pwm  = bcm2835_peripherals + BCM2835_GPIO_PWM/4;
+    bcm2835_clk  = bcm2835_peripherals + BCM2835_CLOCK_BASE/4;
+    bcm2835_pads = bcm2835_peripherals + BCM2835_GPIO_PADS/4;
+    bcm2835_spi0 = bcm2835_peripherals + BCM2835_SPI0_BASE/4;
+    bcm2835_bsc0 = bcm2835_peripherals + BCM2835_BSC0_BASE/4;
+    bcm2835_bsc1 = bcm2835_peripherals + BCM2835_BSC1_BASE/4;
+    bcm2835_st   = bcm2835_peripherals + BCM2835_ST_BASE/4;
+    bcm2835_aux  = bcm2835_peripherals + BCM2835_AUX_BASE/4;
+    bcm2835_spi1 = bcm2835_peripherals + BCM2835_SPI1_BASE/4;
+    bcm2835_smi  = bcm2835_peripherals + BCM2835_SMI_BASE/4;
+
+    return 1; /* Success */
+#endif
+
     /* Figure out the base and size of the peripheral address block
     // using the device-tree. Required for RPi2/3/4, optional for RPi 1
     */
@@ -2164,7 +2213,11 @@ int bcm2835_close(void)
 {
     if (debug) return 1; /* Success */
 
+#ifdef MOCK_HARDWARE
+    bcm2835_mock_unmap();
+#else
     unmapmem((void**) &bcm2835_peripherals, bcm2835_peripherals_size);
+#endif
     bcm2835_peripherals = MAP_FAILED;
     bcm2835_gpio = MAP_FAILED;
     bcm2835_pwm  = MAP_FAILED;
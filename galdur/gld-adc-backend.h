@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2016-2017 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GLD_ADC_BACKEND_H
+#define __GLD_ADC_BACKEND_H
+
+#include <glib.h>
+#include <stdint.h>
+
+#include "gld-adc.h"
+
+typedef struct _GldAdcBackend GldAdcBackend;
+
+/**
+ * GldAdcBackend:
+ * @name: Name used to select the backend, e.g. with the GALDUR_ADC_BACKEND environment variable
+ * @description: Human readable description
+ * @caps: Capabilities of the backend
+ * @open: Parse the backend arguments (may be %NULL) and allocate private data, or return %NULL on error
+ * @close: Free the private data returned by @open
+ * @start: Prepare for acquisition with the channel count, scan list and frequency of @daq
+ * @stop: Called when acquisition stopped, all resources acquired in @start should be released
+ * @scan: Acquire one scan and store it in @frame, indexed by logical channel.
+ *        Returns %FALSE if no more data can be acquired.
+ * @get_block_size: (optional) Number of scans @scan_block acquires at most, called after @start
+ * @scan_block: (optional) Acquire @n_scans consecutive scans, paced at the sampling frequency
+ *        by the hardware, and store them as consecutive frames in @frames.
+ *
+ * Interface to the hardware (or anything pretending to be hardware) that
+ * the DAQ thread acquires samples from. @scan is called by the DAQ thread
+ * once per point of the sampling grid, all other functions are only called
+ * while the DAQ thread is parked. Backends implementing @scan_block get to
+ * acquire a whole block of scans whenever the DAQ thread is woken up, and
+ * are called only at every block's first grid point. Backends with
+ * %GLD_ADC_BACKEND_CAP_PACED block in @scan or @scan_block until data is
+ * available, and the DAQ thread calls them again right away.
+ **/
+struct _GldAdcBackend {
+    const gchar *name;
+    const gchar *description;
+    GldAdcBackendCaps caps;
+
+    gpointer    (*open) (const gchar *args);
+    void        (*close) (gpointer priv);
+
+    gboolean    (*start) (gpointer priv, GldAdc *daq);
+    void        (*stop) (gpointer priv);
+    gboolean    (*scan) (gpointer priv, int16_t *frame);
+
+    guint       (*get_block_size) (gpointer priv);
+    gboolean    (*scan_block) (gpointer priv, int16_t *frames, guint n_scans);
+};
+
+extern const GldAdcBackend gld_adc_backend_bcm2835;
+extern const GldAdcBackend gld_adc_backend_spidev;
+extern const GldAdcBackend gld_adc_backend_iio;
+extern const GldAdcBackend gld_adc_backend_synthetic;
+extern const GldAdcBackend gld_adc_backend_replay;
+
+#endif /* __GLD_ADC_BACKEND_H */
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2016-2017 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ADC backend talking to the MAX1133 chips of the Galdur board by polling
+ * the BCM2835 SPI registers directly.
+ */
+
+#include "gld-adc-backend.h"
+
+#include "bcm2835.h"
+#include "gld-max1133.h"
+
+typedef struct {
+    GldMax1133Program prog;
+    gboolean batched;
+} Bcm2835Backend;
+
+/**
+ * bcm2835_backend_open:
+ */
+static gpointer
+bcm2835_backend_open (const gchar *args)
+{
+    if (args != NULL) {
+        g_critical ("The bcm2835 ADC backend takes no arguments.");
+        return NULL;
+    }
+
+    return g_new0 (Bcm2835Backend, 1);
+}
+
+/**
+ * bcm2835_backend_close:
+ */
+static void
+bcm2835_backend_close (gpointer priv)
+{
+    g_free (priv);
+}
+
+/**
+ * bcm2835_backend_start:
+ */
+static gboolean
+bcm2835_backend_start (gpointer priv, GldAdc *daq)
+{
+    Bcm2835Backend *be = priv;
+
+    gld_max1133_program_build (&be->prog, daq->scan_list, daq->channel_count);
+    be->batched = daq->batched_spi;
+
+    return TRUE;
+}
+
+/**
+ * bcm2835_backend_stop:
+ */
+static void
+bcm2835_backend_stop (gpointer priv)
+{
+}
+
+/**
+ * bcm2835_backend_scan_single:
+ *
+ * Acquire one scan with a separate SPI transaction per channel.
+ */
+static inline void
+bcm2835_backend_scan_single (Bcm2835Backend *be, int16_t *frame)
+{
+    GldMax1133Program *prog = &be->prog;
+    int16_t rxval = 0;
+    guint i;
+
+    for (i = 0; i < prog->n_ops; i++) {
+        const GldMax1133Op *op = &prog->ops[i];
+
+        /* select the right MAX 1133, all operations of a chip are consecutive */
+        if (i == 0 || op->chip != prog->ops[i - 1].chip)
+            bcm2835_spi_chipSelect (op->chip == 0? BCM2835_SPI_CS0 : BCM2835_SPI_CS1);
+
+        /* synchronous SPI query, two bytes received and stored in int16_t */
+        bcm2835_spi_transfernb ((char*) &prog->txbuf[2 * i], (char*) &rxval, sizeof(int16_t));
+        frame[op->dest] = rxval;
+    }
+}
+
+/**
+ * bcm2835_backend_scan_batched:
+ *
+ * Acquire one scan with a single SPI transaction per chip, keeping the
+ * chip selected while all its conversions are clocked through the FIFO.
+ */
+static inline void
+bcm2835_backend_scan_batched (Bcm2835Backend *be, int16_t *frame)
+{
+    GldMax1133Program *prog = &be->prog;
+    uint8_t rxbuf[2 * GLD_MAX1133_MAX_CHANNELS];
+    guint chip;
+    guint first = 0;
+
+    for (chip = 0; chip < 2; chip++) {
+        const guint n = prog->chip_ops[chip];
+        if (n == 0)
+            continue;
+
+        bcm2835_spi_chipSelect (chip == 0? BCM2835_SPI_CS0 : BCM2835_SPI_CS1);
+        bcm2835_spi_transfernb ((char*) &prog->txbuf[2 * first],
+                                (char*) &rxbuf[2 * first],
+                                2 * n);
+        first += n;
+    }
+
+    /* sort the results into their channels */
+    gld_max1133_program_demux (prog, rxbuf, frame);
+}
+
+/**
+ * bcm2835_backend_scan:
+ */
+static gboolean
+bcm2835_backend_scan (gpointer priv, int16_t *frame)
+{
+    Bcm2835Backend *be = priv;
+
+    if (be->batched)
+        bcm2835_backend_scan_batched (be, frame);
+    else
+        bcm2835_backend_scan_single (be, frame);
+
+    return TRUE;
+}
+
+const GldAdcBackend gld_adc_backend_bcm2835 = {
+    .name = "bcm2835",
+    .description = "MAX1133 ADCs on the Galdur board, polled via the BCM2835 SPI registers",
+    .caps = GLD_ADC_BACKEND_CAP_HARDWARE | GLD_ADC_BACKEND_CAP_MMIO | GLD_ADC_BACKEND_CAP_BATCHED,
+
+    .open = bcm2835_backend_open,
+    .close = bcm2835_backend_close,
+    .start = bcm2835_backend_start,
+    .stop = bcm2835_backend_stop,
+    .scan = bcm2835_backend_scan
+};
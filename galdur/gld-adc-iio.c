@@ -0,0 +1,618 @@
+/*
+ * Copyright (C) 2016-2017 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ADC backend reading buffered scans from a Linux IIO device, e.g. the
+ * max1133 kernel driver. The kernel acquires the data, paced by a trigger
+ * such as an hrtimer, and the DAQ thread only sleeps in read() until the
+ * next block of scans is available.
+ */
+
+#include "gld-adc-backend.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#define IIO_SYSFS_DEVICES "/sys/bus/iio/devices"
+#define IIO_DEFAULT_DEVICE "max1133"
+#define IIO_DEFAULT_BLOCK_SIZE 32
+
+/* how often a reader waiting for data checks whether acquisition was stopped */
+#define IIO_POLL_TIMEOUT_MSEC 100
+
+/**
+ * IioScanElement:
+ *
+ * Format of one channel in the scans read from the IIO device,
+ * as described by its scan_elements/in_voltageN_type attribute.
+ */
+typedef struct {
+    guint offset;       /* byte offset within a scan */
+    gboolean big_endian;
+    gboolean is_signed;
+    guint realbits;
+    guint shift;
+} IioScanElement;
+
+typedef struct {
+    gchar *device;      /* e.g. "iio:device0" */
+    gchar *sysfs_dir;
+    gchar *trigger;     /* trigger to select, or NULL to keep the current one */
+    guint block_size;   /* scans read at once, also used as buffer watermark */
+    guint buffer_length; /* length of the kernel buffer, in scans */
+
+    GldAdc *daq;
+    gchar *old_trigger; /* trigger to restore if starting fails, or NULL if unchanged */
+
+    int fd;
+    guint channel_count;
+    guint scan_bytes;
+    IioScanElement elements[16];    /* per logical channel */
+    uint8_t *readbuf;
+} IioBackend;
+
+/**
+ * iio_write_sysfs_file:
+ *
+ * Write @value to a sysfs attribute.
+ * %g_file_set_contents can not be used for this, as it replaces the file.
+ */
+static gboolean
+iio_write_sysfs_file (const gchar *fname, const gchar *value)
+{
+    FILE *f;
+    gboolean ret;
+
+    f = fopen (fname, "w");
+    if (f == NULL) {
+        g_critical ("Unable to open %s: %s", fname, g_strerror (errno));
+        return FALSE;
+    }
+    ret = fputs (value, f) >= 0;
+    ret = (fclose (f) == 0) && ret;
+    if (!ret)
+        g_critical ("Unable to write '%s' to %s: %s", value, fname, g_strerror (errno));
+
+    return ret;
+}
+
+/**
+ * iio_backend_write_attr:
+ *
+ * Write @value to a sysfs attribute of the device.
+ */
+static gboolean
+iio_backend_write_attr (IioBackend *be, const gchar *attr, const gchar *value)
+{
+    g_autofree gchar *fname = NULL;
+
+    fname = g_build_filename (be->sysfs_dir, attr, NULL);
+    return iio_write_sysfs_file (fname, value);
+}
+
+/**
+ * iio_backend_has_attr:
+ */
+static gboolean
+iio_backend_has_attr (IioBackend *be, const gchar *attr)
+{
+    g_autofree gchar *fname = NULL;
+
+    fname = g_build_filename (be->sysfs_dir, attr, NULL);
+    return g_file_test (fname, G_FILE_TEST_EXISTS);
+}
+
+/**
+ * iio_backend_read_attr:
+ *
+ * Returns: The stripped contents of a sysfs attribute of the device, or %NULL.
+ */
+static gchar*
+iio_backend_read_attr (IioBackend *be, const gchar *attr)
+{
+    g_autofree gchar *fname = NULL;
+    gchar *contents = NULL;
+
+    fname = g_build_filename (be->sysfs_dir, attr, NULL);
+    if (!g_file_get_contents (fname, &contents, NULL, NULL))
+        return NULL;
+
+    return g_strstrip (contents);
+}
+
+/**
+ * iio_find_sysfs_entry:
+ * @prefix: Kind of entry, "iio:device" or "trigger"
+ * @name: Value of the entry's name attribute
+ *
+ * Returns: The name of the first IIO sysfs entry called @name, or %NULL.
+ */
+static gchar*
+iio_find_sysfs_entry (const gchar *prefix, const gchar *name)
+{
+    GDir *dir;
+    const gchar *entry;
+    gchar *ret = NULL;
+
+    dir = g_dir_open (IIO_SYSFS_DEVICES, 0, NULL);
+    if (dir == NULL)
+        return NULL;
+    while ((entry = g_dir_read_name (dir)) != NULL) {
+        g_autofree gchar *fname = NULL;
+        g_autofree gchar *entry_name = NULL;
+
+        if (!g_str_has_prefix (entry, prefix))
+            continue;
+        fname = g_build_filename (IIO_SYSFS_DEVICES, entry, "name", NULL);
+        if (!g_file_get_contents (fname, &entry_name, NULL, NULL))
+            continue;
+        if (g_strcmp0 (g_strstrip (entry_name), name) == 0) {
+            ret = g_strdup (entry);
+            break;
+        }
+    }
+    g_dir_close (dir);
+
+    return ret;
+}
+
+/**
+ * iio_backend_close:
+ */
+static void
+iio_backend_close (gpointer priv)
+{
+    IioBackend *be = priv;
+
+    g_free (be->device);
+    g_free (be->sysfs_dir);
+    g_free (be->trigger);
+    g_free (be->old_trigger);
+    g_free (be);
+}
+
+/**
+ * iio_backend_open:
+ * @args: "[DEVICE][,trigger=NAME][,block=N][,length=N]"
+ *
+ * DEVICE is an IIO device like "iio:device0" or the name of its driver,
+ * and defaults to "max1133". @block is the number of scans read at once,
+ * @length the size of the kernel buffer in scans, which defaults to 16 blocks.
+ */
+static gpointer
+iio_backend_open (const gchar *args)
+{
+    IioBackend *be;
+    gchar **parts = NULL;
+    const gchar *name = IIO_DEFAULT_DEVICE;
+    guint i;
+
+    be = g_new0 (IioBackend, 1);
+    be->fd = -1;
+    be->block_size = IIO_DEFAULT_BLOCK_SIZE;
+
+    if (args != NULL)
+        parts = g_strsplit (args, ",", -1);
+    for (i = 0; parts != NULL && parts[i] != NULL; i++) {
+        if (g_str_has_prefix (parts[i], "trigger=")) {
+            g_free (be->trigger);
+            be->trigger = g_strdup (parts[i] + 8);
+        } else if (g_str_has_prefix (parts[i], "block=")) {
+            be->block_size = MAX (g_ascii_strtoull (parts[i] + 6, NULL, 10), 1);
+        } else if (g_str_has_prefix (parts[i], "length=")) {
+            be->buffer_length = g_ascii_strtoull (parts[i] + 7, NULL, 10);
+        } else if (i == 0) {
+            name = parts[i];
+        } else {
+            g_critical ("Invalid iio backend argument: %s", parts[i]);
+            g_strfreev (parts);
+            iio_backend_close (be);
+            return NULL;
+        }
+    }
+
+    if (g_str_has_prefix (name, "iio:device"))
+        be->device = g_strdup (name);
+    else
+        be->device = iio_find_sysfs_entry ("iio:device", name);
+    g_strfreev (parts);
+    if (be->device == NULL) {
+        g_critical ("Unable to find an IIO device for '%s'.", args != NULL? args : IIO_DEFAULT_DEVICE);
+        iio_backend_close (be);
+        return NULL;
+    }
+    be->sysfs_dir = g_build_filename (IIO_SYSFS_DEVICES, be->device, NULL);
+    if (be->buffer_length < be->block_size)
+        be->buffer_length = 16 * be->block_size;
+
+    return be;
+}
+
+/**
+ * iio_backend_parse_type:
+ *
+ * Parse a scan element type like "be:s16/16>>0".
+ */
+static gboolean
+iio_backend_parse_type (const gchar *type, IioScanElement *element)
+{
+    gchar endianness[3] = { 0 };
+    gchar sign;
+    guint storagebits;
+
+    if (sscanf (type, "%2c:%c%u/%u>>%u", endianness, &sign, &element->realbits, &storagebits, &element->shift) != 5)
+        return FALSE;
+    if (storagebits != 16 || element->realbits == 0 || element->realbits + element->shift > 16)
+        return FALSE;
+
+    element->big_endian = g_strcmp0 (endianness, "be") == 0;
+    element->is_signed = sign == 's';
+
+    return TRUE;
+}
+
+/**
+ * iio_backend_disable_scan_elements:
+ *
+ * Disable all channels of the device.
+ */
+static gboolean
+iio_backend_disable_scan_elements (IioBackend *be)
+{
+    g_autofree gchar *scan_dir = NULL;
+    GDir *dir;
+    const gchar *entry;
+
+    scan_dir = g_build_filename (be->sysfs_dir, "scan_elements", NULL);
+    dir = g_dir_open (scan_dir, 0, NULL);
+    if (dir == NULL)
+        return FALSE;
+    while ((entry = g_dir_read_name (dir)) != NULL) {
+        g_autofree gchar *attr = NULL;
+
+        if (!g_str_has_suffix (entry, "_en"))
+            continue;
+        attr = g_build_filename ("scan_elements", entry, NULL);
+        iio_backend_write_attr (be, attr, "0");
+    }
+    g_dir_close (dir);
+
+    return TRUE;
+}
+
+/**
+ * iio_backend_has_differential_channel:
+ *
+ * Returns: %TRUE if @channel is only available as positive input of a
+ * differential channel like in_voltage0-voltage1.
+ */
+static gboolean
+iio_backend_has_differential_channel (IioBackend *be, guint channel)
+{
+    g_autofree gchar *scan_dir = NULL;
+    g_autofree gchar *prefix = NULL;
+    GDir *dir;
+    const gchar *entry;
+    gboolean ret = FALSE;
+
+    scan_dir = g_build_filename (be->sysfs_dir, "scan_elements", NULL);
+    dir = g_dir_open (scan_dir, 0, NULL);
+    if (dir == NULL)
+        return FALSE;
+    prefix = g_strdup_printf ("in_voltage%u-voltage", channel);
+    while ((entry = g_dir_read_name (dir)) != NULL) {
+        if (g_str_has_prefix (entry, prefix) && g_str_has_suffix (entry, "_en")) {
+            ret = TRUE;
+            break;
+        }
+    }
+    g_dir_close (dir);
+
+    return ret;
+}
+
+/**
+ * iio_backend_unconfigure:
+ *
+ * Undo the configuration done by a failed %iio_backend_start, so
+ * the device is not left half set up.
+ */
+static void
+iio_backend_unconfigure (IioBackend *be)
+{
+    iio_backend_write_attr (be, "buffer/enable", "0");
+    iio_backend_disable_scan_elements (be);
+    if (be->old_trigger != NULL) {
+        /* writing an empty line detaches the trigger */
+        iio_backend_write_attr (be, "trigger/current_trigger",
+                                be->old_trigger[0] != '\0'? be->old_trigger : "\n");
+        g_free (be->old_trigger);
+        be->old_trigger = NULL;
+    }
+}
+
+/**
+ * iio_backend_stop:
+ */
+static void
+iio_backend_stop (gpointer priv)
+{
+    IioBackend *be = priv;
+
+    if (be->fd >= 0) {
+        close (be->fd);
+        be->fd = -1;
+        iio_backend_write_attr (be, "buffer/enable", "0");
+    }
+    g_free (be->readbuf);
+    be->readbuf = NULL;
+}
+
+/**
+ * iio_backend_start:
+ *
+ * Enable the scan elements of all channels in the scan list, where
+ * physical channel N is the in_voltageN channel of the device, select
+ * the trigger and its frequency, and enable the buffer.
+ * The kernel delivers every enabled channel once per scan, so a channel
+ * can not be listed twice. Differential channels are not supported.
+ * If starting fails, everything configured so far is disabled again.
+ */
+static gboolean
+iio_backend_start (gpointer priv, GldAdc *daq)
+{
+    IioBackend *be = priv;
+    g_autofree gchar *dev_node = NULL;
+    g_autofree gchar *freq = NULL;
+    g_autofree gchar *length = NULL;
+    g_autofree gchar *watermark = NULL;
+    guint index[16];
+    guint i, j;
+
+    for (i = 0; i < daq->channel_count; i++) {
+        for (j = 0; j < i; j++) {
+            if (daq->scan_list[j] == daq->scan_list[i]) {
+                g_critical ("The iio ADC backend can not acquire channel %u more than once per scan.",
+                            daq->scan_list[i]);
+                return FALSE;
+            }
+        }
+    }
+
+    iio_backend_stop (be);
+    iio_backend_write_attr (be, "buffer/enable", "0");
+
+    /* disable everything not in the scan list */
+    if (!iio_backend_disable_scan_elements (be)) {
+        g_critical ("IIO device %s does not support buffered capture.", be->device);
+        return FALSE;
+    }
+
+    for (i = 0; i < daq->channel_count; i++) {
+        g_autofree gchar *attr_en = NULL;
+        g_autofree gchar *attr_type = NULL;
+        g_autofree gchar *attr_index = NULL;
+        g_autofree gchar *type = NULL;
+        g_autofree gchar *idx = NULL;
+
+        attr_en = g_strdup_printf ("scan_elements/in_voltage%u_en", daq->scan_list[i]);
+        attr_type = g_strdup_printf ("scan_elements/in_voltage%u_type", daq->scan_list[i]);
+        attr_index = g_strdup_printf ("scan_elements/in_voltage%u_index", daq->scan_list[i]);
+
+        type = iio_backend_read_attr (be, attr_type);
+        idx = iio_backend_read_attr (be, attr_index);
+        if (type == NULL || idx == NULL) {
+            if (iio_backend_has_differential_channel (be, daq->scan_list[i]))
+                g_critical ("Channel %u of IIO device %s is a differential channel (in_voltage%u-voltageN), "
+                            "the iio ADC backend only supports single-ended channels.",
+                            daq->scan_list[i], be->device, daq->scan_list[i]);
+            else
+                g_critical ("IIO device %s has no channel in_voltage%u.", be->device, daq->scan_list[i]);
+            goto fail;
+        }
+        if (!iio_backend_parse_type (type, &be->elements[i])) {
+            g_critical ("Unsupported IIO scan element type '%s' of in_voltage%u.", type, daq->scan_list[i]);
+            goto fail;
+        }
+        if (!iio_backend_write_attr (be, attr_en, "1"))
+            goto fail;
+        index[i] = g_ascii_strtoull (idx, NULL, 10);
+    }
+
+    /* scans contain the enabled channels ordered by their scan index, all of them 16 bit */
+    for (i = 0; i < daq->channel_count; i++) {
+        guint rank = 0;
+        for (j = 0; j < daq->channel_count; j++) {
+            if (index[j] < index[i] || (index[j] == index[i] && j < i))
+                rank++;
+        }
+        be->elements[i].offset = 2 * rank;
+    }
+    be->channel_count = daq->channel_count;
+    be->scan_bytes = 2 * daq->channel_count;
+
+    /* select the trigger and let it run at our sampling frequency, if it can be configured */
+    freq = g_strdup_printf ("%u", MAX (daq->acq_frequency, 1));
+    if (be->trigger != NULL) {
+        g_autofree gchar *trigger_dir = NULL;
+
+        be->old_trigger = iio_backend_read_attr (be, "trigger/current_trigger");
+        if (!iio_backend_write_attr (be, "trigger/current_trigger", be->trigger))
+            goto fail;
+        trigger_dir = iio_find_sysfs_entry ("trigger", be->trigger);
+        if (trigger_dir != NULL) {
+            g_autofree gchar *fname = NULL;
+
+            fname = g_build_filename (IIO_SYSFS_DEVICES, trigger_dir, "sampling_frequency", NULL);
+            if (g_file_test (fname, G_FILE_TEST_EXISTS))
+                iio_write_sysfs_file (fname, freq);
+        }
+    }
+    if (iio_backend_has_attr (be, "sampling_frequency"))
+        iio_backend_write_attr (be, "sampling_frequency", freq);
+
+    /* size the kernel buffer, and wake us only once a whole block is available */
+    length = g_strdup_printf ("%u", be->buffer_length);
+    watermark = g_strdup_printf ("%u", be->block_size);
+    if (!iio_backend_write_attr (be, "buffer/length", length))
+        goto fail;
+    /* older kernels have no watermark, and wake readers for every scan */
+    if (iio_backend_has_attr (be, "buffer/watermark"))
+        iio_backend_write_attr (be, "buffer/watermark", watermark);
+
+    if (!iio_backend_write_attr (be, "buffer/enable", "1"))
+        goto fail;
+
+    dev_node = g_build_filename ("/dev", be->device, NULL);
+    be->fd = open (dev_node, O_RDONLY);
+    if (be->fd < 0) {
+        g_critical ("Unable to open %s: %s", dev_node, g_strerror (errno));
+        goto fail;
+    }
+    be->readbuf = g_malloc (be->block_size * be->scan_bytes);
+    be->daq = daq;
+
+    /* we keep the trigger we selected from now on */
+    g_free (be->old_trigger);
+    be->old_trigger = NULL;
+
+    return TRUE;
+
+fail:
+    iio_backend_unconfigure (be);
+    return FALSE;
+}
+
+/**
+ * iio_backend_get_block_size:
+ */
+static guint
+iio_backend_get_block_size (gpointer priv)
+{
+    IioBackend *be = priv;
+    return be->block_size;
+}
+
+/**
+ * iio_backend_convert:
+ *
+ * Convert a raw scan element to a sample.
+ */
+static inline int16_t
+iio_backend_convert (const IioScanElement *element, const uint8_t *data)
+{
+    uint16_t raw;
+
+    if (element->big_endian)
+        raw = ((uint16_t) data[0] << 8) | data[1];
+    else
+        raw = ((uint16_t) data[1] << 8) | data[0];
+
+    raw >>= element->shift;
+    if (element->realbits < 16) {
+        raw &= (1 << element->realbits) - 1;
+        /* sign extend */
+        if (element->is_signed && (raw & (1 << (element->realbits - 1))))
+            raw |= ~((1 << element->realbits) - 1);
+    }
+
+    return (int16_t) raw;
+}
+
+/**
+ * iio_backend_scan_block:
+ *
+ * Read @n_scans scans with a single read(), blocking until the kernel
+ * has acquired them. The device is polled with a timeout, so a stalled
+ * trigger can not keep us from noticing that acquisition was stopped.
+ */
+static gboolean
+iio_backend_scan_block (gpointer priv, int16_t *frames, guint n_scans)
+{
+    IioBackend *be = priv;
+    const size_t len = n_scans * be->scan_bytes;
+    size_t pos = 0;
+    guint scan, i;
+
+    /* the kernel only hands out whole scans, but may return fewer than we asked for */
+    while (pos < len) {
+        struct pollfd pfd = { .fd = be->fd, .events = POLLIN };
+        ssize_t rc;
+
+        rc = poll (&pfd, 1, IIO_POLL_TIMEOUT_MSEC);
+        if (rc < 0 && errno != EINTR) {
+            g_critical ("Unable to poll %s: %s", be->device, g_strerror (errno));
+            return FALSE;
+        }
+        if (rc <= 0) {
+            if (!be->daq->running)
+                return FALSE;
+            continue;
+        }
+
+        rc = read (be->fd, be->readbuf + pos, len - pos);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            g_critical ("Unable to read from %s: %s", be->device, g_strerror (errno));
+            return FALSE;
+        }
+        if (rc == 0)
+            return FALSE;
+        pos += rc;
+    }
+
+    for (scan = 0; scan < n_scans; scan++) {
+        const uint8_t *src = &be->readbuf[scan * be->scan_bytes];
+        int16_t *frame = &frames[scan * be->channel_count];
+
+        for (i = 0; i < be->channel_count; i++)
+            frame[i] = iio_backend_convert (&be->elements[i], &src[be->elements[i].offset]);
+    }
+
+    return TRUE;
+}
+
+/**
+ * iio_backend_scan:
+ */
+static gboolean
+iio_backend_scan (gpointer priv, int16_t *frame)
+{
+    return iio_backend_scan_block (priv, frame, 1);
+}
+
+const GldAdcBackend gld_adc_backend_iio = {
+    .name = "iio",
+    .description = "Buffered capture from a Linux IIO device, arguments: [DEVICE][,trigger=NAME][,block=N][,length=N]",
+    .caps = GLD_ADC_BACKEND_CAP_HARDWARE | GLD_ADC_BACKEND_CAP_PACED,
+
+    .open = iio_backend_open,
+    .close = iio_backend_close,
+    .start = iio_backend_start,
+    .stop = iio_backend_stop,
+    .scan = iio_backend_scan,
+
+    .get_block_size = iio_backend_get_block_size,
+    .scan_block = iio_backend_scan_block
+};
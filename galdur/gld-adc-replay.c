@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2016-2017 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ADC backend replaying a recording, one frame per point of the sampling
+ * grid, so recorded data arrives at the same pace as from the real ADCs.
+ * Recordings are raw interleaved 16 bit samples, like the .dat files
+ * labrstim can work on offline.
+ */
+
+#include "gld-adc-backend.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef struct {
+    gchar *filename;
+    guint file_channels;     /* number of interleaved channels in the file, 0 to use the channel count */
+    gboolean loop;
+
+    const int16_t *data;
+    size_t data_size;        /* mapped size in bytes */
+    size_t n_frames;
+
+    guint channel_count;
+    guint8 columns[16];      /* file channel of each logical channel */
+    guint stride;
+    size_t position;         /* next frame to replay */
+} ReplayBackend;
+
+/**
+ * replay_backend_close:
+ */
+static void
+replay_backend_close (gpointer priv)
+{
+    ReplayBackend *be = priv;
+
+    if (be->data != NULL)
+        munmap ((void*) be->data, be->data_size);
+    g_free (be->filename);
+    g_free (be);
+}
+
+/**
+ * replay_backend_open:
+ * @args: "FILE[,channels=N][,loop]"
+ *
+ * @channels is the number of interleaved channels in FILE, and defaults to
+ * the number of acquired channels. Physical channel i of the scan list is
+ * read from channel i of the file. With @loop, the recording starts over
+ * when its end is reached, otherwise acquisition stops there.
+ */
+static gpointer
+replay_backend_open (const gchar *args)
+{
+    ReplayBackend *be;
+    gchar **parts;
+    struct stat st;
+    void *data;
+    int fd;
+    guint i;
+
+    if (args == NULL || args[0] == '\0') {
+        g_critical ("The replay ADC backend needs the name of the file to replay.");
+        return NULL;
+    }
+
+    be = g_new0 (ReplayBackend, 1);
+    parts = g_strsplit (args, ",", -1);
+    be->filename = g_strdup (parts[0]);
+    for (i = 1; parts[i] != NULL; i++) {
+        if (g_str_has_prefix (parts[i], "channels=")) {
+            be->file_channels = g_ascii_strtoull (parts[i] + 9, NULL, 10);
+        } else if (g_strcmp0 (parts[i], "loop") == 0) {
+            be->loop = TRUE;
+        } else {
+            g_critical ("Invalid replay backend argument: %s", parts[i]);
+            g_strfreev (parts);
+            replay_backend_close (be);
+            return NULL;
+        }
+    }
+    g_strfreev (parts);
+
+    fd = open (be->filename, O_RDONLY);
+    if (fd < 0) {
+        g_critical ("Unable to open %s for replay: %s", be->filename, g_strerror (errno));
+        replay_backend_close (be);
+        return NULL;
+    }
+    if (fstat (fd, &st) < 0 || st.st_size < (off_t) sizeof(int16_t)) {
+        g_critical ("Unable to replay %s: File is empty or can not be read.", be->filename);
+        close (fd);
+        replay_backend_close (be);
+        return NULL;
+    }
+
+    /* map the whole recording, so the DAQ thread never waits for file I/O after the first pass */
+    data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close (fd);
+    if (data == MAP_FAILED) {
+        g_critical ("Unable to map %s for replay: %s", be->filename, g_strerror (errno));
+        replay_backend_close (be);
+        return NULL;
+    }
+    be->data = data;
+    be->data_size = st.st_size;
+
+    return be;
+}
+
+/**
+ * replay_backend_start:
+ *
+ * Every acquisition replays the recording from its beginning.
+ */
+static gboolean
+replay_backend_start (gpointer priv, GldAdc *daq)
+{
+    ReplayBackend *be = priv;
+    guint i;
+
+    be->stride = be->file_channels > 0? be->file_channels : daq->channel_count;
+    be->n_frames = be->data_size / (be->stride * sizeof(int16_t));
+    if (be->n_frames == 0) {
+        g_critical ("%s does not contain a single frame of %u channels.", be->filename, be->stride);
+        return FALSE;
+    }
+
+    for (i = 0; i < daq->channel_count; i++) {
+        if (daq->scan_list[i] >= be->stride) {
+            g_critical ("Can not replay channel %u, %s only has %u channels.",
+                        daq->scan_list[i], be->filename, be->stride);
+            return FALSE;
+        }
+        be->columns[i] = daq->scan_list[i];
+    }
+    be->channel_count = daq->channel_count;
+    be->position = 0;
+
+    return TRUE;
+}
+
+/**
+ * replay_backend_stop:
+ */
+static void
+replay_backend_stop (gpointer priv)
+{
+}
+
+/**
+ * replay_backend_scan:
+ */
+static gboolean
+replay_backend_scan (gpointer priv, int16_t *frame)
+{
+    ReplayBackend *be = priv;
+    const int16_t *src;
+    guint i;
+
+    if (be->position == be->n_frames) {
+        if (!be->loop)
+            return FALSE;
+        be->position = 0;
+    }
+
+    src = &be->data[be->position * be->stride];
+    for (i = 0; i < be->channel_count; i++)
+        frame[i] = src[be->columns[i]];
+    be->position++;
+
+    return TRUE;
+}
+
+const GldAdcBackend gld_adc_backend_replay = {
+    .name = "replay",
+    .description = "Replay of a recording of interleaved 16 bit samples, arguments: FILE[,channels=N][,loop]",
+    .caps = GLD_ADC_BACKEND_CAP_FINITE,
+
+    .open = replay_backend_open,
+    .close = replay_backend_close,
+    .start = replay_backend_start,
+    .stop = replay_backend_stop,
+    .scan = replay_backend_scan
+};
@@ -0,0 +1,389 @@
+/*
+ * Copyright (C) 2016-2017 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ADC backend talking to the MAX1133 chips of the Galdur board through
+ * the Linux spidev driver, so it works without access to /dev/mem and
+ * next to other users of the kernel's SPI driver.
+ *
+ * All SPI transactions of a scan on one chip are prepared once when
+ * acquisition starts and submitted as a single SPI_IOC_MESSAGE, so a scan
+ * costs one system call per chip. If all channels are on the same chip,
+ * a whole block of scans can be submitted at once, with the SPI controller
+ * pacing them to the sampling frequency by delaying after every scan.
+ */
+
+#include "gld-adc-backend.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+
+#include "gld-max1133.h"
+
+/* same clock as the bcm2835 backend: 250 MHz core clock with a divider of 128 */
+#define SPIDEV_DEFAULT_SPEED_HZ 1953125
+
+/* the ioctl size field limits a message to 511 transfers */
+#define SPIDEV_MAX_TRANSFERS ((1 << _IOC_SIZEBITS) / sizeof(struct spi_ioc_transfer) - 1)
+/* spidev's default buffer size, which limits the bytes of a single message */
+#define SPIDEV_MAX_MESSAGE_BYTES 4096
+
+typedef struct {
+    gchar *device[2];   /* spidev device of each chip */
+    int fd[2];          /* opened when a scan list first uses the chip */
+    guint32 speed_hz;
+    guint16 delay_usec; /* extra delay after every transaction, e.g. for slow clocks */
+    guint block_size;   /* number of scans to submit at once, if possible */
+
+    GldMax1133Program prog;
+    guint channel_count;
+
+    /* prepared SPI messages, the transfers of a scan on chip c start at xfer_first[c] */
+    guint scans_per_message;
+    guint xfers_per_scan;
+    guint xfer_first[2];
+    guint chip_xfers[2];
+    struct spi_ioc_transfer *xfers;
+    uint8_t *txbuf;
+    uint8_t *rxbuf;
+} SpidevBackend;
+
+/**
+ * spidev_backend_stop:
+ */
+static void
+spidev_backend_stop (gpointer priv)
+{
+    SpidevBackend *be = priv;
+
+    g_free (be->xfers);
+    g_free (be->txbuf);
+    g_free (be->rxbuf);
+    be->xfers = NULL;
+    be->txbuf = NULL;
+    be->rxbuf = NULL;
+}
+
+/**
+ * spidev_backend_close:
+ */
+static void
+spidev_backend_close (gpointer priv)
+{
+    SpidevBackend *be = priv;
+    guint chip;
+
+    spidev_backend_stop (be);
+    for (chip = 0; chip < 2; chip++) {
+        if (be->fd[chip] >= 0)
+            close (be->fd[chip]);
+        g_free (be->device[chip]);
+    }
+    g_free (be);
+}
+
+/**
+ * spidev_backend_open_device:
+ *
+ * Open a spidev device and configure it for the MAX1133.
+ */
+static int
+spidev_backend_open_device (const gchar *device, guint32 speed_hz)
+{
+    uint8_t mode = SPI_MODE_0;
+    uint8_t bits = 8;
+    int fd;
+
+    fd = open (device, O_RDWR);
+    if (fd < 0) {
+        g_critical ("Unable to open SPI device %s: %s", device, g_strerror (errno));
+        return -1;
+    }
+
+    if (ioctl (fd, SPI_IOC_WR_MODE, &mode) < 0 ||
+        ioctl (fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 ||
+        ioctl (fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed_hz) < 0) {
+        g_critical ("Unable to configure SPI device %s: %s", device, g_strerror (errno));
+        close (fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * spidev_backend_open:
+ * @args: "DEVICE0,DEVICE1[,speed=HZ][,delay=USEC][,block=N]",
+ *        the devices default to "/dev/spidev0.0,/dev/spidev0.1"
+ *
+ * The devices are only opened once a scan list uses their chip, so boards
+ * with a single chip select work as long as only the first chip is used.
+ */
+static gpointer
+spidev_backend_open (const gchar *args)
+{
+    SpidevBackend *be;
+    gchar **parts = NULL;
+    guint i;
+    guint n_devices = 0;
+
+    be = g_new0 (SpidevBackend, 1);
+    be->fd[0] = be->fd[1] = -1;
+    be->speed_hz = SPIDEV_DEFAULT_SPEED_HZ;
+    be->block_size = 1;
+
+    if (args != NULL)
+        parts = g_strsplit (args, ",", -1);
+    for (i = 0; parts != NULL && parts[i] != NULL; i++) {
+        if (g_str_has_prefix (parts[i], "speed=")) {
+            be->speed_hz = g_ascii_strtoull (parts[i] + 6, NULL, 10);
+        } else if (g_str_has_prefix (parts[i], "delay=")) {
+            be->delay_usec = MIN (g_ascii_strtoull (parts[i] + 6, NULL, 10), G_MAXUINT16);
+        } else if (g_str_has_prefix (parts[i], "block=")) {
+            be->block_size = MAX (g_ascii_strtoull (parts[i] + 6, NULL, 10), 1);
+        } else if (n_devices < 2) {
+            be->device[n_devices++] = g_strdup (parts[i]);
+        } else {
+            g_critical ("Invalid spidev backend argument: %s", parts[i]);
+            goto fail;
+        }
+    }
+    g_strfreev (parts);
+    parts = NULL;
+
+    if (be->device[0] == NULL)
+        be->device[0] = g_strdup ("/dev/spidev0.0");
+    if (be->device[1] == NULL)
+        be->device[1] = g_strdup ("/dev/spidev0.1");
+    if (be->speed_hz == 0) {
+        g_critical ("Invalid SPI clock speed for the spidev backend.");
+        goto fail;
+    }
+
+    return be;
+
+fail:
+    g_strfreev (parts);
+    spidev_backend_close (be);
+    return NULL;
+}
+
+/**
+ * spidev_backend_start:
+ *
+ * Prepare the SPI messages for the current scan list. Without batching,
+ * every conversion is a transfer of its own, and the chip is deselected
+ * between them (cs_change). In batched mode, all conversions of a chip are
+ * one transfer. When submitting blocks of scans, the chip is deselected
+ * after every scan, and the last transfer of a scan is delayed so the next
+ * one starts one sampling period after it.
+ */
+static gboolean
+spidev_backend_start (gpointer priv, GldAdc *daq)
+{
+    SpidevBackend *be = priv;
+    GldMax1133Program *prog = &be->prog;
+    const guint frequency = MAX (daq->acq_frequency, 1);
+    guint64 scan_delay_usec = be->delay_usec;
+    guint chip, scan, i;
+
+    spidev_backend_stop (be);
+    gld_max1133_program_build (prog, daq->scan_list, daq->channel_count);
+    be->channel_count = daq->channel_count;
+
+    for (chip = 0; chip < 2; chip++) {
+        if (prog->chip_ops[chip] == 0 || be->fd[chip] >= 0)
+            continue;
+        be->fd[chip] = spidev_backend_open_device (be->device[chip], be->speed_hz);
+        if (be->fd[chip] < 0)
+            return FALSE;
+    }
+
+    be->xfers_per_scan = 0;
+    for (chip = 0; chip < 2; chip++) {
+        be->xfer_first[chip] = be->xfers_per_scan;
+        if (prog->chip_ops[chip] == 0)
+            be->chip_xfers[chip] = 0;
+        else
+            be->chip_xfers[chip] = daq->batched_spi? 1 : prog->chip_ops[chip];
+        be->xfers_per_scan += be->chip_xfers[chip];
+    }
+
+    /* a message can only address a single chip, so blocks of scans need all channels on one of them */
+    be->scans_per_message = be->block_size;
+    if (be->scans_per_message > 1 && prog->chip_ops[0] > 0 && prog->chip_ops[1] > 0) {
+        g_warning ("The scan list uses both ADC chips, reading single scans instead of blocks.");
+        be->scans_per_message = 1;
+    }
+    be->scans_per_message = MIN (be->scans_per_message, SPIDEV_MAX_TRANSFERS / MAX (be->xfers_per_scan, 1));
+    be->scans_per_message = MIN (be->scans_per_message, SPIDEV_MAX_MESSAGE_BYTES / MAX (2 * prog->n_ops, 1));
+    be->scans_per_message = MAX (be->scans_per_message, 1);
+
+    if (be->scans_per_message > 1) {
+        guint64 scan_time_usec;
+
+        /* the time one scan keeps the bus busy, rounded up */
+        scan_time_usec = ((guint64) 16 * prog->n_ops * G_USEC_PER_SEC + be->speed_hz - 1) / be->speed_hz +
+                         (guint64) be->delay_usec * be->xfers_per_scan;
+        if (scan_time_usec >= G_USEC_PER_SEC / frequency) {
+            g_critical ("A scan takes %u usec at the selected SPI speed, which is too slow for %u Hz.",
+                        (guint) scan_time_usec, frequency);
+            return FALSE;
+        }
+        scan_delay_usec = G_USEC_PER_SEC / frequency - scan_time_usec + be->delay_usec;
+
+        /* the delay of a transfer is only 16 bit wide */
+        if (scan_delay_usec > G_MAXUINT16) {
+            g_critical ("Reading blocks of scans at %u Hz needs a delay of %"G_GUINT64_FORMAT" usec between scans, "
+                        "but at most %u usec are possible. Use a higher sampling rate or block=1.",
+                        frequency, scan_delay_usec, G_MAXUINT16);
+            return FALSE;
+        }
+    }
+
+    be->txbuf = g_malloc (be->scans_per_message * 2 * prog->n_ops);
+    be->rxbuf = g_malloc0 (be->scans_per_message * 2 * prog->n_ops);
+    be->xfers = g_new0 (struct spi_ioc_transfer, be->scans_per_message * be->xfers_per_scan);
+
+    for (scan = 0; scan < be->scans_per_message; scan++) {
+        const guint scan_offset = scan * 2 * prog->n_ops;
+        guint op = 0;
+
+        memcpy (&be->txbuf[scan_offset], prog->txbuf, 2 * prog->n_ops);
+        for (chip = 0; chip < 2; chip++) {
+            for (i = 0; i < be->chip_xfers[chip]; i++) {
+                struct spi_ioc_transfer *xfer = &be->xfers[scan * be->xfers_per_scan + be->xfer_first[chip] + i];
+                const guint n_ops = daq->batched_spi? prog->chip_ops[chip] : 1;
+                const gboolean last_of_scan = i == be->chip_xfers[chip] - 1;
+
+                xfer->tx_buf = (unsigned long) &be->txbuf[scan_offset + 2 * op];
+                xfer->rx_buf = (unsigned long) &be->rxbuf[scan_offset + 2 * op];
+                xfer->len = 2 * n_ops;
+                xfer->speed_hz = be->speed_hz;
+                xfer->bits_per_word = 8;
+                xfer->delay_usecs = last_of_scan? (guint16) scan_delay_usec : be->delay_usec;
+
+                /* deselect the chip between conversions, or between scans in batched mode.
+                 * Setting it on the last transfer of a message would keep the chip selected
+                 * afterwards, which is fixed up when submitting. */
+                xfer->cs_change = !daq->batched_spi || last_of_scan;
+                op += n_ops;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * spidev_backend_submit:
+ *
+ * Submit @n_scans scans of the prepared messages, with one ioctl per chip.
+ */
+static gboolean
+spidev_backend_submit (SpidevBackend *be, guint n_scans)
+{
+    guint chip;
+
+    for (chip = 0; chip < 2; chip++) {
+        struct spi_ioc_transfer *first;
+        struct spi_ioc_transfer *last;
+        guint n_xfers;
+        int rc;
+
+        if (be->chip_xfers[chip] == 0)
+            continue;
+
+        /* blocks only exist for a single chip, whose transfers are consecutive */
+        n_xfers = n_scans == 1? be->chip_xfers[chip] : n_scans * be->xfers_per_scan;
+        first = &be->xfers[be->xfer_first[chip]];
+        last = &first[n_xfers - 1];
+
+        /* release the chip at the end of the message */
+        last->cs_change = 0;
+        rc = ioctl (be->fd[chip], SPI_IOC_MESSAGE(n_xfers), first);
+        last->cs_change = 1;
+        if (rc < 0) {
+            g_critical ("SPI transfer on %s failed: %s", be->device[chip], g_strerror (errno));
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * spidev_backend_get_block_size:
+ */
+static guint
+spidev_backend_get_block_size (gpointer priv)
+{
+    SpidevBackend *be = priv;
+    return be->scans_per_message;
+}
+
+/**
+ * spidev_backend_scan_block:
+ */
+static gboolean
+spidev_backend_scan_block (gpointer priv, int16_t *frames, guint n_scans)
+{
+    SpidevBackend *be = priv;
+    guint scan;
+
+    g_assert (n_scans <= be->scans_per_message);
+    if (!spidev_backend_submit (be, n_scans))
+        return FALSE;
+
+    /* sort the results into their channels */
+    for (scan = 0; scan < n_scans; scan++)
+        gld_max1133_program_demux (&be->prog,
+                                   &be->rxbuf[scan * 2 * be->prog.n_ops],
+                                   &frames[scan * be->channel_count]);
+
+    return TRUE;
+}
+
+/**
+ * spidev_backend_scan:
+ */
+static gboolean
+spidev_backend_scan (gpointer priv, int16_t *frame)
+{
+    return spidev_backend_scan_block (priv, frame, 1);
+}
+
+const GldAdcBackend gld_adc_backend_spidev = {
+    .name = "spidev",
+    .description = "MAX1133 ADCs on the Galdur board via Linux spidev, arguments: [DEVICE0,DEVICE1][,speed=HZ][,delay=USEC][,block=N]",
+    .caps = GLD_ADC_BACKEND_CAP_HARDWARE | GLD_ADC_BACKEND_CAP_BATCHED,
+
+    .open = spidev_backend_open,
+    .close = spidev_backend_close,
+    .start = spidev_backend_start,
+    .stop = spidev_backend_stop,
+    .scan = spidev_backend_scan,
+
+    .get_block_size = spidev_backend_get_block_size,
+    .scan_block = spidev_backend_scan_block
+};
@@ -0,0 +1,530 @@
+/*
+ * Copyright (C) 2016-2017 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ADC backend generating synthetic local field potentials, so the whole
+ * acquisition and processing chain can run (and be benchmarked) on any
+ * Linux machine, with known events to test the detectors against.
+ *
+ * The signal of every channel is pink noise plus a theta oscillation, with
+ * sharp wave ripple bursts on all channels and spikes on single channels
+ * injected at random times. Everything is derived from the seed, so the
+ * same arguments always produce exactly the same data and events.
+ * Samples are generated in blocks, with all channels of a scan computed
+ * side by side so the compiler can vectorize the inner loops.
+ */
+
+#include "gld-adc-backend.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SYN_LANES       16      /* channels computed per scan, always all of them */
+#define SYN_BLOCK_SIZE  256     /* scans generated at once */
+#define SYN_MAX_SPIKES  8       /* spikes that can overlap */
+#define SYN_SPIKE_MS    2.0
+
+typedef struct {
+    guint64 start;      /* sample index the spike starts at */
+    guint channel;
+} SynSpike;
+
+typedef struct {
+    const gchar *event;
+    guint64 start;      /* sample index the event starts at */
+    guint64 peak;
+    guint64 end;
+    gint channel;       /* -1 for events on all channels */
+} SynTruthRow;
+
+typedef struct {
+    /* parameters */
+    guint64 seed;
+    double theta_hz;
+    double theta_amp;
+    double noise_amp;
+    double ripple_rate;     /* ripples per second */
+    double ripple_hz;
+    double ripple_amp;
+    double ripple_ms;
+    double spike_rate;      /* spikes per second, over all channels */
+    double spike_amp;
+    gchar *truth_fname;
+
+    /* generator state */
+    guint channel_count;
+    guint frequency;
+    guint64 index;          /* index of the next generated scan */
+    guint64 rng;            /* scalar xorshift64 state, for event scheduling */
+    guint32 lane_rng[SYN_LANES] __attribute__ ((aligned (64)));
+    float pink[3][SYN_LANES] __attribute__ ((aligned (64)));
+    float theta_re[SYN_LANES] __attribute__ ((aligned (64)));
+    float theta_im[SYN_LANES] __attribute__ ((aligned (64)));
+    float gain[SYN_LANES] __attribute__ ((aligned (64)));
+    float theta_cos, theta_sin;
+
+    guint64 ripple_start;   /* start of the current or next ripple */
+    guint64 ripple_len;
+    double ripple_re, ripple_im, ripple_cos, ripple_sin;
+
+    guint64 next_spike;
+    SynSpike spikes[SYN_MAX_SPIKES];
+    guint n_spikes;
+    float *spike_template;
+    guint spike_len;
+
+    /* generated scans, handed out one by one */
+    int16_t block[SYN_BLOCK_SIZE][SYN_LANES] __attribute__ ((aligned (64)));
+    guint block_pos;
+
+    FILE *truth;
+    GArray *truth_pending;  /* rows of generated events whose first scan was not handed out yet */
+    guint truth_written;    /* rows of truth_pending already in the file */
+} SyntheticBackend;
+
+/**
+ * synthetic_backend_close:
+ */
+static void
+synthetic_backend_close (gpointer priv)
+{
+    SyntheticBackend *be = priv;
+
+    if (be->truth != NULL)
+        fclose (be->truth);
+    if (be->truth_pending != NULL)
+        g_array_free (be->truth_pending, TRUE);
+    g_free (be->spike_template);
+    g_free (be->truth_fname);
+    g_free (be);
+}
+
+/**
+ * synthetic_backend_open:
+ * @args: Comma-separated KEY=VALUE pairs, see the backend description.
+ *
+ * Amplitudes are in ADC units, "truth" names a CSV file that receives
+ * the sample index of every injected event.
+ */
+static gpointer
+synthetic_backend_open (const gchar *args)
+{
+    SyntheticBackend *be;
+    gchar **parts = NULL;
+    guint i;
+    struct {
+        const gchar *key;
+        double *value;
+    } params[10];
+
+    be = g_new0 (SyntheticBackend, 1);
+    be->seed = 1;
+    be->theta_hz = 8;
+    be->theta_amp = 1000;
+    be->noise_amp = 300;
+    be->ripple_rate = 0.5;
+    be->ripple_hz = 180;
+    be->ripple_amp = 800;
+    be->ripple_ms = 60;
+    be->spike_rate = 5;
+    be->spike_amp = 1500;
+
+    params[0].key = "theta";        params[0].value = &be->theta_hz;
+    params[1].key = "theta_amp";    params[1].value = &be->theta_amp;
+    params[2].key = "noise_amp";    params[2].value = &be->noise_amp;
+    params[3].key = "ripple_rate";  params[3].value = &be->ripple_rate;
+    params[4].key = "ripple";       params[4].value = &be->ripple_hz;
+    params[5].key = "ripple_amp";   params[5].value = &be->ripple_amp;
+    params[6].key = "ripple_ms";    params[6].value = &be->ripple_ms;
+    params[7].key = "spike_rate";   params[7].value = &be->spike_rate;
+    params[8].key = "spike_amp";    params[8].value = &be->spike_amp;
+    params[9].key = NULL;
+
+    if (args != NULL)
+        parts = g_strsplit (args, ",", -1);
+    for (i = 0; parts != NULL && parts[i] != NULL; i++) {
+        gchar *value = strchr (parts[i], '=');
+        guint j;
+
+        if (value == NULL)
+            goto fail;
+        *value++ = '\0';
+
+        if (g_strcmp0 (parts[i], "seed") == 0) {
+            be->seed = g_ascii_strtoull (value, NULL, 10);
+            continue;
+        }
+        if (g_strcmp0 (parts[i], "truth") == 0) {
+            g_free (be->truth_fname);
+            be->truth_fname = g_strdup (value);
+            continue;
+        }
+        for (j = 0; params[j].key != NULL; j++) {
+            if (g_strcmp0 (parts[i], params[j].key) == 0)
+                break;
+        }
+        if (params[j].key == NULL)
+            goto fail;
+        *params[j].value = g_ascii_strtod (value, NULL);
+        if (*params[j].value < 0)
+            goto fail;
+    }
+    g_strfreev (parts);
+
+    if (be->ripple_ms <= 0)
+        be->ripple_ms = 1;
+
+    /* xorshift must never be seeded with zero */
+    if (be->seed == 0)
+        be->seed = 1;
+
+    return be;
+
+fail:
+    g_critical ("Invalid synthetic backend argument: %s", parts[i]);
+    g_strfreev (parts);
+    synthetic_backend_close (be);
+    return NULL;
+}
+
+/**
+ * synthetic_backend_next_random:
+ */
+static inline guint64
+synthetic_backend_next_random (SyntheticBackend *be)
+{
+    guint64 x = be->rng;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    be->rng = x;
+
+    return x;
+}
+
+/**
+ * synthetic_backend_next_interval:
+ *
+ * Returns: A random, exponentially distributed number of samples until
+ * the next event of a Poisson process with @rate events per second,
+ * or %G_MAXUINT64 if @rate is zero.
+ */
+static guint64
+synthetic_backend_next_interval (SyntheticBackend *be, double rate)
+{
+    double u;
+
+    if (rate <= 0)
+        return G_MAXUINT64;
+
+    /* uniform in (0, 1] */
+    u = ((synthetic_backend_next_random (be) >> 11) + 1) * (1.0 / 9007199254740992.0);
+    return (guint64) (-log (u) / rate * be->frequency) + 1;
+}
+
+/**
+ * synthetic_backend_schedule_ripple:
+ *
+ * Schedule the next ripple after the current one ended.
+ */
+static void
+synthetic_backend_schedule_ripple (SyntheticBackend *be, guint64 after)
+{
+    const guint64 interval = synthetic_backend_next_interval (be, be->ripple_rate);
+
+    be->ripple_start = interval == G_MAXUINT64? G_MAXUINT64 : after + interval;
+    be->ripple_re = 0;
+    be->ripple_im = 1;
+}
+
+/**
+ * synthetic_backend_start:
+ */
+static gboolean
+synthetic_backend_start (gpointer priv, GldAdc *daq)
+{
+    SyntheticBackend *be = priv;
+    guint i;
+
+    be->frequency = MAX (daq->acq_frequency, 1);
+    be->channel_count = daq->channel_count;
+    be->index = 0;
+    be->block_pos = SYN_BLOCK_SIZE;
+    be->rng = be->seed;
+
+    /* every channel sees the same sources with a slightly different gain,
+     * and a theta phase that shifts along the probe */
+    for (i = 0; i < SYN_LANES; i++) {
+        const guint phys = i < daq->channel_count? daq->scan_list[i] : i;
+
+        be->lane_rng[i] = (guint32) (synthetic_backend_next_random (be) >> 32) | 1;
+        be->pink[0][i] = be->pink[1][i] = be->pink[2][i] = 0;
+        be->gain[i] = 1.0f - 0.03f * phys;
+        be->theta_re[i] = cosf (0.1f * phys);
+        be->theta_im[i] = sinf (0.1f * phys);
+    }
+    be->theta_cos = cos (2 * M_PI * be->theta_hz / be->frequency);
+    be->theta_sin = sin (2 * M_PI * be->theta_hz / be->frequency);
+
+    be->ripple_len = MAX ((guint64) (be->ripple_ms * be->frequency / 1000), 1);
+    be->ripple_cos = cos (2 * M_PI * be->ripple_hz / be->frequency);
+    be->ripple_sin = sin (2 * M_PI * be->ripple_hz / be->frequency);
+    synthetic_backend_schedule_ripple (be, 0);
+
+    /* biphasic extracellular spike waveform */
+    g_free (be->spike_template);
+    be->spike_len = MAX ((guint) (SYN_SPIKE_MS * be->frequency / 1000), 1);
+    be->spike_template = g_new (float, be->spike_len);
+    for (i = 0; i < be->spike_len; i++) {
+        const double t_ms = 1000.0 * i / be->frequency;
+        be->spike_template[i] = -exp (-pow (t_ms - 0.3, 2) / (2 * 0.1 * 0.1))
+                                + 0.4 * exp (-pow (t_ms - 0.7, 2) / (2 * 0.25 * 0.25));
+    }
+    be->n_spikes = 0;
+    be->next_spike = synthetic_backend_next_interval (be, be->spike_rate);
+
+    if (be->truth_fname != NULL) {
+        if (be->truth != NULL)
+            fclose (be->truth);
+        be->truth = fopen (be->truth_fname, "w");
+        if (be->truth == NULL) {
+            g_critical ("Unable to open %s: %s", be->truth_fname, g_strerror (errno));
+            return FALSE;
+        }
+        fprintf (be->truth, "event,start_index,peak_index,end_index,channel\n");
+
+        if (be->truth_pending == NULL)
+            be->truth_pending = g_array_new (FALSE, FALSE, sizeof(SynTruthRow));
+        g_array_set_size (be->truth_pending, 0);
+        be->truth_written = 0;
+    }
+
+    return TRUE;
+}
+
+/**
+ * synthetic_backend_stop:
+ */
+static void
+synthetic_backend_stop (gpointer priv)
+{
+    SyntheticBackend *be = priv;
+
+    /* events that were generated ahead but never delivered are dropped */
+    if (be->truth != NULL) {
+        fclose (be->truth);
+        be->truth = NULL;
+    }
+}
+
+/**
+ * synthetic_backend_log_event:
+ *
+ * Queue a truth row, it is written once the first scan of the event is
+ * handed out, so the file never lists events the reader did not get.
+ */
+static void
+synthetic_backend_log_event (SyntheticBackend *be, const gchar *event,
+                             guint64 start, guint64 peak, guint64 end, gint channel)
+{
+    SynTruthRow row = { event, start, peak, end, channel };
+
+    if (be->truth == NULL)
+        return;
+    g_array_append_val (be->truth_pending, row);
+}
+
+/**
+ * synthetic_backend_write_truth:
+ * @index: Sample index of the scan that was just handed out
+ *
+ * Write the truth rows of all events starting at or before @index.
+ */
+static inline void
+synthetic_backend_write_truth (SyntheticBackend *be, guint64 index)
+{
+    while (be->truth_written < be->truth_pending->len) {
+        const SynTruthRow *row = &g_array_index (be->truth_pending, SynTruthRow, be->truth_written);
+
+        if (row->start > index)
+            return;
+        fprintf (be->truth, "%s,%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT ",%i\n",
+                 row->event, row->start, row->peak, row->end, row->channel);
+        be->truth_written++;
+    }
+
+    g_array_set_size (be->truth_pending, 0);
+    be->truth_written = 0;
+}
+
+/**
+ * synthetic_backend_start_events:
+ *
+ * Start all events scheduled for scan @index, and queue their truth rows.
+ */
+static void
+synthetic_backend_start_events (SyntheticBackend *be, guint64 index)
+{
+    if (index == be->ripple_start)
+        synthetic_backend_log_event (be, "ripple", index, index + be->ripple_len / 2,
+                                     index + be->ripple_len - 1, -1);
+
+    while (index == be->next_spike) {
+        SynSpike *spike;
+
+        if (be->n_spikes == SYN_MAX_SPIKES) {
+            be->next_spike++;
+            break;
+        }
+        spike = &be->spikes[be->n_spikes++];
+        spike->start = index;
+        spike->channel = synthetic_backend_next_random (be) % be->channel_count;
+        synthetic_backend_log_event (be, "spike", index, index + (guint64) (0.3 * be->frequency / 1000),
+                                     index + be->spike_len - 1, spike->channel);
+        be->next_spike = index + MIN (synthetic_backend_next_interval (be, be->spike_rate),
+                                      G_MAXUINT64 - index);
+    }
+}
+
+/**
+ * synthetic_backend_generate_block:
+ *
+ * Generate the next %SYN_BLOCK_SIZE scans. The per-scan work on all
+ * channels is written as loops over %SYN_LANES independent values,
+ * so it compiles to SIMD code.
+ */
+static void
+synthetic_backend_generate_block (SyntheticBackend *be)
+{
+    const float noise_amp = be->noise_amp;
+    const float theta_amp = be->theta_amp;
+    const float tc = be->theta_cos, ts = be->theta_sin;
+    float out[SYN_LANES] __attribute__ ((aligned (64)));
+    guint f, c, i;
+
+    for (f = 0; f < SYN_BLOCK_SIZE; f++) {
+        const guint64 index = be->index + f;
+        float ripple = 0;
+
+        synthetic_backend_start_events (be, index);
+
+        /* a ripple is a Gaussian-windowed oscillation, on all channels */
+        if (index >= be->ripple_start) {
+            const double t = (double) (index - be->ripple_start) - be->ripple_len / 2.0;
+            const double sigma = be->ripple_len / 6.0;
+            const double re = be->ripple_re;
+
+            ripple = be->ripple_amp * exp (-(t * t) / (2 * sigma * sigma)) * be->ripple_im;
+            be->ripple_re = re * be->ripple_cos - be->ripple_im * be->ripple_sin;
+            be->ripple_im = re * be->ripple_sin + be->ripple_im * be->ripple_cos;
+            if (index + 1 == be->ripple_start + be->ripple_len)
+                synthetic_backend_schedule_ripple (be, index + 1);
+        }
+
+        for (c = 0; c < SYN_LANES; c++) {
+            guint32 x = be->lane_rng[c];
+            float white, re;
+
+            /* xorshift32 white noise in [-1, 1) */
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            be->lane_rng[c] = x;
+            white = (float) (int32_t) x * (1.0f / 2147483648.0f);
+
+            /* pink noise, Paul Kellet's economy filter */
+            be->pink[0][c] = 0.99765f * be->pink[0][c] + white * 0.0990460f;
+            be->pink[1][c] = 0.96300f * be->pink[1][c] + white * 0.2965164f;
+            be->pink[2][c] = 0.57000f * be->pink[2][c] + white * 1.0526913f;
+
+            /* theta oscillation, by rotating a phasor */
+            re = be->theta_re[c];
+            be->theta_re[c] = re * tc - be->theta_im[c] * ts;
+            be->theta_im[c] = re * ts + be->theta_im[c] * tc;
+
+            out[c] = be->gain[c] * (theta_amp * be->theta_im[c] + ripple) +
+                     noise_amp * (be->pink[0][c] + be->pink[1][c] + be->pink[2][c] + 0.1848f * white);
+        }
+
+        /* add spikes, and drop the ones that ended */
+        for (i = 0; i < be->n_spikes; ) {
+            SynSpike *spike = &be->spikes[i];
+            const guint64 t = index - spike->start;
+
+            out[spike->channel] += be->spike_amp * be->spike_template[t];
+            if (t + 1 == be->spike_len)
+                be->spikes[i] = be->spikes[--be->n_spikes];
+            else
+                i++;
+        }
+
+        for (c = 0; c < SYN_LANES; c++)
+            be->block[f][c] = (int16_t) CLAMP (lrintf (out[c]), INT16_MIN, INT16_MAX);
+    }
+
+    /* keep the phasors on the unit circle despite rounding errors */
+    for (c = 0; c < SYN_LANES; c++) {
+        const float norm = 1.0f / sqrtf (be->theta_re[c] * be->theta_re[c] + be->theta_im[c] * be->theta_im[c]);
+        be->theta_re[c] *= norm;
+        be->theta_im[c] *= norm;
+    }
+    if (be->ripple_re != 0 || be->ripple_im != 0) {
+        const double norm = 1.0 / sqrt (be->ripple_re * be->ripple_re + be->ripple_im * be->ripple_im);
+        be->ripple_re *= norm;
+        be->ripple_im *= norm;
+    }
+
+    be->index += SYN_BLOCK_SIZE;
+    be->block_pos = 0;
+}
+
+/**
+ * synthetic_backend_scan:
+ */
+static gboolean
+synthetic_backend_scan (gpointer priv, int16_t *frame)
+{
+    SyntheticBackend *be = priv;
+
+    if (be->block_pos == SYN_BLOCK_SIZE)
+        synthetic_backend_generate_block (be);
+
+    memcpy (frame, be->block[be->block_pos++], be->channel_count * sizeof(int16_t));
+    if (be->truth != NULL && be->truth_pending->len > 0)
+        synthetic_backend_write_truth (be, be->index - SYN_BLOCK_SIZE + be->block_pos - 1);
+
+    return TRUE;
+}
+
+const GldAdcBackend gld_adc_backend_synthetic = {
+    .name = "synthetic",
+    .description = "Generated LFP with theta, ripples and spikes, arguments: [seed=N][,theta=HZ][,theta_amp=A]"
+                   "[,noise_amp=A][,ripple_rate=PER_SEC][,ripple=HZ][,ripple_amp=A][,ripple_ms=MS]"
+                   "[,spike_rate=PER_SEC][,spike_amp=A][,truth=CSV_FILE]",
+    .caps = GLD_ADC_BACKEND_CAP_NONE,
+
+    .open = synthetic_backend_open,
+    .close = synthetic_backend_close,
+    .start = synthetic_backend_start,
+    .stop = synthetic_backend_stop,
+    .scan = synthetic_backend_scan
+};
@@ -24,65 +24,173 @@
 #include <errno.h>
 #include <unistd.h>
 #include <stdlib.h>
-#include <linux/spi/spidev.h>
-#include <linux/types.h>
-#include <sys/ioctl.h>
-#include <linux/ioctl.h>
-#include <fcntl.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
-#include "bcm2835.h"
+#include "gld-adc-backend.h"
 #include "gld-utils.h"
 
-#define BIT(x) (1UL << x)
+#define NSEC_PER_SEC 1000000000ULL
 
-#define MAX1133_START       BIT(7) /* start byte */
-#define MAX1133_UNIPOLAR    BIT(6) /* unipolar mode if set, bipolar if not set */
-#define MAX1133_INT_CLOCK   BIT(5) /* use internat clock if set, use external if not set */
+/* maximum number of scans a backend can acquire at once */
+#define GLD_ADC_MAX_SCAN_BLOCK 512
 
-#define MAX1133_M1       BIT(4)
-#define MAX1133_M0       BIT(3)
-
-#define MAX1133_P2       BIT(2)
-#define MAX1133_P1       BIT(1)
-#define MAX1133_P0       BIT(0)
+static void*    daq_thread_main (void *daq_ptr);
 
-static uint8_t max1133_mux_channel_map[8] = {
-    0,
-    MAX1133_P0,
-    MAX1133_P1,
-    MAX1133_P0 | MAX1133_P1,
-    MAX1133_P2,
-    MAX1133_P0 | MAX1133_P2,
-    MAX1133_P1 | MAX1133_P2,
-    MAX1133_P0 | MAX1133_P1 | MAX1133_P2
-};
+typedef struct _ScanTimes ScanTimes;
+static void     scan_times_reset (ScanTimes *times);
 
-static void*    daq_thread_main (void *daq_ptr);
+/* size of a cache line on the Cortex-A72 (and most x86 CPUs) */
+#define GLD_CACHE_LINE_SIZE 64
 
 typedef struct _DataBuffer DataBuffer;
 
+/**
+ * DataBuffer:
+ *
+ * Lock-free single-producer/single-consumer ring buffer for one ADC channel,
+ * or for interleaved frames of all channels.
+ * The DAQ thread is the only writer of @head, the reading thread the only
+ * writer of @tail. Both positions count up monotonically and are masked with
+ * @mask to find the slot in @buffer, which is why @capacity is always a power
+ * of two. Every item in the buffer consists of @stride values.
+ * If the consumer does not keep up, the producer overwrites the oldest unread
+ * data and increments @overruns. The consumer notices that it was lapped and
+ * skips forward to the oldest sample that is still valid. The slot at @head
+ * is written before @head is advanced, so the oldest of the last @capacity
+ * items may be in the middle of being overwritten, and at most
+ * @capacity - 1 items can be read safely.
+ * A consumer waiting for data publishes the write position it needs in
+ * @wake_target and sleeps on the @wake_seq futex, which the producer bumps
+ * once that position was reached.
+ */
 struct _DataBuffer
 {
     int16_t *buffer;
-    size_t capacity; /* maximum number of items in the buffer */
+    size_t capacity; /* maximum number of items in the buffer, power of two */
+    size_t mask;     /* capacity - 1 */
+    guint stride;    /* number of values per item */
+
+    /* producer side */
+    _Atomic size_t head __attribute__ ((aligned (GLD_CACHE_LINE_SIZE))); /* write position */
+    size_t tail_cache; /* last read position seen by the producer */
+    _Atomic size_t overruns; /* number of samples overwritten before they were read */
 
-    size_t wr_pos;   /* write position */
-    size_t rd_pos;   /* read position */
+    /* consumer side */
+    _Atomic size_t tail __attribute__ ((aligned (GLD_CACHE_LINE_SIZE))); /* read position */
 
-    size_t len;      /* length of the data */
+    /* consumer wakeup */
+    _Atomic size_t wake_target __attribute__ ((aligned (GLD_CACHE_LINE_SIZE))); /* write position to wake at, 0 if nobody waits */
+    _Atomic uint32_t wake_seq; /* futex word */
 };
 
+/**
+ * gld_round_up_pow2:
+ */
+static size_t
+gld_round_up_pow2 (size_t value)
+{
+    size_t res = 1;
+    while (res < value)
+        res <<= 1;
+    return res;
+}
+
+/* maximum number of consecutive scans that share one timestamp entry */
+#define SCAN_TIME_BLOCK_SIZE 32
+
+/**
+ * ScanTimeEntry:
+ *
+ * Acquisition time of the first scan of a run of evenly spaced scans.
+ * A run starts every %SCAN_TIME_BLOCK_SIZE scans, and additionally at the
+ * first scan after missed grid points were skipped, so interpolating
+ * within a run never crosses a gap in the sample clock.
+ * @sequence is the number of the entry and tells readers whether it is
+ * the one they are looking for, or was overwritten.
+ */
+typedef struct {
+    _Atomic size_t sequence;
+    _Atomic size_t position;  /* buffer position of the first scan */
+    _Atomic uint64_t index;   /* 64-bit sample index of the first scan */
+    _Atomic int64_t time_ns;  /* CLOCK_MONOTONIC time the scan was started */
+} ScanTimeEntry;
+
+/**
+ * ScanTimeRun:
+ *
+ * Consistent copy of a #ScanTimeEntry taken by a reader.
+ */
+typedef struct {
+    size_t position;
+    guint64 index;
+    int64_t time_ns;
+} ScanTimeRun;
+
+/**
+ * ScanTimes:
+ *
+ * Ring of scan timestamps, shared by all data buffers of a #GldAdc, since
+ * the buffer position of a sample always equals the number of its scan.
+ * Entries are appended in order by the DAQ thread only, and validated
+ * seqlock-style by readers.
+ */
+struct _ScanTimes
+{
+    ScanTimeEntry *entries;
+    size_t mask;
+
+    _Atomic guint frequency; /* nominal scan rate, used to interpolate within a run */
+    _Atomic size_t count;    /* number of entries written so far */
+
+    /* producer side */
+    size_t position;   /* buffer position of the next scan */
+    guint64 index;     /* sample index of the next scan */
+    gboolean new_run;  /* grid points were skipped, the next scan starts a new run */
+};
+
+#define SCAN_TIME_SEQUENCE_INVALID ((size_t) -1)
+
+/**
+ * AdcStats:
+ *
+ * Acquisition health counters. Only ever written by the DAQ thread
+ * (or while it is idle), so plain relaxed loads and stores suffice,
+ * readers may see a slightly inconsistent snapshot.
+ */
+struct _AdcStats
+{
+    _Atomic uint64_t samples_acquired;
+    _Atomic uint64_t samples_dropped;
+    _Atomic uint64_t deadline_misses;
+
+    _Atomic int64_t scan_duration_max_ns;
+    _Atomic int64_t scan_interval_max_ns;
+    _Atomic uint64_t scan_duration_hist[GLD_ADC_HISTOGRAM_BUCKETS];
+    _Atomic uint64_t scan_interval_hist[GLD_ADC_HISTOGRAM_BUCKETS];
+};
+typedef struct _AdcStats AdcStats;
+
+/* increment a counter that only the DAQ thread writes to */
+#define ADC_STATS_ADD(counter, n) \
+    atomic_store_explicit (&(counter), atomic_load_explicit (&(counter), memory_order_relaxed) + (n), memory_order_relaxed)
+
 /**
  * data_buffer_init:
  *
  * Initialize a data ring buffer.
  */
 static void
-data_buffer_init (DataBuffer *dbuf, size_t capacity)
+data_buffer_init (DataBuffer *dbuf, size_t capacity, guint stride)
 {
     g_assert (capacity > 0);
+    g_assert (stride > 0);
 
-    dbuf->buffer = malloc (capacity * sizeof(int16_t));
+    capacity = gld_round_up_pow2 (capacity);
+    dbuf->buffer = malloc (capacity * stride * sizeof(int16_t));
     if (dbuf->buffer == NULL) {
         g_printerr ("Could not allocate memory for data buffer.");
         exit (8);
@@ -90,8 +198,14 @@ data_buffer_init (DataBuffer *dbuf, size_t capacity)
     }
 
     dbuf->capacity = capacity;
-    dbuf->wr_pos = 0;
-    dbuf->rd_pos = 0;
+    dbuf->mask = capacity - 1;
+    dbuf->stride = stride;
+    dbuf->tail_cache = 0;
+    atomic_init (&dbuf->head, 0);
+    atomic_init (&dbuf->tail, 0);
+    atomic_init (&dbuf->overruns, 0);
+    atomic_init (&dbuf->wake_target, 0);
+    atomic_init (&dbuf->wake_seq, 0);
 }
 
 /**
@@ -100,12 +214,19 @@ data_buffer_init (DataBuffer *dbuf, size_t capacity)
  * Initialize a data ring buffer.
  */
 static DataBuffer*
-data_buffer_new (size_t capacity)
+data_buffer_new (size_t capacity, guint stride)
 {
     DataBuffer *dbuf;
 
-    dbuf = g_slice_new0 (DataBuffer);
-    data_buffer_init (dbuf, capacity);
+    /* keep head and tail on their own cache lines */
+    dbuf = aligned_alloc (GLD_CACHE_LINE_SIZE, sizeof(DataBuffer));
+    if (dbuf == NULL) {
+        g_printerr ("Could not allocate memory for data buffer.");
+        exit (8);
+        return NULL;
+    }
+    memset (dbuf, 0, sizeof(DataBuffer));
+    data_buffer_init (dbuf, capacity, stride);
 
     return dbuf;
 }
@@ -116,19 +237,22 @@ data_buffer_new (size_t capacity)
 static void
 data_buffer_free (DataBuffer *dbuf)
 {
-    g_free (dbuf->buffer);
-    g_slice_free (DataBuffer, dbuf);
+    free (dbuf->buffer);
+    free (dbuf);
 }
 
 /**
  * data_buffer_reset:
+ *
+ * Must only be called while the DAQ thread is not writing.
  */
 static void
 data_buffer_reset (DataBuffer *dbuf)
 {
-    dbuf->wr_pos = 0;
-    dbuf->rd_pos = 0;
-    dbuf->len = 0;
+    dbuf->tail_cache = 0;
+    atomic_store_explicit (&dbuf->tail, 0, memory_order_relaxed);
+    atomic_store_explicit (&dbuf->overruns, 0, memory_order_relaxed);
+    atomic_store_explicit (&dbuf->head, 0, memory_order_release);
 }
 
 /**
@@ -137,60 +261,938 @@ data_buffer_reset (DataBuffer *dbuf)
 LBS_UNUSED static size_t
 data_buffer_get_size (DataBuffer *dbuf)
 {
-    return dbuf->wr_pos;
+    return atomic_load_explicit (&dbuf->head, memory_order_acquire);
 }
 
 /**
- * data_buffer_push:
+ * data_buffer_wake_readers:
+ *
+ * Wake up all threads waiting for data in this buffer.
  */
 static void
-data_buffer_push_data (DataBuffer *dbuf, const int16_t value)
+data_buffer_wake_readers (DataBuffer *dbuf)
+{
+    atomic_fetch_add_explicit (&dbuf->wake_seq, 1, memory_order_release);
+    syscall (SYS_futex, &dbuf->wake_seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/**
+ * data_buffer_push:
+ *
+ * Add a new item of @stride values to the buffer. Only called from the DAQ thread.
+ */
+static inline void
+data_buffer_push_data (DataBuffer *dbuf, const int16_t *item)
+{
+    size_t target;
+    guint i;
+    const size_t head = atomic_load_explicit (&dbuf->head, memory_order_relaxed);
+
+    if (G_UNLIKELY (head - dbuf->tail_cache >= dbuf->capacity)) {
+        /* only look at the consumer position if we might be overwriting unread data */
+        dbuf->tail_cache = atomic_load_explicit (&dbuf->tail, memory_order_acquire);
+        if (head - dbuf->tail_cache >= dbuf->capacity)
+            atomic_fetch_add_explicit (&dbuf->overruns, 1, memory_order_relaxed);
+    }
+
+    for (i = 0; i < dbuf->stride; i++)
+        dbuf->buffer[(head & dbuf->mask) * dbuf->stride + i] = item[i];
+    atomic_store_explicit (&dbuf->head, head + 1, memory_order_release);
+
+    /* pairs with the fence in data_buffer_wait_for, so either we see the
+     * wakeup target or the waiting reader sees our new write position */
+    atomic_thread_fence (memory_order_seq_cst);
+    target = atomic_load_explicit (&dbuf->wake_target, memory_order_relaxed);
+    if (target != 0 && head + 1 >= target) {
+        /* only wake once, the reader may have set a new target already */
+        if (atomic_compare_exchange_strong_explicit (&dbuf->wake_target, &target, 0,
+                                                     memory_order_relaxed,
+                                                     memory_order_relaxed))
+            data_buffer_wake_readers (dbuf);
+    }
+}
+
+/**
+ * data_buffer_wait_for:
+ * @running: %FALSE once no more data will be added
+ * @n: Number of unread items to wait for
+ * @timeout_usec: Maximum time to wait in microseconds, or -1 to wait forever
+ *
+ * Block until at least @n unread items are in the buffer.
+ *
+ * Returns: %TRUE if the data is available, %FALSE on timeout or if acquisition stopped.
+ */
+static gboolean
+data_buffer_wait_for (DataBuffer *dbuf, volatile gboolean *running, size_t n, gint64 timeout_usec)
 {
-    static pthread_mutex_t mutex;
+    gint64 deadline = 0;
+
+    /* we can never have more than the buffer capacity available */
+    n = MIN (MAX (n, 1), dbuf->capacity - 1);
+    if (timeout_usec >= 0)
+        deadline = g_get_monotonic_time () + timeout_usec;
+
+    while (TRUE) {
+        const uint32_t seq = atomic_load_explicit (&dbuf->wake_seq, memory_order_acquire);
+        const size_t tail = atomic_load_explicit (&dbuf->tail, memory_order_relaxed);
+        struct timespec timeout;
+        struct timespec *timeout_ptr = NULL;
+        size_t head;
+
+        atomic_store_explicit (&dbuf->wake_target, tail + n, memory_order_relaxed);
+        atomic_thread_fence (memory_order_seq_cst);
+        head = atomic_load_explicit (&dbuf->head, memory_order_relaxed);
+        if (head - tail >= n) {
+            atomic_store_explicit (&dbuf->wake_target, 0, memory_order_relaxed);
+            return TRUE;
+        }
+
+        if (!(*running)) {
+            atomic_store_explicit (&dbuf->wake_target, 0, memory_order_relaxed);
+            return FALSE;
+        }
+
+        if (timeout_usec >= 0) {
+            const gint64 remaining = deadline - g_get_monotonic_time ();
+            if (remaining <= 0) {
+                atomic_store_explicit (&dbuf->wake_target, 0, memory_order_relaxed);
+                return FALSE;
+            }
+            timeout.tv_sec = remaining / G_USEC_PER_SEC;
+            timeout.tv_nsec = (remaining % G_USEC_PER_SEC) * 1000;
+            timeout_ptr = &timeout;
+        }
 
-    if (dbuf->wr_pos >= dbuf->capacity) {
-        /* we reached the end of our buffer slice, start from the beginning */
-        dbuf->wr_pos = 0;
+        /* sleep until the producer bumps the sequence number, returns immediately if it already did */
+        syscall (SYS_futex, &dbuf->wake_seq, FUTEX_WAIT_PRIVATE, seq, timeout_ptr, NULL, 0);
     }
+}
 
-    if ((dbuf->wr_pos == dbuf->rd_pos) && (dbuf->len == dbuf->capacity - 1)) {
-        g_warning ("Acquiring data faster than we use it, skipped %zu entries.", dbuf->capacity);
-        pthread_mutex_lock (&mutex);
-        data_buffer_reset (dbuf);
-        pthread_mutex_unlock (&mutex);
+/**
+ * data_buffer_pull_begin:
+ * @dbuf: the buffer
+ * @max_len: maximum number of items to read
+ * @tail_out: position of the first readable item
+ *
+ * Determine how much data can be read, skipping any data that
+ * was overwritten by the producer.
+ *
+ * Returns: the number of items available for reading, at most @max_len
+ */
+static inline size_t
+data_buffer_pull_begin (DataBuffer *dbuf, size_t max_len, size_t *tail_out)
+{
+    size_t tail = atomic_load_explicit (&dbuf->tail, memory_order_relaxed);
+    const size_t head = atomic_load_explicit (&dbuf->head, memory_order_acquire);
+
+    /* we were lapped by the producer, jump to the oldest valid sample,
+     * the slot of head - capacity may be getting overwritten right now */
+    if (head - tail >= dbuf->capacity)
+        tail = head - dbuf->capacity + 1;
+
+    *tail_out = tail;
+    return MIN (head - tail, max_len);
+}
+
+/**
+ * data_buffer_pull_end:
+ *
+ * Commit a read of @len items starting at @tail.
+ *
+ * Returns: %FALSE if the producer overwrote parts of the data while we were reading it.
+ */
+static inline gboolean
+data_buffer_pull_end (DataBuffer *dbuf, size_t tail, size_t len)
+{
+    size_t head;
+
+    /* make sure all reads of the data happened before we look at the write position again */
+    atomic_thread_fence (memory_order_acquire);
+    head = atomic_load_explicit (&dbuf->head, memory_order_relaxed);
+    if (G_UNLIKELY (head - tail >= dbuf->capacity)) {
+        /* data was overwritten while copying, caller needs to retry */
+        atomic_store_explicit (&dbuf->tail, head - dbuf->capacity + 1, memory_order_release);
+        return FALSE;
     }
 
-    dbuf->buffer[dbuf->wr_pos] = value;
-    dbuf->wr_pos++;
-    dbuf->len++;
+    atomic_store_explicit (&dbuf->tail, tail + len, memory_order_release);
+    return TRUE;
+}
+
+/**
+ * data_buffer_seek_latest:
+ *
+ * Move the read position to the oldest of the @len most recent items.
+ * At least @len items must have been written to the buffer.
+ */
+static inline void
+data_buffer_seek_latest (DataBuffer *dbuf, size_t len)
+{
+    const size_t head = atomic_load_explicit (&dbuf->head, memory_order_acquire);
+    atomic_store_explicit (&dbuf->tail, head - len, memory_order_release);
+}
+
+/**
+ * data_buffer_wait_for_latest:
+ *
+ * Block until @hop_len items arrived since the last read, and at least
+ * @len items were written in total, then seek to the newest @len items.
+ *
+ * Returns: %FALSE if acquisition stopped before enough data was available.
+ */
+static gboolean
+data_buffer_wait_for_latest (DataBuffer *dbuf, volatile gboolean *running, size_t len, size_t hop_len)
+{
+    const size_t tail = atomic_load_explicit (&dbuf->tail, memory_order_relaxed);
+    size_t n = MAX (hop_len, 1);
+
+    /* the first window needs to be filled completely */
+    if (tail < len)
+        n = MAX (n, len - tail);
+
+    if (!data_buffer_wait_for (dbuf, running, n, -1))
+        return FALSE;
+
+    data_buffer_seek_latest (dbuf, len);
+    return TRUE;
+}
+
+/**
+ * data_buffer_peek:
+ *
+ * Expose up to @max_len readable items as two contiguous spans
+ * of the ring memory, without copying anything.
+ *
+ * Returns: the number of items available in both spans
+ */
+static size_t
+data_buffer_peek (DataBuffer *dbuf, size_t max_len, GldAdcSpan *span1, GldAdcSpan *span2)
+{
+    size_t tail, len, first;
+
+    len = data_buffer_pull_begin (dbuf, max_len, &tail);
+
+    /* remember if we skipped data the producer already overwrote */
+    atomic_store_explicit (&dbuf->tail, tail, memory_order_relaxed);
+
+    first = MIN (len, dbuf->capacity - (tail & dbuf->mask));
+    span1->data = dbuf->buffer + (tail & dbuf->mask) * dbuf->stride;
+    span1->len = first;
+    span2->data = dbuf->buffer;
+    span2->len = len - first;
+
+    return len;
+}
+
+/**
+ * data_buffer_commit:
+ *
+ * Mark @len previously peeked items as read.
+ */
+static gboolean
+data_buffer_commit (DataBuffer *dbuf, size_t len)
+{
+    const size_t tail = atomic_load_explicit (&dbuf->tail, memory_order_relaxed);
+    const size_t head = atomic_load_explicit (&dbuf->head, memory_order_acquire);
+
+    g_return_val_if_fail (len <= head - tail, FALSE);
+    return data_buffer_pull_end (dbuf, tail, len);
+}
+
+/* copy up to @max_len items of a single-value ring into @dest, converting them to @type,
+ * and store the buffer position of the first copied item in @position */
+#define DATA_BUFFER_DEFINE_PULL(func_name, type)                                \
+static size_t                                                                   \
+func_name (DataBuffer *dbuf, type *dest, size_t max_len, size_t *position)      \
+{                                                                               \
+    size_t tail, len, first, i;                                                 \
+    const int16_t *src;                                                         \
+                                                                                \
+    do {                                                                        \
+        len = data_buffer_pull_begin (dbuf, max_len, &tail);                    \
+        *position = tail;                                                       \
+        if (len == 0)                                                           \
+            return 0;                                                           \
+                                                                                \
+        /* the data may wrap around the end of the ring, copy two spans */      \
+        src = dbuf->buffer + (tail & dbuf->mask);                               \
+        first = MIN (len, dbuf->capacity - (tail & dbuf->mask));                \
+        for (i = 0; i < first; i++)                                             \
+            dest[i] = src[i];                                                   \
+        for (i = first; i < len; i++)                                           \
+            dest[i] = dbuf->buffer[i - first];                                  \
+    } while (!data_buffer_pull_end (dbuf, tail, len));                          \
+                                                                                \
+    return len;                                                                 \
 }
 
+DATA_BUFFER_DEFINE_PULL (data_buffer_pull_int16,  int16_t)
+DATA_BUFFER_DEFINE_PULL (data_buffer_pull_double, double)
+DATA_BUFFER_DEFINE_PULL (data_buffer_pull_float,  float)
+
 /**
  * data_buffer_pull_data:
  */
 static inline gboolean
 data_buffer_pull_data (DataBuffer *dbuf, int16_t *data)
 {
-    if (dbuf->rd_pos >= dbuf->capacity) {
-        /* we reached the end of our buffer slice, start from the beginning */
-        dbuf->rd_pos = 0;
+    size_t position;
+    return data_buffer_pull_int16 (dbuf, data, 1, &position) == 1;
+}
+
+/**
+ * data_buffer_pull_frames:
+ *
+ * Copy up to @max_len interleaved frames into @dest.
+ * The buffer position of the first frame is stored in @position.
+ */
+static size_t
+data_buffer_pull_frames (DataBuffer *dbuf, int16_t *dest, size_t max_len, size_t *position)
+{
+    size_t tail, len, first;
+
+    do {
+        len = data_buffer_pull_begin (dbuf, max_len, &tail);
+        *position = tail;
+        if (len == 0)
+            return 0;
+
+        first = MIN (len, dbuf->capacity - (tail & dbuf->mask));
+        memcpy (dest,
+                dbuf->buffer + (tail & dbuf->mask) * dbuf->stride,
+                first * dbuf->stride * sizeof(int16_t));
+        memcpy (dest + first * dbuf->stride,
+                dbuf->buffer,
+                (len - first) * dbuf->stride * sizeof(int16_t));
+    } while (!data_buffer_pull_end (dbuf, tail, len));
+
+    return len;
+}
+
+/**
+ * data_buffer_pull_frames_float:
+ *
+ * Copy up to @max_len frames into per-channel float arrays.
+ * Entries of @dest that are %NULL are skipped.
+ * The buffer position of the first frame is stored in @position.
+ */
+static size_t
+data_buffer_pull_frames_float (DataBuffer *dbuf, float **dest, size_t offset, size_t max_len, size_t *position)
+{
+    size_t tail, len, first, i;
+    guint c;
+
+    do {
+        const int16_t *src;
+
+        len = data_buffer_pull_begin (dbuf, max_len, &tail);
+        *position = tail;
+        if (len == 0)
+            return 0;
+
+        first = MIN (len, dbuf->capacity - (tail & dbuf->mask));
+        for (c = 0; c < dbuf->stride; c++) {
+            float *cdest = dest[c];
+            if (cdest == NULL)
+                continue;
+            cdest += offset;
+
+            src = dbuf->buffer + (tail & dbuf->mask) * dbuf->stride + c;
+            for (i = 0; i < first; i++)
+                cdest[i] = src[i * dbuf->stride];
+            src = dbuf->buffer + c;
+            for (i = first; i < len; i++)
+                cdest[i] = src[(i - first) * dbuf->stride];
+        }
+    } while (!data_buffer_pull_end (dbuf, tail, len));
+
+    return len;
+}
+
+/**
+ * scan_times_new:
+ *
+ * Create a timestamp ring covering a data buffer of @capacity items.
+ */
+static ScanTimes*
+scan_times_new (size_t capacity)
+{
+    ScanTimes *times;
+    size_t n_entries;
+
+    /* a full buffer can touch one more block than it holds, the oldest entry
+     * may be in the middle of being replaced, and runs cut short by skipped
+     * grid points need entries of their own */
+    n_entries = gld_round_up_pow2 (2 * (capacity / SCAN_TIME_BLOCK_SIZE + 3));
+
+    times = g_new0 (ScanTimes, 1);
+    times->entries = g_new0 (ScanTimeEntry, n_entries);
+    times->mask = n_entries - 1;
+    scan_times_reset (times);
+
+    return times;
+}
+
+/**
+ * scan_times_free:
+ */
+static void
+scan_times_free (ScanTimes *times)
+{
+    if (times == NULL)
+        return;
+    g_free (times->entries);
+    g_free (times);
+}
+
+/**
+ * scan_times_reset:
+ *
+ * Forget all timestamps, must only be called while no data is acquired.
+ */
+static void
+scan_times_reset (ScanTimes *times)
+{
+    size_t i;
+
+    for (i = 0; i <= times->mask; i++)
+        atomic_store_explicit (&times->entries[i].sequence, SCAN_TIME_SEQUENCE_INVALID, memory_order_relaxed);
+    atomic_store_explicit (&times->count, 0, memory_order_release);
+    times->position = 0;
+    times->index = 0;
+    times->new_run = TRUE;
+}
+
+/**
+ * scan_times_push:
+ *
+ * Register the acquisition time of the next scan. Must be called by the
+ * producer before the scan data is pushed to the buffers.
+ */
+static inline void
+scan_times_push (ScanTimes *times, int64_t time_ns)
+{
+    const size_t position = times->position;
+
+    if (times->new_run || (position % SCAN_TIME_BLOCK_SIZE) == 0) {
+        const size_t sequence = atomic_load_explicit (&times->count, memory_order_relaxed);
+        ScanTimeEntry *entry = &times->entries[sequence & times->mask];
+
+        /* invalidate the entry while we are updating it */
+        atomic_store_explicit (&entry->sequence, SCAN_TIME_SEQUENCE_INVALID, memory_order_relaxed);
+        atomic_thread_fence (memory_order_release);
+        atomic_store_explicit (&entry->position, position, memory_order_relaxed);
+        atomic_store_explicit (&entry->index, times->index, memory_order_relaxed);
+        atomic_store_explicit (&entry->time_ns, time_ns, memory_order_relaxed);
+        atomic_store_explicit (&entry->sequence, sequence, memory_order_release);
+        atomic_store_explicit (&times->count, sequence + 1, memory_order_release);
+        times->new_run = FALSE;
+    }
+
+    times->position++;
+    times->index++;
+}
+
+/**
+ * scan_times_skip:
+ * @n_scans: Number of grid points that were not acquired
+ *
+ * Advance the sample index of the next scan by @n_scans, without taking
+ * up buffer positions. The next scan starts a new run, so timestamps are
+ * never interpolated across the gap.
+ */
+static inline void
+scan_times_skip (ScanTimes *times, guint64 n_scans)
+{
+    if (n_scans == 0)
+        return;
+    times->index += n_scans;
+    times->new_run = TRUE;
+}
+
+/**
+ * scan_times_read:
+ * @sequence: Number of the entry to read
+ *
+ * Take a consistent copy of entry @sequence.
+ *
+ * Returns: %TRUE if the entry was still available.
+ */
+static gboolean
+scan_times_read (ScanTimes *times, size_t sequence, ScanTimeRun *run)
+{
+    ScanTimeEntry *entry = &times->entries[sequence & times->mask];
+
+    if (atomic_load_explicit (&entry->sequence, memory_order_acquire) != sequence)
+        return FALSE;
+    run->position = atomic_load_explicit (&entry->position, memory_order_relaxed);
+    run->index = atomic_load_explicit (&entry->index, memory_order_relaxed);
+    run->time_ns = atomic_load_explicit (&entry->time_ns, memory_order_relaxed);
+
+    /* check that the producer did not replace the entry while we were reading it */
+    atomic_thread_fence (memory_order_acquire);
+    return atomic_load_explicit (&entry->sequence, memory_order_relaxed) == sequence;
+}
+
+/**
+ * scan_time_run_starts_at_or_before:
+ *
+ * Returns: %TRUE if @run starts at or before the buffer position or
+ * sample index @key.
+ */
+static inline gboolean
+scan_time_run_starts_at_or_before (const ScanTimeRun *run, guint64 key, gboolean by_index)
+{
+    if (by_index)
+        return run->index <= key;
+    /* buffer positions wrap around with the width of size_t */
+    return (size_t) ((size_t) key - run->position) <= SIZE_MAX / 2;
+}
+
+/**
+ * scan_times_find:
+ * @key: Buffer position or sample index of the scan
+ * @by_index: %TRUE if @key is a sample index
+ * @run: Location to store the run containing @key
+ * @next: Location to store the run after it, if there is one
+ *
+ * Find the newest run starting at or before @key. Both buffer positions
+ * and sample indices grow with the entry number, so a binary search over
+ * the entries still in the ring suffices.
+ *
+ * Returns: The number of runs found, 0 if @key is no longer known.
+ */
+static guint
+scan_times_find (ScanTimes *times, guint64 key, gboolean by_index, ScanTimeRun *run, ScanTimeRun *next)
+{
+    const size_t count = atomic_load_explicit (&times->count, memory_order_acquire);
+    size_t lo, hi;
+
+    if (count == 0)
+        return 0;
+
+    /* the newest run is by far the most common answer */
+    hi = count - 1;
+    if (!scan_times_read (times, hi, run))
+        return 0;
+    if (scan_time_run_starts_at_or_before (run, key, by_index))
+        return 1;
+
+    /* skip the oldest slot, the producer may be replacing it right now */
+    lo = count > times->mask ? count - times->mask : 0;
+    if (lo >= hi || !scan_times_read (times, lo, run) || !scan_time_run_starts_at_or_before (run, key, by_index))
+        return 0;
+
+    /* @run is entry lo and starts at or before @key, entry hi starts after it */
+    while (hi - lo > 1) {
+        const size_t mid = lo + (hi - lo) / 2;
+        ScanTimeRun mid_run;
+
+        if (!scan_times_read (times, mid, &mid_run))
+            return 0;
+        if (scan_time_run_starts_at_or_before (&mid_run, key, by_index)) {
+            lo = mid;
+            *run = mid_run;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (!scan_times_read (times, hi, next))
+        return 1;
+    return 2;
+}
+
+/**
+ * scan_times_lookup:
+ * @position: The buffer position of the scan
+ *
+ * Find sample index and acquisition time of the scan at @position.
+ * Scans within a run are assumed to be spaced at the nominal frequency.
+ *
+ * Returns: %TRUE if the timestamp was still available.
+ */
+static gboolean
+scan_times_lookup (ScanTimes *times, size_t position, guint64 *index, int64_t *time_ns)
+{
+    const guint frequency = atomic_load_explicit (&times->frequency, memory_order_relaxed);
+    ScanTimeRun run, next;
+    size_t offset;
+
+    if (scan_times_find (times, position, FALSE, &run, &next) == 0)
+        return FALSE;
+
+    offset = position - run.position;
+    *index = run.index + offset;
+    *time_ns = run.time_ns + (int64_t) ((offset * NSEC_PER_SEC) / MAX (frequency, 1));
+    return TRUE;
+}
+
+/**
+ * scan_times_lookup_index:
+ * @index: The sample index of the scan
+ *
+ * Find the acquisition time of the scan with sample index @index.
+ *
+ * Returns: %TRUE if the scan was acquired and its timestamp is still available,
+ * %FALSE if it is unknown or its grid point was skipped.
+ */
+static gboolean
+scan_times_lookup_index (ScanTimes *times, guint64 index, int64_t *time_ns)
+{
+    const guint frequency = atomic_load_explicit (&times->frequency, memory_order_relaxed);
+    ScanTimeRun run, next;
+    guint64 offset;
+
+    switch (scan_times_find (times, index, TRUE, &run, &next)) {
+        case 0:
+            return FALSE;
+        case 2:
+            /* indices between the end of a run and the start of the next one were skipped */
+            if (index - run.index >= next.position - run.position)
+                return FALSE;
+            break;
+        default:
+            break;
+    }
+
+    offset = index - run.index;
+    *time_ns = run.time_ns + (int64_t) ((offset * NSEC_PER_SEC) / MAX (frequency, 1));
+    return TRUE;
+}
+
+/**
+ * gld_adc_fill_window:
+ *
+ * Describe the samples at buffer positions @first to @last in @window.
+ */
+static void
+gld_adc_fill_window (GldAdc *daq, size_t first, size_t last, GldAdcWindow *window)
+{
+    const guint frequency = MAX (atomic_load_explicit (&daq->scan_times->frequency, memory_order_relaxed), 1);
+
+    if (window == NULL)
+        return;
+
+    if (!scan_times_lookup (daq->scan_times, last, &window->last_index, &window->last_time_ns)) {
+        /* the reader fell so far behind that even the newest data was overwritten */
+        memset (window, 0, sizeof (GldAdcWindow));
+        return;
+    }
+
+    if (!scan_times_lookup (daq->scan_times, first, &window->first_index, &window->first_time_ns)) {
+        /* the first block is gone already, extrapolate from the last sample */
+        window->first_index = window->last_index - (last - first);
+        window->first_time_ns = window->last_time_ns - (int64_t) (((guint64) (last - first) * NSEC_PER_SEC) / frequency);
+    }
+}
+
+/**
+ * adc_stats_reset:
+ */
+static void
+adc_stats_reset (AdcStats *stats)
+{
+    guint i;
+
+    atomic_store_explicit (&stats->samples_acquired, 0, memory_order_relaxed);
+    atomic_store_explicit (&stats->samples_dropped, 0, memory_order_relaxed);
+    atomic_store_explicit (&stats->deadline_misses, 0, memory_order_relaxed);
+    atomic_store_explicit (&stats->scan_duration_max_ns, 0, memory_order_relaxed);
+    atomic_store_explicit (&stats->scan_interval_max_ns, 0, memory_order_relaxed);
+    for (i = 0; i < GLD_ADC_HISTOGRAM_BUCKETS; i++) {
+        atomic_store_explicit (&stats->scan_duration_hist[i], 0, memory_order_relaxed);
+        atomic_store_explicit (&stats->scan_interval_hist[i], 0, memory_order_relaxed);
+    }
+}
+
+/**
+ * adc_stats_bucket:
+ *
+ * Returns: The log2 histogram bucket for a duration of @ns nanoseconds.
+ */
+static inline guint
+adc_stats_bucket (int64_t ns)
+{
+    guint bucket;
+
+    if (ns <= 1)
+        return 0;
+    bucket = 63 - __builtin_clzll ((unsigned long long) ns);
+    return MIN (bucket, GLD_ADC_HISTOGRAM_BUCKETS - 1);
+}
+
+/**
+ * adc_stats_add_duration:
+ *
+ * Record @ns in histogram @hist and the maximum @max_ns.
+ */
+static inline void
+adc_stats_add_duration (_Atomic uint64_t *hist, _Atomic int64_t *max_ns, int64_t ns)
+{
+    ADC_STATS_ADD (hist[adc_stats_bucket (ns)], 1);
+    if (ns > atomic_load_explicit (max_ns, memory_order_relaxed))
+        atomic_store_explicit (max_ns, ns, memory_order_relaxed);
+}
+
+/**
+ * gld_adc_free_buffers:
+ */
+static void
+gld_adc_free_buffers (GldAdc *daq)
+{
+    guint i;
+
+    if (daq->buffer != NULL) {
+        for (i = 0; i < daq->channel_count; i++)
+            data_buffer_free (daq->buffer[i]);
+        g_free (daq->buffer);
+        daq->buffer = NULL;
+    }
+    if (daq->frames != NULL) {
+        data_buffer_free (daq->frames);
+        daq->frames = NULL;
+    }
+    scan_times_free (daq->scan_times);
+    daq->scan_times = NULL;
+}
+
+/**
+ * gld_adc_wake_readers:
+ *
+ * Wake all threads blocked waiting for data, e.g. because acquisition stopped.
+ */
+static void
+gld_adc_wake_readers (GldAdc *daq)
+{
+    guint i;
+
+    if (daq->frames != NULL)
+        data_buffer_wake_readers (daq->frames);
+    if (daq->buffer != NULL) {
+        for (i = 0; i < daq->channel_count; i++)
+            data_buffer_wake_readers (daq->buffer[i]);
+    }
+}
+
+/**
+ * gld_adc_alloc_buffers:
+ */
+static void
+gld_adc_alloc_buffers (GldAdc *daq)
+{
+    guint i;
+
+    gld_adc_free_buffers (daq);
+    if (daq->buffer_mode == GLD_ADC_BUFFER_FRAMES) {
+        daq->frames = data_buffer_new (daq->buffer_capacity, daq->channel_count);
+    } else {
+        daq->buffer = g_malloc_n (daq->channel_count, sizeof(DataBuffer*));
+        for (i = 0; i < daq->channel_count; i++)
+            daq->buffer[i] = data_buffer_new (daq->buffer_capacity, 1);
+    }
+    daq->scan_times = scan_times_new (gld_round_up_pow2 (daq->buffer_capacity));
+}
+
+/* all available acquisition backends, the first one is the default for real hardware */
+static const GldAdcBackend *adc_backends[] = {
+    &gld_adc_backend_bcm2835,
+    &gld_adc_backend_spidev,
+    &gld_adc_backend_iio,
+    &gld_adc_backend_synthetic,
+    &gld_adc_backend_replay,
+    NULL
+};
+
+/**
+ * gld_adc_find_backend:
+ * @spec: Backend specification, "name" or "name:args"
+ * @args: (out) (optional): Location to store the arguments part of @spec, free with %g_free
+ *
+ * Returns: The backend selected by @spec, or %NULL if there is none.
+ */
+static const GldAdcBackend*
+gld_adc_find_backend (const gchar *spec, gchar **args)
+{
+    g_autofree gchar *name = NULL;
+    const gchar *sep;
+    guint i;
+
+    if (spec == NULL)
+        return NULL;
+
+    sep = strchr (spec, ':');
+    if (sep == NULL)
+        name = g_strdup (spec);
+    else
+        name = g_strndup (spec, sep - spec);
+
+    for (i = 0; adc_backends[i] != NULL; i++) {
+        if (g_strcmp0 (adc_backends[i]->name, name) == 0) {
+            if (args != NULL)
+                *args = (sep == NULL || sep[1] == '\0')? NULL : g_strdup (sep + 1);
+            return adc_backends[i];
+        }
     }
 
-    /* fail if we don't have enough data yet */
-    if (dbuf->len == 0)
+    return NULL;
+}
+
+/**
+ * gld_adc_get_builtin_backend:
+ *
+ * Returns: The backend to use if none was selected.
+ */
+static const gchar*
+gld_adc_get_builtin_backend (void)
+{
+#ifdef SIMULATE_DATA
+    return gld_adc_backend_synthetic.name;
+#else
+    return gld_adc_backend_bcm2835.name;
+#endif
+}
+
+/**
+ * gld_adc_get_default_backend:
+ *
+ * Get the specification of the acquisition backend new %GldAdc instances use.
+ * This is the value of the GALDUR_ADC_BACKEND environment variable if set,
+ * "synthetic" if Galdur was built to simulate data, and "bcm2835" otherwise.
+ */
+const gchar*
+gld_adc_get_default_backend (void)
+{
+    const gchar *env_spec;
+
+    env_spec = g_getenv ("GALDUR_ADC_BACKEND");
+    if (env_spec != NULL && env_spec[0] != '\0')
+        return env_spec;
+
+    return gld_adc_get_builtin_backend ();
+}
+
+/**
+ * gld_adc_lookup_backend_caps:
+ * @spec: Backend specification, "name" or "name:args"
+ * @caps: (out): Capabilities of the backend
+ *
+ * Look up the capabilities of a backend without opening it, e.g. to find
+ * out whether the board has to be initialized before using it.
+ *
+ * Returns: %TRUE if the backend exists.
+ */
+gboolean
+gld_adc_lookup_backend_caps (const gchar *spec, GldAdcBackendCaps *caps)
+{
+    const GldAdcBackend *backend;
+
+    backend = gld_adc_find_backend (spec, NULL);
+    if (backend == NULL)
+        return FALSE;
+    *caps = backend->caps;
+
+    return TRUE;
+}
+
+/**
+ * gld_adc_print_backends:
+ *
+ * List all available acquisition backends on @stream.
+ */
+void
+gld_adc_print_backends (FILE *stream)
+{
+    guint i;
+
+    for (i = 0; adc_backends[i] != NULL; i++)
+        fprintf (stream, "  %-10s %s\n", adc_backends[i]->name, adc_backends[i]->description);
+}
+
+/**
+ * gld_adc_close_backend:
+ */
+static void
+gld_adc_close_backend (GldAdc *daq)
+{
+    if (daq->backend == NULL)
+        return;
+
+    if (daq->backend_started)
+        daq->backend->stop (daq->backend_priv);
+    daq->backend_started = FALSE;
+    daq->backend->close (daq->backend_priv);
+    daq->backend = NULL;
+    daq->backend_priv = NULL;
+}
+
+/**
+ * gld_adc_set_backend:
+ * @spec: Backend specification, "name" or "name:args"
+ *
+ * Select where samples are acquired from. The backend name is one of
+ * "bcm2835" (MAX1133 chips on the Galdur board, polled via the BCM2835
+ * SPI registers), "spidev" (the same chips via the Linux spidev driver),
+ * "iio" (buffered capture from a kernel IIO driver), "synthetic"
+ * (generated signals) or "replay" (data from a file, paced by the sampling
+ * clock). Backend specific arguments follow the name after a colon,
+ * e.g. "replay:recording.dat,channels=32,loop".
+ * The previous backend is only replaced if the new one could be opened.
+ *
+ * Returns: %TRUE on success.
+ */
+gboolean
+gld_adc_set_backend (GldAdc *daq, const gchar *spec)
+{
+    const GldAdcBackend *backend;
+    g_autofree gchar *args = NULL;
+    gpointer priv;
+
+    g_return_val_if_fail (!daq->running, FALSE);
+
+    backend = gld_adc_find_backend (spec, &args);
+    if (backend == NULL) {
+        g_critical ("Unknown ADC backend: %s", spec);
         return FALSE;
-    if (dbuf->rd_pos >= dbuf->wr_pos)
+    }
+
+    priv = backend->open (args);
+    if (priv == NULL) {
+        g_critical ("Unable to open ADC backend: %s", spec);
         return FALSE;
+    }
 
-    (*data) = dbuf->buffer[dbuf->rd_pos];
-    dbuf->len--;
-    dbuf->rd_pos++;
+    gld_adc_close_backend (daq);
+    daq->backend = backend;
+    daq->backend_priv = priv;
 
     return TRUE;
 }
 
+/**
+ * gld_adc_get_backend_name:
+ */
+const gchar*
+gld_adc_get_backend_name (GldAdc *daq)
+{
+    return daq->backend->name;
+}
+
+/**
+ * gld_adc_get_backend_caps:
+ */
+GldAdcBackendCaps
+gld_adc_get_backend_caps (GldAdc *daq)
+{
+    return daq->backend->caps;
+}
+
 /**
  * gld_adc_new:
+ * @channel_count: Number of channels to acquire
+ * @buffer_capacity: Size of each channel buffer, rounded up to a power of two.
+ *     One sample less than that can be read back.
+ * @cpu_affinity: CPU core to run the DAQ thread on, or -1
  */
 GldAdc*
 gld_adc_new (guint channel_count, size_t buffer_capacity, int cpu_affinity)
@@ -208,25 +1210,33 @@ gld_adc_new (guint channel_count, size_t buffer_capacity, int cpu_affinity)
     daq = g_slice_new0 (GldAdc);
     daq->acq_frequency = 20000; /* default to 20 kHz data acquisition speed */
 
-    /* allocate buffer space */
-    daq->buffer = g_malloc_n (channel_count, sizeof(DataBuffer*));
-    for (i = 0; i < channel_count; i++)
-        daq->buffer[i] = data_buffer_new (buffer_capacity);
+    /* allocate buffer space, one ring buffer per channel by default */
     daq->channel_count = channel_count;
+    daq->buffer_capacity = buffer_capacity;
+    daq->buffer_mode = GLD_ADC_BUFFER_CHANNELS;
+    gld_adc_alloc_buffers (daq);
 
-    /* initialize RNG if we are faking data */
-#ifdef SIMULATE_DATA
-    srand (time(NULL));
-#endif
+    daq->stats = g_new0 (AdcStats, 1);
+    adc_stats_reset (daq->stats);
 
-    daq->cpu_affinity = cpu_affinity;
+    /* scan the first channel_count physical channels by default */
+    for (i = 0; i < channel_count; i++)
+        daq->scan_list[i] = i;
 
-    /* default duration we sleep when we could not fetch new data */
-    gld_adc_set_nodata_sleep_time (daq, gld_set_timespec_from_ms (0.2));
+    if (!gld_adc_set_backend (daq, gld_adc_get_default_backend ())) {
+        g_critical ("Falling back to the '%s' ADC backend.", gld_adc_get_builtin_backend ());
+        if (!gld_adc_set_backend (daq, gld_adc_get_builtin_backend ()))
+            g_error ("Unable to open any ADC backend.");
+    }
 
-    /* create DAQ thread */
+    daq->cpu_affinity = cpu_affinity;
+
+    /* create DAQ thread, it parks itself until acquisition is started */
+    pthread_mutex_init (&daq->state_lock, NULL);
+    pthread_cond_init (&daq->state_cond, NULL);
     daq->shutdown = FALSE;
     daq->running = FALSE;
+    daq->parked = FALSE;
     rc = pthread_create (&daq->tid, NULL, &daq_thread_main, daq);
     if (rc) {
         g_error ("Return code from pthread_create() is %d\n", rc);
@@ -237,111 +1247,289 @@ gld_adc_new (guint channel_count, size_t buffer_capacity, int cpu_affinity)
 }
 
 /**
- * gld_adc_free:
+ * gld_adc_free:
+ */
+void
+gld_adc_free (GldAdc *daq)
+{
+    g_return_if_fail (daq != NULL);
+
+    /* make DAQ thread terminate, and wait for it before freeing anything it uses */
+    pthread_mutex_lock (&daq->state_lock);
+    daq->running  = FALSE;
+    daq->shutdown = TRUE;
+    pthread_cond_broadcast (&daq->state_cond);
+    pthread_mutex_unlock (&daq->state_lock);
+    pthread_join (daq->tid, NULL);
+
+    gld_adc_wake_readers (daq);
+    pthread_mutex_destroy (&daq->state_lock);
+    pthread_cond_destroy (&daq->state_cond);
+    gld_adc_close_backend (daq);
+
+    /* dispose of buffers */
+    gld_adc_free_buffers (daq);
+    g_free (daq->stats);
+
+    g_slice_free (GldAdc, daq);
+}
+
+/**
+ * gld_adc_set_acq_frequency:
+ */
+void
+gld_adc_set_acq_frequency (GldAdc *daq, guint hz)
+{
+    daq->acq_frequency = hz;
+}
+
+/**
+ * gld_adc_set_busy_wait_time:
+ * @usec: Time in microseconds to busy-wait before each scan, or 0 to disable.
+ *
+ * Instead of relying on the scheduler to wake the DAQ thread exactly at the
+ * time of the next scan, wake it up @usec early and spin for the remaining time.
+ * This reduces sampling jitter at the expense of CPU time.
+ */
+void
+gld_adc_set_busy_wait_time (GldAdc *daq, guint usec)
+{
+    daq->busy_wait_ns = (int64_t) usec * 1000;
+}
+
+/**
+ * gld_adc_set_batched_spi:
+ * @batched: %TRUE to read all channels of a chip in one SPI transaction
+ *
+ * By default, every channel is read with its own SPI transaction. In batched
+ * mode, the control bytes of all channels of a MAX1133 are sent in a single
+ * transaction with the chip selected throughout, which removes most of the
+ * per-transaction overhead and allows higher sampling rates with many channels.
+ * Only backends with %GLD_ADC_BACKEND_CAP_BATCHED support this, all other
+ * backends ignore the setting.
+ */
+void
+gld_adc_set_batched_spi (GldAdc *daq, gboolean batched)
+{
+    g_return_if_fail (!daq->running);
+    daq->batched_spi = batched;
+}
+
+/**
+ * gld_adc_set_scan_list:
+ * @channels: Physical ADC channels (0-15) to acquire, in order
+ * @n_channels: Length of @channels, must equal the channel count of @daq
+ *
+ * Select which physical ADC inputs are converted, and in which order.
+ * Logical channel i of @daq (as used by all read functions) is physical
+ * channel @channels[i]. Only the listed inputs are converted, so a scan
+ * takes one SPI transaction per listed channel, and fewer channels allow
+ * higher sampling frequencies.
+ *
+ * Returns: %TRUE on success.
+ */
+gboolean
+gld_adc_set_scan_list (GldAdc *daq, const guint *channels, guint n_channels)
+{
+    guint i;
+
+    g_return_val_if_fail (!daq->running, FALSE);
+
+    if (n_channels != daq->channel_count) {
+        g_critical ("Scan list has %u entries, but the ADC was set up for %u channels.",
+                    n_channels, daq->channel_count);
+        return FALSE;
+    }
+    for (i = 0; i < n_channels; i++) {
+        if (channels[i] >= 16) {
+            g_critical ("Invalid ADC channel %u in scan list.", channels[i]);
+            return FALSE;
+        }
+    }
+
+    for (i = 0; i < n_channels; i++)
+        daq->scan_list[i] = channels[i];
+
+    return TRUE;
+}
+
+/**
+ * gld_adc_set_buffer_mode:
+ *
+ * Select whether samples are stored in one ring buffer per channel
+ * (%GLD_ADC_BUFFER_CHANNELS) or in a single ring buffer holding one frame
+ * with all channels per scan (%GLD_ADC_BUFFER_FRAMES).
+ * Frames keep all channels sample-aligned and are read with
+ * %gld_adc_get_frames and %gld_adc_get_frames_float, the per-channel
+ * functions can not be used in this mode.
+ *
+ * Changing the mode discards all buffered data and is only allowed while
+ * no data is being acquired.
+ */
+gboolean
+gld_adc_set_buffer_mode (GldAdc *daq, GldAdcBufferMode mode)
+{
+    g_return_val_if_fail (!daq->running, FALSE);
+
+    if (daq->buffer_mode == mode)
+        return TRUE;
+    daq->buffer_mode = mode;
+    gld_adc_alloc_buffers (daq);
+
+    return TRUE;
+}
+
+/**
+ * gld_adc_get_buffer_mode:
+ */
+GldAdcBufferMode
+gld_adc_get_buffer_mode (GldAdc *daq)
+{
+    return daq->buffer_mode;
+}
+
+/**
+ * gld_adc_push_frame:
+ *
+ * Store a scan acquired at @time_ns in the buffers.
+ */
+static inline void
+gld_adc_push_frame (GldAdc *daq, const int16_t *frame, int64_t time_ns)
+{
+    guint i;
+
+    /* timestamp first, so it is available as soon as readers see the data */
+    scan_times_push (daq->scan_times, time_ns);
+
+    if (daq->buffer_mode == GLD_ADC_BUFFER_FRAMES) {
+        data_buffer_push_data (daq->frames, frame);
+    } else {
+        for (i = 0; i < daq->channel_count; i++)
+            data_buffer_push_data (daq->buffer[i], &frame[i]);
+    }
+}
+
+/**
+ * gld_adc_acquire_oneshot:
+ *
+ * Returns: %FALSE if the backend could not acquire any more data.
+ */
+static inline gboolean
+gld_adc_acquire_oneshot (GldAdc *daq, int64_t time_ns)
+{
+    int16_t frame[16];
+
+    /* retrieve data from all channels in the scan list */
+    if (!daq->backend->scan (daq->backend_priv, frame))
+        return FALSE;
+
+    gld_adc_push_frame (daq, frame, time_ns);
+
+    return TRUE;
+}
+
+/**
+ * gld_adc_acquire_block:
+ * @time_ns: Time of the first scan
+ * @period_ns: Sampling period
+ * @n_scans: Number of scans to acquire, at most %GLD_ADC_MAX_SCAN_BLOCK
+ *
+ * Acquire consecutive scans, which the backend paces at the sampling frequency.
+ *
+ * Returns: %FALSE if the backend could not acquire any more data.
  */
-void
-gld_adc_free (GldAdc *daq)
+static gboolean
+gld_adc_acquire_block (GldAdc *daq, int64_t time_ns, int64_t period_ns, guint n_scans)
 {
+    int16_t frames[GLD_ADC_MAX_SCAN_BLOCK * 16];
+    gboolean ret;
     guint i;
-    g_return_if_fail (daq != NULL);
 
-    /* make DAQ thread terminate */
-    daq->running  = FALSE;
-    daq->shutdown = TRUE;
+    if (n_scans == 1)
+        ret = daq->backend->scan (daq->backend_priv, frames);
+    else
+        ret = daq->backend->scan_block (daq->backend_priv, frames, n_scans);
+    if (!ret)
+        return FALSE;
 
-    /* dispose of buffers */
-    for (i = 0; i < daq->channel_count; i++)
-        data_buffer_free (daq->buffer[i]);
-    g_free (daq->buffer);
+    /* paced backends return as soon as the data is available, so the last scan was just taken */
+    if (daq->backend->caps & GLD_ADC_BACKEND_CAP_PACED) {
+        struct timespec now;
 
-    g_slice_free (GldAdc, daq);
-}
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        time_ns = gld_nanoseconds_from_timespec (&now) - (n_scans - 1) * period_ns;
+    }
 
-/**
- * gld_adc_set_acq_frequency:
- */
-void
-gld_adc_set_acq_frequency (GldAdc *daq, guint hz)
-{
-    daq->acq_frequency = hz;
+    for (i = 0; i < n_scans; i++)
+        gld_adc_push_frame (daq, &frames[i * daq->channel_count], time_ns + i * period_ns);
+
+    return TRUE;
 }
 
 /**
- * gld_adc_set_nodata_sleep_time:
+ * gld_adc_scan_deadline_ns:
  *
- * Set time we sleep when we want to acquire a sample of a specified
- * length but do not acquire data quickly enough.
+ * Returns: Absolute time of scan @scan_no on the sampling grid that started
+ * at @grid_start_ns. Computed from the scan index rather than accumulated
+ * from a period, so rounding errors never add up.
  */
-void
-gld_adc_set_nodata_sleep_time (GldAdc *daq, struct timespec time)
+static inline int64_t
+gld_adc_scan_deadline_ns (int64_t grid_start_ns, guint64 scan_no, guint frequency)
 {
-    daq->nodata_sleep_time = time;
+    return grid_start_ns + (int64_t) ((scan_no * NSEC_PER_SEC) / frequency);
 }
 
 /**
- * gld_adc_acquire_oneshot:
+ * gld_adc_wait_until:
+ *
+ * Sleep until the absolute CLOCK_MONOTONIC time @deadline_ns.
+ * If @busy_wait_ns is nonzero, we wake up this much earlier and spin
+ * for the rest of the time to avoid scheduler wakeup latency.
  */
-static inline void
-gld_adc_acquire_oneshot (GldAdc *daq)
+static void
+gld_adc_wait_until (int64_t deadline_ns, int64_t busy_wait_ns)
 {
-    int16_t rxval = 0;
-    guint i;
-
-    /* retrieve data from all channels */
-    for (i = 0; i < daq->channel_count; i++) {
-        uint8_t txbuf = MAX1133_START;
-        int chan;
-
-        if (i < 8) {
-            if (i == 0) {
-                if (daq->channel_count >= 8)
-                    chan = 7;
-                else
-                    chan = daq->channel_count - 1;
-            } else {
-                chan = i - 1;
-            }
-            txbuf |= max1133_mux_channel_map[i];
+    struct timespec deadline;
+    struct timespec now;
 
-            /* select MAX 1133 1 */
-            bcm2835_spi_chipSelect(BCM2835_SPI_CS0);
-        } else {
-            if ((i - 8) == 0) {
-                chan = daq->channel_count - 1;
-            } else {
-                chan = i - 1;
-            }
-            txbuf |= max1133_mux_channel_map[i - 8];
-
-            /* select MAX 1133 2 */
-            bcm2835_spi_chipSelect(BCM2835_SPI_CS1);
-        }
+    deadline = gld_set_timespec_from_ns (deadline_ns - busy_wait_ns);
+    while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) { }
 
-#ifndef SIMULATE_DATA
-        /* synchronous SPI query, two bytes received and stored in int16_t */
-        bcm2835_spi_transfernb ((char*) &txbuf, (char*) &rxval, sizeof(int16_t));
-#else
-        if ((chan % 2) == 0)
-            rxval = rand () % (600 * (chan + 1));
-        else
-            rxval = (rand () % (600 * (chan + 1))) * -1;
-#endif
-        data_buffer_push_data (daq->buffer[chan], rxval);
-    }
+    if (busy_wait_ns <= 0)
+        return;
+    do {
+        clock_gettime (CLOCK_MONOTONIC, &now);
+    } while (gld_nanoseconds_from_timespec (&now) < deadline_ns);
 }
 
 /**
  * daq_thread_main:
+ *
+ * Acquire one scan at every point of an absolute CLOCK_MONOTONIC time grid
+ * with a spacing of 1/acq_frequency.
+ * A scan that starts a little late is still taken, but if we fell behind
+ * by whole grid points (e.g. because a scan took too long), the missed
+ * points are skipped so the sample clock keeps its phase, and are counted
+ * as dropped samples.
+ * Backends that acquire blocks of scans paced by the hardware are called
+ * at the first grid point of every block instead, and backends pacing
+ * acquisition themselves are called continuously.
  */
 static void*
 daq_thread_main (void *daq_ptr)
 {
     GldAdc *daq = (GldAdc*) daq_ptr;
-    struct timespec start, stop;
-    struct timespec daq_time;
-
-    struct timespec delay_time;
-    struct timespec max_delay_time;
+    struct timespec now;
+
+    int64_t grid_start_ns = 0;
+    int64_t now_ns;
+    int64_t last_scan_ns = 0;
+    guint64 scan_no = 0;
+    guint frequency = 0;
+    guint n_scans;
+    guint last_n_scans = 1;
+    gboolean paced = FALSE;
+    gboolean grid_started = FALSE;
 
     size_t sample_count = 0;
     gboolean continuous_sampling;
@@ -353,51 +1541,107 @@ daq_thread_main (void *daq_ptr)
         }
     }
 
-    max_delay_time = gld_set_timespec_from_ms (1000 / daq->acq_frequency);
-
     continuous_sampling = daq->sample_max_count < 0;
     while (TRUE) {
         if (!daq->running) {
-            /* we are not acquiring data - check if we should terminate */
-            if (daq->shutdown)
+            gboolean shutdown;
+
+            /* we are not acquiring data - park until we are started again or should terminate */
+            pthread_mutex_lock (&daq->state_lock);
+            daq->parked = TRUE;
+            pthread_cond_broadcast (&daq->state_cond);
+            while (!daq->running && !daq->shutdown)
+                pthread_cond_wait (&daq->state_cond, &daq->state_lock);
+            daq->parked = FALSE;
+            shutdown = daq->shutdown;
+            pthread_mutex_unlock (&daq->state_lock);
+
+            if (shutdown)
                 break;
             sample_count = 0;
             continuous_sampling = daq->sample_max_count < 0;
+            grid_started = FALSE;
+            last_n_scans = 1;
             continue;
         }
 
-        if (clock_gettime (CLOCK_REALTIME, &start) == -1 ) {
-            g_critical ("Unable to get realtime DAQ start time.");
-            continue;
+        if (!grid_started) {
+            /* (re)start the sampling grid, the first scan is taken immediately */
+            if (clock_gettime (CLOCK_MONOTONIC, &now) == -1) {
+                g_critical ("Unable to get DAQ start time.");
+                daq->running = FALSE;
+                gld_adc_wake_readers (daq);
+                continue;
+            }
+            frequency = MAX (daq->acq_frequency, 1);
+            paced = (daq->backend->caps & GLD_ADC_BACKEND_CAP_PACED) != 0;
+            atomic_store_explicit (&daq->scan_times->frequency, frequency, memory_order_relaxed);
+            grid_start_ns = gld_nanoseconds_from_timespec (&now);
+            scan_no = 0;
+            last_scan_ns = 0;
+            grid_started = TRUE;
         }
 
-        /* acquire a single set of data */
-        gld_adc_acquire_oneshot (daq);
+        if (paced) {
+            /* the backend blocks until its data is ready, we only need to keep reading */
+            clock_gettime (CLOCK_MONOTONIC, &now);
+            now_ns = gld_nanoseconds_from_timespec (&now);
+        } else {
+            /* wait for the grid point of this scan */
+            gld_adc_wait_until (gld_adc_scan_deadline_ns (grid_start_ns, scan_no, frequency),
+                                daq->busy_wait_ns);
+
+            clock_gettime (CLOCK_MONOTONIC, &now);
+            now_ns = gld_nanoseconds_from_timespec (&now);
+            if (now_ns >= gld_adc_scan_deadline_ns (grid_start_ns, scan_no + 1, frequency)) {
+                /* the previous scan took so long that we missed whole grid points,
+                 * skip ahead to the latest one to keep the sample clock's phase */
+                guint64 latest_scan_no = ((guint64) (now_ns - grid_start_ns) * frequency) / NSEC_PER_SEC;
+
+                ADC_STATS_ADD (daq->stats->deadline_misses, 1);
+                ADC_STATS_ADD (daq->stats->samples_dropped, latest_scan_no - scan_no);
+                scan_times_skip (daq->scan_times, latest_scan_no - scan_no);
+                grid_start_ns += (int64_t) (latest_scan_no / frequency) * NSEC_PER_SEC;
+                scan_no = latest_scan_no % frequency;
+            }
+        }
 
-        if (clock_gettime (CLOCK_REALTIME, &stop) == -1 ) {
-            g_critical ("Unable to get realtime DAQ stop time.");
+        /* acquire a single set of data, or a whole block */
+        n_scans = daq->scan_block_size;
+        if (!continuous_sampling)
+            n_scans = MIN (n_scans, daq->sample_max_count - sample_count);
+        if (!gld_adc_acquire_block (daq, now_ns, NSEC_PER_SEC / frequency, n_scans)) {
             daq->running = FALSE;
+            gld_adc_wake_readers (daq);
             continue;
         }
 
-        daq_time.tv_sec = stop.tv_sec - start.tv_sec;
-        daq_time.tv_nsec = stop.tv_nsec - start.tv_nsec;
+        /* update statistics, durations of blocks are averaged over their scans */
+        ADC_STATS_ADD (daq->stats->samples_acquired, n_scans);
+        if (last_scan_ns != 0)
+            adc_stats_add_duration (daq->stats->scan_interval_hist,
+                                    &daq->stats->scan_interval_max_ns,
+                                    (now_ns - last_scan_ns) / last_n_scans);
+        last_scan_ns = now_ns;
+        last_n_scans = n_scans;
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        adc_stats_add_duration (daq->stats->scan_duration_hist,
+                                &daq->stats->scan_duration_max_ns,
+                                (gld_nanoseconds_from_timespec (&now) - now_ns) / n_scans);
 
         if (!continuous_sampling) {
-            sample_count++;
+            sample_count += n_scans;
             daq->running = daq->sample_max_count > sample_count;
+            if (!daq->running)
+                gld_adc_wake_readers (daq);
         }
 
-        if ((daq_time.tv_sec > max_delay_time.tv_sec) && (daq_time.tv_nsec > max_delay_time.tv_nsec)) {
-            /* we took too long, get new sample immediately */
-            continue;
+        scan_no += n_scans;
+        if (scan_no >= frequency) {
+            /* move the grid start by whole seconds, so the scan index can never overflow */
+            grid_start_ns += (int64_t) (scan_no / frequency) * NSEC_PER_SEC;
+            scan_no %= frequency;
         }
-
-        delay_time.tv_sec = max_delay_time.tv_sec - daq_time.tv_sec;
-        delay_time.tv_nsec = max_delay_time.tv_nsec - daq_time.tv_nsec;
-
-        /* wait the remaining time */
-        nanosleep (&delay_time, NULL);
     }
 
     return NULL;
@@ -419,7 +1663,23 @@ gld_adc_acquire_samples (GldAdc *daq, ssize_t sample_count)
     gld_adc_reset (daq);
 
     daq->sample_max_count = sample_count;
+    adc_stats_reset (daq->stats);
+
+    if (!daq->backend->start (daq->backend_priv, daq)) {
+        g_critical ("Unable to start acquisition with the '%s' ADC backend.", daq->backend->name);
+        return FALSE;
+    }
+    daq->backend_started = TRUE;
+
+    daq->scan_block_size = 1;
+    if (daq->backend->scan_block != NULL)
+        daq->scan_block_size = CLAMP (daq->backend->get_block_size (daq->backend_priv), 1, GLD_ADC_MAX_SCAN_BLOCK);
+
+    /* wake up the DAQ thread */
+    pthread_mutex_lock (&daq->state_lock);
     daq->running = TRUE;
+    pthread_cond_broadcast (&daq->state_cond);
+    pthread_mutex_unlock (&daq->state_lock);
 
     return TRUE;
 }
@@ -428,12 +1688,30 @@ gld_adc_acquire_samples (GldAdc *daq, ssize_t sample_count)
  * gld_adc_acquire_single_dataset:
  *
  * Immediately acquire a single dataset.
+ *
+ * Returns: %TRUE if data was acquired.
  */
-void
+gboolean
 gld_adc_acquire_single_dataset (GldAdc *daq)
 {
+    struct timespec now;
+    gboolean ret;
+
     g_assert (!daq->running);
-    gld_adc_acquire_oneshot (daq);
+
+    /* (re)start the backend, so it uses the current settings */
+    if (daq->backend_started)
+        daq->backend->stop (daq->backend_priv);
+    daq->backend_started = FALSE;
+    if (!daq->backend->start (daq->backend_priv, daq))
+        return FALSE;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    ret = gld_adc_acquire_oneshot (daq, gld_nanoseconds_from_timespec (&now));
+
+    daq->backend->stop (daq->backend_priv);
+
+    return ret;
 }
 
 /**
@@ -443,15 +1721,49 @@ gboolean
 gld_adc_reset (GldAdc *daq)
 {
     guint i;
-    daq->running = FALSE;
-    daq->tid = 0;
 
-    for (i = 0; i < daq->channel_count; i++)
-        data_buffer_reset (daq->buffer[i]);
+    /* stop acquisition and wait until the DAQ thread is parked,
+     * so it does not touch the buffers while we reset them */
+    pthread_mutex_lock (&daq->state_lock);
+    daq->running = FALSE;
+    while (!daq->parked)
+        pthread_cond_wait (&daq->state_cond, &daq->state_lock);
+    pthread_mutex_unlock (&daq->state_lock);
+
+    /* nobody should wait for new data anymore */
+    gld_adc_wake_readers (daq);
+
+    if (daq->backend_started)
+        daq->backend->stop (daq->backend_priv);
+    daq->backend_started = FALSE;
+
+    if (daq->buffer_mode == GLD_ADC_BUFFER_FRAMES) {
+        data_buffer_reset (daq->frames);
+    } else {
+        for (i = 0; i < daq->channel_count; i++)
+            data_buffer_reset (daq->buffer[i]);
+    }
+    scan_times_reset (daq->scan_times);
 
     return TRUE;
 }
 
+/**
+ * gld_adc_wait_finished:
+ *
+ * Block until the DAQ thread has stopped acquiring data, e.g. because the
+ * number of samples requested with %gld_adc_acquire_samples was reached.
+ * Returns immediately if no acquisition is running.
+ */
+void
+gld_adc_wait_finished (GldAdc *daq)
+{
+    pthread_mutex_lock (&daq->state_lock);
+    while (daq->running || !daq->parked)
+        pthread_cond_wait (&daq->state_cond, &daq->state_lock);
+    pthread_mutex_unlock (&daq->state_lock);
+}
+
 /**
  * gld_adc_is_running:
  */
@@ -472,6 +1784,7 @@ gboolean
 gld_adc_get_sample (GldAdc *daq, guint channel, int16_t *data)
 {
     g_assert (channel < daq->channel_count);
+    g_return_val_if_fail (daq->buffer_mode == GLD_ADC_BUFFER_CHANNELS, FALSE);
     return data_buffer_pull_data (daq->buffer[channel], data);
 }
 
@@ -479,25 +1792,41 @@ gld_adc_get_sample (GldAdc *daq, guint channel, int16_t *data)
 /**
  * gld_adc_get_samples:
  *
+ * @window: (nullable): Location to store index and acquisition time of the samples
+ *
  * Get @samples_len samples in @samples for channel @channel
  * This function will block until the requested number of samples has
  * been added to the buffer.
+ *
+ * Returns: %TRUE on success, %FALSE if acquisition stopped before enough data was available.
  */
-void
-gld_adc_get_samples (GldAdc *daq, guint channel, int16_t *samples, size_t samples_len)
+gboolean
+gld_adc_get_samples (GldAdc *daq, guint channel, int16_t *samples, size_t samples_len, GldAdcWindow *window)
 {
     size_t sample_no = 0;
+    size_t first = 0, last = 0;
+    g_return_val_if_fail (daq->buffer_mode == GLD_ADC_BUFFER_CHANNELS, FALSE);
 
     while (sample_no < samples_len) {
-        int16_t data;
-        if (data_buffer_pull_data (daq->buffer[channel], &data)) {
-            samples[sample_no] = data;
-            sample_no++;
-        } else {
-            /* sleep a little, as we have no data in the buffer */
-            nanosleep (&daq->nodata_sleep_time, NULL);
-        }
+        size_t len, position;
+
+        /* block until all remaining samples have arrived */
+        if (!data_buffer_wait_for (daq->buffer[channel], &daq->running, samples_len - sample_no, -1))
+            return FALSE;
+
+        len = data_buffer_pull_int16 (daq->buffer[channel],
+                                      samples + sample_no,
+                                      samples_len - sample_no,
+                                      &position);
+        if (sample_no == 0)
+            first = position;
+        last = position + len - 1;
+        sample_no += len;
     }
+
+    if (samples_len > 0)
+        gld_adc_fill_window (daq, first, last, window);
+    return TRUE;
 }
 
 /**
@@ -505,21 +1834,33 @@ gld_adc_get_samples (GldAdc *daq, guint channel, int16_t *samples, size_t sample
  *
  * Same as %gld_adc_get_samples, but using an array of doubles.
  */
-void
-gld_adc_get_samples_double (GldAdc *daq, guint channel, double *samples, size_t samples_len)
+gboolean
+gld_adc_get_samples_double (GldAdc *daq, guint channel, double *samples, size_t samples_len, GldAdcWindow *window)
 {
     size_t sample_no = 0;
+    size_t first = 0, last = 0;
+    g_return_val_if_fail (daq->buffer_mode == GLD_ADC_BUFFER_CHANNELS, FALSE);
 
     while (sample_no < samples_len) {
-        int16_t data;
-        if (data_buffer_pull_data (daq->buffer[channel], &data)) {
-            samples[sample_no] = data;
-            sample_no++;
-        } else {
-            /* sleep a little, as we have no data in the buffer */
-            nanosleep (&daq->nodata_sleep_time, NULL);
-        }
+        size_t len, position;
+
+        /* block until all remaining samples have arrived */
+        if (!data_buffer_wait_for (daq->buffer[channel], &daq->running, samples_len - sample_no, -1))
+            return FALSE;
+
+        len = data_buffer_pull_double (daq->buffer[channel],
+                                       samples + sample_no,
+                                       samples_len - sample_no,
+                                       &position);
+        if (sample_no == 0)
+            first = position;
+        last = position + len - 1;
+        sample_no += len;
     }
+
+    if (samples_len > 0)
+        gld_adc_fill_window (daq, first, last, window);
+    return TRUE;
 }
 
 /**
@@ -527,21 +1868,86 @@ gld_adc_get_samples_double (GldAdc *daq, guint channel, double *samples, size_t
  *
  * Same as %gld_adc_get_samples, but using an array of floats.
  */
-void
-gld_adc_get_samples_float (GldAdc *daq, guint channel, float *samples, size_t samples_len)
+gboolean
+gld_adc_get_samples_float (GldAdc *daq, guint channel, float *samples, size_t samples_len, GldAdcWindow *window)
 {
     size_t sample_no = 0;
+    size_t first = 0, last = 0;
+    g_return_val_if_fail (daq->buffer_mode == GLD_ADC_BUFFER_CHANNELS, FALSE);
 
     while (sample_no < samples_len) {
-        int16_t data;
-        if (data_buffer_pull_data (daq->buffer[channel], &data)) {
-            samples[sample_no] = data;
-            sample_no++;
-        } else {
-            /* sleep a little, as we have no data in the buffer */
-            nanosleep (&daq->nodata_sleep_time, NULL);
-        }
+        size_t len, position;
+
+        /* block until all remaining samples have arrived */
+        if (!data_buffer_wait_for (daq->buffer[channel], &daq->running, samples_len - sample_no, -1))
+            return FALSE;
+
+        len = data_buffer_pull_float (daq->buffer[channel],
+                                      samples + sample_no,
+                                      samples_len - sample_no,
+                                      &position);
+        if (sample_no == 0)
+            first = position;
+        last = position + len - 1;
+        sample_no += len;
     }
+
+    if (samples_len > 0)
+        gld_adc_fill_window (daq, first, last, window);
+    return TRUE;
+}
+
+/**
+ * gld_adc_get_latest_window_float:
+ * @channel: The channel to read
+ * @samples: Array of @samples_len floats
+ * @samples_len: Length of the window
+ * @hop_len: Number of new samples to wait for
+ * @window: (nullable): Location to store index and acquisition time of the samples
+ *
+ * Read a sliding window of the @samples_len most recent samples of @channel.
+ * This function blocks only until @hop_len new samples have been acquired
+ * since the previous call, the rest of the window is taken from the history
+ * kept in the ring buffer. If the caller is slower than @hop_len samples per
+ * call, intermediate windows are skipped and the newest one is returned.
+ *
+ * Returns: %TRUE on success, %FALSE if acquisition stopped before enough data was available.
+ */
+gboolean
+gld_adc_get_latest_window_float (GldAdc *daq, guint channel, float *samples, size_t samples_len, size_t hop_len, GldAdcWindow *window)
+{
+    DataBuffer *dbuf;
+    size_t len, position;
+
+    g_return_val_if_fail (daq->buffer_mode == GLD_ADC_BUFFER_CHANNELS, FALSE);
+    dbuf = daq->buffer[channel];
+    g_return_val_if_fail (samples_len > 0 && samples_len < dbuf->capacity, FALSE);
+
+    if (!data_buffer_wait_for_latest (dbuf, &daq->running, samples_len, hop_len))
+        return FALSE;
+
+    /* all data is available already, and the producer only ever adds more */
+    len = data_buffer_pull_float (dbuf, samples, samples_len, &position);
+    g_assert (len == samples_len);
+
+    gld_adc_fill_window (daq, position, position + len - 1, window);
+    return TRUE;
+}
+
+/**
+ * gld_adc_get_sample_time:
+ * @index: Sample index, as found in a #GldAdcWindow
+ * @time_ns: Location to store the CLOCK_MONOTONIC acquisition time in nanoseconds
+ *
+ * Look up when the scan with sample index @index was acquired.
+ *
+ * Returns: %TRUE if the scan is still known, %FALSE if its data was already
+ * overwritten, its grid point was skipped, or it was not acquired yet.
+ */
+gboolean
+gld_adc_get_sample_time (GldAdc *daq, guint64 index, int64_t *time_ns)
+{
+    return scan_times_lookup_index (daq->scan_times, index, time_ns);
 }
 
 /**
@@ -553,9 +1959,340 @@ gld_adc_get_samples_float (GldAdc *daq, guint channel, float *samples, size_t sa
 void
 gld_adc_skip_to_front (GldAdc *daq, guint channel)
 {
-    static pthread_mutex_t mutex;
+    DataBuffer *dbuf;
+
+    g_return_if_fail (daq->buffer_mode == GLD_ADC_BUFFER_CHANNELS);
+    dbuf = daq->buffer[channel];
+
+    atomic_store_explicit (&dbuf->tail,
+                           atomic_load_explicit (&dbuf->head, memory_order_acquire),
+                           memory_order_release);
+}
+
+/**
+ * gld_adc_get_overrun_count:
+ *
+ * Returns: The number of samples of @channel that were overwritten by the
+ * DAQ thread before they could be read since acquisition was started.
+ */
+size_t
+gld_adc_get_overrun_count (GldAdc *daq, guint channel)
+{
+    DataBuffer *dbuf;
+
+    g_assert (channel < daq->channel_count);
+    /* in frame mode, an overrun always affects all channels */
+    dbuf = daq->buffer_mode == GLD_ADC_BUFFER_FRAMES? daq->frames : daq->buffer[channel];
+    return atomic_load_explicit (&dbuf->overruns, memory_order_relaxed);
+}
+
+/**
+ * gld_adc_get_stats:
+ * @stats: Location to store the statistics
+ *
+ * Get acquisition health statistics since acquisition was started.
+ * This is safe to call while the DAQ thread is running.
+ */
+void
+gld_adc_get_stats (GldAdc *daq, GldAdcStats *stats)
+{
+    AdcStats *s = daq->stats;
+    guint i;
+
+    memset (stats, 0, sizeof (GldAdcStats));
+    stats->channel_count = daq->channel_count;
+    stats->samples_acquired = atomic_load_explicit (&s->samples_acquired, memory_order_relaxed);
+    stats->samples_dropped = atomic_load_explicit (&s->samples_dropped, memory_order_relaxed);
+    stats->deadline_misses = atomic_load_explicit (&s->deadline_misses, memory_order_relaxed);
+    stats->scan_duration_max_ns = atomic_load_explicit (&s->scan_duration_max_ns, memory_order_relaxed);
+    stats->scan_interval_max_ns = atomic_load_explicit (&s->scan_interval_max_ns, memory_order_relaxed);
+    for (i = 0; i < GLD_ADC_HISTOGRAM_BUCKETS; i++) {
+        stats->scan_duration_hist[i] = atomic_load_explicit (&s->scan_duration_hist[i], memory_order_relaxed);
+        stats->scan_interval_hist[i] = atomic_load_explicit (&s->scan_interval_hist[i], memory_order_relaxed);
+    }
+    for (i = 0; i < daq->channel_count; i++)
+        stats->overruns[i] = gld_adc_get_overrun_count (daq, i);
+}
+
+/**
+ * gld_adc_print_histogram:
+ */
+static void
+gld_adc_print_histogram (FILE *stream, const gchar *title, const guint64 *hist, int64_t max_ns)
+{
+    guint i;
+
+    fprintf (stream, "  %s (max %.1f us):\n", title, max_ns / 1000.0);
+    for (i = 0; i < GLD_ADC_HISTOGRAM_BUCKETS; i++) {
+        if (hist[i] == 0)
+            continue;
+        fprintf (stream, "    %10.3f - %10.3f us: %"G_GUINT64_FORMAT"\n",
+                 (1ULL << i) / 1000.0,
+                 (2ULL << i) / 1000.0,
+                 hist[i]);
+    }
+}
+
+/**
+ * gld_adc_print_stats:
+ * @stream: Where to print the statistics, e.g. stdout
+ *
+ * Print a human-readable summary of the acquisition health statistics.
+ */
+void
+gld_adc_print_stats (GldAdc *daq, FILE *stream)
+{
+    GldAdcStats stats;
+    guint i;
+
+    gld_adc_get_stats (daq, &stats);
+
+    fprintf (stream, "ADC acquisition statistics:\n");
+    fprintf (stream, "  Samples acquired: %"G_GUINT64_FORMAT" per channel\n", stats.samples_acquired);
+    fprintf (stream, "  Samples dropped: %"G_GUINT64_FORMAT" (%"G_GUINT64_FORMAT" missed deadlines)\n",
+             stats.samples_dropped, stats.deadline_misses);
+    fprintf (stream, "  Buffer overruns:");
+    for (i = 0; i < stats.channel_count; i++)
+        fprintf (stream, " %u: %"G_GUINT64_FORMAT, i, stats.overruns[i]);
+    fprintf (stream, "\n");
+    gld_adc_print_histogram (stream, "Scan duration", stats.scan_duration_hist, stats.scan_duration_max_ns);
+    gld_adc_print_histogram (stream, "Scan interval", stats.scan_interval_hist, stats.scan_interval_max_ns);
+}
+
+/**
+ * gld_adc_wait_for:
+ * @channel: The channel to wait for
+ * @n: Number of unread samples to wait for
+ * @timeout_usec: Maximum time to wait in microseconds, or -1 to wait until the data arrives
+ *
+ * Block until at least @n unread samples are available in @channel.
+ * The DAQ thread wakes the caller as soon as the n-th sample was stored,
+ * so no time is spent polling the buffer.
+ *
+ * Returns: %TRUE if the data is available, %FALSE on timeout or if acquisition was stopped.
+ */
+gboolean
+gld_adc_wait_for (GldAdc *daq, guint channel, size_t n, gint64 timeout_usec)
+{
+    g_assert (channel < daq->channel_count);
+    g_return_val_if_fail (daq->buffer_mode == GLD_ADC_BUFFER_CHANNELS, FALSE);
+
+    return data_buffer_wait_for (daq->buffer[channel], &daq->running, n, timeout_usec);
+}
+
+/**
+ * gld_adc_wait_for_frames:
+ *
+ * Same as %gld_adc_wait_for, but for frames in %GLD_ADC_BUFFER_FRAMES mode.
+ */
+gboolean
+gld_adc_wait_for_frames (GldAdc *daq, size_t n, gint64 timeout_usec)
+{
+    g_return_val_if_fail (daq->buffer_mode == GLD_ADC_BUFFER_FRAMES, FALSE);
+
+    return data_buffer_wait_for (daq->frames, &daq->running, n, timeout_usec);
+}
+
+/**
+ * gld_adc_peek:
+ * @channel: The channel to read from
+ * @n: Maximum number of samples to expose
+ * @span1: Returns the first part of the data
+ * @span2: Returns the part of the data that wrapped around the end of the ring buffer, may be empty
+ *
+ * Give direct read access to up to @n of the oldest unread samples of @channel
+ * without copying them. The data is split over two contiguous spans if it wraps
+ * around the end of the ring buffer.
+ * Use %gld_adc_wait_for to block until enough data is available.
+ * Once the data has been processed, it must be released with %gld_adc_commit.
+ * The spans stay valid as long as the reader does not fall behind the DAQ thread
+ * by more than the buffer capacity, which %gld_adc_commit will report.
+ * This function does not block. Only valid in %GLD_ADC_BUFFER_CHANNELS mode.
+ *
+ * Returns: The number of samples available in both spans, at most @n.
+ */
+size_t
+gld_adc_peek (GldAdc *daq, guint channel, size_t n, GldAdcSpan *span1, GldAdcSpan *span2)
+{
+    g_assert (channel < daq->channel_count);
+    g_return_val_if_fail (daq->buffer_mode == GLD_ADC_BUFFER_CHANNELS, 0);
+
+    return data_buffer_peek (daq->buffer[channel], n, span1, span2);
+}
+
+/**
+ * gld_adc_commit:
+ * @channel: The channel that was read from
+ * @n: Number of samples to release, not more than was returned by %gld_adc_peek
+ *
+ * Mark @n samples previously obtained with %gld_adc_peek as read.
+ *
+ * Returns: %FALSE if the DAQ thread overwrote the peeked data before it was committed,
+ *          in which case the data in the spans must be discarded.
+ */
+gboolean
+gld_adc_commit (GldAdc *daq, guint channel, size_t n)
+{
+    g_assert (channel < daq->channel_count);
+    g_return_val_if_fail (daq->buffer_mode == GLD_ADC_BUFFER_CHANNELS, FALSE);
+
+    return data_buffer_commit (daq->buffer[channel], n);
+}
+
+/**
+ * gld_adc_peek_frames:
+ *
+ * Same as %gld_adc_peek, but for interleaved frames in %GLD_ADC_BUFFER_FRAMES mode.
+ * The length of the spans is given in frames.
+ */
+size_t
+gld_adc_peek_frames (GldAdc *daq, size_t n, GldAdcSpan *span1, GldAdcSpan *span2)
+{
+    g_return_val_if_fail (daq->buffer_mode == GLD_ADC_BUFFER_FRAMES, 0);
+
+    return data_buffer_peek (daq->frames, n, span1, span2);
+}
+
+/**
+ * gld_adc_commit_frames:
+ *
+ * Same as %gld_adc_commit, but for frames obtained with %gld_adc_peek_frames.
+ */
+gboolean
+gld_adc_commit_frames (GldAdc *daq, size_t n)
+{
+    g_return_val_if_fail (daq->buffer_mode == GLD_ADC_BUFFER_FRAMES, FALSE);
+
+    return data_buffer_commit (daq->frames, n);
+}
+
+/**
+ * gld_adc_get_frames:
+ * @frames: Array of at least @n_frames * channel_count values
+ * @n_frames: Number of frames to read
+ * @window: (nullable): Location to store index and acquisition time of the frames
+ *
+ * Get @n_frames interleaved frames of all channels, with the samples of all
+ * channels of the same scan being next to each other.
+ * This function will block until the requested number of frames has
+ * been added to the buffer. Only valid in %GLD_ADC_BUFFER_FRAMES mode.
+ *
+ * Returns: %TRUE on success, %FALSE if acquisition stopped before enough data was available.
+ */
+gboolean
+gld_adc_get_frames (GldAdc *daq, int16_t *frames, size_t n_frames, GldAdcWindow *window)
+{
+    size_t frame_no = 0;
+    size_t first = 0, last = 0;
+    g_return_val_if_fail (daq->buffer_mode == GLD_ADC_BUFFER_FRAMES, FALSE);
+
+    while (frame_no < n_frames) {
+        size_t len, position;
+
+        /* block until all remaining frames have arrived */
+        if (!data_buffer_wait_for (daq->frames, &daq->running, n_frames - frame_no, -1))
+            return FALSE;
+
+        len = data_buffer_pull_frames (daq->frames,
+                                       frames + frame_no * daq->channel_count,
+                                       n_frames - frame_no,
+                                       &position);
+        if (frame_no == 0)
+            first = position;
+        last = position + len - 1;
+        frame_no += len;
+    }
+
+    if (n_frames > 0)
+        gld_adc_fill_window (daq, first, last, window);
+    return TRUE;
+}
+
+/**
+ * gld_adc_get_frames_float:
+ * @channel_data: Array of channel_count float arrays, each holding at least @n_frames values
+ * @n_frames: Number of frames to read
+ *
+ * Get @n_frames sample-aligned frames, deinterleaved into one float array
+ * per channel in a single pass. Channels whose entry in @channel_data is
+ * %NULL are skipped.
+ * This function will block until the requested number of frames has
+ * been added to the buffer. Only valid in %GLD_ADC_BUFFER_FRAMES mode.
+ *
+ * Returns: %TRUE on success, %FALSE if acquisition stopped before enough data was available.
+ */
+gboolean
+gld_adc_get_frames_float (GldAdc *daq, float **channel_data, size_t n_frames, GldAdcWindow *window)
+{
+    size_t frame_no = 0;
+    size_t first = 0, last = 0;
+    g_return_val_if_fail (daq->buffer_mode == GLD_ADC_BUFFER_FRAMES, FALSE);
+
+    while (frame_no < n_frames) {
+        size_t len, position;
+
+        /* block until all remaining frames have arrived */
+        if (!data_buffer_wait_for (daq->frames, &daq->running, n_frames - frame_no, -1))
+            return FALSE;
+
+        len = data_buffer_pull_frames_float (daq->frames,
+                                             channel_data,
+                                             frame_no,
+                                             n_frames - frame_no,
+                                             &position);
+        if (frame_no == 0)
+            first = position;
+        last = position + len - 1;
+        frame_no += len;
+    }
+
+    if (n_frames > 0)
+        gld_adc_fill_window (daq, first, last, window);
+    return TRUE;
+}
+
+/**
+ * gld_adc_get_latest_frames_float:
+ * @channel_data: Array of channel_count float arrays of length @n_frames, entries may be %NULL
+ * @n_frames: Length of the window
+ * @hop_len: Number of new frames to wait for
+ * @window: (nullable): Location to store index and acquisition time of the frames
+ *
+ * Same as %gld_adc_get_latest_window_float, but reading a sliding window
+ * of all channels in %GLD_ADC_BUFFER_FRAMES mode.
+ *
+ * Returns: %TRUE on success, %FALSE if acquisition stopped before enough data was available.
+ */
+gboolean
+gld_adc_get_latest_frames_float (GldAdc *daq, float **channel_data, size_t n_frames, size_t hop_len, GldAdcWindow *window)
+{
+    size_t len, position;
+
+    g_return_val_if_fail (daq->buffer_mode == GLD_ADC_BUFFER_FRAMES, FALSE);
+    g_return_val_if_fail (n_frames > 0 && n_frames < daq->frames->capacity, FALSE);
+
+    if (!data_buffer_wait_for_latest (daq->frames, &daq->running, n_frames, hop_len))
+        return FALSE;
+
+    len = data_buffer_pull_frames_float (daq->frames, channel_data, 0, n_frames, &position);
+    g_assert (len == n_frames);
+
+    gld_adc_fill_window (daq, position, position + len - 1, window);
+    return TRUE;
+}
+
+/**
+ * gld_adc_skip_frames_to_front:
+ *
+ * Skip to the front of the frame buffer, ignoring all previously
+ * recorded data. Only valid in %GLD_ADC_BUFFER_FRAMES mode.
+ */
+void
+gld_adc_skip_frames_to_front (GldAdc *daq)
+{
+    g_return_if_fail (daq->buffer_mode == GLD_ADC_BUFFER_FRAMES);
 
-    pthread_mutex_lock (&mutex);
-    data_buffer_reset (daq->buffer[channel]);
-    pthread_mutex_unlock (&mutex);
+    atomic_store_explicit (&daq->frames->tail,
+                           atomic_load_explicit (&daq->frames->head, memory_order_acquire),
+                           memory_order_release);
 }
@@ -21,21 +21,131 @@
 #define __GLD_ADC_H
 
 #include <glib.h>
+#include <stdio.h>
 #include <stdint.h>
+#include <pthread.h>
+
+/**
+ * GldAdcBufferMode:
+ * @GLD_ADC_BUFFER_CHANNELS:	One ring buffer per channel
+ * @GLD_ADC_BUFFER_FRAMES:	One ring buffer of interleaved frames, one frame per scan
+ *
+ * How acquired samples are stored.
+ **/
+typedef enum {
+    GLD_ADC_BUFFER_CHANNELS,
+    GLD_ADC_BUFFER_FRAMES
+} GldAdcBufferMode;
+
+/**
+ * GldAdcSpan:
+ *
+ * A contiguous piece of ring buffer memory, with @len
+ * samples (or frames, in frame mode) starting at @data.
+ **/
+typedef struct {
+    const int16_t *data;
+    size_t len;
+} GldAdcSpan;
+
+/**
+ * GldAdcWindow:
+ * @first_index: Sample index of the first scan, counted from the start of acquisition
+ * @last_index: Sample index of the last scan
+ * @first_time_ns: CLOCK_MONOTONIC time the first scan was acquired, in nanoseconds
+ * @last_time_ns: CLOCK_MONOTONIC time the last scan was acquired, in nanoseconds
+ *
+ * Describes which scans a block of read data came from.
+ * If @last_index - @first_index is larger than the number of read
+ * samples minus one, data was overwritten while reading it.
+ **/
+typedef struct {
+    guint64 first_index;
+    guint64 last_index;
+    int64_t first_time_ns;
+    int64_t last_time_ns;
+} GldAdcWindow;
+
+/**
+ * GldAdcBackendCaps:
+ * @GLD_ADC_BACKEND_CAP_NONE:		No special capabilities
+ * @GLD_ADC_BACKEND_CAP_HARDWARE:	Acquires from the real ADCs of the Galdur board
+ * @GLD_ADC_BACKEND_CAP_MMIO:		Accesses the BCM2835 peripherals directly, %gld_board_initialize must be called first
+ * @GLD_ADC_BACKEND_CAP_BATCHED:	Supports batched SPI transactions, see %gld_adc_set_batched_spi
+ * @GLD_ADC_BACKEND_CAP_FINITE:		May run out of data and stop acquisition by itself
+ * @GLD_ADC_BACKEND_CAP_PACED:		Acquisition is paced by the backend (e.g. a kernel driver), not by the DAQ thread
+ *
+ * Capabilities of an acquisition backend.
+ **/
+typedef enum {
+    GLD_ADC_BACKEND_CAP_NONE     = 0,
+    GLD_ADC_BACKEND_CAP_HARDWARE = 1 << 0,
+    GLD_ADC_BACKEND_CAP_MMIO     = 1 << 1,
+    GLD_ADC_BACKEND_CAP_BATCHED  = 1 << 2,
+    GLD_ADC_BACKEND_CAP_FINITE   = 1 << 3,
+    GLD_ADC_BACKEND_CAP_PACED    = 1 << 4
+} GldAdcBackendCaps;
+
+#define GLD_ADC_HISTOGRAM_BUCKETS 32
+
+/**
+ * GldAdcStats:
+ * @channel_count: Number of valid entries in @overruns
+ * @samples_acquired: Number of scans taken, i.e. samples per channel
+ * @samples_dropped: Samples per channel that were never acquired, because the DAQ thread fell behind its sampling grid
+ * @deadline_misses: Number of times the DAQ thread fell behind, each one dropping one or more samples
+ * @overruns: Per channel, number of samples overwritten before they were read
+ * @scan_duration_max_ns: Longest time a single scan took
+ * @scan_interval_max_ns: Longest time between the start of two consecutive scans
+ * @scan_duration_hist: Histogram of scan durations, bucket i counts durations of 2^i to 2^(i+1) ns.
+ *   For backends acquiring blocks of scans, the average per scan of a block is counted.
+ * @scan_interval_hist: Histogram of the time between two consecutive scans, bucketed like @scan_duration_hist
+ *
+ * Acquisition health statistics, see %gld_adc_get_stats.
+ **/
+typedef struct {
+    guint channel_count;
+    guint64 samples_acquired;
+    guint64 samples_dropped;
+    guint64 deadline_misses;
+    guint64 overruns[16];
+
+    int64_t scan_duration_max_ns;
+    int64_t scan_interval_max_ns;
+    guint64 scan_duration_hist[GLD_ADC_HISTOGRAM_BUCKETS];
+    guint64 scan_interval_hist[GLD_ADC_HISTOGRAM_BUCKETS];
+} GldAdcStats;
 
 typedef struct
 {
     struct _DataBuffer **buffer;
+    struct _DataBuffer *frames;
+    struct _ScanTimes *scan_times;
+    guint8 scan_list[16];        /* physical channel of each logical channel */
+    gboolean batched_spi;
+
+    const struct _GldAdcBackend *backend; /* where samples are acquired from */
+    gpointer backend_priv;
+    gboolean backend_started;
+    guint scan_block_size;       /* number of scans the backend acquires at once */
     guint       channel_count;
     pthread_t   tid;
 
+    GldAdcBufferMode buffer_mode;
+    size_t      buffer_capacity;
+
     guint acq_frequency;
     ssize_t sample_max_count;
+    int64_t busy_wait_ns;
+    struct _AdcStats *stats;
 
     int cpu_affinity;
-    struct timespec nodata_sleep_time;
+    /* DAQ thread state, changes are signalled via @state_cond */
+    pthread_mutex_t state_lock;
+    pthread_cond_t state_cond;
     volatile gboolean running;
     volatile gboolean shutdown;
+    gboolean parked; /* DAQ thread is idle and waiting to be started */
 } GldAdc;
 
 GldAdc          *gld_adc_new (guint channel_count,
@@ -45,35 +155,115 @@ void            gld_adc_free (GldAdc *daq);
 
 void            gld_adc_set_acq_frequency (GldAdc *daq,
                                               guint hz);
-void            gld_adc_set_nodata_sleep_time (GldAdc *daq,
-                                               struct timespec time);
+void            gld_adc_set_busy_wait_time (GldAdc *daq,
+                                            guint usec);
+
+gboolean        gld_adc_set_backend (GldAdc *daq,
+                                     const gchar *spec);
+const gchar     *gld_adc_get_backend_name (GldAdc *daq);
+GldAdcBackendCaps gld_adc_get_backend_caps (GldAdc *daq);
+
+const gchar     *gld_adc_get_default_backend (void);
+gboolean        gld_adc_lookup_backend_caps (const gchar *spec,
+                                             GldAdcBackendCaps *caps);
+void            gld_adc_print_backends (FILE *stream);
+
+void            gld_adc_set_batched_spi (GldAdc *daq,
+                                         gboolean batched);
+gboolean        gld_adc_set_scan_list (GldAdc *daq,
+                                       const guint *channels,
+                                       guint n_channels);
+
+gboolean        gld_adc_set_buffer_mode (GldAdc *daq,
+                                         GldAdcBufferMode mode);
+GldAdcBufferMode gld_adc_get_buffer_mode (GldAdc *daq);
 
-void            gld_adc_acquire_single_dataset (GldAdc *daq);
+gboolean        gld_adc_acquire_single_dataset (GldAdc *daq);
 gboolean        gld_adc_acquire_samples (GldAdc *daq,
                                          ssize_t sample_count);
 
 gboolean        gld_adc_reset (GldAdc *daq);
+void            gld_adc_wait_finished (GldAdc *daq);
 gboolean        gld_adc_is_running (GldAdc *daq);
 
 gboolean        gld_adc_get_sample (GldAdc *daq,
                                      guint channel,
                                      int16_t *data);
 
-void            gld_adc_get_samples (GldAdc *daq,
+gboolean        gld_adc_get_samples (GldAdc *daq,
                                      guint channel,
                                      int16_t *samples,
-                                     size_t samples_len);
-void            gld_adc_get_samples_double (GldAdc *daq,
+                                     size_t samples_len,
+                                     GldAdcWindow *window);
+gboolean        gld_adc_get_samples_double (GldAdc *daq,
                                             guint channel,
                                             double *samples,
-                                            size_t samples_len);
-void            gld_adc_get_samples_float (GldAdc *daq,
+                                            size_t samples_len,
+                                            GldAdcWindow *window);
+gboolean        gld_adc_get_samples_float (GldAdc *daq,
                                            guint channel,
                                            float *samples,
-                                           size_t samples_len);
+                                           size_t samples_len,
+                                           GldAdcWindow *window);
+
+gboolean        gld_adc_get_latest_window_float (GldAdc *daq,
+                                                 guint channel,
+                                                 float *samples,
+                                                 size_t samples_len,
+                                                 size_t hop_len,
+                                                 GldAdcWindow *window);
+
+gboolean        gld_adc_get_sample_time (GldAdc *daq,
+                                         guint64 index,
+                                         int64_t *time_ns);
 
 void            gld_adc_skip_to_front (GldAdc *daq,
                                        guint channel);
 
+size_t          gld_adc_get_overrun_count (GldAdc *daq,
+                                           guint channel);
+void            gld_adc_get_stats (GldAdc *daq,
+                                   GldAdcStats *stats);
+void            gld_adc_print_stats (GldAdc *daq,
+                                     FILE *stream);
+
+gboolean        gld_adc_wait_for (GldAdc *daq,
+                                  guint channel,
+                                  size_t n,
+                                  gint64 timeout_usec);
+gboolean        gld_adc_wait_for_frames (GldAdc *daq,
+                                         size_t n,
+                                         gint64 timeout_usec);
+
+size_t          gld_adc_peek (GldAdc *daq,
+                              guint channel,
+                              size_t n,
+                              GldAdcSpan *span1,
+                              GldAdcSpan *span2);
+gboolean        gld_adc_commit (GldAdc *daq,
+                                guint channel,
+                                size_t n);
+size_t          gld_adc_peek_frames (GldAdc *daq,
+                                     size_t n,
+                                     GldAdcSpan *span1,
+                                     GldAdcSpan *span2);
+gboolean        gld_adc_commit_frames (GldAdc *daq,
+                                       size_t n);
+
+gboolean        gld_adc_get_frames (GldAdc *daq,
+                                    int16_t *frames,
+                                    size_t n_frames,
+                                    GldAdcWindow *window);
+gboolean        gld_adc_get_frames_float (GldAdc *daq,
+                                          float **channel_data,
+                                          size_t n_frames,
+                                          GldAdcWindow *window);
+gboolean        gld_adc_get_latest_frames_float (GldAdc *daq,
+                                                 float **channel_data,
+                                                 size_t n_frames,
+                                                 size_t hop_len,
+                                                 GldAdcWindow *window);
+void            gld_adc_skip_frames_to_front (GldAdc *daq);
+
 
 #endif /* __GLD_ADC_H */
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2016-2017 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gld-max1133.h"
+
+#include <string.h>
+
+#define BIT(x) (1UL << x)
+
+#define MAX1133_START       BIT(7) /* start byte */
+#define MAX1133_UNIPOLAR    BIT(6) /* unipolar mode if set, bipolar if not set */
+#define MAX1133_INT_CLOCK   BIT(5) /* use internat clock if set, use external if not set */
+
+#define MAX1133_M1       BIT(4)
+#define MAX1133_M0       BIT(3)
+
+#define MAX1133_P2       BIT(2)
+#define MAX1133_P1       BIT(1)
+#define MAX1133_P0       BIT(0)
+
+static uint8_t max1133_mux_channel_map[8] = {
+    0,
+    MAX1133_P0,
+    MAX1133_P1,
+    MAX1133_P0 | MAX1133_P1,
+    MAX1133_P2,
+    MAX1133_P0 | MAX1133_P2,
+    MAX1133_P1 | MAX1133_P2,
+    MAX1133_P0 | MAX1133_P1 | MAX1133_P2
+};
+
+/**
+ * gld_max1133_program_build:
+ * @scan_list: Physical channel (0-15) of each logical channel
+ * @n_channels: Length of @scan_list
+ *
+ * Compute the SPI transactions of a scan from the scan list.
+ * Every chip converts its channels in scan list order, and since the
+ * result of transaction j arrives with transaction j + 1, the first
+ * transaction of a scan returns the last channel of the previous scan.
+ */
+void
+gld_max1133_program_build (GldMax1133Program *prog, const guint8 *scan_list, guint n_channels)
+{
+    guint chip, i, j;
+
+    prog->n_ops = 0;
+    for (chip = 0; chip < 2; chip++) {
+        guint logical[GLD_MAX1133_MAX_CHANNELS];
+        guint n = 0;
+
+        for (i = 0; i < n_channels; i++) {
+            if (scan_list[i] / 8 == chip)
+                logical[n++] = i;
+        }
+
+        for (j = 0; j < n; j++) {
+            GldMax1133Op *op = &prog->ops[prog->n_ops];
+
+            prog->txbuf[2 * prog->n_ops] = MAX1133_START | max1133_mux_channel_map[scan_list[logical[j]] % 8];
+            prog->txbuf[2 * prog->n_ops + 1] = 0;
+            op->chip = chip;
+            op->dest = logical[(j + n - 1) % n];
+            prog->n_ops++;
+        }
+        prog->chip_ops[chip] = n;
+    }
+}
+
+/**
+ * gld_max1133_program_demux:
+ * @rxbuf: Bytes received for all operations of @prog, 2 per operation
+ * @frame: Destination, indexed by logical channel
+ *
+ * Sort the results of a scan into their logical channels.
+ */
+void
+gld_max1133_program_demux (const GldMax1133Program *prog, const uint8_t *rxbuf, int16_t *frame)
+{
+    guint i;
+
+    for (i = 0; i < prog->n_ops; i++) {
+        int16_t rxval;
+        memcpy (&rxval, &rxbuf[2 * i], sizeof(int16_t));
+        frame[prog->ops[i].dest] = rxval;
+    }
+}
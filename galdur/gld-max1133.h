@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2016-2017 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GLD_MAX1133_H
+#define __GLD_MAX1133_H
+
+#include <glib.h>
+#include <stdint.h>
+
+#define GLD_MAX1133_MAX_CHANNELS 16
+
+/**
+ * GldMax1133Op:
+ *
+ * A single SPI transaction of a scan. The MAX1133 is pipelined: the
+ * transaction that selects a mux input returns the result of the previous
+ * conversion on the same chip, which is stored as logical channel @dest.
+ */
+typedef struct {
+    uint8_t chip;    /* 0 for the first MAX1133, 1 for the second */
+    uint8_t dest;    /* logical channel receiving the returned sample */
+} GldMax1133Op;
+
+/**
+ * GldMax1133Program:
+ *
+ * All SPI transactions of one scan over the two MAX1133 chips of the
+ * Galdur board, the ones of the first chip first.
+ * @txbuf holds the two bytes sent with every operation: the control
+ * byte with start bit and mux input, and a padding byte clocking out
+ * the rest of the result.
+ */
+typedef struct {
+    GldMax1133Op ops[GLD_MAX1133_MAX_CHANNELS];
+    uint8_t txbuf[2 * GLD_MAX1133_MAX_CHANNELS];
+    guint n_ops;
+    guint chip_ops[2]; /* number of operations on each chip */
+} GldMax1133Program;
+
+void            gld_max1133_program_build (GldMax1133Program *prog,
+                                           const guint8 *scan_list,
+                                           guint n_channels);
+void            gld_max1133_program_demux (const GldMax1133Program *prog,
+                                           const uint8_t *rxbuf,
+                                           int16_t *frame);
+
+#endif /* __GLD_MAX1133_H */
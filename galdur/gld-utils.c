@@ -81,6 +81,28 @@ gld_milliseconds_from_timespec (struct timespec* duration)
     return ms;
 }
 
+/**
+ * gld_nanoseconds_from_timespec:
+ */
+int64_t
+gld_nanoseconds_from_timespec (const struct timespec* time)
+{
+    return ((int64_t) time->tv_sec * 1000000000LL) + time->tv_nsec;
+}
+
+/**
+ * gld_set_timespec_from_ns:
+ */
+struct timespec
+gld_set_timespec_from_ns (int64_t nanosec)
+{
+    struct timespec temp;
+    temp.tv_sec = nanosec / 1000000000LL;
+    temp.tv_nsec = nanosec % 1000000000LL;
+
+    return temp;
+}
+
 /**
  * gld_set_thread_cpu_affinity:
  *
@@ -25,11 +25,13 @@
 #include <glib.h>
 
 struct timespec gld_set_timespec_from_ms (double milisec);
+struct timespec gld_set_timespec_from_ns (int64_t nanosec);
 struct timespec gld_time_diff (struct timespec* start,
                       struct timespec* end);
 
 int64_t     gld_microsecond_from_timespec (struct timespec* duration);
 int64_t     gld_milliseconds_from_timespec (struct timespec* duration);
+int64_t     gld_nanoseconds_from_timespec (const struct timespec* time);
 
 int         gld_set_thread_cpu_affinity (int cpu_id);
 int         gld_set_thread_no_cpu_affinity (int cpu_id);
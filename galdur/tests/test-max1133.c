@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "gld-max1133.h"
+
+/**
+ * Max1133TestCase:
+ *
+ * A scan list and the SPI transactions expected for it. Operation j of a
+ * chip selects the mux input of its j-th channel, and returns the sample
+ * started by operation (j - 1) mod k of the same chip, k being the number
+ * of channels on that chip.
+ */
+typedef struct {
+    const gchar *name;
+    guint n_channels;
+    guint8 scan_list[GLD_MAX1133_MAX_CHANNELS];
+    guint chip_ops[2];
+    uint8_t control[GLD_MAX1133_MAX_CHANNELS]; /* control byte of every operation */
+    uint8_t chip[GLD_MAX1133_MAX_CHANNELS];
+    uint8_t dest[GLD_MAX1133_MAX_CHANNELS];
+} Max1133TestCase;
+
+static const Max1133TestCase test_cases[] = {
+    {
+        "full",
+        16,
+        { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+        { 8, 8 },
+        { 0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87 },
+        { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1 },
+        { 7, 0, 1, 2, 3, 4, 5, 6, 15, 8, 9, 10, 11, 12, 13, 14 },
+    },
+    {
+        "single chip",
+        3,
+        { 12, 8, 11 },
+        { 0, 3 },
+        { 0x84, 0x80, 0x83 },
+        { 1, 1, 1 },
+        { 2, 0, 1 },
+    },
+    {
+        "mixed chips",
+        6,
+        { 3, 9, 1, 15, 12, 5 },
+        { 3, 3 },
+        { 0x83, 0x81, 0x85, 0x81, 0x87, 0x84 },
+        { 0, 0, 0, 1, 1, 1 },
+        { 5, 0, 2, 4, 1, 3 },
+    },
+    {
+        "single channel",
+        1,
+        { 10 },
+        { 0, 1 },
+        { 0x82 },
+        { 1 },
+        { 0 },
+    },
+};
+
+static gboolean
+test_program_build (const Max1133TestCase *tc)
+{
+    GldMax1133Program prog;
+    gboolean ret = TRUE;
+    guint i;
+
+    gld_max1133_program_build (&prog, tc->scan_list, tc->n_channels);
+
+    if (prog.n_ops != tc->n_channels ||
+        prog.chip_ops[0] != tc->chip_ops[0] || prog.chip_ops[1] != tc->chip_ops[1]) {
+        g_printerr ("%s: %u operations (%u + %u), expected %u (%u + %u)\n", tc->name,
+                    prog.n_ops, prog.chip_ops[0], prog.chip_ops[1],
+                    tc->n_channels, tc->chip_ops[0], tc->chip_ops[1]);
+        return FALSE;
+    }
+
+    for (i = 0; i < prog.n_ops; i++) {
+        if (prog.txbuf[2 * i] != tc->control[i] || prog.txbuf[2 * i + 1] != 0 ||
+            prog.ops[i].chip != tc->chip[i] || prog.ops[i].dest != tc->dest[i]) {
+            g_printerr ("%s: operation %u sends 0x%02x 0x%02x to chip %u for channel %u, "
+                        "expected 0x%02x 0x00 to chip %u for channel %u\n", tc->name, i,
+                        prog.txbuf[2 * i], prog.txbuf[2 * i + 1], prog.ops[i].chip, prog.ops[i].dest,
+                        tc->control[i], tc->chip[i], tc->dest[i]);
+            ret = FALSE;
+        }
+    }
+
+    return ret;
+}
+
+static gboolean
+test_program_demux (const Max1133TestCase *tc)
+{
+    GldMax1133Program prog;
+    uint8_t rxbuf[2 * GLD_MAX1133_MAX_CHANNELS];
+    int16_t frame[GLD_MAX1133_MAX_CHANNELS];
+    gboolean ret = TRUE;
+    guint i;
+
+    gld_max1133_program_build (&prog, tc->scan_list, tc->n_channels);
+
+    /* every operation returns its own number */
+    for (i = 0; i < prog.n_ops; i++) {
+        const int16_t value = 100 + i;
+        memcpy (&rxbuf[2 * i], &value, sizeof(int16_t));
+    }
+    gld_max1133_program_demux (&prog, rxbuf, frame);
+
+    for (i = 0; i < prog.n_ops; i++) {
+        if (frame[tc->dest[i]] != 100 + (int16_t) i) {
+            g_printerr ("%s: channel %u got the sample of operation %i, expected %u\n",
+                        tc->name, tc->dest[i], frame[tc->dest[i]] - 100, i);
+            ret = FALSE;
+        }
+    }
+
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    gboolean ok = TRUE;
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (test_cases); i++) {
+        if (!test_program_build (&test_cases[i]) || !test_program_demux (&test_cases[i]))
+            ok = FALSE;
+        else
+            g_print ("%s: ok\n", test_cases[i].name);
+    }
+
+    return ok? 0 : 1;
+}
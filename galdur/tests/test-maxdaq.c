@@ -28,7 +28,7 @@ test_daq_speed ()
 
     gld_adc_acquire_samples (daq, SAMPLE_COUNT);
 
-    while (gld_adc_is_running (daq)) {}
+    gld_adc_wait_finished (daq);
 
     clock_gettime(CLOCK_REALTIME, &stop);
 
@@ -0,0 +1,180 @@
+#include <stdio.h>
+
+#include "galdur.h"
+#include "bcm2835-mock.h"
+
+static guint SAMPLE_COUNT = 500;
+static guint SAMPLE_FREQUENCY = 20000; /* 20 kHz */
+
+static gboolean test_failed = FALSE;
+
+/**
+ * test_source:
+ *
+ * Encode the physical channel and the number of the conversion in
+ * every sample, so we can tell exactly which one ended up where.
+ */
+static int16_t
+test_source (guint channel, guint64 index, gpointer user_data)
+{
+    return (int16_t) ((channel + 1) * 1000 + index % 1000);
+}
+
+/**
+ * test_sample_lags:
+ *
+ * The MAX1133 returns each conversion with the next transaction on the
+ * same chip, so the channel a chip converts last in a scan is returned
+ * by the first transaction of the next one, one scan late.
+ */
+static gboolean
+test_sample_lags (const guint *scan_list, guint n_channels, guint channel)
+{
+    guint i;
+
+    for (i = channel + 1; i < n_channels; i++) {
+        if (scan_list[i] / 8 == scan_list[channel] / 8)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+void
+test_acquire (const guint *scan_list, guint n_channels, gboolean batched)
+{
+    GldAdc *daq;
+    guint i, s;
+
+    g_print ("Acquiring %u channels (%s SPI transactions):", n_channels, batched? "batched" : "single");
+    for (i = 0; i < n_channels; i++)
+        g_print (" %u", scan_list[i]);
+    g_print ("\n");
+
+    /* initialize the board for every run, so the emulated ADCs start idle */
+    if (!gld_board_initialize ()) {
+        test_failed = TRUE;
+        return;
+    }
+    bcm2835_mock_set_adc_source (test_source, NULL);
+
+    daq = gld_adc_new (n_channels, SAMPLE_COUNT, -1);
+    if (!gld_adc_set_backend (daq, "bcm2835") ||
+        !gld_adc_set_scan_list (daq, scan_list, n_channels)) {
+        test_failed = TRUE;
+        goto out;
+    }
+    gld_adc_set_batched_spi (daq, batched);
+    gld_adc_set_acq_frequency (daq, SAMPLE_FREQUENCY);
+
+    gld_adc_acquire_samples (daq, SAMPLE_COUNT);
+    gld_adc_wait_finished (daq);
+
+    for (i = 0; i < n_channels; i++) {
+        const guint lag = test_sample_lags (scan_list, n_channels, i)? 1 : 0;
+
+        for (s = 0; s < SAMPLE_COUNT; s++) {
+            int16_t expected = 0;
+            int16_t data;
+
+            if (!gld_adc_get_sample (daq, i, &data)) {
+                g_printerr ("  channel %u: only %u of %u samples acquired\n", i, s, SAMPLE_COUNT);
+                test_failed = TRUE;
+                break;
+            }
+
+            /* the first scan returns nothing for the lagging channels, there was no conversion before it */
+            if (s >= lag)
+                expected = test_source (scan_list[i], s - lag, NULL);
+            if (data != expected) {
+                g_printerr ("  channel %u, scan %u: got %i, expected %i\n", i, s, data, expected);
+                test_failed = TRUE;
+                break;
+            }
+        }
+    }
+
+out:
+    gld_adc_free (daq);
+    bcm2835_mock_set_adc_source (NULL, NULL);
+    gld_board_shutdown ();
+}
+
+void
+test_gpio_edges ()
+{
+    static const uint8_t levels[] = { GLD_GPIO_HIGH, GLD_GPIO_LOW, GLD_GPIO_HIGH, GLD_GPIO_LOW };
+    Bcm2835MockGpioEdge *edges;
+    guint n_edges;
+    guint i;
+
+    g_print ("Checking GPIO edges\n");
+    if (!gld_board_initialize ()) {
+        test_failed = TRUE;
+        return;
+    }
+
+    /* forget whatever setting up the board did */
+    g_free (bcm2835_mock_steal_gpio_edges (&n_edges));
+
+    /* a pulse train on an output, and an external edge on an input */
+    gld_gpio_set_mode (GLD_GPIO_PIN_18, GLD_GPIO_MODE_OUTPUT);
+    for (i = 0; i < G_N_ELEMENTS (levels); i++)
+        gld_gpio_set_value (GLD_GPIO_PIN_18, levels[i]);
+    gld_gpio_set_mode (GLD_GPIO_PIN_23, GLD_GPIO_MODE_INPUT);
+    bcm2835_mock_set_gpio_input (GLD_GPIO_PIN_23, GLD_GPIO_HIGH);
+    if (gld_gpio_read_level (GLD_GPIO_PIN_23) != GLD_GPIO_HIGH) {
+        g_printerr ("  pin 23 does not read the level driven from outside\n");
+        test_failed = TRUE;
+    }
+
+    edges = bcm2835_mock_steal_gpio_edges (&n_edges);
+    if (n_edges != G_N_ELEMENTS (levels) + 1) {
+        g_printerr ("  got %u GPIO edges, expected %u\n", n_edges, (guint) G_N_ELEMENTS (levels) + 1);
+        test_failed = TRUE;
+    } else {
+        for (i = 0; i < n_edges; i++) {
+            const uint8_t pin = i < G_N_ELEMENTS (levels)? GLD_GPIO_PIN_18 : GLD_GPIO_PIN_23;
+            const uint8_t level = i < G_N_ELEMENTS (levels)? levels[i] : GLD_GPIO_HIGH;
+
+            if (edges[i].pin != pin || edges[i].level != level) {
+                g_printerr ("  edge %u: pin %u went to %u, expected pin %u to go to %u\n",
+                            i, edges[i].pin, edges[i].level, pin, level);
+                test_failed = TRUE;
+            }
+            if (i > 0 && edges[i].time_ns < edges[i - 1].time_ns) {
+                g_printerr ("  edge %u happened before the one preceding it\n", i);
+                test_failed = TRUE;
+            }
+        }
+    }
+    g_free (edges);
+
+    bcm2835_mock_set_gpio_input (GLD_GPIO_PIN_23, GLD_GPIO_LOW);
+    gld_board_shutdown ();
+}
+
+int main(int argc, char **argv)
+{
+    static const guint all_channels[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+    static const guint first_chip[] = { 6, 2, 0 };
+    static const guint second_chip[] = { 12, 8 };
+    static const guint mixed_chips[] = { 3, 9, 1, 15, 12, 5 };
+    static const guint one_channel[] = { 10 };
+    guint batched;
+
+    for (batched = 0; batched < 2; batched++) {
+        test_acquire (all_channels, G_N_ELEMENTS (all_channels), batched);
+        test_acquire (first_chip, G_N_ELEMENTS (first_chip), batched);
+        test_acquire (second_chip, G_N_ELEMENTS (second_chip), batched);
+        test_acquire (mixed_chips, G_N_ELEMENTS (mixed_chips), batched);
+        test_acquire (one_channel, G_N_ELEMENTS (one_channel), batched);
+    }
+
+    test_gpio_edges ();
+
+    if (test_failed) {
+        g_printerr ("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
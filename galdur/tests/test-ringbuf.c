@@ -0,0 +1,111 @@
+#include <stdio.h>
+
+/* the ring buffer is private to the ADC code, so test it from the inside */
+#include "gld-adc.c"
+
+#define TEST_CAPACITY 16
+
+static gboolean test_failed = FALSE;
+
+static void
+push_items (DataBuffer *dbuf, guint n)
+{
+    guint i;
+
+    for (i = 0; i < n; i++) {
+        const int16_t value = (int16_t) atomic_load_explicit (&dbuf->head, memory_order_relaxed);
+        data_buffer_push_data (dbuf, &value);
+    }
+}
+
+static void
+check_position (const gchar *what, size_t position, size_t expected)
+{
+    if (position == expected)
+        return;
+    g_printerr ("  %s: read position %zu, expected %zu\n", what, position, expected);
+    test_failed = TRUE;
+}
+
+/**
+ * test_lap_while_reading:
+ *
+ * The producer gets exactly one ring ahead of the reader while it copies,
+ * so the oldest item may be half overwritten and the read has to be retried.
+ */
+static void
+test_lap_while_reading ()
+{
+    DataBuffer *dbuf;
+    size_t tail, len;
+
+    g_print ("Lapping a reader by exactly the capacity while it reads\n");
+    dbuf = data_buffer_new (TEST_CAPACITY, 1);
+
+    push_items (dbuf, 4);
+    len = data_buffer_pull_begin (dbuf, TEST_CAPACITY, &tail);
+    check_position ("before the lap", tail, 0);
+    if (len != 4) {
+        g_printerr ("  %zu items readable, expected 4\n", len);
+        test_failed = TRUE;
+    }
+
+    push_items (dbuf, TEST_CAPACITY - 4);
+    if (data_buffer_pull_end (dbuf, tail, len)) {
+        g_printerr ("  read was committed although the producer is writing to its first slot\n");
+        test_failed = TRUE;
+    }
+    check_position ("after the lap", atomic_load_explicit (&dbuf->tail, memory_order_relaxed), 1);
+
+    data_buffer_free (dbuf);
+}
+
+/**
+ * test_lap_before_reading:
+ *
+ * A reader that was lapped by exactly the capacity before it started
+ * must skip the slot the producer writes next.
+ */
+static void
+test_lap_before_reading ()
+{
+    DataBuffer *dbuf;
+    int16_t data[TEST_CAPACITY];
+    size_t position, len, i;
+
+    g_print ("Reading after being lapped by exactly the capacity\n");
+    dbuf = data_buffer_new (TEST_CAPACITY, 1);
+
+    push_items (dbuf, 3);
+    len = data_buffer_pull_int16 (dbuf, data, 3, &position);
+    check_position ("before the lap", position, 0);
+
+    push_items (dbuf, TEST_CAPACITY);
+    len = data_buffer_pull_int16 (dbuf, data, TEST_CAPACITY, &position);
+    check_position ("after the lap", position, 4);
+    if (len != TEST_CAPACITY - 1) {
+        g_printerr ("  read %zu items, expected %i\n", len, TEST_CAPACITY - 1);
+        test_failed = TRUE;
+    }
+    for (i = 0; i < len; i++) {
+        if (data[i] != (int16_t) (position + i)) {
+            g_printerr ("  item %zu is %i, expected %zu\n", i, data[i], position + i);
+            test_failed = TRUE;
+            break;
+        }
+    }
+
+    data_buffer_free (dbuf);
+}
+
+int main(int argc, char **argv)
+{
+    test_lap_while_reading ();
+    test_lap_before_reading ();
+
+    if (test_failed) {
+        g_printerr ("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <glib/gstdio.h>
+
+#include "galdur.h"
+#include "gld-adc-backend.h"
+
+#define CHANNEL_COUNT 16
+#define SAMPLE_FREQUENCY 30000 /* 30 kHz */
+
+static gboolean test_failed = FALSE;
+
+/**
+ * SyntheticEvent:
+ *
+ * One row of the truth file.
+ */
+typedef struct {
+    gchar event[16];
+    guint64 start;
+    guint64 peak;
+    guint64 end;
+    gint channel;
+} SyntheticEvent;
+
+/**
+ * generate_scans:
+ *
+ * Run the synthetic backend with @args directly, without the DAQ thread
+ * pacing it, and return @n_scans scans of all channels.
+ */
+static int16_t*
+generate_scans (const gchar *args, guint n_scans, double *scans_per_sec)
+{
+    static const guint scan_list[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 };
+    const GldAdcBackend *backend = &gld_adc_backend_synthetic;
+    struct timespec start, stop;
+    GldAdc *daq;
+    gpointer priv;
+    int16_t *data = NULL;
+    guint i;
+
+    daq = gld_adc_new (CHANNEL_COUNT, 0, -1);
+    gld_adc_set_scan_list (daq, scan_list, CHANNEL_COUNT);
+    gld_adc_set_acq_frequency (daq, SAMPLE_FREQUENCY);
+
+    priv = backend->open (args);
+    if (priv == NULL || !backend->start (priv, daq)) {
+        g_printerr ("  unable to start the synthetic backend with '%s'\n", args);
+        test_failed = TRUE;
+        goto out;
+    }
+
+    data = g_new (int16_t, (gsize) n_scans * CHANNEL_COUNT);
+    clock_gettime (CLOCK_MONOTONIC, &start);
+    for (i = 0; i < n_scans; i++)
+        backend->scan (priv, &data[i * CHANNEL_COUNT]);
+    clock_gettime (CLOCK_MONOTONIC, &stop);
+    backend->stop (priv);
+
+    if (scans_per_sec != NULL)
+        *scans_per_sec = n_scans / ((stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9);
+
+out:
+    if (priv != NULL)
+        backend->close (priv);
+    gld_adc_free (daq);
+    return data;
+}
+
+/**
+ * read_truth_file:
+ *
+ * Returns: (transfer full): The events listed in @fname, or %NULL on error.
+ */
+static GArray*
+read_truth_file (const gchar *fname)
+{
+    g_autofree gchar *contents = NULL;
+    g_auto(GStrv) lines = NULL;
+    GArray *events;
+    guint i;
+
+    if (!g_file_get_contents (fname, &contents, NULL, NULL)) {
+        g_printerr ("  unable to read %s\n", fname);
+        return NULL;
+    }
+    lines = g_strsplit (contents, "\n", -1);
+    if (g_strcmp0 (lines[0], "event,start_index,peak_index,end_index,channel") != 0) {
+        g_printerr ("  unexpected truth file header: %s\n", lines[0]);
+        return NULL;
+    }
+
+    events = g_array_new (FALSE, FALSE, sizeof(SyntheticEvent));
+    for (i = 1; lines[i] != NULL && lines[i][0] != '\0'; i++) {
+        SyntheticEvent ev;
+
+        if (sscanf (lines[i], "%15[^,],%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT ",%i",
+                    ev.event, &ev.start, &ev.peak, &ev.end, &ev.channel) != 5) {
+            g_printerr ("  malformed truth file line: %s\n", lines[i]);
+            g_array_free (events, TRUE);
+            return NULL;
+        }
+        g_array_append_val (events, ev);
+    }
+
+    return events;
+}
+
+/**
+ * test_determinism:
+ *
+ * The same arguments must always produce exactly the same samples.
+ */
+static void
+test_determinism ()
+{
+    static const guint n_scans = 20000;
+    g_autofree int16_t *data1 = NULL;
+    g_autofree int16_t *data2 = NULL;
+    g_autofree int16_t *data3 = NULL;
+    const gsize size = (gsize) n_scans * CHANNEL_COUNT * sizeof(int16_t);
+
+    g_print ("Checking that the same seed produces the same samples\n");
+    data1 = generate_scans ("seed=42,spike_rate=50,ripple_rate=5", n_scans, NULL);
+    data2 = generate_scans ("seed=42,spike_rate=50,ripple_rate=5", n_scans, NULL);
+    data3 = generate_scans ("seed=43,spike_rate=50,ripple_rate=5", n_scans, NULL);
+    if (data1 == NULL || data2 == NULL || data3 == NULL)
+        return;
+
+    if (memcmp (data1, data2, size) != 0) {
+        g_printerr ("  two runs with the same seed differ\n");
+        test_failed = TRUE;
+    }
+    if (memcmp (data1, data3, size) == 0) {
+        g_printerr ("  two runs with different seeds are identical\n");
+        test_failed = TRUE;
+    }
+}
+
+/**
+ * test_truth_events:
+ *
+ * Generate nothing but events, so every sample that is not zero has to
+ * belong to an event of the truth file, and every event listed has to
+ * be visible in the delivered samples.
+ */
+static void
+test_truth_events (const gchar *event, const gchar *args)
+{
+    static const guint n_scans = 3 * SAMPLE_FREQUENCY + 123;
+    g_autofree gchar *fname = NULL;
+    g_autofree gchar *full_args = NULL;
+    g_autofree int16_t *data = NULL;
+    g_autofree guint8 *covered = NULL;
+    GArray *events;
+    guint i, c;
+
+    g_print ("Checking the truth file for %ss\n", event);
+    fname = g_build_filename (g_get_tmp_dir (), "galdur-test-synthetic-truth.csv", NULL);
+    full_args = g_strdup_printf ("seed=7,theta_amp=0,noise_amp=0,%s,truth=%s", args, fname);
+    data = generate_scans (full_args, n_scans, NULL);
+    if (data == NULL)
+        return;
+
+    events = read_truth_file (fname);
+    g_remove (fname);
+    if (events == NULL) {
+        test_failed = TRUE;
+        return;
+    }
+    if (events->len == 0) {
+        g_printerr ("  no %ss were generated\n", event);
+        test_failed = TRUE;
+    }
+
+    covered = g_new0 (guint8, (gsize) n_scans * CHANNEL_COUNT);
+    for (i = 0; i < events->len; i++) {
+        const SyntheticEvent *ev = &g_array_index (events, SyntheticEvent, i);
+        const SyntheticEvent *prev = i > 0? &g_array_index (events, SyntheticEvent, i - 1) : NULL;
+        gboolean visible = FALSE;
+        guint64 s;
+
+        if (g_strcmp0 (ev->event, event) != 0 || ev->channel < (g_strcmp0 (event, "ripple") == 0? -1 : 0) ||
+            ev->channel >= CHANNEL_COUNT) {
+            g_printerr ("  unexpected event %s on channel %i\n", ev->event, ev->channel);
+            test_failed = TRUE;
+            continue;
+        }
+        if (ev->start > ev->peak || ev->peak > ev->end) {
+            g_printerr ("  %s %u: start %" G_GUINT64_FORMAT ", peak %" G_GUINT64_FORMAT ", end %" G_GUINT64_FORMAT
+                        " are not in order\n", event, i, ev->start, ev->peak, ev->end);
+            test_failed = TRUE;
+        }
+        if (prev != NULL && ev->start < prev->start) {
+            g_printerr ("  %s %u starts before the one preceding it\n", event, i);
+            test_failed = TRUE;
+        }
+        if (ev->start >= n_scans) {
+            g_printerr ("  %s %u starts at %" G_GUINT64_FORMAT ", but only %u scans were delivered\n",
+                        event, i, ev->start, n_scans);
+            test_failed = TRUE;
+            continue;
+        }
+
+        for (s = ev->start; s <= ev->end && s < n_scans; s++) {
+            for (c = 0; c < CHANNEL_COUNT; c++) {
+                if (ev->channel >= 0 && (guint) ev->channel != c)
+                    continue;
+                covered[s * CHANNEL_COUNT + c] = 1;
+                if (data[s * CHANNEL_COUNT + c] != 0)
+                    visible = TRUE;
+            }
+        }
+        if (!visible) {
+            g_printerr ("  %s %u at %" G_GUINT64_FORMAT " is not in the delivered data\n", event, i, ev->start);
+            test_failed = TRUE;
+        }
+    }
+
+    for (i = 0; i < n_scans * CHANNEL_COUNT; i++) {
+        if (data[i] != 0 && !covered[i]) {
+            g_printerr ("  channel %u, scan %u: %i, but no %s is listed for it\n",
+                        i % CHANNEL_COUNT, i / CHANNEL_COUNT, data[i], event);
+            test_failed = TRUE;
+            break;
+        }
+    }
+
+    g_array_free (events, TRUE);
+}
+
+/**
+ * test_throughput:
+ *
+ * The generator has to keep up with the fastest acquisition we emulate.
+ */
+static void
+test_throughput ()
+{
+    static const guint n_scans = 5 * SAMPLE_FREQUENCY;
+    g_autofree int16_t *data = NULL;
+    double scans_per_sec = 0;
+
+    g_print ("Checking the generator sustains %u channels at %u Hz\n", CHANNEL_COUNT, SAMPLE_FREQUENCY);
+    data = generate_scans ("seed=1,spike_rate=50,ripple_rate=5", n_scans, &scans_per_sec);
+    if (data == NULL)
+        return;
+
+    g_print ("  %.0f scans per second\n", scans_per_sec);
+    if (scans_per_sec < SAMPLE_FREQUENCY) {
+        g_printerr ("  the generator only produces %.0f scans per second, %u are needed\n",
+                    scans_per_sec, SAMPLE_FREQUENCY);
+        test_failed = TRUE;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    test_determinism ();
+    test_truth_events ("spike", "ripple_rate=0,spike_rate=300");
+    test_truth_events ("ripple", "spike_rate=0,ripple_rate=4");
+    test_throughput ();
+
+    if (test_failed) {
+        g_printerr ("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
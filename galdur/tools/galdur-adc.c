@@ -26,14 +26,23 @@ static gint64 opt_sample_count      = 1000 * 124;
 static gint   opt_channel_count     = 16;
 
 static gint64 opt_sample_frequency  = 6000; /* 6 kHz */
+static gint   opt_busy_wait_usec    = 0;
 
 static gchar  *opt_base_filename = NULL;
+static gchar  *opt_scan_list = NULL;
+static gboolean opt_batched = FALSE;
+static gchar  *opt_backend = NULL;
+
+static guint  scan_list[16];
 
 void
 run_galdur_adc_daq ()
 {
     struct timespec start, stop;
+    struct timespec cpu_start, cpu_stop, cpu_diff;
     struct timespec diff;
+    double elapsed_sec;
+    GldAdcStats stats;
     GldAdc *daq;
     guint i;
 
@@ -41,16 +50,37 @@ run_galdur_adc_daq ()
             opt_sample_count, opt_channel_count, opt_sample_frequency);
 
     daq = gld_adc_new (opt_channel_count, opt_sample_count, -1);
+    if (opt_backend != NULL) {
+        if (!gld_adc_set_backend (daq, opt_backend)) {
+            gld_adc_free (daq);
+            return;
+        }
+    }
+    g_print ("Using the '%s' ADC backend.\n", gld_adc_get_backend_name (daq));
+
+    if (opt_scan_list != NULL) {
+        if (!gld_adc_set_scan_list (daq, scan_list, opt_channel_count)) {
+            gld_adc_free (daq);
+            return;
+        }
+    }
 
     gld_adc_set_acq_frequency (daq, opt_sample_frequency);
+    gld_adc_set_busy_wait_time (daq, opt_busy_wait_usec);
+    gld_adc_set_batched_spi (daq, opt_batched);
 
     clock_gettime(CLOCK_REALTIME, &start);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_start);
 
-    gld_adc_acquire_samples (daq, opt_sample_count);
+    if (!gld_adc_acquire_samples (daq, opt_sample_count)) {
+        gld_adc_free (daq);
+        return;
+    }
 
-    while (gld_adc_is_running (daq)) {}
+    gld_adc_wait_finished (daq);
 
     clock_gettime(CLOCK_REALTIME, &stop);
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_stop);
 
     diff.tv_sec = stop.tv_sec - start.tv_sec;
     diff.tv_nsec = stop.tv_nsec - start.tv_nsec;
@@ -75,6 +105,16 @@ run_galdur_adc_daq ()
     }
 
     g_print ("Required time: %lld(sec) + %lld(nsec)\n", (long long) diff.tv_sec, (long long) diff.tv_nsec);
+    /* a finite backend may have run out of data before all samples were acquired */
+    gld_adc_get_stats (daq, &stats);
+    elapsed_sec = diff.tv_sec + diff.tv_nsec / 1000000000.0;
+    g_print ("Effective sampling frequency: %.1fHz\n", stats.samples_acquired / elapsed_sec);
+
+    /* CPU time the acquisition took away from everything else, e.g. signal processing */
+    cpu_diff = gld_time_diff (&cpu_start, &cpu_stop);
+    g_print ("CPU usage: %.1f%% of one core\n",
+             100.0 * (gld_nanoseconds_from_timespec (&cpu_diff) / 1000000000.0) / elapsed_sec);
+    gld_adc_print_stats (daq, stdout);
     g_print ("Sampled data written to /tmp\n");
 
     gld_adc_free (daq);
@@ -88,8 +128,16 @@ static GOptionEntry option_entries[] =
         "Number of channels to record from", "Channel count" },
     { "frequency", 'f', 0, G_OPTION_ARG_INT64, &opt_sample_frequency,
         "Sampling frequency", "Sampling frequency" },
+    { "busy-wait", 0, 0, G_OPTION_ARG_INT, &opt_busy_wait_usec,
+        "Busy-wait this many microseconds before each scan to reduce jitter", "Microseconds" },
     { "basefile", 'o', 0, G_OPTION_ARG_FILENAME, &opt_base_filename,
         "Base filename for resulting data", "Base filename" },
+    { "scan-list", 's', 0, G_OPTION_ARG_STRING, &opt_scan_list,
+        "Comma-separated list of physical channels to record from, overrides the channel count", "0,1,..." },
+    { "batched", 'b', 0, G_OPTION_ARG_NONE, &opt_batched,
+        "Read all channels of an ADC chip in a single SPI transaction", NULL },
+    { "backend", 0, 0, G_OPTION_ARG_STRING, &opt_backend,
+        "Acquisition backend to read from, 'list' shows all available backends", "name[:args]" },
 
     { NULL }
 };
@@ -98,6 +146,7 @@ int main(int argc, char **argv)
 {
     GError *error = NULL;
     GOptionContext *octx;
+    GldAdcBackendCaps caps;
 
     /* parse our options */
     octx = g_option_context_new ("- Galdur ADC Test Tool");
@@ -108,12 +157,46 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    if (g_strcmp0 (opt_backend, "list") == 0) {
+        g_print ("Available ADC backends:\n");
+        gld_adc_print_backends (stdout);
+        return 0;
+    }
+    if (!gld_adc_lookup_backend_caps (opt_backend != NULL? opt_backend : gld_adc_get_default_backend (), &caps)) {
+        g_printerr ("Unknown ADC backend. Run with '--backend=list' to see all available backends.\n");
+        return 1;
+    }
+
     if (opt_base_filename == NULL) {
         g_print ("No base filename given, storing data in '/tmp/galdur-adc-<chan>.csv'.\n");
         g_print ("\n");
         opt_base_filename = g_strdup ("/tmp/galdur-adc-");
     }
 
+    if (opt_scan_list != NULL) {
+        gchar **chans = g_strsplit (opt_scan_list, ",", -1);
+        guint i;
+
+        if (g_strv_length (chans) > G_N_ELEMENTS (scan_list)) {
+            g_printerr ("The scan list can not have more than %u entries.\n", (guint) G_N_ELEMENTS (scan_list));
+            g_strfreev (chans);
+            return 2;
+        }
+        for (i = 0; chans[i] != NULL; i++) {
+            gchar *end = NULL;
+            guint64 chan = g_ascii_strtoull (chans[i], &end, 10);
+
+            if (end == chans[i] || *end != '\0' || chan > 15) {
+                g_printerr ("Invalid channel in scan list: '%s', channels must be between 0 and 15.\n", chans[i]);
+                g_strfreev (chans);
+                return 2;
+            }
+            scan_list[i] = chan;
+        }
+        opt_channel_count = i;
+        g_strfreev (chans);
+    }
+
     if (opt_channel_count < 0) {
         g_error ("A negative channel count is not allowed.");
         return 2;
@@ -122,18 +205,26 @@ int main(int argc, char **argv)
         g_error ("A negative amount of samples is not only fairly useless but also impossible.");
         return 2;
     }
+    if (opt_busy_wait_usec < 0) {
+        g_error ("A negative busy-wait time is not allowed.");
+        return 2;
+    }
     if (opt_sample_frequency < 0) {
         g_error ("A negative sampling frequency is an interesting idea, but not something that makes much sense and that we can do.");
         return 2;
     }
 
-    if (!gld_board_initialize ())
-        return 1;
+    /* only backends accessing the BCM2835 directly need the board to be set up */
+    if (caps & GLD_ADC_BACKEND_CAP_MMIO) {
+        if (!gld_board_initialize ())
+            return 1;
 
-    gld_board_set_spi_clock_divider (48); /* fast SPI connection */
+        gld_board_set_spi_clock_divider (48); /* fast SPI connection */
+    }
 
     run_galdur_adc_daq ();
 
-    gld_board_shutdown ();
+    if (caps & GLD_ADC_BACKEND_CAP_MMIO)
+        gld_board_shutdown ();
     return 0;
 }
@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "biquad.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+
+/* the state is kept in double precision: theta and delta bands sit at
+ * 1/1000 of the sampling rate, where single precision poles drift */
+#if defined(__AVX__)
+#include <immintrin.h>
+#define BIQUAD_SIMD_NAME "AVX"
+#define BIQUAD_LANES 4
+typedef __m256d biquad_vec;
+#define biquad_load(p) _mm256_load_pd (p)
+#define biquad_store(p, v) _mm256_store_pd (p, v)
+#define biquad_add(a, b) _mm256_add_pd (a, b)
+#define biquad_sub(a, b) _mm256_sub_pd (a, b)
+#define biquad_mul(a, b) _mm256_mul_pd (a, b)
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define BIQUAD_SIMD_NAME "SSE2"
+#define BIQUAD_LANES 2
+typedef __m128d biquad_vec;
+#define biquad_load(p) _mm_load_pd (p)
+#define biquad_store(p, v) _mm_store_pd (p, v)
+#define biquad_add(a, b) _mm_add_pd (a, b)
+#define biquad_sub(a, b) _mm_sub_pd (a, b)
+#define biquad_mul(a, b) _mm_mul_pd (a, b)
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define BIQUAD_SIMD_NAME "NEON"
+#define BIQUAD_LANES 2
+typedef float64x2_t biquad_vec;
+#define biquad_load(p) vld1q_f64 (p)
+#define biquad_store(p, v) vst1q_f64 (p, v)
+#define biquad_add(a, b) vaddq_f64 (a, b)
+#define biquad_sub(a, b) vsubq_f64 (a, b)
+#define biquad_mul(a, b) vmulq_f64 (a, b)
+#else
+#define BIQUAD_SIMD_NAME "scalar"
+#define BIQUAD_LANES 1
+typedef double biquad_vec;
+#define biquad_load(p) (*(p))
+#define biquad_store(p, v) (*(p) = (v))
+#define biquad_add(a, b) ((a) + (b))
+#define biquad_sub(a, b) ((a) - (b))
+#define biquad_mul(a, b) ((a) * (b))
+#endif
+
+#define BIQUAD_ALIGNMENT 32
+
+static double*
+biquad_alloc (size_t n)
+{
+    void *p;
+
+    if (posix_memalign (&p, BIQUAD_ALIGNMENT, sizeof (double) * n) != 0)
+        return NULL;
+    memset (p, 0, sizeof (double) * n);
+    return p;
+}
+
+int
+biquad_cascade_init (struct biquad_cascade* bq, int n_channels, int n_sections)
+{
+    if (n_channels <= 0 || n_sections <= 0) {
+        fprintf (stderr, "biquad_cascade_init needs at least one channel and one section\n");
+        return -1;
+    }
+    bq->n_channels = n_channels;
+    bq->n_sections = n_sections;
+    bq->stride = (n_channels + BIQUAD_LANES - 1) / BIQUAD_LANES * BIQUAD_LANES;
+    bq->coefficients = NULL;
+    bq->state = NULL;
+    bq->work = NULL;
+
+    // padding channels keep zero coefficients and only ever filter zeros
+    if ((bq->coefficients = biquad_alloc (5 * n_sections * bq->stride)) == NULL) {
+        fprintf (stderr, "problem allocating memory for bq->coefficients\n");
+        goto fail;
+    }
+    if ((bq->state = biquad_alloc (2 * n_sections * bq->stride)) == NULL) {
+        fprintf (stderr, "problem allocating memory for bq->state\n");
+        goto fail;
+    }
+    if ((bq->work = biquad_alloc (bq->stride)) == NULL) {
+        fprintf (stderr, "problem allocating memory for bq->work\n");
+        goto fail;
+    }
+    return 0;
+
+fail:
+    biquad_cascade_free (bq);
+    return -1;
+}
+
+int
+biquad_cascade_free (struct biquad_cascade* bq)
+{
+    free (bq->coefficients);
+    free (bq->state);
+    free (bq->work);
+    // a failed init already freed everything, freeing again must be harmless
+    bq->coefficients = NULL;
+    bq->state = NULL;
+    bq->work = NULL;
+    return 0;
+}
+
+/**
+ * biquad_cascade_set_bandpass:
+ *
+ * Design a Butterworth band-pass for @channel, with n_sections second-order
+ * sections (a low-pass prototype of order n_sections) by bilinear transform
+ * of the analog filter. The gain is 1 and the phase 0 at the center
+ * frequency, the geometric mean of the two cut-off frequencies.
+ */
+int
+biquad_cascade_set_bandpass (struct biquad_cascade* bq, int channel, int sampling_rate,
+                             float min_frequency, float max_frequency)
+{
+    const int order = bq->n_sections;
+    const double fs2 = 2.0 * sampling_rate;
+    double w_low, w_high, w0, bw, center;
+    double complex poles[2 * order];
+    int n_poles = 0;
+    int k, s;
+
+    if (channel < 0 || channel >= bq->n_channels) {
+        fprintf (stderr, "biquad_cascade_set_bandpass: channel %d out of range\n", channel);
+        return -1;
+    }
+    if (min_frequency <= 0 || max_frequency <= min_frequency || max_frequency >= sampling_rate / 2.0) {
+        fprintf (stderr, "biquad_cascade_set_bandpass: invalid band %f-%f Hz at %d Hz\n",
+                 min_frequency, max_frequency, sampling_rate);
+        return -1;
+    }
+
+    // prewarp the cut-off frequencies
+    w_low = fs2 * tan (M_PI * min_frequency / sampling_rate);
+    w_high = fs2 * tan (M_PI * max_frequency / sampling_rate);
+    w0 = sqrt (w_low * w_high);
+    bw = w_high - w_low;
+    center = 2 * atan (w0 / fs2);
+
+    // each prototype pole in the upper half plane gives two band-pass poles,
+    // their conjugates come from the lower half plane
+    for (k = 0; k < (order + 1) / 2; k++) {
+        double complex p = cexp (I * M_PI * (2 * k + order + 1) / (2.0 * order));
+        double complex q = p * bw / 2;
+        double complex d = csqrt (q * q - w0 * w0);
+
+        if (2 * k + 1 == order) {
+            // real prototype pole, its two band-pass poles make one section
+            poles[n_poles++] = q + d;
+            poles[n_poles++] = q - d;
+        } else {
+            poles[n_poles++] = q + d;
+            poles[n_poles++] = conj (q + d);
+            poles[n_poles++] = q - d;
+            poles[n_poles++] = conj (q - d);
+        }
+    }
+
+    for (s = 0; s < order; s++) {
+        // bilinear transform of the two poles of this section
+        double complex za = (fs2 + poles[2 * s]) / (fs2 - poles[2 * s]);
+        double complex zb = (fs2 + poles[2 * s + 1]) / (fs2 - poles[2 * s + 1]);
+        double a1 = creal (-(za + zb));
+        double a2 = creal (za * zb);
+        // one zero at 0 Hz and one at Nyquist per section, normalised at the center
+        double complex e1 = cexp (-I * center);
+        double complex e2 = cexp (-2 * I * center);
+        double gain = 1 / cabs ((1 - e2) / (1 + a1 * e1 + a2 * e2));
+        double *c = bq->coefficients + 5 * s * bq->stride + channel;
+
+        c[0 * bq->stride] = gain;
+        c[1 * bq->stride] = 0;
+        c[2 * bq->stride] = -gain;
+        c[3 * bq->stride] = a1;
+        c[4 * bq->stride] = a2;
+    }
+    return 0;
+}
+
+void
+biquad_cascade_reset (struct biquad_cascade* bq)
+{
+    memset (bq->state, 0, sizeof (double) * 2 * bq->n_sections * bq->stride);
+}
+
+/**
+ * biquad_cascade_process:
+ * @in: @n_frames frames of n_channels interleaved samples
+ * @out: @n_frames frames of n_channels interleaved filtered samples, may be @in
+ *
+ * Filter the next samples of every channel.
+ */
+void
+biquad_cascade_process (struct biquad_cascade* bq, const float* in, float* out, size_t n_frames)
+{
+    const int stride = bq->stride;
+    size_t frame;
+    int s, ch;
+
+    for (frame = 0; frame < n_frames; frame++) {
+        for (ch = 0; ch < bq->n_channels; ch++)
+            bq->work[ch] = in[frame * bq->n_channels + ch];
+
+        for (s = 0; s < bq->n_sections; s++) {
+            const double *c = bq->coefficients + 5 * s * stride;
+            double *z = bq->state + 2 * s * stride;
+
+            for (ch = 0; ch < stride; ch += BIQUAD_LANES) {
+                biquad_vec x = biquad_load (bq->work + ch);
+                biquad_vec z1 = biquad_load (z + ch);
+                biquad_vec z2 = biquad_load (z + stride + ch);
+                biquad_vec y = biquad_add (biquad_mul (biquad_load (c + ch), x), z1);
+
+                z1 = biquad_add (biquad_sub (biquad_mul (biquad_load (c + stride + ch), x),
+                                             biquad_mul (biquad_load (c + 3 * stride + ch), y)),
+                                 z2);
+                z2 = biquad_sub (biquad_mul (biquad_load (c + 2 * stride + ch), x),
+                                 biquad_mul (biquad_load (c + 4 * stride + ch), y));
+                biquad_store (z + ch, z1);
+                biquad_store (z + stride + ch, z2);
+                biquad_store (bq->work + ch, y);
+            }
+        }
+
+        for (ch = 0; ch < bq->n_channels; ch++)
+            out[frame * bq->n_channels + ch] = bq->work[ch];
+    }
+}
+
+/**
+ * biquad_get_simd_name:
+ *
+ * Returns: the instruction set the channels are filtered with.
+ */
+const char*
+biquad_get_simd_name (void)
+{
+    return BIQUAD_SIMD_NAME;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LS_BIQUAD_H
+#define __LS_BIQUAD_H
+
+#include <stddef.h>
+
+/**
+ * biquad_cascade:
+ *
+ * Cascade of second-order sections filtering several channels sample by
+ * sample. Every channel has its own coefficients, so one cascade can
+ * filter the same signal in several bands at once. Channels are filtered
+ * in parallel with SIMD instructions where available.
+ *
+ * Coefficients and state are stored section by section, with the channels
+ * contiguous and padded to a multiple of the SIMD width.
+ */
+struct biquad_cascade
+{
+    int n_channels;
+    int n_sections; // number of second-order sections, the order of a band-pass
+    int stride; // n_channels rounded up to the SIMD width
+    double* coefficients; // b0 b1 b2 a1 a2 of each section, stride values each
+    double* state; // z1 z2 of each section (transposed direct form II), stride values each
+    double* work; // one frame, stride values
+};
+
+int biquad_cascade_init (struct biquad_cascade* bq,
+                         int n_channels,
+                         int n_sections);
+int biquad_cascade_free (struct biquad_cascade* bq);
+int biquad_cascade_set_bandpass (struct biquad_cascade* bq,
+                                 int channel,
+                                 int sampling_rate,
+                                 float min_frequency,
+                                 float max_frequency);
+void biquad_cascade_reset (struct biquad_cascade* bq);
+void biquad_cascade_process (struct biquad_cascade* bq,
+                             const float* in,
+                             float* out,
+                             size_t n_frames);
+const char* biquad_get_simd_name (void);
+
+#endif /* __LS_BIQUAD_H */
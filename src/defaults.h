@@ -43,6 +43,7 @@
 #define MIN_FREQUENCY_DELTA 2
 #define MAX_FREQUENCY_DELTA 4
 #define MAX_PHASE_DIFFERENCE 10
+#define HOP_SIZE_THETA 60 // new samples between two phase estimates, 3 ms of data at 20 kHz
 
 /* defaults for SWR detection */
 #define FFT_SIGNAL_DATA_SIZE_SWR 1024 // number of data points that goes into the fft, needs to be a 2^x number
@@ -55,9 +56,21 @@
 #define MIN_FREQUENCY_SWR 125 // default minimum frequency for ripple detection
 #define MAX_FREQUENCY_SWR 250 // default maximum frequency for ripple detection
 #define FREQUENCY_WAVELET_FOR_CONVOLUTION 160
-#define SLEEP_WHEN_NO_NEW_DATA_MS 0.2  // 0.2 is ok, probably best not to change that
+#define SWR_MAX_WAVELETS 8 // largest bank of morlet wavelets across the ripple band (--swr_wavelets)
+#define HOP_SIZE_SWR 60 // new samples between two ripple detections, 3 ms of data at 20 kHz
 #define INTERVAL_DURATION_BETWEEN_SWR_PROCESSING_MS 4 // the program will sleep 4 ms between each calculation of ripple power
-#define SIZE_ROOT_MEAN_SQUARE_ARRAY 10000
+#define SWR_BASELINE_FREEZE_SEC 30 // the mean and sd of power stop changing after this, 10000 segments at 20 kHz
+#define SWR_STREAM_HOP_MS 1 // new samples per step of the streaming SWR engines (--swr_engine=stream or biquad)
+#define SWR_STREAM_FILTER_LENGTH_MS 20 // length of the streaming band-pass FIR, its group delay is half of it (10 ms)
+#define SWR_STREAM_WAVELET_SD 2 // the streaming wavelet spans +/- this many SD of the morlet, like the FFT_SIGNAL_DATA_SIZE_SWR kernel at 20 kHz
+                                // its group delay is half of its length (25 ms at 160 Hz)
+#define BIQUAD_ORDER_SWR 4 // second-order sections of the ripple band-pass (--swr_engine=biquad)
+#define BIQUAD_ORDER_THETA 2 // second-order sections of the theta and delta band-passes (--theta_engine=biquad)
+#define BIQUAD_SETTLING_CYCLES 4 // periods of the lowest cut-off frequency to wait before trusting the biquad output
+#define SWR_HILBERT_LENGTH_MS 8 // length of the Hilbert transformer (--swr_engine=hilbert), the envelope lags by half of it (4 ms)
+#define SWR_HILBERT_SMOOTHING_MS 4 // time constant of the exponential smoothing of the ripple envelope
+#define SWR_MULTI_MAX_CHANNELS 8 // channels of multi-channel SWR detection (--swr_channels), the ADC converts the reference too
+#define SWR_MULTI_LATENCY_BUDGET_MS 2 // multi-channel detections later than this after the last sample are dropped
 
 /* RT process defaults */
 #define LS_PRIORITY     49      /* we use 49 as the PRREMPT_RT use 50
@@ -72,6 +85,7 @@
 #define NSEC_PER_SEC    (1000000000) /* The number of nsecs per sec. */
 #define NANOSLEEP_OVERSHOOT 0.0080000
 
+#define LS_FFTW_WISDOM_FILE "/var/cache/labrstim/fftwf-wisdom" /* FFT plans saved between sessions */
 #define PI_TTY_CTLPORT "/dev/ttyAMA0"
 
 #endif /* __LS_DEFAULTS_H */
@@ -23,12 +23,21 @@ date 15.02.2010
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "defaults.h"
 
+unsigned int fftw_planner_flags = FFTW_MEASURE;
+int fftw_wisdom_changed = 0;
+
+/**
+ * fftw_interface_theta_init:
+ * @with_fft: 0 to only allocate the signal and filtered signal arrays, when
+ *            they are filled by another filter, 1 to also plan the FFTs
+ */
 int
-fftw_interface_theta_init (struct fftw_interface_theta *fftw_int, int sampling_rate_hz)
+fftw_interface_theta_init (struct fftw_interface_theta *fftw_int, int sampling_rate_hz, int with_fft)
 {
     unsigned int i;
     // the next 3 variables should be set according to argument pass to this function.
@@ -37,6 +46,7 @@ fftw_interface_theta_init (struct fftw_interface_theta *fftw_int, int sampling_r
     fftw_int->fft_signal_data_size = FFT_SIGNAL_DATA_SIZE_THETA;  // should be a power of 2
     fftw_int->power_signal_length = DATA_IN_SEGMENT_TO_POWER_THETA;       // last data on which to calculate power, for theta/delta ratio
     fftw_int->real_data_to_fft_size = REAL_DATA_IN_SEGMENT_TO_FFT_THETA;
+    fftw_int->kernels = spectral_kernels_get ();
     if (fftw_int->fft_signal_data_size < fftw_int->real_data_to_fft_size) {
         fprintf (stderr,
                  "fftw_int->fft_signal_data_size<fftw_int->real_data_to_fft_size in fftw_interface_theta_init\n");
@@ -59,6 +69,16 @@ fftw_interface_theta_init (struct fftw_interface_theta *fftw_int, int sampling_r
     fftw_int->signal_root_mean_square_theta = 0;
     fftw_int->signal_root_mean_square_delta = 0;
 
+    // only allocated and planned with_fft
+    fftw_int->filter_function_theta = NULL;
+    fftw_int->filter_function_delta = NULL;
+    fftw_int->out_theta = NULL;
+    fftw_int->out_delta = NULL;
+    fftw_int->fft_plan_forward_theta = NULL;
+    fftw_int->fft_plan_backward_theta = NULL;
+    fftw_int->fft_plan_forward_delta = NULL;
+    fftw_int->fft_plan_backward_delta = NULL;
+
     // allocate memory
     if ((fftw_int->signal_data =
              malloc (sizeof (float) * fftw_int->fft_signal_data_size)) == NULL) {
@@ -70,18 +90,6 @@ fftw_interface_theta_init (struct fftw_interface_theta *fftw_int, int sampling_r
         // initialise to 0
         fftw_int->signal_data[i] = 0;
     }
-    if ((fftw_int->filter_function_theta =
-             malloc (sizeof (float) * fftw_int->m)) == NULL) {
-        fprintf (stderr,
-                 "problem allocating memory for fftw_int->filter_function_theta\n");
-        return -1;
-    }
-    if ((fftw_int->filter_function_delta =
-             malloc (sizeof (float) * fftw_int->m)) == NULL) {
-        fprintf (stderr,
-                 "problem allocating memory for fftw_int->filter_function_delta\n");
-        return -1;
-    }
     if ((fftw_int->filtered_signal_theta =
              (float *) fftwf_malloc (sizeof (float) *
                                      fftw_int->fft_signal_data_size)) == NULL) {
@@ -96,6 +104,21 @@ fftw_interface_theta_init (struct fftw_interface_theta *fftw_int, int sampling_r
                  "problem allocating memory for fftw_int->filtered_signal_delta\n");
         return -1;
     }
+    if (!with_fft)
+        return 0;
+
+    if ((fftw_int->filter_function_theta =
+             malloc (sizeof (float) * fftw_int->m)) == NULL) {
+        fprintf (stderr,
+                 "problem allocating memory for fftw_int->filter_function_theta\n");
+        return -1;
+    }
+    if ((fftw_int->filter_function_delta =
+             malloc (sizeof (float) * fftw_int->m)) == NULL) {
+        fprintf (stderr,
+                 "problem allocating memory for fftw_int->filter_function_delta\n");
+        return -1;
+    }
     if ((fftw_int->out_theta =
              (fftwf_complex *) fftwf_malloc (sizeof (fftwf_complex) *
                                            fftw_int->fft_signal_data_size)) == NULL) {
@@ -110,35 +133,33 @@ fftw_interface_theta_init (struct fftw_interface_theta *fftw_int, int sampling_r
     }
     // the output complex of fftw has n/2+1 size , real is in out_theta[i][0] and imaginary is in out_theta [i][1]
     if ((fftw_int->fft_plan_forward_theta =
-             fftwf_plan_dft_r2c_1d (fftw_int->fft_signal_data_size,
-                                   fftw_int->filtered_signal_theta,
-                                   fftw_int->out_theta, FFTW_MEASURE)) == NULL) {
+             LS_FFTW_PLAN (fftwf_plan_dft_r2c_1d, fftw_int->fft_signal_data_size,
+                                                 fftw_int->filtered_signal_theta,
+                                                 fftw_int->out_theta)) == NULL) {
         fprintf (stderr,
                  "unable to create a plan for fftw_int->fft_plan_forward_theta\n");
         return -1;
     }
     if ((fftw_int->fft_plan_backward_theta =
-             fftwf_plan_dft_c2r_1d (fftw_int->fft_signal_data_size,
-                                   fftw_int->out_theta,
-                                   fftw_int->filtered_signal_theta,
-                                   FFTW_MEASURE)) == NULL) {
+             LS_FFTW_PLAN (fftwf_plan_dft_c2r_1d, fftw_int->fft_signal_data_size,
+                                                 fftw_int->out_theta,
+                                                 fftw_int->filtered_signal_theta)) == NULL) {
         fprintf (stderr,
                  "unable to create a plan for fftw_int->fft_plan_backward_theta\n");
         return -1;
     }
     if ((fftw_int->fft_plan_forward_delta =
-             fftwf_plan_dft_r2c_1d (fftw_int->fft_signal_data_size,
-                                   fftw_int->filtered_signal_delta,
-                                   fftw_int->out_delta, FFTW_MEASURE)) == NULL) {
+             LS_FFTW_PLAN (fftwf_plan_dft_r2c_1d, fftw_int->fft_signal_data_size,
+                                                 fftw_int->filtered_signal_delta,
+                                                 fftw_int->out_delta)) == NULL) {
         fprintf (stderr,
                  "unable to create a plan for fftw_int->fft_plan_forward_delta\n");
         return -1;
     }
     if ((fftw_int->fft_plan_backward_delta =
-             fftwf_plan_dft_c2r_1d (fftw_int->fft_signal_data_size,
-                                   fftw_int->out_delta,
-                                   fftw_int->filtered_signal_delta,
-                                   FFTW_MEASURE)) == NULL) {
+             LS_FFTW_PLAN (fftwf_plan_dft_c2r_1d, fftw_int->fft_signal_data_size,
+                                                 fftw_int->out_delta,
+                                                 fftw_int->filtered_signal_delta)) == NULL) {
         fprintf (stderr,
                  "unable to create a plan for fftw_int->fft_plan_backward_delta\n");
         return -1;
@@ -168,10 +189,14 @@ fftw_interface_theta_free (struct fftw_interface_theta *fftw_int)
     fftwf_free (fftw_int->filtered_signal_delta);
     fftwf_free (fftw_int->out_theta);
     fftwf_free (fftw_int->out_delta);
-    fftwf_destroy_plan (fftw_int->fft_plan_forward_theta);
-    fftwf_destroy_plan (fftw_int->fft_plan_forward_delta);
-    fftwf_destroy_plan (fftw_int->fft_plan_backward_theta);
-    fftwf_destroy_plan (fftw_int->fft_plan_backward_delta);
+    if (fftw_int->fft_plan_forward_theta != NULL)
+        fftwf_destroy_plan (fftw_int->fft_plan_forward_theta);
+    if (fftw_int->fft_plan_forward_delta != NULL)
+        fftwf_destroy_plan (fftw_int->fft_plan_forward_delta);
+    if (fftw_int->fft_plan_backward_theta != NULL)
+        fftwf_destroy_plan (fftw_int->fft_plan_backward_theta);
+    if (fftw_int->fft_plan_backward_delta != NULL)
+        fftwf_destroy_plan (fftw_int->fft_plan_backward_delta);
     return 0;
 }
 
@@ -179,52 +204,31 @@ int
 fftw_interface_theta_apply_filter_theta_delta (struct fftw_interface_theta
         *fftw_int)
 {
-    unsigned int i;
-    double sum = 0;
+    const struct spectral_kernels *k = fftw_int->kernels;
     double mean;
 
     // set the mean of the signal to 0
-    for (i = 0; i < fftw_int->real_data_to_fft_size; i++) {
-        sum += fftw_int->signal_data[i];
-    }
-    mean = sum / fftw_int->real_data_to_fft_size;
-    for (i = 0; i < fftw_int->real_data_to_fft_size; i++) {
-        fftw_int->signal_data[i] = fftw_int->signal_data[i] - mean;
-    }
+    mean = k->sum (fftw_int->signal_data, fftw_int->real_data_to_fft_size) / fftw_int->real_data_to_fft_size;
+    k->add_scalar (fftw_int->signal_data, -mean, fftw_int->real_data_to_fft_size);
 
     // copy the signal data into the fitered signal array
-    for (i = 0; i < fftw_int->fft_signal_data_size; i++) {
-        fftw_int->filtered_signal_theta[i] = fftw_int->signal_data[i];
-        fftw_int->filtered_signal_delta[i] = fftw_int->signal_data[i];
-    }
+    memcpy (fftw_int->filtered_signal_theta, fftw_int->signal_data, sizeof (float) * fftw_int->fft_signal_data_size);
+    memcpy (fftw_int->filtered_signal_delta, fftw_int->signal_data, sizeof (float) * fftw_int->fft_signal_data_size);
 
     // do the fft forward, will give us an array of complex values
     fftwf_execute (fftw_int->fft_plan_forward_theta);
     fftwf_execute (fftw_int->fft_plan_forward_delta);
 
+    // do the filtering, and the rescaling by the factor of fft_signal_data_size
+    // while the data is in the frequency domain, which is half the size
+    k->mask (fftw_int->out_theta, fftw_int->filter_function_theta,
+             1.0 / fftw_int->fft_signal_data_size, fftw_int->m);
+    k->mask (fftw_int->out_delta, fftw_int->filter_function_delta,
+             1.0 / fftw_int->fft_signal_data_size, fftw_int->m);
 
-    // do the filtering
-    for (i = 0; i < fftw_int->m; i++) {
-        fftw_int->out_theta[i][0] =
-            fftw_int->out_theta[i][0] * fftw_int->filter_function_theta[i];
-        fftw_int->out_theta[i][1] =
-            fftw_int->out_theta[i][1] * fftw_int->filter_function_theta[i];
-        fftw_int->out_delta[i][0] =
-            fftw_int->out_delta[i][0] * fftw_int->filter_function_delta[i];
-        fftw_int->out_delta[i][1] =
-            fftw_int->out_delta[i][1] * fftw_int->filter_function_delta[i];
-    }
     // reverse the fft
     fftwf_execute (fftw_int->fft_plan_backward_theta);
     fftwf_execute (fftw_int->fft_plan_backward_delta);
-
-    // rescale the results by the factor of fft_signal_data_size
-    for (i = 0; i < fftw_int->fft_signal_data_size; i++) {
-        fftw_int->filtered_signal_theta[i] =
-            fftw_int->filtered_signal_theta[i] / fftw_int->fft_signal_data_size;
-        fftw_int->filtered_signal_delta[i] =
-            fftw_int->filtered_signal_delta[i] / fftw_int->fft_signal_data_size;
-    }
     return 0;
 }
 
@@ -234,34 +238,19 @@ fftw_interface_theta_apply_filter_theta_delta (struct fftw_interface_theta
 float
 fftw_interface_theta_delta_ratio (struct fftw_interface_theta *fftw_int)
 {
-    unsigned int i;
-    fftw_int->signal_sum_square = 0;
-    fftw_int->signal_mean_square = 0;
-    fftw_int->signal_root_mean_square_theta = 0;
-    fftw_int->signal_root_mean_square_delta = 0;
-    fftw_int->signal_sum_square = 0;
+    const size_t start = fftw_int->real_data_to_fft_size - fftw_int->power_signal_length;
 
     // the signal is at the beginning of the filtered_signal_array
-    for (i = fftw_int->real_data_to_fft_size - fftw_int->power_signal_length;
-         i < fftw_int->real_data_to_fft_size; i++) {
-        fftw_int->signal_sum_square +=
-            (fftw_int->filtered_signal_theta[i] *
-             fftw_int->filtered_signal_theta[i]);
-    }
-
+    fftw_int->signal_sum_square =
+        fftw_int->kernels->sum_squares (fftw_int->filtered_signal_theta + start, fftw_int->power_signal_length);
     fftw_int->signal_mean_square =
         fftw_int->signal_sum_square / fftw_int->real_data_to_fft_size;
     fftw_int->signal_root_mean_square_theta =
         sqrt (fftw_int->signal_mean_square);
 
     // for delta
-    fftw_int->signal_sum_square = 0;
-    for (i = fftw_int->real_data_to_fft_size - fftw_int->power_signal_length;
-         i < fftw_int->real_data_to_fft_size; i++) {
-        fftw_int->signal_sum_square +=
-            (fftw_int->filtered_signal_delta[i] *
-             fftw_int->filtered_signal_delta[i]);
-    }
+    fftw_int->signal_sum_square =
+        fftw_int->kernels->sum_squares (fftw_int->filtered_signal_delta + start, fftw_int->power_signal_length);
     fftw_int->signal_mean_square =
         fftw_int->signal_sum_square / fftw_int->real_data_to_fft_size;
     fftw_int->signal_root_mean_square_delta =
@@ -426,11 +415,16 @@ phase_difference (float phase1, float phase2)
 }
 
 
-
+/**
+ * fftw_interface_swr_init:
+ * @n_wavelets: 1 to convolve with one wavelet at FREQUENCY_WAVELET_FOR_CONVOLUTION, or the
+ *              number of wavelets spread across the ripple band
+ */
 int
-fftw_interface_swr_init (struct fftw_interface_swr *fftw_int, int sampling_rate_hz)
+fftw_interface_swr_init (struct fftw_interface_swr *fftw_int, int sampling_rate_hz, int n_wavelets)
 {
     unsigned int i;
+    int k;
     // the next 3 variables should be set according to argument pass to this function.
     // that way the size of signal analyzed could be set in main.c according to options
     fftw_int->sampling_rate = sampling_rate_hz;
@@ -438,6 +432,7 @@ fftw_interface_swr_init (struct fftw_interface_swr *fftw_int, int sampling_rate_
     fftw_int->power_signal_length = DATA_IN_SEGMENT_TO_POWER_SWR;
     fftw_int->real_data_to_fft_size = REAL_DATA_IN_SEGMENT_TO_FFT_SWR;
     fftw_int->fft_scale = 1.0 / (float) fftw_int->fft_signal_data_size;
+    fftw_int->kernels = spectral_kernels_get ();
     if (fftw_int->fft_signal_data_size < fftw_int->real_data_to_fft_size) {
         fprintf (stderr,
                  "fftw_int->fft_signal_data_size<fftw_int->real_data_to_fft_size in fftw_interface_swr_init\n");
@@ -453,11 +448,29 @@ fftw_interface_swr_init (struct fftw_interface_swr *fftw_int, int sampling_rate_
     fftw_int->max_frequency_swr = MAX_FREQUENCY_SWR;
     fftw_int->frequency_wavelet_for_convolution =
         FREQUENCY_WAVELET_FOR_CONVOLUTION;
+    if (n_wavelets < 1 || n_wavelets > SWR_MAX_WAVELETS) {
+        fprintf (stderr, "n_wavelets should be from 1 to %d in fftw_interface_swr_init\n", SWR_MAX_WAVELETS);
+        return -1;
+    }
+    fftw_int->n_wavelets = n_wavelets;
+    if ((fftw_int->wavelet_frequencies = malloc (sizeof (float) * n_wavelets)) == NULL) {
+        fprintf (stderr,
+                 "problem allocating memory for fftw_int->wavelet_frequencies\n");
+        return -1;
+    }
+    if (n_wavelets == 1) {
+        fftw_int->wavelet_frequencies[0] = fftw_int->frequency_wavelet_for_convolution;
+    } else {
+        // centres of n_wavelets equal bands on a log scale
+        for (k = 0; k < n_wavelets; k++)
+            fftw_int->wavelet_frequencies[k] = fftw_int->min_frequency_swr *
+                pow (fftw_int->max_frequency_swr / fftw_int->min_frequency_swr, (k + 0.5) / n_wavelets);
+    }
 
-    // variables to calculate the power
-    fftw_int->size_root_mean_square_array = SIZE_ROOT_MEAN_SQUARE_ARRAY;
-    fftw_int->number_segments_analysed = 0;
-    fftw_int->number_convolution_peaks_analysed = 0;
+    // variables to calculate the power, the baseline freezes after SWR_BASELINE_FREEZE_SEC of segments
+    fftw_interface_swr_set_baseline (fftw_int, 0,
+                                     (long int) SWR_BASELINE_FREEZE_SEC * sampling_rate_hz / HOP_SIZE_SWR,
+                                     0);
     fftw_int->signal_sum_square = 0;
     fftw_int->signal_mean_square = 0;
     fftw_int->signal_root_mean_square = 0;
@@ -488,104 +501,71 @@ fftw_interface_swr_init (struct fftw_interface_swr *fftw_int, int sampling_rate_
         fftw_int->signal_data[i] = 0;
         fftw_int->ref_signal_data[i] = 0;
     }
-    if ((fftw_int->root_mean_square_array =
-             malloc (sizeof (float) * fftw_int->size_root_mean_square_array)) ==
-        NULL) {
-        fprintf (stderr,
-                 "problem allocating memory for fftw_int->root_mean_square_array\n");
-        return -1;
-    }
-    if ((fftw_int->convolution_peak_array =
-             malloc (sizeof (float) * fftw_int->size_root_mean_square_array)) ==
-        NULL) {
-        fprintf (stderr,
-                 "problem allocating memory for fftw_int->convolution_peak_array\n");
-        return -1;
-    }
-
     if ((fftw_int->filter_function_swr =
              malloc (sizeof (float) * fftw_int->m)) == NULL) {
         fprintf (stderr,
                  "problem allocating memory for fftw_int->filter_function_swr\n");
         return -1;
     }
+    // the filtered and convoluted signals share one block, so that one batched transform computes all of them
     if ((fftw_int->filtered_signal_swr =
-             (float *) fftwf_malloc (sizeof (float) *
+             (float *) fftwf_malloc (sizeof (float) * (1 + n_wavelets) *
                                      fftw_int->fft_signal_data_size)) == NULL) {
         fprintf (stderr,
                  "problem allocating memory for fftw_int->filtered_signal_swr\n");
         return -1;
     }
-    for (i = 0; i < fftw_int->fft_signal_data_size; i++) {
+    for (i = 0; i < (1 + n_wavelets) * fftw_int->fft_signal_data_size; i++) {
         fftw_int->filtered_signal_swr[i] = 0;     // assigned to value of 0
     }
+    fftw_int->convoluted_signal = fftw_int->filtered_signal_swr + fftw_int->fft_signal_data_size;
 
+    fftw_int->spectrum_distance = (fftw_int->m + 3) / 4 * 4;
     if ((fftw_int->out_swr =
-             (fftwf_complex *) fftwf_malloc (sizeof (fftwf_complex) *
-                                           fftw_int->fft_signal_data_size)) == NULL) {
+             (fftwf_complex *) fftwf_malloc (sizeof (fftwf_complex) * (1 + n_wavelets) *
+                                           fftw_int->spectrum_distance)) == NULL) {
         fprintf (stderr, "problem allocating memory for fftw_int->out_swr\n");
         return -1;
     }
+    fftw_int->out_convoluted = fftw_int->out_swr + fftw_int->spectrum_distance;
     if ((fftw_int->out_wavelet =
-             (fftwf_complex *) fftwf_malloc (sizeof (fftwf_complex) *
-                                           fftw_int->fft_signal_data_size)) == NULL) {
+             (fftwf_complex *) fftwf_malloc (sizeof (fftwf_complex) * n_wavelets *
+                                           fftw_int->spectrum_distance)) == NULL) {
         fprintf (stderr,
                  "problem allocating memory for fftw_int->out_wavelet\n");
         return -1;
     }
-    if ((fftw_int->out_convoluted =
-             (fftwf_complex *) fftwf_malloc (sizeof (fftwf_complex) *
-                                           fftw_int->fft_signal_data_size)) == NULL) {
-        fprintf (stderr,
-                 "problem allocating memory for fftw_int->out_convoluted\n");
-        return -1;
-    }
-    if ((fftw_int->convoluted_signal =
-             (float *) fftwf_malloc (sizeof (float) *
-                                     fftw_int->fft_signal_data_size)) == NULL) {
-        fprintf (stderr,
-                 "problem allocating memory for fftw_int->convoluted_signal\n");
-        return -1;
-    }
 
 
     // to fft the signal before filtering, the output complex of fftw has n/2+1 size , real is in out_swr[i][0] and imaginary is in out_swr [i][1]
     if ((fftw_int->fft_plan_forward_swr =
-             fftwf_plan_dft_r2c_1d (fftw_int->fft_signal_data_size,
-                                   fftw_int->filtered_signal_swr, fftw_int->out_swr,
-                                   FFTW_MEASURE)) == NULL) {
+             LS_FFTW_PLAN (fftwf_plan_dft_r2c_1d, fftw_int->fft_signal_data_size,
+                                                 fftw_int->filtered_signal_swr, fftw_int->out_swr)) == NULL) {
         fprintf (stderr,
                  "unable to create a plan for fftw_int->fft_plan_forward_swr\n");
         return -1;
     }
     // to fft the wavelet, the output complex of fftw has n/2+1 size , real is in out_swr[i][0] and imaginary is in out_swr [i][1]
     if ((fftw_int->fft_plan_forward_wavelet =
-             fftwf_plan_dft_r2c_1d (fftw_int->fft_signal_data_size,
-                                   fftw_int->wavelet_for_convolution,
-                                   fftw_int->out_wavelet, FFTW_MEASURE)) == NULL) {
+             LS_FFTW_PLAN (fftwf_plan_dft_r2c_1d, fftw_int->fft_signal_data_size,
+                                                 fftw_int->wavelet_for_convolution,
+                                                 fftw_int->out_wavelet)) == NULL) {
         fprintf (stderr,
                  "unable to create a plan for fftw_int->fft_plan_forward_wavelet\n");
         return -1;
     }
-    // the get back the filtered signal
-    if ((fftw_int->fft_plan_backward_swr =
-             fftwf_plan_dft_c2r_1d (fftw_int->fft_signal_data_size,
-                                   fftw_int->out_swr, fftw_int->filtered_signal_swr,
-                                   FFTW_MEASURE)) == NULL) {
-        fprintf (stderr,
-                 "unable to create a plan for fftw_int->fft_plan_backward_swr\n");
-        return -1;
-    }
-
-    // the get back the filtered signal
-    if ((fftw_int->fft_plan_backward_wavelet_convolution =
-             fftwf_plan_dft_c2r_1d (fftw_int->fft_signal_data_size,
-                                   fftw_int->out_convoluted,
-                                   fftw_int->convoluted_signal,
-                                   FFTW_MEASURE)) == NULL) {
-        fprintf (stderr,
-                 "unable to create a plan for fftw_int->fft_plan_backward_swr\n");
-        return -1;
+    // to get back the filtered signal and the convoluted signals, as one batch of transforms
+    {
+        const int n = fftw_int->fft_signal_data_size;
+
+        if ((fftw_int->fft_plan_backward =
+                 LS_FFTW_PLAN (fftwf_plan_many_dft_c2r, 1, &n, 1 + n_wavelets,
+                                                        fftw_int->out_swr, NULL, 1, fftw_int->spectrum_distance,
+                                                        fftw_int->filtered_signal_swr, NULL, 1, fftw_int->fft_signal_data_size)) == NULL) {
+            fprintf (stderr,
+                     "unable to create a plan for fftw_int->fft_plan_backward\n");
+            return -1;
+        }
     }
 
 
@@ -596,14 +576,27 @@ fftw_interface_swr_init (struct fftw_interface_swr *fftw_int, int sampling_rate_
                              fftw_int->min_frequency_swr, // lower cut-off frequency
                              fftw_int->max_frequency_swr);        // higher cut-off frequency
 
-    // make the wavelet for convolution
-    make_wavelet_for_convolution (fftw_int->sampling_rate,
-                                  fftw_int->fft_signal_data_size,
-                                  fftw_int->wavelet_for_convolution,
-                                  fftw_int->frequency_wavelet_for_convolution);
-
-    // fft the wavelet for convolution as we only need it in the frequency domain for convolution
-    fftwf_execute (fftw_int->fft_plan_forward_wavelet);
+    // make the wavelets for convolution, and fft them as we only need them in the frequency domain for convolution
+    for (k = 0; k < n_wavelets; k++) {
+        fftwf_complex *spectrum = fftw_int->out_wavelet + k * fftw_int->spectrum_distance;
+
+        make_wavelet_for_convolution (fftw_int->sampling_rate,
+                                      fftw_int->fft_signal_data_size,
+                                      fftw_int->wavelet_for_convolution,
+                                      fftw_int->wavelet_frequencies[k]);
+        fftwf_execute_dft_r2c (fftw_int->fft_plan_forward_wavelet, fftw_int->wavelet_for_convolution, spectrum);
+
+        // the gain of a wavelet falls with its frequency, give all of them a gain of 1 so that their peaks compare
+        if (n_wavelets > 1) {
+            const size_t centre = lround (fftw_int->wavelet_frequencies[k] * fftw_int->fft_signal_data_size / fftw_int->sampling_rate);
+            const float gain = hypot (spectrum[centre][0], spectrum[centre][1]);
+
+            for (i = 0; i < fftw_int->m; i++) {
+                spectrum[i][0] /= gain;
+                spectrum[i][1] /= gain;
+            }
+        }
+    }
 
 
     return 0;
@@ -615,17 +608,14 @@ fftw_interface_swr_free (struct fftw_interface_swr *fftw_int)
     free (fftw_int->signal_data);
     free (fftw_int->ref_signal_data);
     free (fftw_int->wavelet_for_convolution);
-    free (fftw_int->root_mean_square_array);
-    free (fftw_int->convolution_peak_array);
+    free (fftw_int->wavelet_frequencies);
     free (fftw_int->filter_function_swr);
     fftwf_free (fftw_int->filtered_signal_swr);
-    fftwf_free (fftw_int->convoluted_signal);
     fftwf_free (fftw_int->out_swr);
     fftwf_free (fftw_int->out_wavelet);
-    fftwf_free (fftw_int->out_convoluted);
     fftwf_destroy_plan (fftw_int->fft_plan_forward_swr);
     fftwf_destroy_plan (fftw_int->fft_plan_forward_wavelet);
-    fftwf_destroy_plan (fftw_int->fft_plan_backward_swr);
+    fftwf_destroy_plan (fftw_int->fft_plan_backward);
     return 0;
 }
 
@@ -633,46 +623,33 @@ int
 fftw_interface_swr_differential_and_filter (struct fftw_interface_swr
         *fftw_int)
 {
-    unsigned int i;
-    double sum = 0;
+    const struct spectral_kernels *k = fftw_int->kernels;
+    int i;
     double mean;
     // do the differential between signal and ref_signal, one signal minus the other
-    for (i = 0; i < fftw_int->real_data_to_fft_size; i++) {
-        fftw_int->signal_data[i] =
-            fftw_int->signal_data[i] - fftw_int->ref_signal_data[i];
-        sum += fftw_int->signal_data[i];
-    }
-    mean = sum / fftw_int->real_data_to_fft_size;
+    mean = k->difference (fftw_int->signal_data, fftw_int->signal_data, fftw_int->ref_signal_data,
+                          fftw_int->real_data_to_fft_size) / fftw_int->real_data_to_fft_size;
 
     // correct signal so that the mean is 0, and copy the signal data into the fitered signal array, signal will be at beginning of filtered_signal_swr array
-    for (i = 0; i < fftw_int->real_data_to_fft_size; i++) {
-        fftw_int->signal_data[i] = fftw_int->signal_data[i] - mean;
-        fftw_int->filtered_signal_swr[i] = fftw_int->signal_data[i];
-    }
+    k->add_scalar (fftw_int->signal_data, -mean, fftw_int->real_data_to_fft_size);
+    memcpy (fftw_int->filtered_signal_swr, fftw_int->signal_data, sizeof (float) * fftw_int->real_data_to_fft_size);
+    // the rest is padding of 0, the backward transform of the previous segment left its output there
+    memset (fftw_int->filtered_signal_swr + fftw_int->real_data_to_fft_size, 0,
+            sizeof (float) * (fftw_int->fft_signal_data_size - fftw_int->real_data_to_fft_size));
 
     fftwf_execute (fftw_int->fft_plan_forward_swr);
 
-    // do the convolution in the frequency domain, out_swr and out_wavelet
-    for (i = 0; i < fftw_int->m; i++) {
-        // // pointwise product of the Fourier transforms
-        fftw_int->out_convoluted[i][0] = (fftw_int->out_swr[i][0] * fftw_int->out_wavelet[i][0] - fftw_int->out_swr[i][1] * fftw_int->out_wavelet[i][1]) * fftw_int->fft_scale;   // A.re * B.re - A.im * B.im
-        fftw_int->out_convoluted[i][1] = (fftw_int->out_swr[i][0] * fftw_int->out_wavelet[i][1] + fftw_int->out_swr[i][1] * fftw_int->out_wavelet[i][0]) * fftw_int->fft_scale;   // A.re * B.im + A.im * B.re
-    }
-
-    // do the filtering
-    for (i = 0; i < fftw_int->m; i++) {
-        fftw_int->out_swr[i][0] =
-            fftw_int->out_swr[i][0] * fftw_int->filter_function_swr[i] *
-            fftw_int->fft_scale;
-        fftw_int->out_swr[i][1] =
-            fftw_int->out_swr[i][1] * fftw_int->filter_function_swr[i] *
-            fftw_int->fft_scale;
+    // do the convolution with out_wavelet (pointwise product of the Fourier transforms)
+    // and the filtering in the frequency domain, in one pass; the other wavelets of a bank first, before filtering
+    for (i = 1; i < fftw_int->n_wavelets; i++) {
+        k->multiply (fftw_int->out_swr, fftw_int->out_wavelet + i * fftw_int->spectrum_distance,
+                     fftw_int->out_convoluted + i * fftw_int->spectrum_distance, fftw_int->fft_scale, fftw_int->m);
     }
+    k->mask_and_multiply (fftw_int->out_swr, fftw_int->filter_function_swr, fftw_int->out_wavelet,
+                          fftw_int->out_convoluted, fftw_int->fft_scale, fftw_int->m);
 
-    // get the convoluted signal in time domain, in ftw_int->convoluted_signal
-    fftwf_execute (fftw_int->fft_plan_backward_wavelet_convolution);
-    // get the filtered signal in time domain, in filtered_signal_swr
-    fftwf_execute (fftw_int->fft_plan_backward_swr);
+    // get the filtered signal in time domain, in filtered_signal_swr, and the convoluted signals, from convoluted_signal on
+    fftwf_execute (fftw_int->fft_plan_backward);
     return 0;
 }
 
@@ -683,33 +660,39 @@ float
 fftw_interface_swr_get_convolution_peak (struct fftw_interface_swr *fftw_int)
 {
 
-    unsigned int i;
-    float max = fftw_int->convoluted_signal[0];
+    int i;
+    float max = -INFINITY;
 
-    for (i = fftw_int->real_data_to_fft_size - fftw_int->power_signal_length;
-         i < fftw_int->real_data_to_fft_size; i++) {
-        if (fftw_int->convoluted_signal[i] > max) {
-            max = fftw_int->convoluted_signal[i];
-        }
+    // search only the most recent power_signal_length samples, of all wavelets
+    for (i = 0; i < fftw_int->n_wavelets; i++) {
+        const float *convoluted = fftw_int->convoluted_signal + i * fftw_int->fft_signal_data_size;
+
+        max = fmaxf (max, fftw_int->kernels->max (convoluted + fftw_int->real_data_to_fft_size - fftw_int->power_signal_length,
+                                                  fftw_int->power_signal_length));
     }
-    // store the convolution peak in the array if we haven't yet finish establishing the mean and sd of convolution peak
-    if (fftw_int->number_convolution_peaks_analysed <
-        fftw_int->size_root_mean_square_array) {
-        fftw_int->convolution_peak_array[fftw_int->
-                                         number_convolution_peaks_analysed] =
-                                             max;
-
-        // calculate the mean and sd with the data we have so far
-        fftw_int->mean_convolution_peak =
-            mean (fftw_int->number_convolution_peaks_analysed + 1,
-                  fftw_int->convolution_peak_array, -1.0);
-        fftw_int->std_convolution_peak =
-            standard_deviation (fftw_int->number_convolution_peaks_analysed + 1,
-                                fftw_int->convolution_peak_array, -1.0);
-        fftw_int->number_convolution_peaks_analysed++;
-    }
-    return (max -
-            fftw_int->mean_convolution_peak) / fftw_int->std_convolution_peak;
+
+    // add the convolution peak to the baseline, unless it is frozen
+    running_stats_add (&fftw_int->convolution_peak_stats, max);
+    fftw_int->mean_convolution_peak = running_stats_get_mean (&fftw_int->convolution_peak_stats);
+    fftw_int->std_convolution_peak = running_stats_get_sd (&fftw_int->convolution_peak_stats);
+
+    return running_stats_get_z (&fftw_int->convolution_peak_stats, max);
+}
+
+/**
+ * fftw_interface_swr_set_baseline:
+ * @alpha: weight of a new segment once the baseline is exponentially weighted, 0 for equal weights
+ * @freeze_count: number of segments after which the baseline stops changing, 0 to never freeze
+ * @max_z: segments with a larger z score are clipped to it before changing the baseline, 0 to not clip
+ *
+ * Configure how the mean and sd of power and convolution peak are
+ * established, and start again from an empty baseline.
+ */
+void
+fftw_interface_swr_set_baseline (struct fftw_interface_swr *fftw_int, double alpha, long int freeze_count, double max_z)
+{
+    running_stats_init (&fftw_int->power_stats, alpha, freeze_count, max_z);
+    running_stats_init (&fftw_int->convolution_peak_stats, alpha, freeze_count, max_z);
 }
 
 /**
@@ -720,38 +703,21 @@ fftw_interface_swr_get_convolution_peak (struct fftw_interface_swr *fftw_int)
 float
 fftw_interface_swr_get_power (struct fftw_interface_swr *fftw_int)
 {
-    unsigned int i;
-    fftw_int->signal_sum_square = 0;
-    fftw_int->signal_mean_square = 0;
-    fftw_int->signal_root_mean_square = 0;
-
     // the signal is at the beginning of the filtered_signal_array, go to end of signal minus the power_signal_length
-    for (i = fftw_int->real_data_to_fft_size - fftw_int->power_signal_length;
-         i < fftw_int->real_data_to_fft_size; i++) {
-        fftw_int->signal_sum_square +=
-            (fftw_int->filtered_signal_swr[i] * fftw_int->filtered_signal_swr[i]);
-    }
+    // the squares are summed in double precision
+    fftw_int->signal_sum_square =
+        fftw_int->kernels->sum_squares (fftw_int->filtered_signal_swr + fftw_int->real_data_to_fft_size - fftw_int->power_signal_length,
+                                        fftw_int->power_signal_length);
 
     fftw_int->signal_mean_square = fftw_int->signal_sum_square / fftw_int->power_signal_length;   // the denominator was corrected on 03.02.12
     fftw_int->signal_root_mean_square = sqrt (fftw_int->signal_mean_square);
 
-    // store the first power in the array to get the mean and sd
-    if (fftw_int->number_segments_analysed <
-        fftw_int->size_root_mean_square_array) {
-        fftw_int->root_mean_square_array[fftw_int->number_segments_analysed] =
-            fftw_int->signal_root_mean_square;
-        fftw_int->mean_power =
-            mean (fftw_int->number_segments_analysed + 1,
-                  fftw_int->root_mean_square_array, -9999999.0);
-        fftw_int->std_power =
-            standard_deviation (fftw_int->number_segments_analysed + 1,
-                                fftw_int->root_mean_square_array, -1.0);
-        fftw_int->number_segments_analysed++;
-    }
-    fftw_int->z_power =
-        (fftw_int->signal_root_mean_square -
-         fftw_int->mean_power) / fftw_int->std_power;
-    //  printf("num_seg: %ld, power_signal_length: %d, power: %.3lf, mean: %.3lf, sd: %.3lf, z_power: %.3lf, index start power window: %d\n",fftw_int->number_segments_analysed,fftw_int->power_signal_length,fftw_int->signal_root_mean_square,fftw_int->mean_power,fftw_int->std_power, fftw_int->z_power,fftw_int->real_data_to_fft_size-fftw_int->power_signal_length);
+    // add the power to the baseline, unless it is frozen
+    running_stats_add (&fftw_int->power_stats, fftw_int->signal_root_mean_square);
+    fftw_int->mean_power = running_stats_get_mean (&fftw_int->power_stats);
+    fftw_int->std_power = running_stats_get_sd (&fftw_int->power_stats);
+    fftw_int->z_power = running_stats_get_z (&fftw_int->power_stats, fftw_int->signal_root_mean_square);
+    //  printf("num_seg: %ld, power_signal_length: %d, power: %.3lf, mean: %.3lf, sd: %.3lf, z_power: %.3lf, index start power window: %d\n",fftw_int->power_stats.count,fftw_int->power_signal_length,fftw_int->signal_root_mean_square,fftw_int->mean_power,fftw_int->std_power, fftw_int->z_power,fftw_int->real_data_to_fft_size-fftw_int->power_signal_length);
     return fftw_int->z_power;
 }
 
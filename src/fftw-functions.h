@@ -23,6 +23,32 @@
 #include <time.h>
 #include <fftw3.h>
 
+#include "running-stats.h"
+#include "spectral-kernels.h"
+
+/* planner rigor of all plans, FFTW_MEASURE unless we are warming up the wisdom */
+extern unsigned int fftw_planner_flags;
+/* set when a plan could not be made from wisdom alone, so the wisdom should be saved */
+extern int fftw_wisdom_changed;
+
+/**
+ * LS_FFTW_PLAN:
+ * @planner: fftwf planner function, its flags are added as last argument
+ *
+ * Make a plan from the loaded wisdom if it has one, without measuring and
+ * without touching the arrays. Otherwise plan with fftw_planner_flags and
+ * remember that the wisdom changed.
+ */
+#define LS_FFTW_PLAN(planner, ...) \
+    ({ \
+        fftwf_plan plan_ = planner (__VA_ARGS__, FFTW_WISDOM_ONLY | fftw_planner_flags); \
+        if (plan_ == NULL) { \
+            fftw_wisdom_changed = 1; \
+            plan_ = planner (__VA_ARGS__, fftw_planner_flags); \
+        } \
+        plan_; \
+    })
+
 /**
  * fftw_interface_swr:
  *
@@ -44,15 +70,14 @@ struct fftw_interface_swr
     float min_frequency_swr;
     float max_frequency_swr;
     float frequency_wavelet_for_convolution;
+    int n_wavelets; // size of the bank of wavelets the signal is convolved with
+    float* wavelet_frequencies; // centre frequency of each wavelet
     // power calculation
-    float signal_sum_square;
+    double signal_sum_square;
     float signal_mean_square;
     float signal_root_mean_square;
-    float* root_mean_square_array; // to establish mean and sd of power
-    float* convolution_peak_array; // to establish the mean and sd of peak
-    int size_root_mean_square_array;
-    long int number_segments_analysed;
-    long int number_convolution_peaks_analysed;
+    struct running_stats power_stats; // to establish mean and sd of power
+    struct running_stats convolution_peak_stats; // to establish the mean and sd of peak
     float mean_power; // mean of all signal root mean square so far
     float std_power; // standard deviation of all root mean square so far
     float z_power;
@@ -61,14 +86,15 @@ struct fftw_interface_swr
     // filter function to do the filtering of the signal
     float* filter_function_swr; // kernel to do the filtering after the fft
     fftwf_complex *out_swr; // complex array return by fft forward
-    fftwf_complex *out_wavelet; // complex array return by fft forward
-    fftwf_complex *out_convoluted; // to put the convoluted complex signal
+    fftwf_complex *out_wavelet; // spectrum of each wavelet, spectrum_distance apart
+    fftwf_complex *out_convoluted; // to put the convoluted complex signal of each wavelet, in the same block as out_swr
+    size_t spectrum_distance; // from out_swr to out_convoluted, m rounded up to keep SIMD alignment
     float* filtered_signal_swr; // will go in and out of the fft
-    float* convoluted_signal; // will get the convolution results of signal*wavelet
+    float* convoluted_signal; // will get the convolution results of signal*wavelet, one per wavelet, follows filtered_signal_swr
     fftwf_plan fft_plan_forward_swr; // plan to do fft forward
     fftwf_plan fft_plan_forward_wavelet; // plan to do fft forward
-    fftwf_plan fft_plan_backward_swr; // plan to do fft backward
-    fftwf_plan fft_plan_backward_wavelet_convolution; // plan to do fft backward
+    fftwf_plan fft_plan_backward; // plan to do all fft backward at once, filtered signal and convolutions
+    const struct spectral_kernels* kernels; // loops around the ffts, for this CPU
 };
 
 /**
@@ -106,9 +132,10 @@ struct fftw_interface_theta
     fftwf_plan fft_plan_backward_theta; // plan to do fft forward
     fftwf_plan fft_plan_forward_delta; // plan to do fft backward
     fftwf_plan fft_plan_backward_delta; // plan to do fft backward
+    const struct spectral_kernels* kernels; // loops around the ffts, for this CPU
 };
 
-int fftw_interface_theta_init (struct fftw_interface_theta* fftw_int, int sampling_rate_hz); // should have parameters to allow signal of different length to be treated
+int fftw_interface_theta_init (struct fftw_interface_theta* fftw_int, int sampling_rate_hz, int with_fft); // should have parameters to allow signal of different length to be treated
 int fftw_interface_theta_free (struct fftw_interface_theta* fftw_int);
 int fftw_interface_theta_apply_filter_theta_delta (struct fftw_interface_theta* fftw_int);
 float fftw_interface_theta_delta_ratio (struct fftw_interface_theta* fftw_int);
@@ -117,12 +144,16 @@ float fftw_interface_theta_get_phase (struct fftw_interface_theta* fftw_int,
                                       struct timespec* elapsed_since_acquisition,
                                       float frequency);
 
-int fftw_interface_swr_init (struct fftw_interface_swr* fftw_int, int sampling_rate_hz); // should have parameters to allow signal of different length to be treated
+int fftw_interface_swr_init (struct fftw_interface_swr* fftw_int, int sampling_rate_hz, int n_wavelets); // should have parameters to allow signal of different length to be treated
 int fftw_interface_swr_free (struct fftw_interface_swr* fftw_int);
 
 int fftw_interface_swr_differential_and_filter (struct fftw_interface_swr* fftw_int);
 float fftw_interface_swr_get_power (struct fftw_interface_swr* fftw_int);
 float fftw_interface_swr_get_convolution_peak (struct fftw_interface_swr* fftw_int);
+void fftw_interface_swr_set_baseline (struct fftw_interface_swr* fftw_int,
+                                      double alpha,
+                                      long int freeze_count,
+                                      double max_z);
 
 float phase_difference (float phase1,
                         float phase2);
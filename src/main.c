@@ -27,6 +27,7 @@
 #include <galdur.h>
 
 #include "defaults.h"
+#include "fftw-functions.h"
 #include "tasks.h"
 #include "stimpulse.h"
 #include "utils.h"
@@ -44,6 +45,10 @@ static int    opt_channels_in_dat_file = -1;
 
 static int    opt_offline_channel = -1;
 
+static gboolean opt_adc_stats = FALSE;
+static gchar  *opt_adc_backend = NULL;
+static gchar  *opt_fftw_wisdom = NULL;
+
 static GOptionEntry generic_option_entries[] =
 {
     { "minimum_interval_ms", 'm', 0, G_OPTION_ARG_DOUBLE, &opt_minimum_interval_ms,
@@ -61,6 +66,15 @@ static GOptionEntry generic_option_entries[] =
     { "offline_channel", 'x', 0, G_OPTION_ARG_INT, &opt_offline_channel,
         "The channel on which swr detection is done when working offline from a dat file (-o and -s)", "number" },
 
+    { "adc-stats", 0, 0, G_OPTION_ARG_NONE, &opt_adc_stats,
+        "Print data acquisition and processing time statistics at the end of the trial", NULL },
+
+    { "adc-backend", 0, 0, G_OPTION_ARG_STRING, &opt_adc_backend,
+        "Acquire data from this Galdur ADC backend, e.g. 'synthetic' or 'replay:FILE,channels=N'", "name[:args]" },
+
+    { "fftw-wisdom", 0, 0, G_OPTION_ARG_FILENAME, &opt_fftw_wisdom,
+        "Load and save FFT plans in this file instead of " LS_FFTW_WISDOM_FILE, "file" },
+
     { NULL }
 };
 
@@ -159,6 +173,9 @@ labrstim_option_context_parse (GOptionContext *opt_context, const gchar *subcomm
         }
     }
 
+    tasks_set_print_adc_stats (opt_adc_stats);
+    tasks_set_adc_backend (opt_adc_backend);
+
     return 0;
 }
 
@@ -320,12 +337,17 @@ labrstim_run_theta (const gchar *command, char **argv, int argc)
 
     static double   opt_stimulation_theta_phase = 90;
     static gboolean opt_random = FALSE;
+    static gchar   *opt_theta_engine = NULL;
+    LsThetaEngine   theta_engine;
     const GOptionEntry theta_stim_options[] = {
         { "theta", 't', 0, G_OPTION_ARG_DOUBLE, &opt_stimulation_theta_phase,
           "Stimulation at the given theta phases", "theta_phase" },
 
         { "random", 'R', 0, G_OPTION_ARG_NONE, &opt_random,
           "Train of stimulations with random intervals, use with -m and -M", NULL },
+
+        { "theta_engine", 0, 0, G_OPTION_ARG_STRING, &opt_theta_engine,
+          "Signal processing for theta filtering: fft (sliding window, default) or biquad (IIR, sample by sample)", "engine" },
         { NULL }
     };
 
@@ -345,9 +367,19 @@ labrstim_run_theta (const gchar *command, char **argv, int argc)
         return 1;
     }
 
+    if (opt_theta_engine == NULL || g_strcmp0 (opt_theta_engine, "fft") == 0) {
+        theta_engine = LS_THETA_ENGINE_FFT;
+    } else if (g_strcmp0 (opt_theta_engine, "biquad") == 0) {
+        theta_engine = LS_THETA_ENGINE_BIQUAD;
+    } else {
+        g_printerr ("Unknown theta engine '%s', should be 'fft' or 'biquad'.\n", opt_theta_engine);
+        return 1;
+    }
+
     if (opt_dat_filename == NULL)
         stimpulse_set_intensity (laser_intensity_volt);
-    success = perform_theta_stimulation (opt_random,
+    success = perform_theta_stimulation (theta_engine,
+                                         opt_random,
                                          sampling_rate_hz,
                                          trial_duration_sec,
                                          pulse_duration_ms,
@@ -383,6 +415,18 @@ labrstim_run_swr (const gchar *command, char **argv, int argc)
     static double   opt_swr_convolution_peak_threshold = 0.5; /* as a z score */
     static gboolean opt_delay_swr = FALSE;
     static int      opt_swr_offline_reference = -1;
+    static gchar   *opt_swr_engine = NULL;
+    static double   opt_swr_baseline_ewma = 0;
+    static double   opt_swr_baseline_freeze = SWR_BASELINE_FREEZE_SEC;
+    static double   opt_swr_baseline_max_z = 0;
+    static gchar   *opt_swr_channels = NULL;
+    static gchar   *opt_swr_vote = NULL;
+    static double   opt_swr_latency_budget = SWR_MULTI_LATENCY_BUDGET_MS;
+    static int      opt_swr_wavelets = 1;
+    LsSwrEngine     swr_engine;
+    int             swr_channels[SWR_MULTI_MAX_CHANNELS];
+    int             n_swr_channels = 0;
+    int             swr_votes = 0;
 
     const GOptionEntry swr_stim_options[] = {
         { "swr_refractory", 'f', 0, G_OPTION_ARG_DOUBLE, &opt_swr_refractory,
@@ -399,6 +443,30 @@ labrstim_run_swr (const gchar *command, char **argv, int argc)
 
         { "swr_offline_reference", 'y', 0, G_OPTION_ARG_INT, &opt_swr_offline_reference,
           "The reference channel for swr detection when working offline from a dat file (-o and -s)", "number" },
+
+        { "swr_engine", 0, 0, G_OPTION_ARG_STRING, &opt_swr_engine,
+          "Signal processing for swr detection: fft (sliding window, default), stream (overlap-save, 1 ms steps), biquad (IIR, 1 ms steps) or hilbert (envelope z score against -s, 1 ms steps)", "engine" },
+
+        { "swr_baseline_ewma", 0, 0, G_OPTION_ARG_DOUBLE, &opt_swr_baseline_ewma,
+          "Time constant of an exponentially weighted power baseline, 0 to weight all segments equally (default)", "sec" },
+
+        { "swr_baseline_freeze", 0, 0, G_OPTION_ARG_DOUBLE, &opt_swr_baseline_freeze,
+          "Stop updating the power baseline after this time, 0 to never freeze it", "sec" },
+
+        { "swr_baseline_max_z", 0, 0, G_OPTION_ARG_DOUBLE, &opt_swr_baseline_max_z,
+          "Clip segments above this z score before adding them to the power baseline, 0 to not clip (default)", "z" },
+
+        { "swr_channels", 0, 0, G_OPTION_ARG_STRING, &opt_swr_channels,
+          "Detect swr on several channels against the reference, comma separated ADC inputs (or .dat file channels with -o, instead of -x)", "ch,ch,..." },
+
+        { "swr_vote", 0, 0, G_OPTION_ARG_STRING, &opt_swr_vote,
+          "With --swr_channels, number of channels that must detect a swr, or max to let the channel with the largest power decide (default)", "k|max" },
+
+        { "swr_latency_budget", 0, 0, G_OPTION_ARG_DOUBLE, &opt_swr_latency_budget,
+          "With --swr_channels, drop detections made later than this after the last sample, 0 for no limit", "ms" },
+
+        { "swr_wavelets", 0, 0, G_OPTION_ARG_INT, &opt_swr_wavelets,
+          "Convolve with a bank of this many morlet wavelets across the ripple band and use the largest peak, 1 for a single 160 Hz wavelet (default)", "number" },
         { NULL }
     };
 
@@ -448,27 +516,178 @@ labrstim_run_swr (const gchar *command, char **argv, int argc)
         return 3;
     }
 
+    if (opt_swr_baseline_ewma < 0 || opt_swr_baseline_freeze < 0 || opt_swr_baseline_max_z < 0) {
+        g_printerr ("The SWR baseline options should be larger or equal to 0.\n");
+        return 3;
+    }
+    tasks_set_swr_baseline (opt_swr_baseline_ewma, opt_swr_baseline_freeze, opt_swr_baseline_max_z);
+
+    if (opt_swr_engine == NULL || g_strcmp0 (opt_swr_engine, "fft") == 0) {
+        swr_engine = LS_SWR_ENGINE_FFT;
+    } else if (g_strcmp0 (opt_swr_engine, "stream") == 0) {
+        swr_engine = LS_SWR_ENGINE_STREAM;
+    } else if (g_strcmp0 (opt_swr_engine, "biquad") == 0) {
+        swr_engine = LS_SWR_ENGINE_BIQUAD;
+    } else if (g_strcmp0 (opt_swr_engine, "hilbert") == 0) {
+        swr_engine = LS_SWR_ENGINE_HILBERT;
+    } else {
+        g_printerr ("Unknown SWR engine '%s', should be 'fft', 'stream', 'biquad' or 'hilbert'.\n", opt_swr_engine);
+        return 3;
+    }
+
+    if (opt_swr_wavelets < 1 || opt_swr_wavelets > SWR_MAX_WAVELETS) {
+        g_printerr ("The number of SWR wavelets should be from 1 to %d but is %d.\n", SWR_MAX_WAVELETS, opt_swr_wavelets);
+        return 3;
+    }
+    if (opt_swr_wavelets > 1 && (swr_engine != LS_SWR_ENGINE_FFT || opt_swr_channels != NULL)) {
+        g_printerr ("A bank of SWR wavelets (--swr_wavelets) only works with the single-channel fft engine.\n");
+        return 3;
+    }
+    tasks_set_swr_wavelets (opt_swr_wavelets);
+
+    if (opt_swr_channels != NULL) {
+        g_auto(GStrv) channel_list = g_strsplit (opt_swr_channels, ",", -1);
+        const int max_channel = opt_dat_filename != NULL ? opt_channels_in_dat_file - 1 : 15;
+
+        for (guint i = 0; channel_list[i] != NULL; i++) {
+            gchar *end = NULL;
+            gint64 channel = g_ascii_strtoll (channel_list[i], &end, 10);
+
+            if (end == channel_list[i] || *end != '\0' || channel < 0 || channel > max_channel ||
+                (opt_dat_filename == NULL && channel == LS_REF_CHAN)) {
+                g_printerr ("Invalid SWR channel '%s', should be from 0 to %d and not the reference channel.\n",
+                            channel_list[i], max_channel);
+                return 3;
+            }
+            if (n_swr_channels == SWR_MULTI_MAX_CHANNELS) {
+                g_printerr ("At most %d SWR channels can be given.\n", SWR_MULTI_MAX_CHANNELS);
+                return 3;
+            }
+            swr_channels[n_swr_channels++] = channel;
+        }
+        if (n_swr_channels == 0) {
+            g_printerr ("No SWR channel given to --swr_channels.\n");
+            return 3;
+        }
+
+        if (opt_swr_vote != NULL && g_strcmp0 (opt_swr_vote, "max") != 0) {
+            swr_votes = g_ascii_strtoll (opt_swr_vote, NULL, 10);
+            if (swr_votes < 1 || swr_votes > n_swr_channels) {
+                g_printerr ("The SWR vote should be max or from 1 to %d but is %s.\n", n_swr_channels, opt_swr_vote);
+                return 3;
+            }
+        }
+
+        if (swr_engine != LS_SWR_ENGINE_FFT) {
+            g_printerr ("Multi-channel SWR detection (--swr_channels) only works with the fft engine.\n");
+            return 3;
+        }
+        if (opt_swr_latency_budget < 0) {
+            g_printerr ("The SWR latency budget should be larger or equal to 0.\n");
+            return 3;
+        }
+    }
+
     if (opt_dat_filename == NULL)
         stimpulse_set_intensity (laser_intensity_volt);
-    success = perform_swr_stimulation (sampling_rate_hz,
-                                       trial_duration_sec,
-                                       pulse_duration_ms,
-                                       opt_swr_refractory,
-                                       opt_swr_power_threshold,
-                                       opt_swr_convolution_peak_threshold,
-                                       opt_delay_swr,
-                                       opt_minimum_interval_ms,
-                                       opt_maximum_interval_ms,
-                                       opt_dat_filename,
-                                       opt_channels_in_dat_file,
-                                       opt_offline_channel,
-                                       opt_swr_offline_reference);
+    if (n_swr_channels > 0)
+        success = perform_swr_multi_stimulation (sampling_rate_hz,
+                                                 trial_duration_sec,
+                                                 pulse_duration_ms,
+                                                 opt_swr_refractory,
+                                                 opt_swr_power_threshold,
+                                                 opt_swr_convolution_peak_threshold,
+                                                 swr_channels,
+                                                 n_swr_channels,
+                                                 swr_votes,
+                                                 opt_swr_latency_budget,
+                                                 opt_delay_swr,
+                                                 opt_minimum_interval_ms,
+                                                 opt_maximum_interval_ms,
+                                                 opt_dat_filename,
+                                                 opt_channels_in_dat_file,
+                                                 opt_swr_offline_reference);
+    else
+        success = perform_swr_stimulation (swr_engine,
+                                           sampling_rate_hz,
+                                           trial_duration_sec,
+                                           pulse_duration_ms,
+                                           opt_swr_refractory,
+                                           opt_swr_power_threshold,
+                                           opt_swr_convolution_peak_threshold,
+                                           opt_delay_swr,
+                                           opt_minimum_interval_ms,
+                                           opt_maximum_interval_ms,
+                                           opt_dat_filename,
+                                           opt_channels_in_dat_file,
+                                           opt_offline_channel,
+                                           opt_swr_offline_reference);
     if (!success)
         return 5;
 
     return 0;
 }
 
+/**
+ * labrstim_run_plan_warmup:
+ *
+ * Compute the best FFT plans for the given sampling rates, to be saved as wisdom.
+ */
+static gint
+labrstim_run_plan_warmup (const gchar *command, char **argv, int argc)
+{
+    g_autoptr(GOptionContext) opt_context = NULL;
+    gint ret;
+    gint i;
+
+    const GOptionEntry warmup_options[] = {
+        { NULL }
+    };
+
+    opt_context = labrstim_new_subcommand_option_context (command, warmup_options);
+    g_option_context_set_summary (opt_context,
+                                  "Plan all FFTs with FFTW_PATIENT for the given sampling rates (Hz), "
+                                  "or for the default sampling rate, and save them as wisdom.");
+
+    ret = labrstim_option_context_parse (opt_context, command, &argc, &argv);
+    if (ret != 0)
+        return ret;
+
+    if (argc <= 2)
+        return perform_plan_warmup (LS_DEFAULT_SAMPLING_RATE)? 0 : 5;
+
+    for (i = 2; i < argc; i++) {
+        int sampling_rate_hz = g_ascii_strtoll (argv[i], NULL, 10);
+
+        if (sampling_rate_hz <= 1000 || sampling_rate_hz > 200000) {
+            g_printerr ("Sampling frequency must be between 1000 and 200000.\nYou gave %s\n", argv[i]);
+            return 1;
+        }
+        if (!perform_plan_warmup (sampling_rate_hz))
+            return 5;
+    }
+
+    return 0;
+}
+
+/**
+ * labrstim_save_fftw_wisdom:
+ *
+ * Save the FFT plans made during this session, if there are new ones.
+ */
+static void
+labrstim_save_fftw_wisdom (const gchar *filename)
+{
+    g_autofree gchar *dir = NULL;
+
+    if (!fftw_wisdom_changed)
+        return;
+
+    dir = g_path_get_dirname (filename);
+    if (g_mkdir_with_parents (dir, 0755) != 0 || !fftwf_export_wisdom_to_filename (filename))
+        g_printerr ("Could not save FFTW wisdom to %s, plans will be measured again next time.\n", filename);
+}
+
 /**
  * labrstim_init_random_seed:
  *
@@ -497,6 +716,7 @@ labrstim_get_summary ()
     g_string_append_printf (string, "  %s - %s\n", "theta", "Theta stimulation.");
     g_string_append_printf (string, "  %s - %s\n", "swr  ", "Sharp-wave-ripple detection and stimulation.");
     g_string_append_printf (string, "  %s - %s\n", "train", "Train stimulation.");
+    g_string_append_printf (string, "  %s - %s\n", "plan-warmup", "Compute the best FFT plans ahead of time, for a fast start of theta and swr.");
 
     g_string_append (string, "\n");
     g_string_append (string, "You can find information about subcommand-specific options by passing \"--help\" to the subcommand.");
@@ -515,6 +735,8 @@ main (int argc, char *argv[])
     const gchar *command = NULL;
     gchar *summary = NULL;
     gint ret = 0;
+    gboolean use_board;
+    const gchar *wisdom_file;
 
     static gboolean opt_show_version = FALSE;
     static gboolean opt_verbose_mode = FALSE;
@@ -596,14 +818,48 @@ main (int argc, char *argv[])
         return 0;
     }
 
+    /* reuse the FFT plans of earlier sessions, so that we do not need to measure them again */
+    wisdom_file = opt_fftw_wisdom != NULL? opt_fftw_wisdom : LS_FFTW_WISDOM_FILE;
+    if (!fftwf_import_wisdom_from_filename (wisdom_file))
+        ls_debug ("No FFTW wisdom loaded from %s\n", wisdom_file);
+
+    if (g_strcmp0 (command, "plan-warmup") == 0) {
+        /* planning needs no board */
+        ret = labrstim_run_plan_warmup (command, argv, argc);
+        labrstim_save_fftw_wisdom (wisdom_file);
+        return ret;
+    }
+
+    /* we only need the DAQ board if we acquire data from its ADCs */
+    use_board = FALSE;
     if (opt_dat_filename == NULL) {
-        /* give the program realtime priority if we are not running from an offline file */
-        if (!labrstim_make_realtime (APP_NAME))
+        const gchar *backend;
+        GldAdcBackendCaps caps;
+
+        backend = opt_adc_backend != NULL? opt_adc_backend : gld_adc_get_default_backend ();
+        if (!gld_adc_lookup_backend_caps (backend, &caps)) {
+            g_printerr ("Unknown ADC backend: %s\n", backend);
+            return 1;
+        }
+        use_board = caps & GLD_ADC_BACKEND_CAP_HARDWARE;
+    }
+
+    if (use_board) {
+        /* give the program realtime priority if we are working with real hardware */
+        if (!labrstim_make_realtime (APP_NAME)) {
+#ifdef MOCK_HARDWARE
+            g_printerr ("Continuing without realtime priority on emulated hardware.\n");
+#else
             return 5;
+#endif
+        }
 
         /* initialize DAQ board */
         if (!gld_board_initialize ())
             return 5;
+    } else {
+        /* without a board, there is nothing to stimulate */
+        stimpulse_set_dry_run (TRUE);
     }
 
     /* set a random seed based on the time we launched */
@@ -622,8 +878,10 @@ main (int argc, char *argv[])
     }
 
     /* clear Galdur board state */
-    if (opt_dat_filename == NULL)
+    if (use_board)
         gld_board_shutdown ();
 
+    labrstim_save_fftw_wisdom (wisdom_file);
+
     return ret;
 }
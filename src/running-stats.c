@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "running-stats.h"
+
+#include <math.h>
+
+void
+running_stats_init (struct running_stats* stats, double alpha, long int freeze_count, double max_z)
+{
+    stats->alpha = alpha;
+    stats->freeze_count = freeze_count;
+    stats->max_z = max_z;
+    running_stats_reset (stats);
+}
+
+void
+running_stats_reset (struct running_stats* stats)
+{
+    stats->count = 0;
+    stats->mean = 0;
+    stats->variance = 0;
+}
+
+/**
+ * running_stats_is_frozen:
+ *
+ * Returns: 1 if no more values will be added, 0 otherwise.
+ */
+int
+running_stats_is_frozen (struct running_stats* stats)
+{
+    return stats->freeze_count > 0 && stats->count >= stats->freeze_count;
+}
+
+/**
+ * running_stats_add:
+ *
+ * Add @value to the statistics, unless they are frozen. Outliers are
+ * clipped to a z score of max_z, so they barely move the baseline but an
+ * exponentially weighted baseline can still follow a lasting change.
+ *
+ * Returns: 1 if the value was added, 0 if the statistics are frozen.
+ */
+int
+running_stats_add (struct running_stats* stats, double value)
+{
+    double weight;
+    double delta;
+
+    if (running_stats_is_frozen (stats))
+        return 0;
+    if (stats->max_z > 0 && stats->count > 1 &&
+        running_stats_get_z (stats, value) > stats->max_z)
+        value = stats->mean + stats->max_z * running_stats_get_sd (stats);
+
+    // equal weights until 1/alpha values were seen, so early values do not dominate
+    stats->count++;
+    weight = 1.0 / stats->count;
+    if (weight < stats->alpha)
+        weight = stats->alpha;
+
+    delta = value - stats->mean;
+    stats->mean += weight * delta;
+    stats->variance = (1 - weight) * (stats->variance + weight * delta * delta);
+    return 1;
+}
+
+double
+running_stats_get_mean (struct running_stats* stats)
+{
+    return stats->mean;
+}
+
+/**
+ * running_stats_get_sd:
+ *
+ * Returns: the sample standard deviation while all values have equal
+ * weights, the exponentially weighted standard deviation afterwards.
+ */
+double
+running_stats_get_sd (struct running_stats* stats)
+{
+    if (stats->count < 2)
+        return 0;
+    if (stats->alpha * stats->count > 1)
+        return sqrt (stats->variance);
+    return sqrt (stats->variance * stats->count / (stats->count - 1));
+}
+
+/**
+ * running_stats_get_z:
+ *
+ * Returns: the z score of @value, 0 as long as the standard deviation is unknown.
+ */
+double
+running_stats_get_z (struct running_stats* stats, double value)
+{
+    double sd = running_stats_get_sd (stats);
+
+    if (sd <= 0)
+        return 0;
+    return (value - stats->mean) / sd;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LS_RUNNING_STATS_H
+#define __LS_RUNNING_STATS_H
+
+/**
+ * running_stats:
+ *
+ * Mean and standard deviation of a stream of values, updated in constant
+ * time per value (Welford), in double precision.
+ *
+ * With alpha > 0 the statistics become exponentially weighted once more
+ * than 1/alpha values were added, so the baseline follows slow changes of
+ * the signal. The statistics can freeze after a number of values, and
+ * can clip outliers so that the events we detect do not inflate their
+ * own baseline.
+ */
+struct running_stats
+{
+    long int count; // number of values added
+    double mean;
+    double variance; // population variance of the values added
+    double alpha; // weight of a new value when exponentially weighted, 0 for equal weights
+    long int freeze_count; // stop adding values after this many, 0 to never stop
+    double max_z; // clip values to this z score before adding them, 0 to add values unchanged
+};
+
+void running_stats_init (struct running_stats* stats,
+                         double alpha,
+                         long int freeze_count,
+                         double max_z);
+void running_stats_reset (struct running_stats* stats);
+int running_stats_add (struct running_stats* stats,
+                       double value);
+int running_stats_is_frozen (struct running_stats* stats);
+double running_stats_get_mean (struct running_stats* stats);
+double running_stats_get_sd (struct running_stats* stats);
+double running_stats_get_z (struct running_stats* stats,
+                            double value);
+
+#endif /* __LS_RUNNING_STATS_H */
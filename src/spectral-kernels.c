@@ -0,0 +1,701 @@
+/*
+ * Copyright (C) 2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "spectral-kernels.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LS_KERNELS_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define LS_KERNELS_NEON 1
+#endif
+
+// SIMD partial sums are kept in single precision for this many values,
+// then added to a double
+#define KERNEL_SUM_BLOCK 256
+
+/**
+ * scalar reference
+ */
+static double
+scalar_sum (const float* x, size_t n)
+{
+    double sum = 0;
+    for (size_t i = 0; i < n; i++)
+        sum += x[i];
+    return sum;
+}
+
+static double
+scalar_sum_squares (const float* x, size_t n)
+{
+    double sum = 0;
+    for (size_t i = 0; i < n; i++)
+        sum += (double) x[i] * x[i];
+    return sum;
+}
+
+static float
+scalar_max (const float* x, size_t n)
+{
+    float max = x[0];
+    for (size_t i = 1; i < n; i++)
+        if (x[i] > max)
+            max = x[i];
+    return max;
+}
+
+static void
+scalar_add_scalar (float* x, float value, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        x[i] += value;
+}
+
+static double
+scalar_difference (float* out, const float* a, const float* b, size_t n)
+{
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        out[i] = a[i] - b[i];
+        sum += out[i];
+    }
+    return sum;
+}
+
+static void
+scalar_mask (fftwf_complex* spectrum, const float* mask, float scale, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        float m = mask[i] * scale;
+        spectrum[i][0] *= m;
+        spectrum[i][1] *= m;
+    }
+}
+
+static void
+scalar_multiply (const fftwf_complex* spectrum, const fftwf_complex* kernel,
+                 fftwf_complex* product, float scale, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        float re = spectrum[i][0] * scale;
+        float im = spectrum[i][1] * scale;
+        product[i][0] = re * kernel[i][0] - im * kernel[i][1];
+        product[i][1] = re * kernel[i][1] + im * kernel[i][0];
+    }
+}
+
+static void
+scalar_mask_and_multiply (fftwf_complex* spectrum, const float* mask,
+                          const fftwf_complex* kernel, fftwf_complex* product,
+                          float scale, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        float re = spectrum[i][0] * scale;
+        float im = spectrum[i][1] * scale;
+        product[i][0] = re * kernel[i][0] - im * kernel[i][1];
+        product[i][1] = re * kernel[i][1] + im * kernel[i][0];
+        spectrum[i][0] = re * mask[i];
+        spectrum[i][1] = im * mask[i];
+    }
+}
+
+static const struct spectral_kernels scalar_kernels = {
+    "scalar",
+    scalar_sum,
+    scalar_sum_squares,
+    scalar_max,
+    scalar_add_scalar,
+    scalar_difference,
+    scalar_mask,
+    scalar_multiply,
+    scalar_mask_and_multiply,
+};
+
+#ifdef LS_KERNELS_X86
+/**
+ * SSE2, 4 floats or 2 complex values per register
+ */
+#define SSE2 __attribute__ ((target ("sse2")))
+
+static SSE2 inline double
+sse2_hsum (__m128 v)
+{
+    float lanes[4];
+    _mm_storeu_ps (lanes, v);
+    return (double) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+static SSE2 double
+sse2_sum (const float* x, size_t n)
+{
+    double sum = 0;
+    size_t i = 0;
+    while (i + 4 <= n) {
+        __m128 acc = _mm_setzero_ps ();
+        size_t end = i + KERNEL_SUM_BLOCK < n ? i + KERNEL_SUM_BLOCK : n;
+        for (; i + 4 <= end; i += 4)
+            acc = _mm_add_ps (acc, _mm_loadu_ps (x + i));
+        sum += sse2_hsum (acc);
+    }
+    return sum + scalar_sum (x + i, n - i);
+}
+
+static SSE2 double
+sse2_sum_squares (const float* x, size_t n)
+{
+    double sum = 0;
+    size_t i = 0;
+    while (i + 4 <= n) {
+        __m128 acc = _mm_setzero_ps ();
+        size_t end = i + KERNEL_SUM_BLOCK < n ? i + KERNEL_SUM_BLOCK : n;
+        for (; i + 4 <= end; i += 4) {
+            __m128 v = _mm_loadu_ps (x + i);
+            acc = _mm_add_ps (acc, _mm_mul_ps (v, v));
+        }
+        sum += sse2_hsum (acc);
+    }
+    return sum + scalar_sum_squares (x + i, n - i);
+}
+
+static SSE2 float
+sse2_max (const float* x, size_t n)
+{
+    float max = x[0];
+    size_t i = 0;
+    if (n >= 4) {
+        __m128 acc = _mm_loadu_ps (x);
+        for (i = 4; i + 4 <= n; i += 4)
+            acc = _mm_max_ps (acc, _mm_loadu_ps (x + i));
+        float lanes[4];
+        _mm_storeu_ps (lanes, acc);
+        max = scalar_max (lanes, 4);
+    }
+    for (; i < n; i++)
+        if (x[i] > max)
+            max = x[i];
+    return max;
+}
+
+static SSE2 void
+sse2_add_scalar (float* x, float value, size_t n)
+{
+    __m128 v = _mm_set1_ps (value);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps (x + i, _mm_add_ps (_mm_loadu_ps (x + i), v));
+    scalar_add_scalar (x + i, value, n - i);
+}
+
+static SSE2 double
+sse2_difference (float* out, const float* a, const float* b, size_t n)
+{
+    double sum = 0;
+    size_t i = 0;
+    while (i + 4 <= n) {
+        __m128 acc = _mm_setzero_ps ();
+        size_t end = i + KERNEL_SUM_BLOCK < n ? i + KERNEL_SUM_BLOCK : n;
+        for (; i + 4 <= end; i += 4) {
+            __m128 d = _mm_sub_ps (_mm_loadu_ps (a + i), _mm_loadu_ps (b + i));
+            _mm_storeu_ps (out + i, d);
+            acc = _mm_add_ps (acc, d);
+        }
+        sum += sse2_hsum (acc);
+    }
+    return sum + scalar_difference (out + i, a + i, b + i, n - i);
+}
+
+static SSE2 void
+sse2_mask (fftwf_complex* spectrum, const float* mask, float scale, size_t n)
+{
+    float* s = (float*) spectrum;
+    __m128 vscale = _mm_set1_ps (scale);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        // m0 m0 m1 m1 and m2 m2 m3 m3, one per complex value
+        __m128 m = _mm_mul_ps (_mm_loadu_ps (mask + i), vscale);
+        __m128 m01 = _mm_unpacklo_ps (m, m);
+        __m128 m23 = _mm_unpackhi_ps (m, m);
+        _mm_storeu_ps (s + 2 * i, _mm_mul_ps (_mm_loadu_ps (s + 2 * i), m01));
+        _mm_storeu_ps (s + 2 * i + 4, _mm_mul_ps (_mm_loadu_ps (s + 2 * i + 4), m23));
+    }
+    scalar_mask (spectrum + i, mask + i, scale, n - i);
+}
+
+// complex product of two interleaved pairs: re = ar*br - ai*bi, im = ar*bi + ai*br
+static SSE2 inline __m128
+sse2_complex_multiply (__m128 a, __m128 b)
+{
+    const __m128 sign = _mm_castsi128_ps (_mm_set_epi32 (0, (int) 0x80000000, 0, (int) 0x80000000));
+    __m128 b_re = _mm_shuffle_ps (b, b, _MM_SHUFFLE (2, 2, 0, 0));
+    __m128 b_im = _mm_shuffle_ps (b, b, _MM_SHUFFLE (3, 3, 1, 1));
+    __m128 a_swap = _mm_shuffle_ps (a, a, _MM_SHUFFLE (2, 3, 0, 1));
+    __m128 cross = _mm_xor_ps (_mm_mul_ps (a_swap, b_im), sign);
+    return _mm_add_ps (_mm_mul_ps (a, b_re), cross);
+}
+
+static SSE2 void
+sse2_multiply (const fftwf_complex* spectrum, const fftwf_complex* kernel,
+               fftwf_complex* product, float scale, size_t n)
+{
+    const float* s = (const float*) spectrum;
+    const float* k = (const float*) kernel;
+    float* p = (float*) product;
+    __m128 vscale = _mm_set1_ps (scale);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)
+        _mm_storeu_ps (p + 2 * i, sse2_complex_multiply (_mm_mul_ps (_mm_loadu_ps (s + 2 * i), vscale),
+                                                         _mm_loadu_ps (k + 2 * i)));
+    scalar_multiply (spectrum + i, kernel + i, product + i, scale, n - i);
+}
+
+static SSE2 void
+sse2_mask_and_multiply (fftwf_complex* spectrum, const float* mask,
+                        const fftwf_complex* kernel, fftwf_complex* product,
+                        float scale, size_t n)
+{
+    float* s = (float*) spectrum;
+    const float* k = (const float*) kernel;
+    float* p = (float*) product;
+    __m128 vscale = _mm_set1_ps (scale);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 m = _mm_loadu_ps (mask + i);
+        __m128 m01 = _mm_unpacklo_ps (m, m);
+        __m128 m23 = _mm_unpackhi_ps (m, m);
+        __m128 s01 = _mm_mul_ps (_mm_loadu_ps (s + 2 * i), vscale);
+        __m128 s23 = _mm_mul_ps (_mm_loadu_ps (s + 2 * i + 4), vscale);
+        _mm_storeu_ps (p + 2 * i, sse2_complex_multiply (s01, _mm_loadu_ps (k + 2 * i)));
+        _mm_storeu_ps (p + 2 * i + 4, sse2_complex_multiply (s23, _mm_loadu_ps (k + 2 * i + 4)));
+        _mm_storeu_ps (s + 2 * i, _mm_mul_ps (s01, m01));
+        _mm_storeu_ps (s + 2 * i + 4, _mm_mul_ps (s23, m23));
+    }
+    scalar_mask_and_multiply (spectrum + i, mask + i, kernel + i, product + i, scale, n - i);
+}
+
+static const struct spectral_kernels sse2_kernels = {
+    "SSE2",
+    sse2_sum,
+    sse2_sum_squares,
+    sse2_max,
+    sse2_add_scalar,
+    sse2_difference,
+    sse2_mask,
+    sse2_multiply,
+    sse2_mask_and_multiply,
+};
+
+/**
+ * AVX2, 8 floats or 4 complex values per register
+ */
+#define AVX2 __attribute__ ((target ("avx2,fma")))
+
+static AVX2 inline double
+avx2_hsum (__m256 v)
+{
+    float lanes[8];
+    _mm256_storeu_ps (lanes, v);
+    return (double) lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7];
+}
+
+static AVX2 double
+avx2_sum (const float* x, size_t n)
+{
+    double sum = 0;
+    size_t i = 0;
+    while (i + 8 <= n) {
+        __m256 acc = _mm256_setzero_ps ();
+        size_t end = i + KERNEL_SUM_BLOCK < n ? i + KERNEL_SUM_BLOCK : n;
+        for (; i + 8 <= end; i += 8)
+            acc = _mm256_add_ps (acc, _mm256_loadu_ps (x + i));
+        sum += avx2_hsum (acc);
+    }
+    return sum + scalar_sum (x + i, n - i);
+}
+
+static AVX2 double
+avx2_sum_squares (const float* x, size_t n)
+{
+    double sum = 0;
+    size_t i = 0;
+    while (i + 8 <= n) {
+        __m256 acc = _mm256_setzero_ps ();
+        size_t end = i + KERNEL_SUM_BLOCK < n ? i + KERNEL_SUM_BLOCK : n;
+        for (; i + 8 <= end; i += 8) {
+            __m256 v = _mm256_loadu_ps (x + i);
+            acc = _mm256_fmadd_ps (v, v, acc);
+        }
+        sum += avx2_hsum (acc);
+    }
+    return sum + scalar_sum_squares (x + i, n - i);
+}
+
+static AVX2 float
+avx2_max (const float* x, size_t n)
+{
+    float max = x[0];
+    size_t i = 0;
+    if (n >= 8) {
+        __m256 acc = _mm256_loadu_ps (x);
+        for (i = 8; i + 8 <= n; i += 8)
+            acc = _mm256_max_ps (acc, _mm256_loadu_ps (x + i));
+        float lanes[8];
+        _mm256_storeu_ps (lanes, acc);
+        max = scalar_max (lanes, 8);
+    }
+    for (; i < n; i++)
+        if (x[i] > max)
+            max = x[i];
+    return max;
+}
+
+static AVX2 void
+avx2_add_scalar (float* x, float value, size_t n)
+{
+    __m256 v = _mm256_set1_ps (value);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps (x + i, _mm256_add_ps (_mm256_loadu_ps (x + i), v));
+    scalar_add_scalar (x + i, value, n - i);
+}
+
+static AVX2 double
+avx2_difference (float* out, const float* a, const float* b, size_t n)
+{
+    double sum = 0;
+    size_t i = 0;
+    while (i + 8 <= n) {
+        __m256 acc = _mm256_setzero_ps ();
+        size_t end = i + KERNEL_SUM_BLOCK < n ? i + KERNEL_SUM_BLOCK : n;
+        for (; i + 8 <= end; i += 8) {
+            __m256 d = _mm256_sub_ps (_mm256_loadu_ps (a + i), _mm256_loadu_ps (b + i));
+            _mm256_storeu_ps (out + i, d);
+            acc = _mm256_add_ps (acc, d);
+        }
+        sum += avx2_hsum (acc);
+    }
+    return sum + scalar_difference (out + i, a + i, b + i, n - i);
+}
+
+// m0 m0 m1 m1 m2 m2 m3 m3 from four mask values
+static AVX2 inline __m256
+avx2_duplicate_mask (__m128 m)
+{
+    return _mm256_set_m128 (_mm_unpackhi_ps (m, m), _mm_unpacklo_ps (m, m));
+}
+
+static AVX2 void
+avx2_mask (fftwf_complex* spectrum, const float* mask, float scale, size_t n)
+{
+    float* s = (float*) spectrum;
+    __m128 vscale = _mm_set1_ps (scale);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256 m = avx2_duplicate_mask (_mm_mul_ps (_mm_loadu_ps (mask + i), vscale));
+        _mm256_storeu_ps (s + 2 * i, _mm256_mul_ps (_mm256_loadu_ps (s + 2 * i), m));
+    }
+    scalar_mask (spectrum + i, mask + i, scale, n - i);
+}
+
+// complex product of four interleaved pairs, even lanes ar*br - ai*bi, odd lanes ai*br + ar*bi
+static AVX2 inline __m256
+avx2_complex_multiply (__m256 a, __m256 b)
+{
+    __m256 b_re = _mm256_moveldup_ps (b);
+    __m256 b_im = _mm256_movehdup_ps (b);
+    __m256 a_swap = _mm256_permute_ps (a, _MM_SHUFFLE (2, 3, 0, 1));
+    return _mm256_fmaddsub_ps (a, b_re, _mm256_mul_ps (a_swap, b_im));
+}
+
+static AVX2 void
+avx2_multiply (const fftwf_complex* spectrum, const fftwf_complex* kernel,
+               fftwf_complex* product, float scale, size_t n)
+{
+    const float* s = (const float*) spectrum;
+    const float* k = (const float*) kernel;
+    float* p = (float*) product;
+    __m256 vscale = _mm256_set1_ps (scale);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm256_storeu_ps (p + 2 * i, avx2_complex_multiply (_mm256_mul_ps (_mm256_loadu_ps (s + 2 * i), vscale),
+                                                            _mm256_loadu_ps (k + 2 * i)));
+    scalar_multiply (spectrum + i, kernel + i, product + i, scale, n - i);
+}
+
+static AVX2 void
+avx2_mask_and_multiply (fftwf_complex* spectrum, const float* mask,
+                        const fftwf_complex* kernel, fftwf_complex* product,
+                        float scale, size_t n)
+{
+    float* s = (float*) spectrum;
+    const float* k = (const float*) kernel;
+    float* p = (float*) product;
+    __m256 vscale = _mm256_set1_ps (scale);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256 m = avx2_duplicate_mask (_mm_loadu_ps (mask + i));
+        __m256 a = _mm256_mul_ps (_mm256_loadu_ps (s + 2 * i), vscale);
+        _mm256_storeu_ps (p + 2 * i, avx2_complex_multiply (a, _mm256_loadu_ps (k + 2 * i)));
+        _mm256_storeu_ps (s + 2 * i, _mm256_mul_ps (a, m));
+    }
+    scalar_mask_and_multiply (spectrum + i, mask + i, kernel + i, product + i, scale, n - i);
+}
+
+static const struct spectral_kernels avx2_kernels = {
+    "AVX2",
+    avx2_sum,
+    avx2_sum_squares,
+    avx2_max,
+    avx2_add_scalar,
+    avx2_difference,
+    avx2_mask,
+    avx2_multiply,
+    avx2_mask_and_multiply,
+};
+#endif /* LS_KERNELS_X86 */
+
+#ifdef LS_KERNELS_NEON
+/**
+ * NEON, 4 floats per register; complex values are split into real and
+ * imaginary registers by the structure loads
+ */
+static inline double
+neon_hsum (float32x4_t v)
+{
+    float lanes[4];
+    vst1q_f32 (lanes, v);
+    return (double) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+static double
+neon_sum (const float* x, size_t n)
+{
+    double sum = 0;
+    size_t i = 0;
+    while (i + 4 <= n) {
+        float32x4_t acc = vdupq_n_f32 (0);
+        size_t end = i + KERNEL_SUM_BLOCK < n ? i + KERNEL_SUM_BLOCK : n;
+        for (; i + 4 <= end; i += 4)
+            acc = vaddq_f32 (acc, vld1q_f32 (x + i));
+        sum += neon_hsum (acc);
+    }
+    return sum + scalar_sum (x + i, n - i);
+}
+
+static double
+neon_sum_squares (const float* x, size_t n)
+{
+    double sum = 0;
+    size_t i = 0;
+    while (i + 4 <= n) {
+        float32x4_t acc = vdupq_n_f32 (0);
+        size_t end = i + KERNEL_SUM_BLOCK < n ? i + KERNEL_SUM_BLOCK : n;
+        for (; i + 4 <= end; i += 4) {
+            float32x4_t v = vld1q_f32 (x + i);
+            acc = vmlaq_f32 (acc, v, v);
+        }
+        sum += neon_hsum (acc);
+    }
+    return sum + scalar_sum_squares (x + i, n - i);
+}
+
+static float
+neon_max (const float* x, size_t n)
+{
+    float max = x[0];
+    size_t i = 0;
+    if (n >= 4) {
+        float32x4_t acc = vld1q_f32 (x);
+        for (i = 4; i + 4 <= n; i += 4)
+            acc = vmaxq_f32 (acc, vld1q_f32 (x + i));
+        float lanes[4];
+        vst1q_f32 (lanes, acc);
+        max = scalar_max (lanes, 4);
+    }
+    for (; i < n; i++)
+        if (x[i] > max)
+            max = x[i];
+    return max;
+}
+
+static void
+neon_add_scalar (float* x, float value, size_t n)
+{
+    float32x4_t v = vdupq_n_f32 (value);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        vst1q_f32 (x + i, vaddq_f32 (vld1q_f32 (x + i), v));
+    scalar_add_scalar (x + i, value, n - i);
+}
+
+static double
+neon_difference (float* out, const float* a, const float* b, size_t n)
+{
+    double sum = 0;
+    size_t i = 0;
+    while (i + 4 <= n) {
+        float32x4_t acc = vdupq_n_f32 (0);
+        size_t end = i + KERNEL_SUM_BLOCK < n ? i + KERNEL_SUM_BLOCK : n;
+        for (; i + 4 <= end; i += 4) {
+            float32x4_t d = vsubq_f32 (vld1q_f32 (a + i), vld1q_f32 (b + i));
+            vst1q_f32 (out + i, d);
+            acc = vaddq_f32 (acc, d);
+        }
+        sum += neon_hsum (acc);
+    }
+    return sum + scalar_difference (out + i, a + i, b + i, n - i);
+}
+
+static void
+neon_mask (fftwf_complex* spectrum, const float* mask, float scale, size_t n)
+{
+    float* s = (float*) spectrum;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t m = vmulq_n_f32 (vld1q_f32 (mask + i), scale);
+        float32x4x2_t v = vld2q_f32 (s + 2 * i);
+        v.val[0] = vmulq_f32 (v.val[0], m);
+        v.val[1] = vmulq_f32 (v.val[1], m);
+        vst2q_f32 (s + 2 * i, v);
+    }
+    scalar_mask (spectrum + i, mask + i, scale, n - i);
+}
+
+static void
+neon_multiply (const fftwf_complex* spectrum, const fftwf_complex* kernel,
+               fftwf_complex* product, float scale, size_t n)
+{
+    const float* s = (const float*) spectrum;
+    const float* k = (const float*) kernel;
+    float* p = (float*) product;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4x2_t a = vld2q_f32 (s + 2 * i);
+        float32x4x2_t b = vld2q_f32 (k + 2 * i);
+        float32x4x2_t c;
+        a.val[0] = vmulq_n_f32 (a.val[0], scale);
+        a.val[1] = vmulq_n_f32 (a.val[1], scale);
+        c.val[0] = vmlsq_f32 (vmulq_f32 (a.val[0], b.val[0]), a.val[1], b.val[1]);
+        c.val[1] = vmlaq_f32 (vmulq_f32 (a.val[0], b.val[1]), a.val[1], b.val[0]);
+        vst2q_f32 (p + 2 * i, c);
+    }
+    scalar_multiply (spectrum + i, kernel + i, product + i, scale, n - i);
+}
+
+static void
+neon_mask_and_multiply (fftwf_complex* spectrum, const float* mask,
+                        const fftwf_complex* kernel, fftwf_complex* product,
+                        float scale, size_t n)
+{
+    float* s = (float*) spectrum;
+    const float* k = (const float*) kernel;
+    float* p = (float*) product;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t m = vld1q_f32 (mask + i);
+        float32x4x2_t a = vld2q_f32 (s + 2 * i);
+        float32x4x2_t b = vld2q_f32 (k + 2 * i);
+        float32x4x2_t c;
+        a.val[0] = vmulq_n_f32 (a.val[0], scale);
+        a.val[1] = vmulq_n_f32 (a.val[1], scale);
+        c.val[0] = vmlsq_f32 (vmulq_f32 (a.val[0], b.val[0]), a.val[1], b.val[1]);
+        c.val[1] = vmlaq_f32 (vmulq_f32 (a.val[0], b.val[1]), a.val[1], b.val[0]);
+        vst2q_f32 (p + 2 * i, c);
+        a.val[0] = vmulq_f32 (a.val[0], m);
+        a.val[1] = vmulq_f32 (a.val[1], m);
+        vst2q_f32 (s + 2 * i, a);
+    }
+    scalar_mask_and_multiply (spectrum + i, mask + i, kernel + i, product + i, scale, n - i);
+}
+
+static const struct spectral_kernels neon_kernels = {
+    "NEON",
+    neon_sum,
+    neon_sum_squares,
+    neon_max,
+    neon_add_scalar,
+    neon_difference,
+    neon_mask,
+    neon_multiply,
+    neon_mask_and_multiply,
+};
+#endif /* LS_KERNELS_NEON */
+
+/**
+ * spectral_kernels_get_by_name:
+ *
+ * Returns the kernels for one instruction set ("scalar", "SSE2", "AVX2" or
+ * "NEON"), or NULL if they are not built in or this CPU cannot run them.
+ */
+const struct spectral_kernels*
+spectral_kernels_get_by_name (const char* name)
+{
+    if (strcasecmp (name, scalar_kernels.name) == 0)
+        return &scalar_kernels;
+#ifdef LS_KERNELS_X86
+    __builtin_cpu_init ();
+    if (strcasecmp (name, avx2_kernels.name) == 0)
+        return __builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma") ? &avx2_kernels : NULL;
+    if (strcasecmp (name, sse2_kernels.name) == 0)
+        return __builtin_cpu_supports ("sse2") ? &sse2_kernels : NULL;
+#endif
+#ifdef LS_KERNELS_NEON
+    // built only when the compiler may use NEON anyway, always on aarch64
+    if (strcasecmp (name, neon_kernels.name) == 0)
+        return &neon_kernels;
+#endif
+    return NULL;
+}
+
+/**
+ * spectral_kernels_get:
+ *
+ * Returns the fastest kernels this CPU can run. LABRSTIM_KERNELS in the
+ * environment forces a given set, e.g. "scalar" to compare against the
+ * reference.
+ */
+const struct spectral_kernels*
+spectral_kernels_get (void)
+{
+    static const struct spectral_kernels* kernels = NULL;
+    if (kernels != NULL)
+        return kernels;
+
+    const char* forced = getenv ("LABRSTIM_KERNELS");
+    if (forced != NULL) {
+        kernels = spectral_kernels_get_by_name (forced);
+        if (kernels == NULL)
+            fprintf (stderr, "spectral kernels %s are not available on this CPU\n", forced);
+    }
+    if (kernels == NULL)
+        kernels = spectral_kernels_get_by_name ("AVX2");
+    if (kernels == NULL)
+        kernels = spectral_kernels_get_by_name ("SSE2");
+    if (kernels == NULL)
+        kernels = spectral_kernels_get_by_name ("NEON");
+    if (kernels == NULL)
+        kernels = &scalar_kernels;
+    return kernels;
+}
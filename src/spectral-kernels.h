@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LS_SPECTRAL_KERNELS_H
+#define __LS_SPECTRAL_KERNELS_H
+
+#include <stddef.h>
+#include <fftw3.h>
+
+/**
+ * spectral_kernels:
+ *
+ * The loops around the FFTs of the theta and SWR pipelines, with one
+ * implementation per instruction set. The best one for the CPU we run on
+ * is chosen at runtime, the scalar one is the reference the others are
+ * tested against.
+ */
+struct spectral_kernels
+{
+    const char* name;
+    // sum of x
+    double (*sum) (const float* x, size_t n);
+    // sum of x * x
+    double (*sum_squares) (const float* x, size_t n);
+    // largest value of x, n > 0
+    float (*max) (const float* x, size_t n);
+    // x = x + value
+    void (*add_scalar) (float* x, float value, size_t n);
+    // out = a - b, returns the sum of out
+    double (*difference) (float* out, const float* a, const float* b, size_t n);
+    // spectrum = spectrum * mask * scale
+    void (*mask) (fftwf_complex* spectrum, const float* mask, float scale, size_t n);
+    // product = spectrum * kernel * scale
+    void (*multiply) (const fftwf_complex* spectrum, const fftwf_complex* kernel,
+                      fftwf_complex* product, float scale, size_t n);
+    // product = spectrum * kernel * scale, then spectrum = spectrum * mask * scale
+    void (*mask_and_multiply) (fftwf_complex* spectrum, const float* mask,
+                               const fftwf_complex* kernel, fftwf_complex* product,
+                               float scale, size_t n);
+};
+
+const struct spectral_kernels* spectral_kernels_get (void);
+const struct spectral_kernels* spectral_kernels_get_by_name (const char* name);
+
+#endif /* __LS_SPECTRAL_KERNELS_H */
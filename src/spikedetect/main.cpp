@@ -187,7 +187,6 @@ static bool run_spikedetect(
     // configure ADC, run DAQ on CPU 0
     daq = gld_adc_new(LS_ADC_CHANNEL_COUNT, LS_DATA_BUFFER_SIZE, 0);
     gld_adc_set_acq_frequency(daq, samplingRateHz);
-    gld_adc_set_nodata_sleep_time(daq, gld_set_timespec_from_ms(SLEEP_WHEN_NO_NEW_DATA_MS));
 
     // get time at beginning of trial
     clock_gettime(CLOCK_REALTIME, &tk.time_beginning_trial);
@@ -228,8 +227,17 @@ static bool run_spikedetect(
         gld_adc_skip_to_front(daq, LS_SCAN_CHAN);
 
         if (offlineDataFile == nullptr) {
-            // get fixed size of samples from the data buffer
-            gld_adc_get_samples_double(daq, LS_SCAN_CHAN, samples, CHUNK_SIZE);
+            GldAdcSpan span1, span2;
+
+            // wait for a full chunk, then convert it straight from the ring buffer memory
+            if (!gld_adc_wait_for(daq, LS_SCAN_CHAN, CHUNK_SIZE, -1)) {
+                fprintf(stderr, "Data acquisition stopped unexpectedly\n");
+                break;
+            }
+            gld_adc_peek(daq, LS_SCAN_CHAN, CHUNK_SIZE, &span1, &span2);
+            std::copy(span1.data, span1.data + span1.len, samples);
+            std::copy(span2.data, span2.data + span2.len, samples + span1.len);
+            gld_adc_commit(daq, LS_SCAN_CHAN, CHUNK_SIZE);
 
             // set time when the last sample was acquired
             clock_gettime(CLOCK_REALTIME, &tk.time_last_acquired_data);
@@ -490,8 +498,20 @@ int main(int argc, char *argv[])
         return 0;
     }
 
+    // we only need the DAQ board if we acquire data from its ADCs,
+    // the backend can be changed with the GALDUR_ADC_BACKEND environment variable
+    bool useBoard = false;
     if (opt_dat_filename == NULL) {
-        /* give the program realtime priority if we are not running from an offline file */
+        GldAdcBackendCaps caps;
+        if (!gld_adc_lookup_backend_caps(gld_adc_get_default_backend(), &caps)) {
+            g_printerr("Unknown ADC backend: %s\n", gld_adc_get_default_backend());
+            return 1;
+        }
+        useBoard = caps & GLD_ADC_BACKEND_CAP_HARDWARE;
+    }
+
+    if (useBoard) {
+        /* give the program realtime priority if we are working with real hardware */
         if (!labrstim_make_realtime("labrstim-spikedetect"))
             return 5;
 
@@ -500,6 +520,8 @@ int main(int argc, char *argv[])
             return 5;
 
         stimpulse_set_intensity(laser_intensity_volt);
+    } else {
+        stimpulse_set_dry_run(TRUE);
     }
 
     bool success = run_spikedetect(
@@ -515,7 +537,7 @@ int main(int argc, char *argv[])
         opt_offline_channel);
 
     // clear Galdur board state
-    if (opt_dat_filename == NULL)
+    if (useBoard)
         gld_board_shutdown();
 
     return success ? 0 : 1;
@@ -22,6 +22,20 @@
 #include <glib.h>
 #include <galdur.h>
 
+/* if set, the Galdur board is not available and stimulation is only pretended */
+static gboolean stim_dry_run = FALSE;
+
+/**
+ * stimpulse_set_dry_run:
+ *
+ * Do not touch the stimulation hardware, e.g. because the board was not
+ * initialized as data is acquired from a synthetic source.
+ */
+void
+stimpulse_set_dry_run (gboolean dry_run)
+{
+    stim_dry_run = dry_run;
+}
 
 /**
  * stimpulse_init:
@@ -29,6 +43,8 @@
 void
 stimpulse_init (void)
 {
+    if (stim_dry_run)
+        return;
     gld_gpio_set_mode (LS_STIM_PIN, GLD_GPIO_MODE_OUTPUT);
 }
 
@@ -38,6 +54,8 @@ stimpulse_init (void)
 void
 stimpulse_set_intensity (uint16_t value)
 {
+    if (stim_dry_run)
+        return;
     gld_dac_set_value (LS_INTENSITY_CHANNEL, value);
 }
 
@@ -47,6 +65,8 @@ stimpulse_set_intensity (uint16_t value)
 void
 stimpulse_set_trigger_high (void)
 {
+    if (stim_dry_run)
+        return;
     gld_gpio_set_value (LS_STIM_PIN, GLD_GPIO_HIGH);
 }
 
@@ -56,5 +76,7 @@ stimpulse_set_trigger_high (void)
 void
 stimpulse_set_trigger_low (void)
 {
+    if (stim_dry_run)
+        return;
     gld_gpio_set_value (LS_STIM_PIN, GLD_GPIO_LOW);
 }
@@ -26,6 +26,7 @@
 #define LS_STIM_PIN GLD_GPIO_PIN_27
 #define LS_INTENSITY_CHANNEL 0
 
+void            stimpulse_set_dry_run (gboolean dry_run);
 void            stimpulse_init (void);
 
 void            stimpulse_set_intensity (uint16_t value);
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "swr-hilbert.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "defaults.h"
+
+/**
+ * swr_hilbert_init:
+ * @max_frames: largest number of samples passed to swr_hilbert_process()
+ * @min_frequency: lower cut-off of the band-pass
+ * @max_frequency: higher cut-off of the band-pass
+ */
+int
+swr_hilbert_init (struct swr_hilbert* hilbert, int sampling_rate_hz, size_t max_frames,
+                  float min_frequency, float max_frequency)
+{
+    size_t j;
+
+    memset (hilbert, 0, sizeof (*hilbert));
+    if (max_frames == 0) {
+        fprintf (stderr, "max_frames of 0 in swr_hilbert_init\n");
+        return -1;
+    }
+    hilbert->sampling_rate = sampling_rate_hz;
+    hilbert->max_frames = max_frames;
+
+    if (biquad_cascade_init (&hilbert->bandpass, 1, BIQUAD_ORDER_SWR) == -1 ||
+        biquad_cascade_set_bandpass (&hilbert->bandpass, 0, sampling_rate_hz, min_frequency, max_frequency) == -1) {
+        fprintf (stderr, "problem initializing the band-pass in swr_hilbert_init\n");
+        goto fail;
+    }
+
+    hilbert->hilbert_delay = SWR_HILBERT_LENGTH_MS * sampling_rate_hz / 2000;
+    hilbert->hilbert_length = 2 * hilbert->hilbert_delay + 1;
+    hilbert->filtered = malloc (sizeof (float) * max_frames);
+    hilbert->hilbert_coefficients = malloc (sizeof (float) * (hilbert->hilbert_delay + 1));
+    hilbert->history = calloc (2 * hilbert->hilbert_length, sizeof (float));
+    if (hilbert->filtered == NULL || hilbert->hilbert_coefficients == NULL || hilbert->history == NULL) {
+        fprintf (stderr, "problem allocating memory in swr_hilbert_init\n");
+        goto fail;
+    }
+
+    // ideal Hilbert transformer, 2 / (pi * lag) at odd lags and 0 at even lags, with a Hamming window
+    for (j = 0; j <= hilbert->hilbert_delay; j++) {
+        const double window = 0.54 + 0.46 * cos (M_PI * j / hilbert->hilbert_delay);
+        hilbert->hilbert_coefficients[j] = j % 2 == 1 ? 2 / (M_PI * j) * window : 0;
+    }
+
+    hilbert->smoothing_alpha = 1 - exp (-1000.0 / (SWR_HILBERT_SMOOTHING_MS * sampling_rate_hz));
+    hilbert->warmup = BIQUAD_SETTLING_CYCLES * sampling_rate_hz / min_frequency + hilbert->hilbert_length +
+                      5 * SWR_HILBERT_SMOOTHING_MS * sampling_rate_hz / 1000;
+    swr_hilbert_set_baseline (hilbert, 0, (long int) SWR_BASELINE_FREEZE_SEC * sampling_rate_hz, 0);
+    return 0;
+
+fail:
+    // everything was zeroed above, so this only frees what was allocated
+    swr_hilbert_free (hilbert);
+    return -1;
+}
+
+int
+swr_hilbert_free (struct swr_hilbert* hilbert)
+{
+    biquad_cascade_free (&hilbert->bandpass);
+    free (hilbert->filtered);
+    free (hilbert->hilbert_coefficients);
+    free (hilbert->history);
+    return 0;
+}
+
+/**
+ * swr_hilbert_set_baseline:
+ *
+ * Configure how the mean and sd of the smoothed envelope are established,
+ * see running_stats_init(). A value is added for every sample.
+ */
+void
+swr_hilbert_set_baseline (struct swr_hilbert* hilbert, double alpha, long int freeze_count, double max_z)
+{
+    running_stats_init (&hilbert->stats, alpha, freeze_count, max_z);
+}
+
+/**
+ * swr_hilbert_process:
+ * @signal: @n_frames new samples
+ * @ref: @n_frames new samples of the reference
+ *
+ * Returns: the largest z score of the smoothed envelope over the new
+ * samples, 0 until the filters have settled.
+ */
+float
+swr_hilbert_process (struct swr_hilbert* hilbert, const float* signal, const float* ref, size_t n_frames)
+{
+    const size_t length = hilbert->hilbert_length;
+    const size_t centre = hilbert->hilbert_delay;
+    float max_z = 0;
+    size_t i;
+    size_t j;
+
+    if (n_frames > hilbert->max_frames) {
+        fprintf (stderr, "%zu samples are more than max_frames in swr_hilbert_process\n", n_frames);
+        return 0;
+    }
+
+    for (i = 0; i < n_frames; i++)
+        hilbert->filtered[i] = signal[i] - ref[i];
+    biquad_cascade_process (&hilbert->bandpass, hilbert->filtered, hilbert->filtered, n_frames);
+
+    for (i = 0; i < n_frames; i++) {
+        const float* window;
+        double real;
+        double imaginary = 0;
+        double envelope;
+
+        // window holds the last length samples, oldest first
+        hilbert->history[hilbert->position] = hilbert->filtered[i];
+        hilbert->history[hilbert->position + length] = hilbert->filtered[i];
+        hilbert->position = (hilbert->position + 1) % length;
+        window = hilbert->history + hilbert->position;
+
+        // analytic signal at the centre of the window, the coefficients are antisymmetric
+        real = window[centre];
+        for (j = 1; j <= centre; j += 2)
+            imaginary += hilbert->hilbert_coefficients[j] * (window[centre - j] - window[centre + j]);
+        envelope = sqrt (real * real + imaginary * imaginary);
+        hilbert->envelope += hilbert->smoothing_alpha * (envelope - hilbert->envelope);
+
+        if (++hilbert->samples_processed <= (long int) hilbert->warmup)
+            continue;
+
+        running_stats_add (&hilbert->stats, hilbert->envelope);
+        hilbert->z = running_stats_get_z (&hilbert->stats, hilbert->envelope);
+        if (hilbert->z > max_z)
+            max_z = hilbert->z;
+    }
+    return max_z;
+}
+
+/**
+ * swr_hilbert_get_warmup:
+ *
+ * Returns: the number of samples after which the z score is valid.
+ */
+size_t
+swr_hilbert_get_warmup (struct swr_hilbert* hilbert)
+{
+    return hilbert->warmup;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LS_SWR_HILBERT_H
+#define __LS_SWR_HILBERT_H
+
+#include <stddef.h>
+
+#include "biquad.h"
+#include "running-stats.h"
+
+/**
+ * swr_hilbert:
+ *
+ * Envelope SWR detector, updated sample by sample: causal band-pass of the
+ * signal minus reference, FIR Hilbert transformer, envelope, exponential
+ * smoothing of the envelope and z score of the smoothed envelope against
+ * a running baseline.
+ *
+ * The Hilbert transformer is a linear-phase FIR, the envelope lags the
+ * band-passed signal by hilbert_delay samples.
+ */
+struct swr_hilbert
+{
+    int sampling_rate;
+    size_t max_frames; // largest number of samples per call
+    struct biquad_cascade bandpass;
+    float* filtered; // band-passed samples of one call
+    size_t hilbert_length; // taps of the Hilbert transformer, odd
+    size_t hilbert_delay; // its group delay, (hilbert_length - 1) / 2
+    float* hilbert_coefficients; // coefficient of the odd lags 1, 3, 5... from the centre
+    float* history; // last hilbert_length band-passed samples, stored twice to read them without wrapping
+    size_t position; // where the next sample goes in history
+    double smoothing_alpha; // weight of a new envelope value in the smoothed envelope
+    double envelope; // smoothed envelope
+    double z; // z score of the smoothed envelope after the last sample
+    struct running_stats stats; // baseline of the smoothed envelope
+    size_t warmup; // samples before the envelope is trusted
+    long int samples_processed;
+};
+
+int swr_hilbert_init (struct swr_hilbert* hilbert,
+                      int sampling_rate_hz,
+                      size_t max_frames,
+                      float min_frequency,
+                      float max_frequency);
+int swr_hilbert_free (struct swr_hilbert* hilbert);
+void swr_hilbert_set_baseline (struct swr_hilbert* hilbert,
+                               double alpha,
+                               long int freeze_count,
+                               double max_z);
+float swr_hilbert_process (struct swr_hilbert* hilbert,
+                           const float* signal,
+                           const float* ref,
+                           size_t n_frames);
+size_t swr_hilbert_get_warmup (struct swr_hilbert* hilbert);
+
+#endif /* __LS_SWR_HILBERT_H */
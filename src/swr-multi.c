@@ -0,0 +1,358 @@
+/*
+ * Copyright (C) 2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "swr-multi.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include <galdur.h>
+#include "defaults.h"
+#include "fftw-functions.h"
+
+/**
+ * swr_multi_group_process:
+ *
+ * Differential, filtering, convolution, power and convolution peak of the
+ * channels of one group, with one transform each way for all channels.
+ */
+static void
+swr_multi_group_process (struct swr_multi_group* group)
+{
+    struct swr_multi* sm = group->sm;
+    const struct spectral_kernels* k = sm->kernels;
+    const size_t n = sm->fft_signal_data_size;
+    const size_t start = sm->real_data_to_fft_size - sm->power_signal_length;
+    int i;
+
+    // signal minus reference with a mean of 0, the padding stays 0
+    for (i = 0; i < group->n_channels; i++) {
+        float* input = group->input + i * n;
+        double mean;
+
+        mean = k->difference (input, swr_multi_get_signal (sm, group->first_channel + i), sm->ref_signal_data,
+                              sm->real_data_to_fft_size) / sm->real_data_to_fft_size;
+        k->add_scalar (input, -mean, sm->real_data_to_fft_size);
+    }
+    fftwf_execute (group->fft_plan_forward);
+
+    // filter and convolve in the frequency domain, convolution spectra follow the filtered ones
+    for (i = 0; i < group->n_channels; i++) {
+        k->mask_and_multiply (group->spectra + i * sm->spectrum_distance, sm->filter_function_swr, sm->out_wavelet,
+                              group->spectra + (group->n_channels + i) * sm->spectrum_distance,
+                              sm->fft_scale, sm->m);
+    }
+    fftwf_execute (group->fft_plan_backward);
+
+    // z scores of power and convolution peak of the most recent samples, against each channel baseline
+    for (i = 0; i < group->n_channels; i++) {
+        const int channel = group->first_channel + i;
+        const float* filtered = group->output + i * n;
+        const float* convoluted = group->output + (group->n_channels + i) * n;
+        double power;
+        double peak;
+
+        power = sqrt (k->sum_squares (filtered + start, sm->power_signal_length) / sm->power_signal_length);
+        peak = k->max (convoluted + start, sm->power_signal_length);
+
+        running_stats_add (&sm->power_stats[channel], power);
+        running_stats_add (&sm->convolution_peak_stats[channel], peak);
+        sm->z_power[channel] = running_stats_get_z (&sm->power_stats[channel], power);
+        sm->z_convolution_peak[channel] = running_stats_get_z (&sm->convolution_peak_stats[channel], peak);
+    }
+}
+
+/**
+ * swr_multi_worker_main:
+ *
+ * Wait for new data by spinning on the generation counter, the core is
+ * ours and waking up from a futex would cost a good part of a hop.
+ */
+static void*
+swr_multi_worker_main (void* data)
+{
+    struct swr_multi_group* group = data;
+    struct swr_multi* sm = group->sm;
+    int generation = 0;
+
+    if (gld_set_thread_cpu_affinity (group->cpu) != 0)
+        fprintf (stderr, "Unable to pin the SWR thread of channel %d to core %d\n", group->first_channel, group->cpu);
+
+    for (;;) {
+        int current;
+
+        while ((current = __atomic_load_n (&sm->generation, __ATOMIC_ACQUIRE)) == generation) {
+            if (__atomic_load_n (&sm->shutdown, __ATOMIC_ACQUIRE))
+                return NULL;
+        }
+        generation = current;
+
+        swr_multi_group_process (group);
+        __atomic_add_fetch (&sm->groups_done, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+static int
+swr_multi_group_init (struct swr_multi* sm, struct swr_multi_group* group)
+{
+    const int n = sm->fft_signal_data_size;
+
+    group->sm = sm;
+    group->input = (float*) fftwf_malloc (sizeof (float) * group->n_channels * sm->fft_signal_data_size);
+    group->spectra = (fftwf_complex*) fftwf_malloc (sizeof (fftwf_complex) * 2 * group->n_channels * sm->spectrum_distance);
+    group->output = (float*) fftwf_malloc (sizeof (float) * 2 * group->n_channels * sm->fft_signal_data_size);
+    if (group->input == NULL || group->spectra == NULL || group->output == NULL) {
+        fprintf (stderr, "problem allocating memory in swr_multi_init\n");
+        return -1;
+    }
+
+    if ((group->fft_plan_forward =
+             LS_FFTW_PLAN (fftwf_plan_many_dft_r2c, 1, &n, group->n_channels,
+                                                   group->input, NULL, 1, sm->fft_signal_data_size,
+                                                   group->spectra, NULL, 1, sm->spectrum_distance)) == NULL) {
+        fprintf (stderr, "unable to create a plan for group->fft_plan_forward\n");
+        return -1;
+    }
+    if ((group->fft_plan_backward =
+             LS_FFTW_PLAN (fftwf_plan_many_dft_c2r, 1, &n, 2 * group->n_channels,
+                                                   group->spectra, NULL, 1, sm->spectrum_distance,
+                                                   group->output, NULL, 1, sm->fft_signal_data_size)) == NULL) {
+        fprintf (stderr, "unable to create a plan for group->fft_plan_backward\n");
+        return -1;
+    }
+
+    // measuring the plans used the arrays, the padding of the input has to be 0
+    memset (group->input, 0, sizeof (float) * group->n_channels * sm->fft_signal_data_size);
+    return 0;
+}
+
+/**
+ * swr_multi_init:
+ * @n_channels: number of channels to detect ripples on
+ * @n_groups: number of threads to spread the channels over, 0 for one per core except the DAQ core
+ *
+ * The calling thread should run on a core of its own too, the worker
+ * threads are pinned to the cores following it.
+ */
+int
+swr_multi_init (struct swr_multi* sm, int sampling_rate_hz, int n_channels, int n_groups)
+{
+    const long int cpus = sysconf (_SC_NPROCESSORS_ONLN);
+    int first_channel = 0;
+    int i;
+
+    memset (sm, 0, sizeof (*sm));
+    if (n_channels <= 0) {
+        fprintf (stderr, "n_channels of %d in swr_multi_init\n", n_channels);
+        return -1;
+    }
+    if (n_groups <= 0)
+        n_groups = cpus > 2 ? cpus - 1 : 1;
+    if (n_groups > n_channels)
+        n_groups = n_channels;
+
+    sm->sampling_rate = sampling_rate_hz;
+    sm->fft_signal_data_size = FFT_SIGNAL_DATA_SIZE_SWR;
+    sm->real_data_to_fft_size = REAL_DATA_IN_SEGMENT_TO_FFT_SWR;
+    sm->power_signal_length = DATA_IN_SEGMENT_TO_POWER_SWR;
+    sm->m = sm->fft_signal_data_size / 2 + 1;
+    sm->spectrum_distance = (sm->m + 3) / 4 * 4;
+    sm->fft_scale = 1.0 / (float) sm->fft_signal_data_size;
+    sm->n_channels = n_channels;
+    sm->n_groups = n_groups;
+    sm->kernels = spectral_kernels_get ();
+
+    sm->signal_data = calloc (n_channels * sm->real_data_to_fft_size, sizeof (float));
+    sm->ref_signal_data = calloc (sm->real_data_to_fft_size, sizeof (float));
+    sm->filter_function_swr = malloc (sizeof (float) * sm->m);
+    sm->power_stats = calloc (n_channels, sizeof (struct running_stats));
+    sm->convolution_peak_stats = calloc (n_channels, sizeof (struct running_stats));
+    sm->z_power = calloc (n_channels, sizeof (float));
+    sm->z_convolution_peak = calloc (n_channels, sizeof (float));
+    sm->groups = calloc (n_groups, sizeof (struct swr_multi_group));
+    if (sm->signal_data == NULL || sm->ref_signal_data == NULL || sm->filter_function_swr == NULL ||
+        sm->power_stats == NULL || sm->convolution_peak_stats == NULL ||
+        sm->z_power == NULL || sm->z_convolution_peak == NULL || sm->groups == NULL) {
+        fprintf (stderr, "problem allocating memory in swr_multi_init\n");
+        goto fail;
+    }
+
+    // same filter and wavelet as fftw_interface_swr
+    make_butterworth_filter (sampling_rate_hz, sm->m, sm->filter_function_swr,
+                             MIN_FREQUENCY_SWR, MAX_FREQUENCY_SWR);
+    {
+        const int n = sm->fft_signal_data_size;
+        float* wavelet = (float*) fftwf_malloc (sizeof (float) * sm->fft_signal_data_size);
+        fftwf_plan plan;
+
+        sm->out_wavelet = (fftwf_complex*) fftwf_malloc (sizeof (fftwf_complex) * sm->m);
+        if (wavelet == NULL || sm->out_wavelet == NULL) {
+            fprintf (stderr, "problem allocating memory in swr_multi_init\n");
+            fftwf_free (wavelet);
+            goto fail;
+        }
+        if ((plan = LS_FFTW_PLAN (fftwf_plan_dft_r2c_1d, n, wavelet, sm->out_wavelet)) == NULL) {
+            fprintf (stderr, "unable to create a plan for the wavelet in swr_multi_init\n");
+            fftwf_free (wavelet);
+            goto fail;
+        }
+        make_wavelet_for_convolution (sampling_rate_hz, n, wavelet, FREQUENCY_WAVELET_FOR_CONVOLUTION);
+        fftwf_execute (plan);
+        fftwf_destroy_plan (plan);
+        fftwf_free (wavelet);
+    }
+    swr_multi_set_baseline (sm, 0, (long int) SWR_BASELINE_FREEZE_SEC * sampling_rate_hz / HOP_SIZE_SWR, 0);
+
+    // split the channels as evenly as possible, plans are made here as fftw planning is not thread safe
+    for (i = 0; i < n_groups; i++) {
+        struct swr_multi_group* group = &sm->groups[i];
+
+        group->first_channel = first_channel;
+        group->n_channels = n_channels / n_groups + (i < n_channels % n_groups);
+        group->cpu = i == 0 ? -1 : 1 + i % MAX (cpus - 1, 1);
+        first_channel += group->n_channels;
+        if (swr_multi_group_init (sm, group) == -1)
+            goto fail;
+    }
+    for (i = 1; i < n_groups; i++) {
+        if (pthread_create (&sm->groups[i].thread, NULL, swr_multi_worker_main, &sm->groups[i]) != 0) {
+            fprintf (stderr, "unable to start the SWR thread of group %d\n", i);
+            goto fail;
+        }
+        sm->n_threads = i;
+    }
+    return 0;
+
+fail:
+    // everything was zeroed above, so this only frees what was allocated and joins what was started
+    swr_multi_free (sm);
+    return -1;
+}
+
+int
+swr_multi_free (struct swr_multi* sm)
+{
+    int i;
+
+    __atomic_store_n (&sm->shutdown, 1, __ATOMIC_RELEASE);
+    for (i = 1; i <= sm->n_threads; i++)
+        pthread_join (sm->groups[i].thread, NULL);
+    for (i = 0; sm->groups != NULL && i < sm->n_groups; i++) {
+        struct swr_multi_group* group = &sm->groups[i];
+
+        fftwf_free (group->input);
+        fftwf_free (group->spectra);
+        fftwf_free (group->output);
+        if (group->fft_plan_forward != NULL)
+            fftwf_destroy_plan (group->fft_plan_forward);
+        if (group->fft_plan_backward != NULL)
+            fftwf_destroy_plan (group->fft_plan_backward);
+    }
+    free (sm->groups);
+    free (sm->signal_data);
+    free (sm->ref_signal_data);
+    free (sm->filter_function_swr);
+    fftwf_free (sm->out_wavelet);
+    free (sm->power_stats);
+    free (sm->convolution_peak_stats);
+    free (sm->z_power);
+    free (sm->z_convolution_peak);
+    sm->groups = NULL;
+    sm->n_groups = 0;
+    sm->n_threads = 0;
+    return 0;
+}
+
+/**
+ * swr_multi_set_baseline:
+ *
+ * Configure the baselines of all channels, see fftw_interface_swr_set_baseline().
+ */
+void
+swr_multi_set_baseline (struct swr_multi* sm, double alpha, long int freeze_count, double max_z)
+{
+    int i;
+
+    for (i = 0; i < sm->n_channels; i++) {
+        running_stats_init (&sm->power_stats[i], alpha, freeze_count, max_z);
+        running_stats_init (&sm->convolution_peak_stats[i], alpha, freeze_count, max_z);
+    }
+}
+
+/**
+ * swr_multi_get_signal:
+ *
+ * Returns: the window of real_data_to_fft_size samples of @channel, to be
+ * filled before swr_multi_process().
+ */
+float*
+swr_multi_get_signal (struct swr_multi* sm, int channel)
+{
+    return sm->signal_data + channel * sm->real_data_to_fft_size;
+}
+
+/**
+ * swr_multi_process:
+ *
+ * Update the z scores of all channels from their current windows, and
+ * return when all groups are done.
+ */
+void
+swr_multi_process (struct swr_multi* sm)
+{
+    __atomic_store_n (&sm->groups_done, 0, __ATOMIC_RELAXED);
+    __atomic_add_fetch (&sm->generation, 1, __ATOMIC_RELEASE);
+
+    swr_multi_group_process (&sm->groups[0]);
+
+    while (__atomic_load_n (&sm->groups_done, __ATOMIC_ACQUIRE) < sm->n_groups - 1)
+        ;
+}
+
+/**
+ * swr_multi_vote:
+ * @votes_needed: channels that must cross both thresholds, 0 to let the channel with the largest power decide
+ *
+ * Fuse the z scores of all channels into one detection. Requiring
+ * several channels rejects artifacts local to one electrode.
+ *
+ * Returns: 1 if a ripple is detected, 0 otherwise.
+ */
+int
+swr_multi_vote (struct swr_multi* sm, double power_threshold, double convolution_peak_threshold, int votes_needed)
+{
+    int votes = 0;
+    int loudest = 0;
+    int i;
+
+    for (i = 0; i < sm->n_channels; i++) {
+        if (sm->z_power[i] > power_threshold && sm->z_convolution_peak[i] > convolution_peak_threshold)
+            votes++;
+        if (sm->z_power[i] > sm->z_power[loudest])
+            loudest = i;
+    }
+
+    if (votes_needed <= 0)
+        return sm->z_power[loudest] > power_threshold && sm->z_convolution_peak[loudest] > convolution_peak_threshold;
+    return votes >= votes_needed;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LS_SWR_MULTI_H
+#define __LS_SWR_MULTI_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <fftw3.h>
+
+#include "running-stats.h"
+#include "spectral-kernels.h"
+
+struct swr_multi;
+
+/**
+ * swr_multi_group:
+ *
+ * Channels analysed together by one thread, with one batched transform
+ * forward and one backward for all of them.
+ */
+struct swr_multi_group
+{
+    struct swr_multi* sm;
+    int first_channel;
+    int n_channels;
+    int cpu; // core the thread is pinned to, -1 for the calling thread
+    float* input; // signal minus reference of each channel, zero padded to fft_size
+    fftwf_complex* spectra; // filtered spectra of all channels, then their convolution spectra
+    float* output; // filtered signal of all channels, then their convoluted signal
+    fftwf_plan fft_plan_forward; // all channels at once
+    fftwf_plan fft_plan_backward; // filtered and convoluted signal of all channels at once
+    pthread_t thread;
+};
+
+/**
+ * swr_multi:
+ *
+ * SWR detection on several channels against one reference, with the
+ * filtering and wavelet convolution of fftw_interface_swr. Every channel
+ * keeps its own power and convolution peak baseline, and the per-channel
+ * z scores are fused into one decision by swr_multi_vote().
+ *
+ * Channels are split into groups, the first one is processed by the
+ * calling thread and the others by threads pinned to their own core.
+ */
+struct swr_multi
+{
+    int sampling_rate;
+    size_t real_data_to_fft_size; // window length
+    size_t fft_signal_data_size; // window plus zero padding
+    size_t m; // length of the fft complex array
+    size_t spectrum_distance; // m rounded up to keep SIMD alignment
+    int power_signal_length; // most recent samples on which power and peak are measured
+    float fft_scale;
+    int n_channels;
+    float* signal_data; // window of each channel, n_channels * real_data_to_fft_size, oldest first
+    float* ref_signal_data; // window of the reference
+    float* filter_function_swr;
+    fftwf_complex* out_wavelet;
+    struct running_stats* power_stats;
+    struct running_stats* convolution_peak_stats;
+    float* z_power; // of each channel, after swr_multi_process()
+    float* z_convolution_peak;
+    const struct spectral_kernels* kernels;
+    int n_groups;
+    struct swr_multi_group* groups;
+    int n_threads; // worker threads started, for groups 1 to n_threads
+    int generation; // incremented to start the worker threads on new data
+    int groups_done;
+    int shutdown;
+};
+
+int swr_multi_init (struct swr_multi* sm,
+                    int sampling_rate_hz,
+                    int n_channels,
+                    int n_groups);
+int swr_multi_free (struct swr_multi* sm);
+void swr_multi_set_baseline (struct swr_multi* sm,
+                             double alpha,
+                             long int freeze_count,
+                             double max_z);
+float* swr_multi_get_signal (struct swr_multi* sm,
+                             int channel);
+void swr_multi_process (struct swr_multi* sm);
+int swr_multi_vote (struct swr_multi* sm,
+                    double power_threshold,
+                    double convolution_peak_threshold,
+                    int votes_needed);
+
+#endif /* __LS_SWR_MULTI_H */
@@ -0,0 +1,326 @@
+/*
+ * Copyright (C) 2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "swr-stream.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "defaults.h"
+#include "fftw-functions.h"
+
+/**
+ * swr_stream_design_filter:
+ *
+ * Turn the Butterworth magnitude mask used by fftw_interface_swr into a
+ * causal linear-phase FIR filter of length 2 * half + 1, by windowing its
+ * zero-phase impulse response with a Hamming window.
+ */
+static int
+swr_stream_design_filter (int sampling_rate, float min_frequency, float max_frequency,
+                          size_t half, float* taps)
+{
+    const int design_size = 4096;
+    const int design_m = design_size / 2 + 1;
+    const size_t length = 2 * half + 1;
+    float *mask;
+    size_t i;
+    int k;
+
+    if ((mask = malloc (sizeof (float) * design_m)) == NULL) {
+        fprintf (stderr, "problem allocating memory for mask in swr_stream_design_filter\n");
+        return -1;
+    }
+    make_butterworth_filter (sampling_rate, design_m, mask, min_frequency, max_frequency);
+
+    for (i = 0; i < length; i++) {
+        const double n = (double) i - half;
+        double h = mask[0] + mask[design_m - 1] * cos (M_PI * n);
+
+        // inverse real fft of the (real, even) mask, evaluated at n only
+        for (k = 1; k < design_m - 1; k++)
+            h += 2 * mask[k] * cos (2 * M_PI * k * n / design_size);
+        h /= design_size;
+
+        taps[i] = h * (0.54 - 0.46 * cos (2 * M_PI * i / (length - 1)));
+    }
+    free (mask);
+
+    return 0;
+}
+
+/**
+ * swr_stream_make_partitions:
+ *
+ * Split @taps into partitions of hop_size samples and store the scaled
+ * spectrum of each, zero-padded to fft_size, in @spectra.
+ */
+static void
+swr_stream_make_partitions (struct swr_stream* stream, const float* taps, size_t length,
+                            size_t partitions, fftwf_complex* spectra)
+{
+    const float scale = 1.0 / (float) stream->fft_size;
+    size_t p, i;
+
+    for (p = 0; p < partitions; p++) {
+        fftwf_complex *spectrum = spectra + p * stream->spectrum_distance;
+
+        for (i = 0; i < stream->fft_size; i++)
+            stream->input_block[i] = 0;
+        for (i = 0; i < stream->hop_size && p * stream->hop_size + i < length; i++)
+            stream->input_block[i] = taps[p * stream->hop_size + i];
+
+        fftwf_execute_dft_r2c (stream->fft_plan_forward, stream->input_block, spectrum);
+        for (i = 0; i < stream->m; i++) {
+            spectrum[i][0] *= scale;
+            spectrum[i][1] *= scale;
+        }
+    }
+}
+
+/**
+ * swr_stream_init:
+ * @hop_size: Number of samples passed to each swr_stream_process() call
+ *
+ * The filter length is set by SWR_STREAM_FILTER_LENGTH_MS, the wavelet is cut
+ * off SWR_STREAM_WAVELET_SD standard deviations from its centre, so it matches
+ * the kernel of fftw_interface_swr. Their group delay is half of that.
+ */
+int
+swr_stream_init (struct swr_stream* stream, int sampling_rate_hz, size_t hop_size,
+                 float min_frequency, float max_frequency, float wavelet_frequency)
+{
+    float *filter_taps;
+    float *wavelet_taps;
+    float *wavelet;
+    size_t half;
+    size_t i;
+
+    if (hop_size == 0) {
+        fprintf (stderr, "hop_size of 0 in swr_stream_init\n");
+        return -1;
+    }
+    stream->sampling_rate = sampling_rate_hz;
+    stream->hop_size = hop_size;
+    stream->fft_size = 2 * hop_size;
+    stream->m = stream->fft_size / 2 + 1;
+    // keep every partition as aligned as the arrays the plans were made with
+    stream->spectrum_distance = (stream->m + 3) / 4 * 4;
+    stream->samples_processed = 0;
+
+    half = (size_t) (SWR_STREAM_FILTER_LENGTH_MS * sampling_rate_hz / 2000.0 + 0.5);
+    stream->filter_length = 2 * half + 1;
+    stream->filter_delay = half;
+
+    // make_wavelet_for_convolution gives the morlet a SD of 2 periods
+    half = (size_t) (SWR_STREAM_WAVELET_SD * 2.0 * sampling_rate_hz / wavelet_frequency + 0.5);
+    if (half == 0)
+        half = 1;
+    stream->wavelet_length = 2 * half;
+    stream->wavelet_delay = half;
+
+    stream->filter_partitions = (stream->filter_length + hop_size - 1) / hop_size;
+    stream->wavelet_partitions = (stream->wavelet_length + hop_size - 1) / hop_size;
+    stream->partitions = stream->filter_partitions > stream->wavelet_partitions ?
+                         stream->filter_partitions : stream->wavelet_partitions;
+    stream->newest_spectrum = 0;
+
+    // allocate memory
+    stream->input_block = (float *) fftwf_malloc (sizeof (float) * stream->fft_size);
+    stream->output_block = (float *) fftwf_malloc (sizeof (float) * stream->fft_size);
+    stream->filter_spectra = (fftwf_complex *) fftwf_malloc (sizeof (fftwf_complex) * stream->spectrum_distance * stream->filter_partitions);
+    stream->wavelet_spectra = (fftwf_complex *) fftwf_malloc (sizeof (fftwf_complex) * stream->spectrum_distance * stream->wavelet_partitions);
+    stream->input_spectra = (fftwf_complex *) fftwf_malloc (sizeof (fftwf_complex) * stream->spectrum_distance * stream->partitions);
+    stream->out_filter = (fftwf_complex *) fftwf_malloc (sizeof (fftwf_complex) * stream->m);
+    stream->out_wavelet = (fftwf_complex *) fftwf_malloc (sizeof (fftwf_complex) * stream->m);
+    if (stream->input_block == NULL || stream->output_block == NULL ||
+        stream->filter_spectra == NULL || stream->wavelet_spectra == NULL ||
+        stream->input_spectra == NULL || stream->out_filter == NULL || stream->out_wavelet == NULL) {
+        fprintf (stderr, "problem allocating memory in swr_stream_init\n");
+        return -1;
+    }
+    if ((stream->fft_plan_forward =
+             LS_FFTW_PLAN (fftwf_plan_dft_r2c_1d, stream->fft_size, stream->input_block,
+                                                  stream->input_spectra)) == NULL) {
+        fprintf (stderr, "unable to create a plan for stream->fft_plan_forward\n");
+        return -1;
+    }
+    if ((stream->fft_plan_backward =
+             LS_FFTW_PLAN (fftwf_plan_dft_c2r_1d, stream->fft_size, stream->out_filter,
+                                                  stream->output_block)) == NULL) {
+        fprintf (stderr, "unable to create a plan for stream->fft_plan_backward\n");
+        return -1;
+    }
+
+    // make the kernels
+    filter_taps = malloc (sizeof (float) * stream->filter_length);
+    wavelet_taps = malloc (sizeof (float) * stream->wavelet_length);
+    wavelet = malloc (sizeof (float) * stream->wavelet_length);
+    if (filter_taps == NULL || wavelet_taps == NULL || wavelet == NULL) {
+        fprintf (stderr, "problem allocating memory for the kernels in swr_stream_init\n");
+        return -1;
+    }
+    if (swr_stream_design_filter (sampling_rate_hz, min_frequency, max_frequency,
+                                  stream->filter_delay, filter_taps) != 0)
+        return -1;
+
+    // the same wavelet as fftw_interface_swr, but delayed to be causal instead of wrapped around 0
+    make_wavelet_for_convolution (sampling_rate_hz, stream->wavelet_length, wavelet, wavelet_frequency);
+    for (i = 0; i < stream->wavelet_length; i++)
+        wavelet_taps[i] = wavelet[(i + stream->wavelet_length / 2) % stream->wavelet_length];
+
+    swr_stream_make_partitions (stream, filter_taps, stream->filter_length,
+                                stream->filter_partitions, stream->filter_spectra);
+    swr_stream_make_partitions (stream, wavelet_taps, stream->wavelet_length,
+                                stream->wavelet_partitions, stream->wavelet_spectra);
+    free (filter_taps);
+    free (wavelet_taps);
+    free (wavelet);
+
+    // clear the history only now, measuring the plans writes to the arrays
+    for (i = 0; i < stream->spectrum_distance * stream->partitions; i++) {
+        stream->input_spectra[i][0] = 0;
+        stream->input_spectra[i][1] = 0;
+    }
+    for (i = 0; i < stream->fft_size; i++)
+        stream->input_block[i] = 0;
+
+    return 0;
+}
+
+int
+swr_stream_free (struct swr_stream* stream)
+{
+    fftwf_destroy_plan (stream->fft_plan_forward);
+    fftwf_destroy_plan (stream->fft_plan_backward);
+    fftwf_free (stream->input_block);
+    fftwf_free (stream->output_block);
+    fftwf_free (stream->filter_spectra);
+    fftwf_free (stream->wavelet_spectra);
+    fftwf_free (stream->input_spectra);
+    fftwf_free (stream->out_filter);
+    fftwf_free (stream->out_wavelet);
+    return 0;
+}
+
+/**
+ * swr_stream_accumulate:
+ *
+ * Sum the products of the input spectra and the matching kernel partitions.
+ */
+static void
+swr_stream_accumulate (struct swr_stream* stream, const fftwf_complex* spectra,
+                       size_t partitions, fftwf_complex* out)
+{
+    size_t p, i;
+
+    for (i = 0; i < stream->m; i++) {
+        out[i][0] = 0;
+        out[i][1] = 0;
+    }
+    for (p = 0; p < partitions; p++) {
+        // partition p of the kernel meets the input block of p hops ago
+        const size_t age = (stream->newest_spectrum + stream->partitions - p) % stream->partitions;
+        const fftwf_complex *x = stream->input_spectra + age * stream->spectrum_distance;
+        const fftwf_complex *h = spectra + p * stream->spectrum_distance;
+
+        for (i = 0; i < stream->m; i++) {
+            out[i][0] += x[i][0] * h[i][0] - x[i][1] * h[i][1];
+            out[i][1] += x[i][0] * h[i][1] + x[i][1] * h[i][0];
+        }
+    }
+}
+
+/**
+ * swr_stream_process:
+ * @signal: hop_size new samples of the signal
+ * @ref: hop_size new samples of the reference
+ * @filtered_window: window of band-pass filtered signal, length @window_length
+ * @convoluted_window: window of convoluted signal, length @window_length
+ *
+ * Filter and convolve the next hop of signal minus reference.
+ * Both windows are shifted by hop_size and the new output samples are
+ * appended at their end, so they always hold the most recent output,
+ * oldest first, in the layout fftw_interface_swr_get_power() and
+ * fftw_interface_swr_get_convolution_peak() expect.
+ */
+int
+swr_stream_process (struct swr_stream* stream, const float* signal, const float* ref,
+                    float* filtered_window, float* convoluted_window, size_t window_length)
+{
+    const size_t hop = stream->hop_size;
+    size_t i;
+
+    if (window_length < hop) {
+        fprintf (stderr, "window_length < hop_size in swr_stream_process\n");
+        return -1;
+    }
+
+    // the input block is the previous hop followed by the new one
+    memmove (stream->input_block, stream->input_block + hop, sizeof (float) * hop);
+    for (i = 0; i < hop; i++)
+        stream->input_block[hop + i] = signal[i] - ref[i];
+
+    stream->newest_spectrum = (stream->newest_spectrum + 1) % stream->partitions;
+    fftwf_execute_dft_r2c (stream->fft_plan_forward, stream->input_block,
+                           stream->input_spectra + stream->newest_spectrum * stream->spectrum_distance);
+
+    swr_stream_accumulate (stream, stream->filter_spectra, stream->filter_partitions, stream->out_filter);
+    swr_stream_accumulate (stream, stream->wavelet_spectra, stream->wavelet_partitions, stream->out_wavelet);
+
+    // the first half of each inverse transform is wrapped around, only the second is valid
+    memmove (filtered_window, filtered_window + hop, sizeof (float) * (window_length - hop));
+    fftwf_execute_dft_c2r (stream->fft_plan_backward, stream->out_filter, stream->output_block);
+    memcpy (filtered_window + window_length - hop, stream->output_block + hop, sizeof (float) * hop);
+
+    memmove (convoluted_window, convoluted_window + hop, sizeof (float) * (window_length - hop));
+    fftwf_execute_dft_c2r (stream->fft_plan_backward, stream->out_wavelet, stream->output_block);
+    memcpy (convoluted_window + window_length - hop, stream->output_block + hop, sizeof (float) * hop);
+
+    stream->samples_processed += hop;
+    return 0;
+}
+
+/**
+ * swr_stream_get_delay:
+ *
+ * Returns: the number of samples both outputs lag the input by, which
+ * is the time an event takes to be fully visible to the detector.
+ */
+size_t
+swr_stream_get_delay (struct swr_stream* stream)
+{
+    return stream->filter_delay > stream->wavelet_delay ?
+           stream->filter_delay : stream->wavelet_delay;
+}
+
+/**
+ * swr_stream_get_warmup:
+ *
+ * Returns: the number of samples to process before the outputs are no
+ * longer affected by the zero history the stream started with.
+ */
+size_t
+swr_stream_get_warmup (struct swr_stream* stream)
+{
+    return stream->filter_length > stream->wavelet_length ?
+           stream->filter_length : stream->wavelet_length;
+}
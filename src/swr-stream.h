@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2016 Matthias Klumpp <matthias@tenstral.net>
+ *
+ * Licensed under the GNU General Public License Version 3
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the license, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __LS_SWR_STREAM_H
+#define __LS_SWR_STREAM_H
+
+#include <stddef.h>
+#include <fftw3.h>
+
+/**
+ * swr_stream:
+ *
+ * Streaming SWR front-end: band-pass filter and wavelet convolution of the
+ * signal minus reference, computed hop by hop with uniformly partitioned
+ * overlap-save convolution. Each call only transforms the new samples,
+ * instead of the whole window as fftw_interface_swr does.
+ *
+ * Both kernels are causal linear-phase FIR filters, so the outputs lag the
+ * input by a fixed group delay: filter_delay samples for the band-pass
+ * filtered signal, and wavelet_delay samples for the convolution.
+ */
+struct swr_stream
+{
+    int sampling_rate;
+    size_t hop_size; // new samples per call, the partition size
+    size_t fft_size; // two partitions
+    size_t m; // length of the fft complex array
+    size_t spectrum_distance; // m rounded up to keep SIMD alignment
+    size_t filter_length; // taps of the band-pass filter
+    size_t wavelet_length; // taps of the wavelet
+    size_t filter_delay; // group delay of the filtered signal in samples
+    size_t wavelet_delay; // group delay of the convoluted signal in samples
+    size_t filter_partitions;
+    size_t wavelet_partitions;
+    size_t partitions; // the larger of the two
+    fftwf_complex *filter_spectra; // spectrum of each filter partition, scaled by 1/fft_size
+    fftwf_complex *wavelet_spectra; // spectrum of each wavelet partition, scaled by 1/fft_size
+    fftwf_complex *input_spectra; // spectra of the last input blocks, a ring of partitions entries
+    size_t newest_spectrum; // index of the most recent entry in input_spectra
+    fftwf_complex *out_filter; // accumulated spectrum of the filter output
+    fftwf_complex *out_wavelet; // accumulated spectrum of the convolution output
+    float *input_block; // last fft_size samples of signal minus reference
+    float *output_block; // inverse fft result, the last hop_size samples are new
+    fftwf_plan fft_plan_forward;
+    fftwf_plan fft_plan_backward;
+    long int samples_processed;
+};
+
+int swr_stream_init (struct swr_stream* stream,
+                     int sampling_rate_hz,
+                     size_t hop_size,
+                     float min_frequency,
+                     float max_frequency,
+                     float wavelet_frequency);
+int swr_stream_free (struct swr_stream* stream);
+int swr_stream_process (struct swr_stream* stream,
+                        const float* signal,
+                        const float* ref,
+                        float* filtered_window,
+                        float* convoluted_window,
+                        size_t window_length);
+size_t swr_stream_get_delay (struct swr_stream* stream);
+size_t swr_stream_get_warmup (struct swr_stream* stream);
+
+#endif /* __LS_SWR_STREAM_H */
@@ -22,15 +22,98 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include <galdur.h>
 #include "defaults.h"
 #include "fftw-functions.h"
+#include "swr-stream.h"
+#include "swr-multi.h"
+#include "swr-hilbert.h"
+#include "biquad.h"
 #include "data-file-si.h"
 #include "utils.h"
 #include "stimpulse.h"
 
+static gboolean print_adc_stats = FALSE;
+static gchar *adc_backend_spec = NULL;
+static double swr_baseline_ewma_sec = 0;
+static double swr_baseline_freeze_sec = SWR_BASELINE_FREEZE_SEC;
+static double swr_baseline_max_z = 0;
+static int swr_wavelets = 1;
+
+/**
+ * tasks_set_print_adc_stats:
+ *
+ * Print ADC acquisition statistics at the end of a trial.
+ */
+void
+tasks_set_print_adc_stats (gboolean enabled)
+{
+    print_adc_stats = enabled;
+}
+
+/**
+ * tasks_set_adc_backend:
+ * @spec: Galdur ADC backend specification, or %NULL for the default
+ *
+ * Select where data is acquired from, see %gld_adc_set_backend.
+ */
+void
+tasks_set_adc_backend (const gchar *spec)
+{
+    g_free (adc_backend_spec);
+    adc_backend_spec = g_strdup (spec);
+}
+
+/**
+ * tasks_set_swr_baseline:
+ * @ewma_sec: time constant of an exponentially weighted baseline, 0 to weight all segments equally
+ * @freeze_sec: time after which the baseline stops changing, 0 to never freeze it
+ * @max_z: power and convolution peak z scores are clipped to this before updating the baseline, 0 to not clip
+ *
+ * Configure how the mean and sd of SWR power and convolution peak are established.
+ */
+void
+tasks_set_swr_baseline (double ewma_sec, double freeze_sec, double max_z)
+{
+    swr_baseline_ewma_sec = ewma_sec;
+    swr_baseline_freeze_sec = freeze_sec;
+    swr_baseline_max_z = max_z;
+}
+
+/**
+ * tasks_set_swr_wavelets:
+ * @n_wavelets: 1 to convolve with one wavelet, or the size of a bank of wavelets across the ripple band
+ *
+ * Configure the wavelet convolution of the fft SWR engine.
+ */
+void
+tasks_set_swr_wavelets (int n_wavelets)
+{
+    swr_wavelets = n_wavelets;
+}
+
+/**
+ * window_append_frames:
+ * @window: Window of @window_length samples, oldest first
+ * @frames: @n_frames frames of @n_channels interleaved samples
+ *
+ * Shift @window by @n_frames samples and append the samples of @channel
+ * in @frames at its end.
+ */
+static void
+window_append_frames (float *window, size_t window_length,
+                      const float *frames, size_t n_frames, int n_channels, int channel)
+{
+    size_t i;
+
+    memmove (window, window + n_frames, sizeof (float) * (window_length - n_frames));
+    for (i = 0; i < n_frames; i++)
+        window[window_length - n_frames + i] = frames[i * n_channels + channel];
+}
+
 /**
  * perform_train_stimulation:
  *
@@ -131,15 +214,19 @@ perform_train_stimulation (gboolean random, int sampling_rate_hz, double trial_d
  * Do the theta stimulation.
  */
 gboolean
-perform_theta_stimulation (gboolean random, int sampling_rate_hz, double trial_duration_sec, double pulse_duration_ms, double stimulation_theta_phase,
+perform_theta_stimulation (LsThetaEngine engine, gboolean random, int sampling_rate_hz, double trial_duration_sec, double pulse_duration_ms, double stimulation_theta_phase,
                            const gchar *offline_data_file, int channels_in_dat_file, int offline_channel)
 {
     TimeKeeper tk;
     GldAdc *daq;
+    GldAdcWindow window;
     gboolean ret = FALSE;
+    gboolean fftw_inter_ready = FALSE;
+    gboolean theta_biquad_ready = FALSE;
+    gboolean data_file_ready = FALSE;
 
     /* variables to work offline from a dat file */
-    int new_samples_per_read_operation = 60; /* 3 ms of data */
+    int new_samples_per_read_operation = HOP_SIZE_THETA;
     data_file_si data_file;
     short int* data_from_file = NULL;
     long int last_sample_no = 0;
@@ -153,6 +240,12 @@ perform_theta_stimulation (gboolean random, int sampling_rate_hz, double trial_d
 
     double max_phase_diff = MAX_PHASE_DIFFERENCE;
 
+    /* sample by sample filtering, used instead of the sliding window with LS_THETA_ENGINE_BIQUAD */
+    struct biquad_cascade theta_biquad;
+    float *adc_channel_data[LS_ADC_CHANNEL_COUNT] = { NULL };
+    float *biquad_frames = NULL;
+    long int first_sample_to_process = 0;
+
     if (sampling_rate_hz <= 0)
         sampling_rate_hz = LS_DEFAULT_SAMPLING_RATE;
 
@@ -168,26 +261,58 @@ perform_theta_stimulation (gboolean random, int sampling_rate_hz, double trial_d
 
     /* configure ADC, run DAQ on CPU 0 */
     daq = gld_adc_new (LS_ADC_CHANNEL_COUNT, LS_DATA_BUFFER_SIZE, 0);
+    if (adc_backend_spec != NULL && !gld_adc_set_backend (daq, adc_backend_spec)) {
+        fprintf (stderr, "Could not select ADC backend '%s'\n", adc_backend_spec);
+        goto out;
+    }
     gld_adc_set_acq_frequency (daq, sampling_rate_hz);
-    gld_adc_set_nodata_sleep_time (daq, gld_set_timespec_from_ms (SLEEP_WHEN_NO_NEW_DATA_MS));
 
-    if (fftw_interface_theta_init (&fftw_inter, sampling_rate_hz) == -1) {
+    /* the biquad engine only needs the windows of fftw_inter, not the FFT plans */
+    if (fftw_interface_theta_init (&fftw_inter, sampling_rate_hz, engine != LS_THETA_ENGINE_BIQUAD) == -1) {
         fprintf (stderr, "Could not initialize fftw_interface_theta\n");
-        return FALSE;
+        goto out;
+    }
+    fftw_inter_ready = TRUE;
+
+    if (engine == LS_THETA_ENGINE_BIQUAD) {
+        /* channel 0 is the theta band, channel 1 the delta band, both filter the same signal */
+        if (biquad_cascade_init (&theta_biquad, 2, BIQUAD_ORDER_THETA) == -1) {
+            fprintf (stderr, "Could not initialize the theta biquad filters\n");
+            goto out;
+        }
+        theta_biquad_ready = TRUE;
+        if (biquad_cascade_set_bandpass (&theta_biquad, 0, sampling_rate_hz,
+                                         fftw_inter.min_frequency_theta, fftw_inter.max_frequency_theta) == -1 ||
+            biquad_cascade_set_bandpass (&theta_biquad, 1, sampling_rate_hz,
+                                         fftw_inter.min_frequency_delta, fftw_inter.max_frequency_delta) == -1) {
+            fprintf (stderr, "Could not initialize the theta biquad filters\n");
+            goto out;
+        }
+        biquad_frames = g_new0 (float, 2 * HOP_SIZE_THETA);
+        adc_channel_data[LS_SCAN_CHAN] = fftw_inter.signal_data;
+
+        /* we read the next hop of samples instead of a window, so we need frames */
+        gld_adc_set_buffer_mode (daq, GLD_ADC_BUFFER_FRAMES);
+
+        /* wait for a full window of output after the filters settled */
+        first_sample_to_process = fftw_inter.real_data_to_fft_size +
+                                  BIQUAD_SETTLING_CYCLES * sampling_rate_hz / fftw_inter.min_frequency_delta;
+        ls_debug ("Biquad theta engine (%s)\n", biquad_get_simd_name ());
     }
 
     if (offline_data_file != NULL) {
         /* initialize the dat file */
         if (init_data_file_si (&data_file, offline_data_file, channels_in_dat_file) != 0) {
             fprintf (stderr, "Problem in initialisation of dat file\n");
-            return FALSE;
+            goto out;
         }
+        data_file_ready = TRUE;
 
         // if get data from dat file, allocate memory to store short integer from dat file
         if ((data_from_file = (short *) malloc (sizeof (short) * fftw_inter.real_data_to_fft_size)) == NULL) {
             fprintf (stderr,
                      "Problem allocating memory for data_from_file\n");
-            return FALSE;
+            goto out;
         }
     }
     tk.duration_refractory_period =
@@ -198,14 +323,14 @@ perform_theta_stimulation (gboolean random, int sampling_rate_hz, double trial_d
 
 #ifdef DEBUG
     // to check the intervals before getting new data.
-    clock_gettime (CLOCK_REALTIME, &tk.time_previous_new_data);
+    clock_gettime (CLOCK_MONOTONIC, &tk.time_previous_new_data);
     long int counter = 0;
 #endif
 
     // get time at beginning of trial
-    clock_gettime (CLOCK_REALTIME, &tk.time_beginning_trial);
-    clock_gettime (CLOCK_REALTIME, &tk.time_now);
-    clock_gettime (CLOCK_REALTIME, &tk.time_last_stimulation);
+    clock_gettime (CLOCK_MONOTONIC, &tk.time_beginning_trial);
+    clock_gettime (CLOCK_MONOTONIC, &tk.time_now);
+    clock_gettime (CLOCK_MONOTONIC, &tk.time_last_stimulation);
     tk.elapsed_beginning_trial =
         gld_time_diff (&tk.time_beginning_trial, &tk.time_now);
 
@@ -226,18 +351,45 @@ perform_theta_stimulation (gboolean random, int sampling_rate_hz, double trial_d
     /* loop until the trial is over */
     while (tk.elapsed_beginning_trial.tv_sec < tk.trial_duration_sec) {
 
-        /* jump to front and start sampling new data */
-        gld_adc_skip_to_front (daq, LS_SCAN_CHAN);
+        if (offline_data_file == NULL && engine == LS_THETA_ENGINE_BIQUAD) {
+            /* get the next hop of samples, every sample goes through the filters exactly once */
+            if (!gld_adc_get_frames_float (daq, adc_channel_data, new_samples_per_read_operation, &window)) {
+                fprintf (stderr, "Data acquisition stopped unexpectedly\n");
+                break;
+            }
+            last_sample_no = window.last_index + 1;
+            tk.time_last_acquired_data = gld_set_timespec_from_ns (window.last_time_ns);
+        } else if (offline_data_file == NULL) {
+            /* wait for a hop of new samples and get the most recent window of data */
+            if (!gld_adc_get_latest_window_float (daq,
+                                                  LS_SCAN_CHAN,
+                                                  fftw_inter.signal_data,
+                                                  fftw_inter.real_data_to_fft_size,
+                                                  HOP_SIZE_THETA,
+                                                  &window)) {
+                fprintf (stderr, "Data acquisition stopped unexpectedly\n");
+                break;
+            }
 
-        if (offline_data_file == NULL) {
-            /* get fixed size of samples from the data buffer */
-            gld_adc_get_samples_float (daq,
-                                       LS_SCAN_CHAN,
-                                       fftw_inter.signal_data,
-                                       fftw_inter.real_data_to_fft_size);
-
-            /* set time when the last sample was acquired */
-            clock_gettime(CLOCK_REALTIME, &tk.time_last_acquired_data);
+            /* the phase is predicted from the time the last sample was actually acquired */
+            tk.time_last_acquired_data = gld_set_timespec_from_ns (window.last_time_ns);
+        } else if (engine == LS_THETA_ENGINE_BIQUAD) {
+            guint i;
+
+            /* get the next hop from a dat file */
+            if (data_file.num_samples_in_file < last_sample_no + new_samples_per_read_operation) {
+                // no more data in file, exit the trial loop
+                break;
+            }
+            if ((data_file_si_get_data_one_channel (&data_file, offline_channel, data_from_file,
+                                                    last_sample_no, last_sample_no + new_samples_per_read_operation)) != 0) {
+                fprintf (stderr, "Problem with data_file_si_get_data_one_channel, first index: %ld, last index: %ld\n",
+                         last_sample_no, last_sample_no + new_samples_per_read_operation);
+                goto out;
+            }
+            for (i = 0; i < (guint) new_samples_per_read_operation; i++)
+                fftw_inter.signal_data[i] = data_from_file[i];
+            last_sample_no = last_sample_no + new_samples_per_read_operation;
         } else {
             guint i;
 
@@ -274,7 +426,7 @@ perform_theta_stimulation (gboolean random, int sampling_rate_hz, double trial_d
         }
 
 #ifdef DEBUG
-        clock_gettime (CLOCK_REALTIME, &tk.time_current_new_data);
+        clock_gettime (CLOCK_MONOTONIC, &tk.time_current_new_data);
         tk.duration_previous_current_new_data =
             gld_time_diff (&tk.time_previous_new_data, &tk.time_current_new_data);
         g_printerr ("%ld, last_sample_no: %ld  with interval %lf(us)\n",
@@ -282,8 +434,23 @@ perform_theta_stimulation (gboolean random, int sampling_rate_hz, double trial_d
                  tk.duration_previous_current_new_data.tv_nsec / 1000.0);
         tk.time_previous_new_data = tk.time_current_new_data;
 #endif
-        // filter for theta and delta
-        fftw_interface_theta_apply_filter_theta_delta (&fftw_inter);
+        if (engine == LS_THETA_ENGINE_BIQUAD) {
+            int i;
+
+            // filter the new samples for theta and delta, append them to the windows
+            for (i = 0; i < new_samples_per_read_operation; i++) {
+                biquad_frames[2 * i] = fftw_inter.signal_data[i];
+                biquad_frames[2 * i + 1] = fftw_inter.signal_data[i];
+            }
+            biquad_cascade_process (&theta_biquad, biquad_frames, biquad_frames, new_samples_per_read_operation);
+            window_append_frames (fftw_inter.filtered_signal_theta, fftw_inter.real_data_to_fft_size,
+                                  biquad_frames, new_samples_per_read_operation, 2, 0);
+            window_append_frames (fftw_inter.filtered_signal_delta, fftw_inter.real_data_to_fft_size,
+                                  biquad_frames, new_samples_per_read_operation, 2, 1);
+        } else {
+            // filter for theta and delta
+            fftw_interface_theta_apply_filter_theta_delta (&fftw_inter);
+        }
 
         /* to see real and filtered signal
             for(i=0;i < fftw_inter.real_data_to_fft_size;i++)
@@ -294,13 +461,16 @@ perform_theta_stimulation (gboolean random, int sampling_rate_hz, double trial_d
             */
         // get the theta/delta ratio
 
-        theta_delta_ratio =
-            fftw_interface_theta_delta_ratio (&fftw_inter);
+        if (last_sample_no < first_sample_to_process)
+            theta_delta_ratio = 0; // the filters are still settling
+        else
+            theta_delta_ratio =
+                fftw_interface_theta_delta_ratio (&fftw_inter);
 
         ls_debug ("theta_delta_ratio: %lf\n", theta_delta_ratio);
 
         if (theta_delta_ratio > THETA_DELTA_RATIO) {
-            clock_gettime (CLOCK_REALTIME, &tk.time_now);
+            clock_gettime (CLOCK_MONOTONIC, &tk.time_now);
             tk.elapsed_last_acquired_data =
                 gld_time_diff (&tk.time_last_acquired_data, &tk.time_now);
             // get the phase
@@ -327,7 +497,7 @@ perform_theta_stimulation (gboolean random, int sampling_rate_hz, double trial_d
                     nanosleep (&tk.duration_sleep_to_right_phase,
                                &tk.req);
                 }
-                clock_gettime (CLOCK_REALTIME, &tk.time_now);
+                clock_gettime (CLOCK_MONOTONIC, &tk.time_now);
                 tk.elapsed_last_stimulation =
                     gld_time_diff (&tk.time_last_stimulation, &tk.time_now);
 
@@ -337,7 +507,7 @@ perform_theta_stimulation (gboolean random, int sampling_rate_hz, double trial_d
                     || tk.elapsed_last_stimulation.tv_sec >
                     tk.duration_refractory_period.tv_sec) {
                     // stimulation time!!
-                    clock_gettime (CLOCK_REALTIME,
+                    clock_gettime (CLOCK_MONOTONIC,
                                    &tk.time_last_stimulation);
 
                     /* start the pulse */
@@ -357,13 +527,13 @@ perform_theta_stimulation (gboolean random, int sampling_rate_hz, double trial_d
             }
         }
 
-        clock_gettime (CLOCK_REALTIME, &tk.time_now);
+        clock_gettime (CLOCK_MONOTONIC, &tk.time_now);
         tk.elapsed_last_acquired_data =
             gld_time_diff (&tk.time_last_acquired_data, &tk.time_now);
 
         // will stop the trial
         //            tk.elapsed_beginning_trial.tv_sec = tk.trial_duration_sec;
-        clock_gettime (CLOCK_REALTIME, &tk.time_now);
+        clock_gettime (CLOCK_MONOTONIC, &tk.time_now);
         tk.elapsed_beginning_trial =
             gld_time_diff (&tk.time_beginning_trial, &tk.time_now);
     }
@@ -373,23 +543,27 @@ perform_theta_stimulation (gboolean random, int sampling_rate_hz, double trial_d
         fprintf (stderr, "Could not stop data acquisition\n");
         goto out;
     }
+    if (print_adc_stats && offline_data_file == NULL)
+        gld_adc_print_stats (daq, stderr);
 
     ret = TRUE; /* success */
 out:
-    /* free the memory used by fftw_inter */
-    fftw_interface_theta_free (&fftw_inter);
+    /* free the memory used by fftw_inter, only what was initialized before a failure */
+    if (fftw_inter_ready)
+        fftw_interface_theta_free (&fftw_inter);
+    if (theta_biquad_ready)
+        biquad_cascade_free (&theta_biquad);
+    g_free (biquad_frames);
 
     /* free daq interface */
     gld_adc_free (daq);
 
     /* free the memory for dat file data, if running with offline data */
-    if (offline_data_file != NULL) {
-        if ((clean_data_file_si (&data_file)) != 0) {
-            fprintf (stderr, "Problem with clean_data_file_si\n");
-            return FALSE;
-        }
-        free (data_from_file);
+    if (data_file_ready && (clean_data_file_si (&data_file)) != 0) {
+        fprintf (stderr, "Problem with clean_data_file_si\n");
+        ret = FALSE;
     }
+    free (data_from_file);
 
     return ret;
 }
@@ -400,23 +574,47 @@ out:
  * Do swr stimulation
  */
 gboolean
-perform_swr_stimulation (int sampling_rate_hz, double trial_duration_sec, double pulse_duration_ms, double swr_refractory, double swr_power_threshold, double swr_convolution_peak_threshold,
+perform_swr_stimulation (LsSwrEngine engine, int sampling_rate_hz, double trial_duration_sec, double pulse_duration_ms, double swr_refractory, double swr_power_threshold, double swr_convolution_peak_threshold,
                          gboolean delay_swr, double minimum_interval_ms, double maximum_interval_ms,
                          const gchar *offline_data_file, int channels_in_dat_file, int offline_channel, int offline_reference_channel)
 {
     TimeKeeper tk;
     GldAdc *daq;
+    GldAdcWindow window;
     gboolean ret = FALSE;
+    gboolean fftw_inter_swr_ready = FALSE;
+    gboolean engine_ready = FALSE;
+    gboolean data_file_ready = FALSE;
 
     /* variables to work offline from a dat file */
     data_file_si data_file;
-    int new_samples_per_read_operation = 60; /* 3 ms of data */
+    int new_samples_per_read_operation = HOP_SIZE_SWR;
     short int *data_from_file = NULL;
     short int *ref_from_file = NULL;
     size_t last_sample_no = 0;
 
     /* fftw SWR filtering structure */
     struct fftw_interface_swr fftw_inter_swr;
+    float *adc_channel_data[LS_ADC_CHANNEL_COUNT] = { NULL };
+
+    /* streaming engines, used instead of the sliding window with LS_SWR_ENGINE_STREAM, LS_SWR_ENGINE_BIQUAD and LS_SWR_ENGINE_HILBERT */
+    struct swr_stream swr_stream;
+    struct biquad_cascade swr_biquad;
+    struct swr_hilbert swr_hilbert;
+    float hilbert_z = 0;
+    float *biquad_frames = NULL;
+    size_t stream_hop = 0;
+    size_t first_sample_to_process;
+    size_t offline_refractory_end = 0;
+    float *stream_signal = NULL;
+    float *stream_ref = NULL;
+
+    /* processing time per hop, to compare engines */
+    struct timespec processing_start;
+    gint64 processing_ns;
+    gint64 total_processing_ns = 0;
+    gint64 max_processing_ns = 0;
+    gulong processed_hops = 0;
 
     if (sampling_rate_hz <= 0)
         sampling_rate_hz = LS_DEFAULT_SAMPLING_RATE;
@@ -431,13 +629,96 @@ perform_swr_stimulation (int sampling_rate_hz, double trial_duration_sec, double
 
     /* create ADC interface and configure it, run DAQ on CPU 0 */
     daq = gld_adc_new (LS_ADC_CHANNEL_COUNT, LS_DATA_BUFFER_SIZE, 0);
+    if (adc_backend_spec != NULL && !gld_adc_set_backend (daq, adc_backend_spec)) {
+        fprintf (stderr, "Could not select ADC backend '%s'\n", adc_backend_spec);
+        goto out;
+    }
     gld_adc_set_acq_frequency (daq, sampling_rate_hz);
-    gld_adc_set_nodata_sleep_time (daq, gld_set_timespec_from_ms (SLEEP_WHEN_NO_NEW_DATA_MS));
+
+    /* store signal and reference in the same frame, so they are always sample-aligned */
+    gld_adc_set_buffer_mode (daq, GLD_ADC_BUFFER_FRAMES);
 
     /* initialize fftw interface */
-    if (fftw_interface_swr_init (&fftw_inter_swr, sampling_rate_hz) == -1) {
+    if (fftw_interface_swr_init (&fftw_inter_swr, sampling_rate_hz, engine == LS_SWR_ENGINE_FFT ? swr_wavelets : 1) == -1) {
         fprintf (stderr, "Could not initialize fftw_interface_swr\n");
-        return FALSE;
+        goto out;
+    }
+    fftw_inter_swr_ready = TRUE;
+    adc_channel_data[LS_SCAN_CHAN] = fftw_inter_swr.signal_data;
+    adc_channel_data[LS_REF_CHAN] = fftw_inter_swr.ref_signal_data;
+    first_sample_to_process = fftw_inter_swr.real_data_to_fft_size;
+
+    if (engine != LS_SWR_ENGINE_FFT) {
+        stream_hop = MAX (SWR_STREAM_HOP_MS * sampling_rate_hz / 1000, 1);
+        if (stream_hop > fftw_inter_swr.real_data_to_fft_size) {
+            fprintf (stderr, "Sampling rate too high for the streaming SWR engine\n");
+            goto out;
+        }
+        stream_signal = g_new0 (float, stream_hop);
+        stream_ref = g_new0 (float, stream_hop);
+        adc_channel_data[LS_SCAN_CHAN] = stream_signal;
+        adc_channel_data[LS_REF_CHAN] = stream_ref;
+    }
+
+    if (engine == LS_SWR_ENGINE_STREAM) {
+        if (swr_stream_init (&swr_stream, sampling_rate_hz, stream_hop,
+                             MIN_FREQUENCY_SWR, MAX_FREQUENCY_SWR,
+                             FREQUENCY_WAVELET_FOR_CONVOLUTION) == -1) {
+            fprintf (stderr, "Could not initialize swr_stream\n");
+            goto out;
+        }
+        engine_ready = TRUE;
+
+        /* only detect once the windows are full of output that saw no zero history */
+        first_sample_to_process += swr_stream_get_warmup (&swr_stream);
+        ls_debug ("Streaming SWR engine, hop: %zu samples, filter delay: %zu samples, wavelet delay: %zu samples\n",
+                  stream_hop, swr_stream.filter_delay, swr_stream.wavelet_delay);
+        g_printerr ("Streaming SWR engine: detection lags the signal by %.1f ms\n",
+                    1000.0 * swr_stream_get_delay (&swr_stream) / sampling_rate_hz);
+    } else if (engine == LS_SWR_ENGINE_BIQUAD) {
+        /* channel 0 is the ripple band, channel 1 replaces the wavelet convolution
+         * by the band of the morlet wavelet, +/- 2 SD in frequency */
+        const float wavelet_half_band = FREQUENCY_WAVELET_FOR_CONVOLUTION / (2 * M_PI);
+
+        if (biquad_cascade_init (&swr_biquad, 2, BIQUAD_ORDER_SWR) == -1) {
+            fprintf (stderr, "Could not initialize the SWR biquad filters\n");
+            goto out;
+        }
+        engine_ready = TRUE;
+        if (biquad_cascade_set_bandpass (&swr_biquad, 0, sampling_rate_hz,
+                                         MIN_FREQUENCY_SWR, MAX_FREQUENCY_SWR) == -1 ||
+            biquad_cascade_set_bandpass (&swr_biquad, 1, sampling_rate_hz,
+                                         FREQUENCY_WAVELET_FOR_CONVOLUTION - wavelet_half_band,
+                                         FREQUENCY_WAVELET_FOR_CONVOLUTION + wavelet_half_band) == -1) {
+            fprintf (stderr, "Could not initialize the SWR biquad filters\n");
+            goto out;
+        }
+        biquad_frames = g_new0 (float, 2 * stream_hop);
+
+        first_sample_to_process += BIQUAD_SETTLING_CYCLES * sampling_rate_hz / MIN_FREQUENCY_SWR;
+        ls_debug ("Biquad SWR engine (%s), hop: %zu samples\n", biquad_get_simd_name (), stream_hop);
+    } else if (engine == LS_SWR_ENGINE_HILBERT) {
+        if (swr_hilbert_init (&swr_hilbert, sampling_rate_hz, stream_hop,
+                              MIN_FREQUENCY_SWR, MAX_FREQUENCY_SWR) == -1) {
+            fprintf (stderr, "Could not initialize swr_hilbert\n");
+            goto out;
+        }
+        engine_ready = TRUE;
+
+        first_sample_to_process += swr_hilbert_get_warmup (&swr_hilbert);
+        ls_debug ("Hilbert SWR engine, hop: %zu samples, Hilbert delay: %zu samples\n",
+                  stream_hop, swr_hilbert.hilbert_delay);
+    }
+
+    /* baseline of power and convolution peak, one segment per hop, or of the envelope, one segment per sample */
+    {
+        const double segments_per_sec = (double) sampling_rate_hz / (engine == LS_SWR_ENGINE_FFT ? HOP_SIZE_SWR : engine == LS_SWR_ENGINE_HILBERT ? 1 : stream_hop);
+        const double alpha = swr_baseline_ewma_sec > 0 ? 1 - exp (-1 / (swr_baseline_ewma_sec * segments_per_sec)) : 0;
+
+        if (engine == LS_SWR_ENGINE_HILBERT)
+            swr_hilbert_set_baseline (&swr_hilbert, alpha, swr_baseline_freeze_sec * segments_per_sec, swr_baseline_max_z);
+        else
+            fftw_interface_swr_set_baseline (&fftw_inter_swr, alpha, swr_baseline_freeze_sec * segments_per_sec, swr_baseline_max_z);
     }
 
     if (offline_data_file == NULL) {
@@ -449,31 +730,32 @@ perform_swr_stimulation (int sampling_rate_hz, double trial_duration_sec, double
         /* initialize the dat file */
         if (init_data_file_si (&data_file, offline_data_file, channels_in_dat_file) != 0) {
             fprintf (stderr, "Problem in initialisation of dat file\n");
-            return FALSE;
+            goto out;
         }
+        data_file_ready = TRUE;
 
         if ((data_from_file = (short *) malloc (sizeof (short) * fftw_inter_swr.real_data_to_fft_size)) == NULL) {
             fprintf (stderr,
                      "Problem allocating memory for data_from_file\n");
-            return FALSE;
+            goto out;
         }
         if ((ref_from_file = (short *) malloc (sizeof (short) * fftw_inter_swr.real_data_to_fft_size)) == NULL) {
             fprintf (stderr,
                      "Problem allocating memory for ref_from_file\n");
-            return FALSE;
+            goto out;
         }
     }
 
 #ifdef DEBUG
     // to check the intervals before getting new data.
-    clock_gettime (CLOCK_REALTIME, &tk.time_previous_new_data);
+    clock_gettime (CLOCK_MONOTONIC, &tk.time_previous_new_data);
     long int counter = 0;
 #endif
 
     // get time at beginning of trial
-    clock_gettime (CLOCK_REALTIME, &tk.time_beginning_trial);
-    clock_gettime (CLOCK_REALTIME, &tk.time_now);
-    clock_gettime (CLOCK_REALTIME, &tk.time_last_stimulation);
+    clock_gettime (CLOCK_MONOTONIC, &tk.time_beginning_trial);
+    clock_gettime (CLOCK_MONOTONIC, &tk.time_now);
+    clock_gettime (CLOCK_MONOTONIC, &tk.time_last_stimulation);
     tk.elapsed_beginning_trial =
         gld_time_diff (&tk.time_beginning_trial, &tk.time_now);
     tk.duration_refractory_period = gld_set_timespec_from_ms (swr_refractory);    // set the refractory period for stimulation
@@ -500,27 +782,51 @@ perform_swr_stimulation (int sampling_rate_hz, double trial_duration_sec, double
         if (offline_data_file == NULL) {
             /* get data from our ADC chip */
 
-            /* skip to buffer front, ignoring previous recordings */
-            gld_adc_skip_to_front (daq, LS_SCAN_CHAN);
-            gld_adc_skip_to_front (daq, LS_REF_CHAN);
-
-            /* get data from ADC chip, data channel */
-            gld_adc_get_samples_float (daq,
-                                       LS_SCAN_CHAN,
-                                       fftw_inter_swr.signal_data,
-                                       fftw_inter_swr.real_data_to_fft_size);
+            if (engine != LS_SWR_ENGINE_FFT) {
+                /* get the next hop of samples, every sample goes through the filter exactly once */
+                if (!gld_adc_get_frames_float (daq, adc_channel_data, stream_hop, &window)) {
+                    fprintf (stderr, "Data acquisition stopped unexpectedly\n");
+                    break;
+                }
+            } else if (!gld_adc_get_latest_frames_float (daq,
+                                                         adc_channel_data,
+                                                         fftw_inter_swr.real_data_to_fft_size,
+                                                         HOP_SIZE_SWR,
+                                                         &window)) {
+                /* wait for a hop of new samples, then get the most recent window of
+                 * data and reference channel from ADC chip in one go */
+                fprintf (stderr, "Data acquisition stopped unexpectedly\n");
+                break;
+            }
 
-            last_sample_no += fftw_inter_swr.real_data_to_fft_size;
+            last_sample_no = window.last_index + 1;
 
-            /* get data from ADC chip, reference channel */
-            gld_adc_get_samples_float (daq,
-                                       LS_REF_CHAN,
-                                       fftw_inter_swr.ref_signal_data,
-                                       fftw_inter_swr.real_data_to_fft_size);
+            /* set time when the last sample was actually acquired */
+            tk.time_last_acquired_data = gld_set_timespec_from_ns (window.last_time_ns);
 
-            /* set time when the last sample was acquired */
-            clock_gettime(CLOCK_REALTIME, &tk.time_last_acquired_data);
+        } else if (engine != LS_SWR_ENGINE_FFT) {
+            guint i;
+            /* get the next hop from a dat file */
 
+            if (data_file.num_samples_in_file < last_sample_no + stream_hop) {
+                // no more data in file, exit the trial loop
+                break;
+            }
+            if ((data_file_si_get_data_one_channel
+                 (&data_file, offline_channel, data_from_file,
+                  last_sample_no, last_sample_no + stream_hop)) != 0 ||
+                (data_file_si_get_data_one_channel
+                 (&data_file, offline_reference_channel, ref_from_file,
+                  last_sample_no, last_sample_no + stream_hop)) != 0) {
+                g_printerr ("Problem with data_file_si_get_data_one_channel, first index: %zu, last index: %zu\n",
+                            last_sample_no, last_sample_no + stream_hop - 1);
+                goto out;
+            }
+            for (i = 0; i < stream_hop; i++) {
+                stream_signal[i] = data_from_file[i];
+                stream_ref[i] = ref_from_file[i];
+            }
+            last_sample_no += stream_hop;
         } else {
             guint i;
             /* get data from a dat file */
@@ -581,22 +887,57 @@ perform_swr_stimulation (int sampling_rate_hz, double trial_duration_sec, double
             }
         } /* end dat file */
 
-        if (last_sample_no >= fftw_inter_swr.real_data_to_fft_size) {
-            // do differential, filtering, and convolution
-            fftw_interface_swr_differential_and_filter (&fftw_inter_swr);
+        clock_gettime (CLOCK_MONOTONIC, &processing_start);
+        if (engine == LS_SWR_ENGINE_STREAM) {
+            // filter and convolve the new samples, append them to the windows
+            swr_stream_process (&swr_stream, stream_signal, stream_ref,
+                                fftw_inter_swr.filtered_signal_swr,
+                                fftw_inter_swr.convoluted_signal,
+                                fftw_inter_swr.real_data_to_fft_size);
+        } else if (engine == LS_SWR_ENGINE_BIQUAD) {
+            guint i;
+
+            // filter the new samples in both bands, append them to the windows
+            for (i = 0; i < stream_hop; i++) {
+                biquad_frames[2 * i] = stream_signal[i] - stream_ref[i];
+                biquad_frames[2 * i + 1] = biquad_frames[2 * i];
+            }
+            biquad_cascade_process (&swr_biquad, biquad_frames, biquad_frames, stream_hop);
+            window_append_frames (fftw_inter_swr.filtered_signal_swr, fftw_inter_swr.real_data_to_fft_size,
+                                  biquad_frames, stream_hop, 2, 0);
+            window_append_frames (fftw_inter_swr.convoluted_signal, fftw_inter_swr.real_data_to_fft_size,
+                                  biquad_frames, stream_hop, 2, 1);
+        } else if (engine == LS_SWR_ENGINE_HILBERT) {
+            // update the envelope and its baseline sample by sample
+            hilbert_z = swr_hilbert_process (&swr_hilbert, stream_signal, stream_ref, stream_hop);
+        }
 
-            // get the power
-            swr_power = fftw_interface_swr_get_power (&fftw_inter_swr);
+        if (last_sample_no >= first_sample_to_process && last_sample_no >= offline_refractory_end) {
+            if (engine == LS_SWR_ENGINE_HILBERT) {
+                // the envelope z score replaces the power, there is no convolution
+                swr_power = hilbert_z;
+            } else {
+                // do differential, filtering, and convolution
+                if (engine == LS_SWR_ENGINE_FFT)
+                    fftw_interface_swr_differential_and_filter (&fftw_inter_swr);
 
-            // get the peak in the convoluted signal
-            swr_convolution_peak = fftw_interface_swr_get_convolution_peak (&fftw_inter_swr);
+                // get the power
+                swr_power = fftw_interface_swr_get_power (&fftw_inter_swr);
+
+                // get the peak in the convoluted signal
+                swr_convolution_peak = fftw_interface_swr_get_convolution_peak (&fftw_inter_swr);
+            }
 
             // get the current time for refractory period
-            clock_gettime (CLOCK_REALTIME, &tk.time_now);
+            clock_gettime (CLOCK_MONOTONIC, &tk.time_now);
+            processing_ns = gld_nanoseconds_from_timespec (&tk.time_now) - gld_nanoseconds_from_timespec (&processing_start);
+            total_processing_ns += processing_ns;
+            max_processing_ns = MAX (max_processing_ns, processing_ns);
+            processed_hops++;
             tk.elapsed_last_stimulation =
                 gld_time_diff (&tk.time_last_stimulation, &tk.time_now);
 
-            if ((swr_power > swr_power_threshold && swr_convolution_peak > swr_convolution_peak_threshold) && /* if power is large enough and refractory over */
+            if ((swr_power > swr_power_threshold && (engine == LS_SWR_ENGINE_HILBERT || swr_convolution_peak > swr_convolution_peak_threshold)) && /* if power is large enough and refractory over */
                 (tk.elapsed_last_stimulation.tv_nsec >
                  tk.duration_refractory_period.tv_nsec
                  || tk.elapsed_last_stimulation.tv_sec >
@@ -636,6 +977,12 @@ perform_swr_stimulation (int sampling_rate_hz, double trial_duration_sec, double
                     /* start the pulse */
                     stimpulse_set_trigger_high ();
 
+#ifdef DEBUG
+                    clock_gettime (CLOCK_MONOTONIC, &tk.time_now);
+                    g_printerr ("acquisition to pulse latency: %"G_GINT64_FORMAT" (us)\n",
+                                (gld_nanoseconds_from_timespec (&tk.time_now) - window.last_time_ns) / 1000);
+#endif
+
                     /* wait */
                     nanosleep (&tk.duration_pulse, &tk.req);
 
@@ -643,11 +990,11 @@ perform_swr_stimulation (int sampling_rate_hz, double trial_duration_sec, double
                     stimpulse_set_trigger_low ();
 
                     /* get the time of last stimulation */
-                    clock_gettime (CLOCK_REALTIME,
+                    clock_gettime (CLOCK_MONOTONIC,
                                    &tk.time_last_stimulation);
 
                     /* sleep so that the interval between two calculation of power is approximately tk.interval_duration_between_swr_processing */
-                    clock_gettime (CLOCK_REALTIME, &tk.time_now);
+                    clock_gettime (CLOCK_MONOTONIC, &tk.time_now);
                     tk.elapsed_from_acquisition = gld_time_diff (&tk.time_last_acquired_data, &tk.time_now);
                     tk.duration_sleep_between_swr_processing = gld_time_diff (&tk.elapsed_from_acquisition, &tk.interval_duration_between_swr_processing);
                     nanosleep (&tk.duration_sleep_between_swr_processing, &tk.req);
@@ -655,12 +1002,17 @@ perform_swr_stimulation (int sampling_rate_hz, double trial_duration_sec, double
                 } else {
                     /* working with data file */
 
-                    //printf("%ld %lf %lf %lf %ld\n",last_sample_no,swr_power,fftw_inter_swr.mean_power,fftw_inter_swr.std_power,fftw_inter_swr.number_segments_analysed);
+                    //printf("%ld %lf %lf %lf %ld\n",last_sample_no,swr_power,fftw_inter_swr.mean_power,fftw_inter_swr.std_power,fftw_inter_swr.power_stats.count);
                     // print the res value of the stimulation time
                     g_print ("%zu\n", last_sample_no);
 
-                    // move forward in file by the duration of the pulse
-                    last_sample_no = last_sample_no + (tk.pulse_duration_ms * sampling_rate_hz / 1000);
+                    if (engine != LS_SWR_ENGINE_FFT) {
+                        // keep the filter state continuous, but do not detect for the duration of the pulse
+                        offline_refractory_end = last_sample_no + (tk.pulse_duration_ms * sampling_rate_hz / 1000);
+                    } else {
+                        // move forward in file by the duration of the pulse
+                        last_sample_no = last_sample_no + (tk.pulse_duration_ms * sampling_rate_hz / 1000);
+                    }
                 }
             }
         }
@@ -680,12 +1032,16 @@ perform_swr_stimulation (int sampling_rate_hz, double trial_duration_sec, double
 
     } /* stimulation trial is over */
 
-    fftw_interface_swr_free (&fftw_inter_swr);
+    if (print_adc_stats && processed_hops > 0)
+        g_printerr ("SWR processing time per hop: mean %.1lf us, max %.1lf us over %lu hops\n",
+                    total_processing_ns / 1000.0 / processed_hops, max_processing_ns / 1000.0, processed_hops);
     if (offline_data_file == NULL) {
         if (!gld_adc_reset (daq)) {
             fprintf (stderr, "Could not stop data acquisition\n");
             goto out;
         }
+        if (print_adc_stats)
+            gld_adc_print_stats (daq, stderr);
     }
 
     ret = TRUE;
@@ -693,15 +1049,305 @@ out:
     /* free daq interface */
     gld_adc_free (daq);
 
+    /* free the signal processing, only what was initialized before a failure */
+    if (engine_ready) {
+        if (engine == LS_SWR_ENGINE_STREAM)
+            swr_stream_free (&swr_stream);
+        else if (engine == LS_SWR_ENGINE_BIQUAD)
+            biquad_cascade_free (&swr_biquad);
+        else if (engine == LS_SWR_ENGINE_HILBERT)
+            swr_hilbert_free (&swr_hilbert);
+    }
+    if (fftw_inter_swr_ready)
+        fftw_interface_swr_free (&fftw_inter_swr);
+
     /* free the memory for dat file data, if running with offline data */
-    if (offline_data_file != NULL) {
-        if ((clean_data_file_si (&data_file)) != 0) {
-            fprintf (stderr, "Problem with clean_data_file_si\n");
+    if (data_file_ready && (clean_data_file_si (&data_file)) != 0) {
+        fprintf (stderr, "Problem with clean_data_file_si\n");
+        ret = FALSE;
+    }
+    free (data_from_file);
+    free (ref_from_file);
+    g_free (stream_signal);
+    g_free (stream_ref);
+    g_free (biquad_frames);
+
+    return ret;
+}
+
+/**
+ * perform_swr_multi_stimulation:
+ * @channels: ADC inputs, or channels of the dat file, to detect ripples on
+ * @votes_needed: channels that must detect a ripple, 0 to let the channel with the largest power decide
+ * @latency_budget_ms: drop detections made later than this after the last sample, 0 for no limit
+ *
+ * Do swr stimulation, detecting ripples on several channels against the
+ * same reference with the fft engine.
+ */
+gboolean
+perform_swr_multi_stimulation (int sampling_rate_hz, double trial_duration_sec, double pulse_duration_ms, double swr_refractory, double swr_power_threshold, double swr_convolution_peak_threshold,
+                               const int *channels, int n_channels, int votes_needed, double latency_budget_ms,
+                               gboolean delay_swr, double minimum_interval_ms, double maximum_interval_ms,
+                               const gchar *offline_data_file, int channels_in_dat_file, int offline_reference_channel)
+{
+    TimeKeeper tk;
+    GldAdc *daq;
+    GldAdcWindow window;
+    gboolean ret = FALSE;
+    struct swr_multi swr;
+    float *adc_channel_data[SWR_MULTI_MAX_CHANNELS + 1] = { NULL };
+    guint scan_list[SWR_MULTI_MAX_CHANNELS + 1];
+    const int64_t latency_budget_ns = latency_budget_ms * 1000000;
+    gulong hops = 0;
+    gulong late_hops = 0;
+    int i;
+
+    /* variables to work offline from a dat file */
+    data_file_si data_file;
+    short int *data_from_file = NULL;
+    size_t last_sample_no = 0;
+
+    if (n_channels <= 0 || n_channels > SWR_MULTI_MAX_CHANNELS) {
+        fprintf (stderr, "Multi-channel SWR detection works on 1 to %d channels\n", SWR_MULTI_MAX_CHANNELS);
+        return FALSE;
+    }
+    if (sampling_rate_hz <= 0)
+        sampling_rate_hz = LS_DEFAULT_SAMPLING_RATE;
+
+    /* set up timekeeper */
+    tk.trial_duration_sec = trial_duration_sec;
+    tk.pulse_duration_ms = pulse_duration_ms;
+    tk.duration_pulse = gld_set_timespec_from_ms (tk.pulse_duration_ms);
+
+    /* create ADC interface, the channels are followed by the reference in every frame, run DAQ on CPU 0 */
+    daq = gld_adc_new (n_channels + 1, LS_DATA_BUFFER_SIZE, 0);
+    if (adc_backend_spec != NULL && !gld_adc_set_backend (daq, adc_backend_spec)) {
+        fprintf (stderr, "Could not select ADC backend '%s'\n", adc_backend_spec);
+        gld_adc_free (daq);
+        return FALSE;
+    }
+    gld_adc_set_acq_frequency (daq, sampling_rate_hz);
+    gld_adc_set_buffer_mode (daq, GLD_ADC_BUFFER_FRAMES);
+    for (i = 0; i < n_channels; i++)
+        scan_list[i] = channels[i];
+    scan_list[n_channels] = LS_REF_CHAN;
+    if (offline_data_file == NULL && !gld_adc_set_scan_list (daq, scan_list, n_channels + 1)) {
+        fprintf (stderr, "Could not scan the SWR channels\n");
+        gld_adc_free (daq);
+        return FALSE;
+    }
+
+    /* one thread per core but the DAQ core, this thread takes the first one */
+    if (swr_multi_init (&swr, sampling_rate_hz, n_channels, 0) == -1) {
+        fprintf (stderr, "Could not initialize swr_multi\n");
+        gld_adc_free (daq);
+        return FALSE;
+    }
+    if (swr.n_groups > 1)
+        gld_set_thread_cpu_affinity (1);
+    ls_debug ("Multi-channel SWR detection on %d channels, %d threads, %s kernels\n",
+              n_channels, swr.n_groups, swr.kernels->name);
+
+    for (i = 0; i < n_channels; i++)
+        adc_channel_data[i] = swr_multi_get_signal (&swr, i);
+    adc_channel_data[n_channels] = swr.ref_signal_data;
+
+    /* baseline of power and convolution peak, one segment per hop */
+    {
+        const double segments_per_sec = (double) sampling_rate_hz / HOP_SIZE_SWR;
+
+        swr_multi_set_baseline (&swr,
+                                swr_baseline_ewma_sec > 0 ? 1 - exp (-1 / (swr_baseline_ewma_sec * segments_per_sec)) : 0,
+                                swr_baseline_freeze_sec * segments_per_sec,
+                                swr_baseline_max_z);
+    }
+
+    if (offline_data_file == NULL) {
+        /* initialize the stimulation output */
+        stimpulse_init ();
+    } else {
+        if (init_data_file_si (&data_file, offline_data_file, channels_in_dat_file) != 0) {
+            fprintf (stderr, "Problem in initialisation of dat file\n");
+            swr_multi_free (&swr);
+            gld_adc_free (daq);
             return FALSE;
         }
-        free (data_from_file);
-        free (ref_from_file);
+        data_from_file = g_new (short int, swr.real_data_to_fft_size);
     }
 
+    // get time at beginning of trial
+    clock_gettime (CLOCK_MONOTONIC, &tk.time_beginning_trial);
+    clock_gettime (CLOCK_MONOTONIC, &tk.time_now);
+    clock_gettime (CLOCK_MONOTONIC, &tk.time_last_stimulation);
+    tk.elapsed_beginning_trial =
+        gld_time_diff (&tk.time_beginning_trial, &tk.time_now);
+    tk.duration_refractory_period = gld_set_timespec_from_ms (swr_refractory);
+
+    ls_debug ("Starting trial loop for multi-channel swr\n");
+
+    if (offline_data_file == NULL && !gld_adc_acquire_samples (daq, -1)) {
+        fprintf (stderr,
+                 "Unable to acquire samples, swr stimulation not possible\n");
+        goto out;
+    }
+
+    /* loop while the trial is running */
+    while (tk.elapsed_beginning_trial.tv_sec < tk.trial_duration_sec) {
+        if (offline_data_file == NULL) {
+            /* wait for a hop of new samples, then get the most recent window of all channels */
+            if (!gld_adc_get_latest_frames_float (daq,
+                                                  adc_channel_data,
+                                                  swr.real_data_to_fft_size,
+                                                  HOP_SIZE_SWR,
+                                                  &window)) {
+                fprintf (stderr, "Data acquisition stopped unexpectedly\n");
+                break;
+            }
+            last_sample_no = window.last_index + 1;
+        } else {
+            guint j;
+
+            /* the window ends at last_sample_no, one hop later than the previous one */
+            last_sample_no = last_sample_no == 0 ? swr.real_data_to_fft_size : last_sample_no + HOP_SIZE_SWR;
+            if (data_file.num_samples_in_file < last_sample_no)
+                break;
+            for (i = 0; i <= n_channels; i++) {
+                const int file_channel = i < n_channels ? channels[i] : offline_reference_channel;
+
+                if (data_file_si_get_data_one_channel (&data_file, file_channel, data_from_file,
+                                                       last_sample_no - swr.real_data_to_fft_size, last_sample_no) != 0) {
+                    g_printerr ("Problem with data_file_si_get_data_one_channel, first index: %zu, last index: %zu\n",
+                                last_sample_no - swr.real_data_to_fft_size, last_sample_no - 1);
+                    goto out;
+                }
+                for (j = 0; j < swr.real_data_to_fft_size; j++)
+                    adc_channel_data[i][j] = data_from_file[j];
+            }
+        }
+
+        // differential, filtering, convolution and z scores of all channels
+        swr_multi_process (&swr);
+        hops++;
+
+        clock_gettime (CLOCK_MONOTONIC, &tk.time_now);
+        if (offline_data_file == NULL)
+            tk.elapsed_beginning_trial = gld_time_diff (&tk.time_beginning_trial, &tk.time_now);
+        if (offline_data_file == NULL && latency_budget_ns > 0 &&
+            gld_nanoseconds_from_timespec (&tk.time_now) - window.last_time_ns > latency_budget_ns) {
+            // a pulse now would come too late for this ripple
+            late_hops++;
+            continue;
+        }
+
+        tk.elapsed_last_stimulation = gld_time_diff (&tk.time_last_stimulation, &tk.time_now);
+        if (!swr_multi_vote (&swr, swr_power_threshold, swr_convolution_peak_threshold, votes_needed) ||
+            gld_nanoseconds_from_timespec (&tk.elapsed_last_stimulation) <= gld_nanoseconds_from_timespec (&tk.duration_refractory_period))
+            continue;
+
+        /* stimulation time!! */
+        if (offline_data_file == NULL) {
+            if (delay_swr) {
+                tk.swr_delay_ms = minimum_interval_ms + (rand () % (int) (maximum_interval_ms - minimum_interval_ms));
+                tk.swr_delay = gld_set_timespec_from_ms (tk.swr_delay_ms);
+                g_print ("SWR delay: %lf ms\n", tk.swr_delay_ms);
+                nanosleep (&tk.swr_delay, &tk.req);
+            }
+
+            stimpulse_set_trigger_high ();
+            nanosleep (&tk.duration_pulse, &tk.req);
+            stimpulse_set_trigger_low ();
+
+            clock_gettime (CLOCK_MONOTONIC, &tk.time_last_stimulation);
+        } else {
+            g_print ("%zu\n", last_sample_no);
+
+            // move forward in file by the duration of the pulse
+            last_sample_no = last_sample_no + (tk.pulse_duration_ms * sampling_rate_hz / 1000);
+        }
+    } /* stimulation trial is over */
+
+    if (late_hops > 0)
+        g_printerr ("%lu of %lu hops exceeded the latency budget of %.2lf ms, their detections were dropped\n",
+                    late_hops, hops, latency_budget_ms);
+
+    if (offline_data_file == NULL) {
+        if (!gld_adc_reset (daq)) {
+            fprintf (stderr, "Could not stop data acquisition\n");
+            goto out;
+        }
+        if (print_adc_stats)
+            gld_adc_print_stats (daq, stderr);
+    }
+
+    ret = TRUE;
+out:
+    if (swr.n_groups > 1)
+        gld_set_thread_no_cpu_affinity (0);
+    swr_multi_free (&swr);
+    gld_adc_free (daq);
+
+    if (offline_data_file != NULL && (clean_data_file_si (&data_file)) != 0) {
+        fprintf (stderr, "Problem with clean_data_file_si\n");
+        ret = FALSE;
+    }
+    g_free (data_from_file);
+
+    return ret;
+}
+
+/**
+ * perform_plan_warmup:
+ *
+ * Make every FFT plan the detectors use at this sampling rate with
+ * FFTW_PATIENT, so that the wisdom has them when a trial starts.
+ */
+gboolean
+perform_plan_warmup (int sampling_rate_hz)
+{
+    struct fftw_interface_theta fftw_inter_theta;
+    struct fftw_interface_swr fftw_inter_swr;
+    struct swr_stream swr_stream;
+    struct swr_multi swr_multi;
+    int n_channels;
+    int n_wavelets;
+    unsigned int flags = fftw_planner_flags;
+    gboolean ret = FALSE;
+
+    fftw_planner_flags = FFTW_PATIENT;
+
+    g_print ("Planning FFTs for %d Hz, this can take a while...\n", sampling_rate_hz);
+    if (fftw_interface_theta_init (&fftw_inter_theta, sampling_rate_hz, 1) == -1) {
+        fprintf (stderr, "Could not initialize fftw_interface_theta\n");
+        goto out;
+    }
+    fftw_interface_theta_free (&fftw_inter_theta);
+
+    for (n_wavelets = 1; n_wavelets <= SWR_MAX_WAVELETS; n_wavelets++) {
+        if (fftw_interface_swr_init (&fftw_inter_swr, sampling_rate_hz, n_wavelets) == -1) {
+            fprintf (stderr, "Could not initialize fftw_interface_swr\n");
+            goto out;
+        }
+        fftw_interface_swr_free (&fftw_inter_swr);
+    }
+
+    if (swr_stream_init (&swr_stream, sampling_rate_hz, MAX (SWR_STREAM_HOP_MS * sampling_rate_hz / 1000, 1),
+                         MIN_FREQUENCY_SWR, MAX_FREQUENCY_SWR, FREQUENCY_WAVELET_FOR_CONVOLUTION) == -1) {
+        fprintf (stderr, "Could not initialize swr_stream\n");
+        goto out;
+    }
+    swr_stream_free (&swr_stream);
+
+    /* multi-channel detection batches the channels of each thread, up to 3 on a four core Raspberry Pi */
+    for (n_channels = 1; n_channels <= (SWR_MULTI_MAX_CHANNELS + 2) / 3; n_channels++) {
+        if (swr_multi_init (&swr_multi, sampling_rate_hz, n_channels, 1) == -1) {
+            fprintf (stderr, "Could not initialize swr_multi\n");
+            goto out;
+        }
+        swr_multi_free (&swr_multi);
+    }
+
+    ret = TRUE;
+out:
+    fftw_planner_flags = flags;
     return ret;
 }
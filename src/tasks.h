@@ -22,6 +22,45 @@
 
 #include <glib.h>
 
+/**
+ * LsSwrEngine:
+ * @LS_SWR_ENGINE_FFT:    filter a sliding window with one FFT per hop
+ * @LS_SWR_ENGINE_STREAM: filter only the new samples with a streaming overlap-save filter
+ * @LS_SWR_ENGINE_BIQUAD: filter sample by sample with a cascade of second-order sections
+ * @LS_SWR_ENGINE_HILBERT: threshold the smoothed Hilbert envelope of the ripple band, sample by sample
+ *
+ * Signal processing used to detect sharp-wave ripples.
+ */
+typedef enum {
+    LS_SWR_ENGINE_FFT,
+    LS_SWR_ENGINE_STREAM,
+    LS_SWR_ENGINE_BIQUAD,
+    LS_SWR_ENGINE_HILBERT
+} LsSwrEngine;
+
+/**
+ * LsThetaEngine:
+ * @LS_THETA_ENGINE_FFT:    filter a sliding window with one FFT per hop
+ * @LS_THETA_ENGINE_BIQUAD: filter sample by sample with a cascade of second-order sections
+ *
+ * Signal processing used to filter theta and delta oscillations.
+ */
+typedef enum {
+    LS_THETA_ENGINE_FFT,
+    LS_THETA_ENGINE_BIQUAD
+} LsThetaEngine;
+
+void
+tasks_set_print_adc_stats (gboolean enabled);
+void
+tasks_set_adc_backend (const gchar *spec);
+void
+tasks_set_swr_baseline (double ewma_sec,
+                        double freeze_sec,
+                        double max_z);
+void
+tasks_set_swr_wavelets (int n_wavelets);
+
 gboolean
 perform_train_stimulation (gboolean random,
                            int sampling_rate_hz,
@@ -32,7 +71,8 @@ perform_train_stimulation (gboolean random,
                            double train_frequency_hz);
 
 gboolean
-perform_theta_stimulation (gboolean random,
+perform_theta_stimulation (LsThetaEngine engine,
+                           gboolean random,
                            int sampling_rate_hz,
                            double trial_duration_sec,
                            double pulse_duration_ms,
@@ -42,7 +82,8 @@ perform_theta_stimulation (gboolean random,
                            int offline_channel);
 
 gboolean
-perform_swr_stimulation (int sampling_rate_hz,
+perform_swr_stimulation (LsSwrEngine engine,
+                         int sampling_rate_hz,
                          double trial_duration_sec,
                          double pulse_duration_ms,
                          double swr_refractory,
@@ -56,5 +97,25 @@ perform_swr_stimulation (int sampling_rate_hz,
                          int offline_channel,
                          int offline_reference_channel);
 
+gboolean
+perform_swr_multi_stimulation (int sampling_rate_hz,
+                               double trial_duration_sec,
+                               double pulse_duration_ms,
+                               double swr_refractory,
+                               double swr_power_threshold,
+                               double swr_convolution_peak_threshold,
+                               const int *channels,
+                               int n_channels,
+                               int votes_needed,
+                               double latency_budget_ms,
+                               gboolean delay_swr,
+                               double minimum_interval_ms,
+                               double maximum_interval_ms,
+                               const gchar *offline_data_file,
+                               int channels_in_dat_file,
+                               int offline_reference_channel);
+
+gboolean
+perform_plan_warmup (int sampling_rate_hz);
 
 #endif /* __LS_TASKS_H */
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "spectral-kernels.h"
+
+/* longest test vector, plus room for the pointer offsets */
+#define MAX_LENGTH 1100
+#define MAX_OFFSET 3
+
+/* floats summed in a different order differ by a few ulp per element */
+#define TOLERANCE 1e-5
+
+static const char* kernel_names[] = { "SSE2", "AVX2", "NEON" };
+
+/* lengths around the vector widths, and longer ones that are not a multiple of them */
+static const size_t lengths[] = { 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 63, 257, 513, 1021, MAX_LENGTH - MAX_OFFSET };
+
+static int failures = 0;
+
+static float
+random_float (float min, float max)
+{
+    return min + (max - min) * (rand () / (float) RAND_MAX);
+}
+
+static void
+check (const char* kernels, const char* entry, size_t n, size_t offset, double value, double expected)
+{
+    if (fabs (value - expected) <= TOLERANCE * (1 + fabs (expected)))
+        return;
+    fprintf (stderr, "%s %s (n: %zu, offset: %zu): %.9g, scalar: %.9g\n",
+             kernels, entry, n, offset, value, expected);
+    failures++;
+}
+
+static void
+check_floats (const char* kernels, const char* entry, size_t n, size_t offset, const float* x, const float* expected)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        check (kernels, entry, n, offset, x[i], expected[i]);
+}
+
+static void
+check_complex (const char* kernels, const char* entry, size_t n, size_t offset,
+               const fftwf_complex* x, const fftwf_complex* expected)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        check (kernels, entry, n, offset, x[i][0], expected[i][0]);
+        check (kernels, entry, n, offset, x[i][1], expected[i][1]);
+    }
+}
+
+/**
+ * test_kernels:
+ *
+ * Run all entry points of @k and of the scalar reference on the same
+ * random data, starting @offset elements into aligned arrays.
+ */
+static void
+test_kernels (const struct spectral_kernels* k, size_t n, size_t offset)
+{
+    const struct spectral_kernels* ref = spectral_kernels_get_by_name ("scalar");
+    float *a = fftwf_alloc_real (MAX_LENGTH), *b = fftwf_alloc_real (MAX_LENGTH);
+    float *mask = fftwf_alloc_real (MAX_LENGTH);
+    float *out = fftwf_alloc_real (MAX_LENGTH), *ref_out = fftwf_alloc_real (MAX_LENGTH);
+    fftwf_complex *spectrum = fftwf_alloc_complex (MAX_LENGTH), *ref_spectrum = fftwf_alloc_complex (MAX_LENGTH);
+    fftwf_complex *kernel = fftwf_alloc_complex (MAX_LENGTH);
+    fftwf_complex *product = fftwf_alloc_complex (MAX_LENGTH), *ref_product = fftwf_alloc_complex (MAX_LENGTH);
+    size_t i;
+
+    for (i = 0; i < MAX_LENGTH; i++) {
+        a[i] = random_float (-100, 150);
+        b[i] = random_float (-100, 100);
+        mask[i] = random_float (0, 1);
+        spectrum[i][0] = ref_spectrum[i][0] = random_float (-1000, 1000);
+        spectrum[i][1] = ref_spectrum[i][1] = random_float (-1000, 1000);
+        kernel[i][0] = random_float (-1, 1);
+        kernel[i][1] = random_float (-1, 1);
+    }
+
+    check (k->name, "sum", n, offset, k->sum (a + offset, n), ref->sum (a + offset, n));
+    check (k->name, "sum_squares", n, offset, k->sum_squares (a + offset, n), ref->sum_squares (a + offset, n));
+    // the largest value is one of the inputs, so it has to be exact
+    if (k->max (a + offset, n) != ref->max (a + offset, n)) {
+        fprintf (stderr, "%s max (n: %zu, offset: %zu): %.9g, scalar: %.9g\n",
+                 k->name, n, offset, k->max (a + offset, n), ref->max (a + offset, n));
+        failures++;
+    }
+
+    check (k->name, "difference", n, offset,
+           k->difference (out + offset, a + offset, b + offset, n),
+           ref->difference (ref_out + offset, a + offset, b + offset, n));
+    check_floats (k->name, "difference", n, offset, out + offset, ref_out + offset);
+
+    memcpy (out, a, sizeof (float) * MAX_LENGTH);
+    memcpy (ref_out, a, sizeof (float) * MAX_LENGTH);
+    k->add_scalar (out + offset, 12.5, n);
+    ref->add_scalar (ref_out + offset, 12.5, n);
+    // elements outside of the range must not be touched
+    check_floats (k->name, "add_scalar", MAX_LENGTH, offset, out, ref_out);
+
+    k->mask (spectrum + offset, mask + offset, 0.5, n);
+    ref->mask (ref_spectrum + offset, mask + offset, 0.5, n);
+    check_complex (k->name, "mask", MAX_LENGTH, offset, spectrum, ref_spectrum);
+
+    k->multiply (spectrum + offset, kernel + offset, product + offset, 0.25, n);
+    ref->multiply (ref_spectrum + offset, kernel + offset, ref_product + offset, 0.25, n);
+    check_complex (k->name, "multiply", n, offset, product + offset, ref_product + offset);
+
+    k->mask_and_multiply (spectrum + offset, mask + offset, kernel + offset, product + offset, 0.125, n);
+    ref->mask_and_multiply (ref_spectrum + offset, mask + offset, kernel + offset, ref_product + offset, 0.125, n);
+    check_complex (k->name, "mask_and_multiply", MAX_LENGTH, offset, spectrum, ref_spectrum);
+    check_complex (k->name, "mask_and_multiply", n, offset, product + offset, ref_product + offset);
+
+    fftwf_free (a);
+    fftwf_free (b);
+    fftwf_free (mask);
+    fftwf_free (out);
+    fftwf_free (ref_out);
+    fftwf_free (spectrum);
+    fftwf_free (ref_spectrum);
+    fftwf_free (kernel);
+    fftwf_free (product);
+    fftwf_free (ref_product);
+}
+
+int main (void)
+{
+    size_t i, l, offset;
+
+    srand (1);
+    for (i = 0; i < sizeof (kernel_names) / sizeof (kernel_names[0]); i++) {
+        const struct spectral_kernels* k = spectral_kernels_get_by_name (kernel_names[i]);
+
+        if (k == NULL) {
+            printf ("%s kernels: not available, skipped\n", kernel_names[i]);
+            continue;
+        }
+        for (l = 0; l < sizeof (lengths) / sizeof (lengths[0]); l++)
+            for (offset = 0; offset <= MAX_OFFSET; offset++)
+                test_kernels (k, lengths[l], offset);
+        printf ("%s kernels: tested\n", k->name);
+    }
+
+    if (failures > 0) {
+        fprintf (stderr, "%d values differ from the scalar kernels\n", failures);
+        return 1;
+    }
+    return 0;
+}
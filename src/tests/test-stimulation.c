@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+
+#include <galdur.h>
+#include <bcm2835-mock.h>
+#include "defaults.h"
+#include "stimpulse.h"
+#include "tasks.h"
+
+/* low enough for the emulated ADC to keep up on a single CPU */
+#define SAMPLING_RATE 10000
+#define THETA_FREQUENCY 8.0
+#define TRIAL_DURATION_SEC 5
+#define PULSE_DURATION_MS 5.0
+#define STIMULATION_PHASE 90.0
+
+/* the filters settle for 3 s, at least a few of the remaining theta cycles have to be hit */
+#define MIN_PULSE_COUNT 5
+/* the filter delay and a hop of samples, a single pulse may be off further when scans were dropped */
+#define MAX_MEAN_PHASE_ERROR 30.0
+#define MAX_PULSE_OVERRUN_MS 5.0
+
+/**
+ * theta_source:
+ *
+ * A pure theta oscillation on the recorded channel, in CLOCK_MONOTONIC
+ * time like the GPIO edges, so the phase of every pulse is known.
+ */
+static int16_t
+theta_source (guint channel, guint64 index, gpointer user_data)
+{
+    struct timespec ts;
+
+    if (channel != LS_SCAN_CHAN)
+        return 0;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (int16_t) (2000 * sin (2 * M_PI * THETA_FREQUENCY * (ts.tv_sec + ts.tv_nsec / 1e9)));
+}
+
+/**
+ * theta_phase:
+ *
+ * Returns: The phase of theta_source at @time_ns in the labrstim
+ * convention, where the negative to positive transition is 180 degrees.
+ */
+static double
+theta_phase (int64_t time_ns)
+{
+    const double cycles = THETA_FREQUENCY * (time_ns / 1000000000) +
+                          THETA_FREQUENCY * (time_ns % 1000000000) / 1e9;
+
+    return fmod (360 * (cycles - floor (cycles)) + 180, 360);
+}
+
+int main (void)
+{
+    Bcm2835MockGpioEdge *edges;
+    guint n_edges, n_pulses = 0;
+    gboolean failed = FALSE;
+    double sum_sin = 0, sum_cos = 0, mean_phase_error;
+    guint i;
+
+    if (!gld_board_initialize ())
+        return 1;
+    bcm2835_mock_set_adc_source (theta_source, NULL);
+
+    /* forget whatever setting up the board did */
+    g_free (bcm2835_mock_steal_gpio_edges (&n_edges));
+
+    printf ("Stimulating at %.0f degrees of a %.0f Hz oscillation for %i s\n",
+            STIMULATION_PHASE, THETA_FREQUENCY, TRIAL_DURATION_SEC);
+    /* the statistics tell whether a failure is down to a machine too busy to acquire */
+    tasks_set_print_adc_stats (TRUE);
+    if (!perform_theta_stimulation (LS_THETA_ENGINE_BIQUAD, FALSE, SAMPLING_RATE, TRIAL_DURATION_SEC,
+                                    PULSE_DURATION_MS, STIMULATION_PHASE, NULL, 0, 0)) {
+        bcm2835_mock_set_adc_source (NULL, NULL);
+        gld_board_shutdown ();
+        return 1;
+    }
+    edges = bcm2835_mock_steal_gpio_edges (&n_edges);
+
+    for (i = 0; i + 1 < n_edges; i += 2) {
+        const Bcm2835MockGpioEdge *rise = &edges[i];
+        const Bcm2835MockGpioEdge *fall = &edges[i + 1];
+        const double width_ms = (fall->time_ns - rise->time_ns) / 1e6;
+        const double phase = theta_phase (rise->time_ns);
+
+        if (rise->pin != LS_STIM_PIN || rise->level != GLD_GPIO_HIGH ||
+            fall->pin != LS_STIM_PIN || fall->level != GLD_GPIO_LOW) {
+            fprintf (stderr, "  edge %u: pin %u went to %u, expected a pulse on pin %u\n",
+                     i, rise->pin, rise->level, LS_STIM_PIN);
+            failed = TRUE;
+            break;
+        }
+        printf ("  pulse %u: %.2f ms at %.1f degrees\n", n_pulses, width_ms, phase);
+        sum_sin += sin (phase * M_PI / 180);
+        sum_cos += cos (phase * M_PI / 180);
+        n_pulses++;
+
+        if (width_ms < PULSE_DURATION_MS || width_ms > PULSE_DURATION_MS + MAX_PULSE_OVERRUN_MS) {
+            fprintf (stderr, "  pulse %u lasted %.2f ms, expected %.1f ms\n", n_pulses - 1, width_ms,
+                     PULSE_DURATION_MS);
+            failed = TRUE;
+        }
+        if (i > 0 && rise->time_ns - edges[i - 2].time_ns < STIMULATION_REFRACTORY_PERIOD_THETA_MS * 1000000LL) {
+            fprintf (stderr, "  pulse %u started within the refractory period of the one preceding it\n",
+                     n_pulses - 1);
+            failed = TRUE;
+        }
+    }
+    if (n_edges % 2 != 0) {
+        fprintf (stderr, "  the stimulation pin was left high\n");
+        failed = TRUE;
+    }
+    if (n_pulses < MIN_PULSE_COUNT) {
+        fprintf (stderr, "  only %u pulses were delivered, expected at least %i\n", n_pulses, MIN_PULSE_COUNT);
+        failed = TRUE;
+    } else {
+        /* circular mean, the phases wrap around at 360 degrees */
+        mean_phase_error = remainder (atan2 (sum_sin, sum_cos) * 180 / M_PI - STIMULATION_PHASE, 360);
+        if (fabs (mean_phase_error) > MAX_MEAN_PHASE_ERROR) {
+            fprintf (stderr, "  pulses started %.1f degrees away from the stimulation phase on average\n",
+                     mean_phase_error);
+            failed = TRUE;
+        }
+    }
+
+    g_free (edges);
+    bcm2835_mock_set_adc_source (NULL, NULL);
+    gld_board_shutdown ();
+
+    if (failed) {
+        fprintf (stderr, "FAILED\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "defaults.h"
+#include "fftw-functions.h"
+#include "swr-stream.h"
+
+#define SAMPLING_RATE 20000
+#define HOP_SIZE 20
+#define SIGNAL_LENGTH 6000
+#define WINDOW_LENGTH 512
+
+/* the stream cuts the wavelet off slightly earlier than the FFT kernel */
+#define TOLERANCE 0.02
+
+/**
+ * fft_kernel_convolution:
+ *
+ * Convolve @x with the wavelet of fftw_interface_swr, which is stored
+ * wrapped around 0, at sample @n. The whole kernel has to fit into @x.
+ */
+static double
+fft_kernel_convolution (const float* kernel, const float* x, size_t n)
+{
+    const long half = FFT_SIGNAL_DATA_SIZE_SWR / 2;
+    double sum = 0;
+    long k;
+
+    for (k = -half; k < half; k++)
+        sum += kernel[k >= 0 ? k : FFT_SIGNAL_DATA_SIZE_SWR + k] * x[n - k];
+    return sum;
+}
+
+int main (void)
+{
+    struct swr_stream stream;
+    float *x = malloc (sizeof (float) * SIGNAL_LENGTH);
+    float *y = malloc (sizeof (float) * SIGNAL_LENGTH);
+    float *kernel = malloc (sizeof (float) * FFT_SIGNAL_DATA_SIZE_SWR);
+    float zero[HOP_SIZE] = { 0 };
+    float filtered[WINDOW_LENGTH] = { 0 };
+    float convoluted[WINDOW_LENGTH] = { 0 };
+    double max_error = 0, max_value = 0;
+    size_t i, n;
+
+    if (swr_stream_init (&stream, SAMPLING_RATE, HOP_SIZE, MIN_FREQUENCY_SWR, MAX_FREQUENCY_SWR,
+                         FREQUENCY_WAVELET_FOR_CONVOLUTION) != 0)
+        return 1;
+    make_wavelet_for_convolution (SAMPLING_RATE, FFT_SIGNAL_DATA_SIZE_SWR, kernel,
+                                  FREQUENCY_WAVELET_FOR_CONVOLUTION);
+
+    // noise with a ripple burst in the middle
+    srand (1);
+    for (i = 0; i < SIGNAL_LENGTH; i++) {
+        const double t = ((double) i - SIGNAL_LENGTH / 2) / SAMPLING_RATE;
+        x[i] = rand () / (float) RAND_MAX - 0.5 +
+               2 * exp (-t * t / (2 * 0.01 * 0.01)) * sin (2 * M_PI * FREQUENCY_WAVELET_FOR_CONVOLUTION * t);
+    }
+    for (i = 0; i < SIGNAL_LENGTH; i += HOP_SIZE) {
+        swr_stream_process (&stream, x + i, zero, filtered, convoluted, WINDOW_LENGTH);
+        for (n = 0; n < HOP_SIZE; n++)
+            y[i + n] = convoluted[WINDOW_LENGTH - HOP_SIZE + n];
+    }
+
+    // the stream output lags the zero-phase convolution by its group delay
+    for (n = FFT_SIGNAL_DATA_SIZE_SWR / 2; n + FFT_SIGNAL_DATA_SIZE_SWR / 2 + stream.wavelet_delay <= SIGNAL_LENGTH; n++) {
+        const double expected = fft_kernel_convolution (kernel, x, n);
+
+        max_error = fmax (max_error, fabs (y[n + stream.wavelet_delay] - expected));
+        max_value = fmax (max_value, fabs (expected));
+    }
+
+    printf ("wavelet: %zu taps, delay: %.1f ms, largest difference to the FFT kernel: %.3g of the peak\n",
+            stream.wavelet_length, 1000.0 * stream.wavelet_delay / SAMPLING_RATE, max_error / max_value);
+    swr_stream_free (&stream);
+    free (x);
+    free (y);
+    free (kernel);
+
+    if (max_error > TOLERANCE * max_value) {
+        fprintf (stderr, "the streaming wavelet differs from the FFT kernel\n");
+        return 1;
+    }
+    return 0;
+}